@@ -22,7 +22,13 @@
 //
 ////////////////////////////////////////////////////////////////
 
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
 #include "rtengine.h"
+#include "cache.h"
 #include "rawimagesource.h"
 #include "rt_math.h"
 #include "gauss.h"
@@ -34,6 +40,53 @@ namespace
 unsigned fc(const unsigned int cfa[2][2], int r, int c) {
     return cfa[r & 1][c & 1];
 }
+
+struct CAFit {
+    bool valid; // false => the fit failed and the correction stopped at this iteration
+    int polyord;
+    double params[2][2][16];
+};
+
+using CAFits = std::vector<CAFit>;
+
+// fits of the auto CA iterations, keyed by the raw data before the correction. The fit only depends on
+// the raw data and on avoidColourshift, so it can be reused for any change of the preprocessing that
+// leaves the raw data unchanged, for more iterations, and for the next processing of the same image
+rtengine::Cache<std::uint64_t, std::shared_ptr<const CAFits>>& getFitCache()
+{
+    static rtengine::Cache<std::uint64_t, std::shared_ptr<const CAFits>> cache(8);
+    return cache;
+}
+
+std::uint64_t getFitKey(const array2D<float>& rawData, int W, int H, const unsigned int cfa[2][2], bool avoidColourshift)
+{
+    // FNV-1a per row, the row hashes are combined in order
+    constexpr std::uint64_t fnvOffset = 14695981039346656037ULL;
+    constexpr std::uint64_t fnvPrime = 1099511628211ULL;
+    std::vector<std::uint64_t> rowHashes(H);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < H; ++i) {
+        std::uint64_t hash = fnvOffset;
+        for (int j = 0; j < W; ++j) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &rawData[i][j], sizeof(bits));
+            hash = (hash ^ bits) * fnvPrime;
+        }
+        rowHashes[i] = hash;
+    }
+
+    std::uint64_t key = fnvOffset;
+    for (const auto value : {static_cast<std::uint64_t>(W), static_cast<std::uint64_t>(H), static_cast<std::uint64_t>(cfa[0][0] | cfa[0][1] << 2 | cfa[1][0] << 4 | cfa[1][1] << 6), static_cast<std::uint64_t>(avoidColourshift)}) {
+        key = (key ^ value) * fnvPrime;
+    }
+    for (const auto rowHash : rowHashes) {
+        key = (key ^ rowHash) * fnvPrime;
+    }
+    return key;
+}
 }
 
 namespace {
@@ -208,7 +261,7 @@ float* RawImageSource::CA_correct_RT(
 
     // Because we can't break parallel processing, we need a switch do handle the errors
     bool processpasstwo = true;
-    double fitparams[2][2][16];
+    double fitparams[2][2][16] = {};
 
     const size_t iterations =
         autoCA
@@ -228,6 +281,16 @@ float* RawImageSource::CA_correct_RT(
         }
     }
 
+    // fits of earlier runs on the same raw data and the fits of this run
+    std::uint64_t fitKey = 0;
+    std::shared_ptr<const CAFits> cachedFits;
+    CAFits fits;
+
+    if (autoCA && !fitParamsSet) {
+        fitKey = getFitKey(rawData, W, H, cfa, avoidColourshift);
+        getFitCache().get(fitKey, cachedFits);
+    }
+
     for (size_t it = 0; it < iterations && processpasstwo; ++it) {
         float blockave[2][2] = {};
         float blocksqave[2][2] = {};
@@ -237,6 +300,16 @@ float* RawImageSource::CA_correct_RT(
         //order of 2d polynomial fit (polyord), and numpar=polyord^2
         int polyord = 4, numpar = 16;
 
+        const bool useCachedFit = cachedFits && it < cachedFits->size();
+        const bool estimate = autoCA && !fitParamsSet && !useCachedFit;
+
+        if (useCachedFit) {
+            const CAFit& fit = (*cachedFits)[it];
+            processpasstwo = fit.valid;
+            polyord = fit.polyord;
+            std::memcpy(fitparams, fit.params, sizeof(fitparams));
+        }
+
         constexpr float eps = 1e-5f, eps2 = 1e-10f; //tolerance to avoid dividing by zero
 
 #ifdef _OPENMP
@@ -270,6 +343,7 @@ float* RawImageSource::CA_correct_RT(
             rgb[2] = (float*) (data + sizeof(float) * (ts * ts + ts * tsh) + 2 * 64);
 
             if (autoCA && !fitParamsSet) {
+                // with a cached fit only the interpolated green of this pass is needed
                 constexpr float caAutostrength = 8.f;
                 //high pass filter for R/B in vertical direction
                 float* rbhpfh  = (float*) (data + 2 * sizeof(float) * ts * ts + 3 * 64);
@@ -482,6 +556,10 @@ float* RawImageSource::CA_correct_RT(
                             }
                         }
 
+                        if (!estimate) {
+                            continue;
+                        }
+
 #ifdef __SSE2__
                         vfloat zd25v = F2V(0.25f);
 #endif
@@ -703,7 +781,7 @@ float* RawImageSource::CA_correct_RT(
 #ifdef _OPENMP
                 #pragma omp single
 #endif
-                {
+                if (estimate) {
                     for (int dir = 0; dir < 2; dir++)
                         for (int c = 0; c < 2; c++) {
                             if (blockdenom[dir][c]) {
@@ -832,6 +910,10 @@ float* RawImageSource::CA_correct_RT(
                         }
                     }
                     //fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
+                    fits.emplace_back();
+                    fits.back().valid = processpasstwo;
+                    fits.back().polyord = polyord;
+                    std::memcpy(fits.back().params, fitparams, sizeof(fitparams));
                 }
                 //end of initialization for CA correction pass
                 //only executed if autoCA is true
@@ -1344,7 +1426,13 @@ float* RawImageSource::CA_correct_RT(
                     const int firstCol = fc(cfa, i, 0) & 1;
                     const int colour = fc(cfa, i, firstCol);
                     const array2D<float>* nonGreen = colour == 0 ? redFactor : blueFactor;
-                    for (int j = firstCol; j < W - 2 * cb; j += 2) {
+                    int j = firstCol;
+#ifdef __SSE2__
+                    for (; j < W - 7 - 2 * cb; j += 8) {
+                        STC2VFU(rawData[i + cb][j + cb], LC2VFU(rawData[i + cb][j + cb]) * LVFU((*nonGreen)[i / 2][j / 2]));
+                    }
+#endif
+                    for (; j < W - 2 * cb; j += 2) {
                         rawData[i + cb][j + cb] *= (*nonGreen)[i / 2][j / 2];
                     }
                 }
@@ -1352,6 +1440,13 @@ float* RawImageSource::CA_correct_RT(
         }
     }
 
+    if (!fits.empty()) {
+        // the estimated fits continue the cached ones
+        const std::shared_ptr<CAFits> allFits = cachedFits ? std::make_shared<CAFits>(*cachedFits) : std::make_shared<CAFits>();
+        allFits->insert(allFits->end(), fits.begin(), fits.end());
+        getFitCache().set(fitKey, allFits);
+    }
+
     if (autoCA && fitParamsTransfer && fitParamsOut) {
         // store calculated parameters
         int index = 0;
@@ -5,8 +5,14 @@
 #include <omp.h>
 #endif
 #include "rt_algo.h"
+#include "settings.h"
 #include "sleef.h"
 
+namespace rtengine
+{
+extern const Settings* settings;
+}
+
 #define DIAGONALS 5
 #define DIAGONALSP1 6
 
@@ -120,8 +126,8 @@ float *SparseConjugateGradient(void Ax(float *Product, float *x, void *Pass), fl
     }
 
     if(iterate == MaximumIterates)
-        if(iterate != n && RMSResidual != 0.0f) {
-            printf("Warning: MaximumIterates (%u) reached in SparseConjugateGradient.\n", MaximumIterates);
+        if(iterate != n && RMSResidual != 0.0f && rtengine::settings->verbose) {
+            fprintf(stderr, "Warning: MaximumIterates (%u) reached in SparseConjugateGradient.\n", MaximumIterates);
         }
 
     if(ax != b) {
@@ -617,6 +623,483 @@ void MultiDiagonalSymmetricMatrix::CholeskyBackSolve(float* RESTRICT x, float* R
     }
 }
 
+namespace
+{
+
+//Coarse grids keep the even pixels. Where the fine grid ends on an odd pixel, it's taken from its only coarse neighbour.
+std::vector<MultigridPreconditioner::Parents> CreateParents(int n, int nc)
+{
+    std::vector<MultigridPreconditioner::Parents> p(n);
+
+    for(int x = 0; x < n; x++) {
+        if((x & 1) == 0) {
+            p[x] = {x / 2, x / 2, 1.0f, 0.0f};
+        } else if((x + 1) / 2 < nc) {
+            p[x] = {x / 2, x / 2 + 1, 0.5f, 0.5f};
+        } else {
+            p[x] = {x / 2, x / 2, 1.0f, 0.0f};
+        }
+    }
+
+    return p;
+}
+
+//Weight of the coarse column or row I in the interpolation of a fine one.
+inline float ParentWeight(const MultigridPreconditioner::Parents &p, int I)
+{
+    return (p.i0 == I ? p.w0 : 0.0f) + (p.i1 == I ? p.w1 : 0.0f);
+}
+
+//Precomputed Galerkin product for the coarse pixels I whose fine neighbourhood doesn't touch the border: the link Out of I (centre,
+//west, north, north west, north east) gets Weight times the link Neighbour of the fine pixel Fine, both 3 x 3 row major, Fine
+//being relative to 2 I.
+struct GalerkinTerm {
+    int Fine, Neighbour, Out;
+    float Weight;
+};
+
+std::vector<GalerkinTerm> CreateGalerkinTerms()
+{
+    const int OutX[5] = {0, -1, 0, -1, 1};
+    const int OutY[5] = {0, 0, -1, -1, -1};
+
+    //Interpolation weight of the coarse offset D for the fine offset r, both relative to the coarse pixel.
+    const auto Weight = [](int r, int D) {
+        if((r & 1) == 0) {
+            return r == 2 * D ? 1.0f : 0.0f;
+        }
+
+        return r == 2 * D - 1 || r == 2 * D + 1 ? 0.5f : 0.0f;
+    };
+
+    std::vector<GalerkinTerm> Terms;
+
+    for(int fy = -1; fy <= 1; fy++)
+        for(int fx = -1; fx <= 1; fx++)
+            for(int dy = -1; dy <= 1; dy++)
+                for(int dx = -1; dx <= 1; dx++)
+                    for(int o = 0; o < 5; o++) {
+                        const float w = Weight(fx, 0) * Weight(fy, 0) * Weight(fx + dx, OutX[o]) * Weight(fy + dy, OutY[o]);
+
+                        if(w != 0.0f) {
+                            Terms.push_back({(fy + 1) * 3 + fx + 1, (dy + 1) * 3 + dx + 1, o, w});
+                        }
+                    }
+
+    return Terms;
+}
+
+}
+
+MultigridPreconditioner::MultigridPreconditioner(MultiDiagonalSymmetricMatrix *A, int width, int height) : A(A)
+{
+    //The coarsest level is solved by plain Gauss-Seidel, so keep it tiny.
+    const int MinimumSize = 8;
+
+    Levels.emplace_back();
+    Level &l = Levels.back();
+    l.w = width;
+    l.h = height;
+    l.Diagonal  = A->Diagonals[0];
+    l.West      = A->Diagonals[A->FindIndex(1)];
+    l.NorthEast = A->Diagonals[A->FindIndex(width - 1)];
+    l.North     = A->Diagonals[A->FindIndex(width)];
+    l.NorthWest = A->Diagonals[A->FindIndex(width + 1)];
+    l.r.resize(static_cast<size_t>(width) * height);
+
+    while(std::max(Levels.back().w, Levels.back().h) > MinimumSize) {
+        Level coarse;
+        CreateCoarseLevel(Levels.back(), coarse);
+        Levels.push_back(std::move(coarse));
+    }
+
+    for(auto &level : Levels) {
+        const int n = level.w * level.h;
+        level.InverseDiagonal.resize(n);
+
+#ifdef _OPENMP
+        #pragma omp parallel for if(n > 65536)
+#endif
+
+        for(int i = 0; i < n; i++) {
+            level.InverseDiagonal[i] = 1.0f / level.Diagonal[i];
+        }
+    }
+}
+
+//Sum of the off diagonal entries of row i times x, for pixels not on the border.
+inline float MultigridPreconditioner::OffDiagonalInterior(const Level &l, const float *x, int i)
+{
+    const int w = l.w;
+    return l.West[i - 1] * x[i - 1] + l.West[i] * x[i + 1]
+           + l.North[i - w] * x[i - w] + l.North[i] * x[i + w]
+           + l.NorthWest[i - w - 1] * x[i - w - 1] + l.NorthWest[i] * x[i + w + 1]
+           + l.NorthEast[i - w + 1] * x[i - w + 1] + l.NorthEast[i] * x[i + w - 1];
+}
+
+//Same for any pixel (xx, y).
+inline float MultigridPreconditioner::OffDiagonal(const Level &l, const float *x, int xx, int y)
+{
+    const int w = l.w, h = l.h;
+    const int i = y * w + xx;
+
+    if(xx > 0 && xx < w - 1 && y > 0 && y < h - 1) {
+        return OffDiagonalInterior(l, x, i);
+    }
+
+    float sum = 0.0f;
+
+    if(xx > 0) {
+        sum += l.West[i - 1] * x[i - 1];
+    }
+
+    if(xx < w - 1) {
+        sum += l.West[i] * x[i + 1];
+    }
+
+    if(y > 0) {
+        sum += l.North[i - w] * x[i - w];
+
+        if(xx > 0) {
+            sum += l.NorthWest[i - w - 1] * x[i - w - 1];
+        }
+
+        if(xx < w - 1) {
+            sum += l.NorthEast[i - w + 1] * x[i - w + 1];
+        }
+    }
+
+    if(y < h - 1) {
+        sum += l.North[i] * x[i + w];
+
+        if(xx > 0) {
+            sum += l.NorthEast[i] * x[i + w - 1];
+        }
+
+        if(xx < w - 1) {
+            sum += l.NorthWest[i] * x[i + w + 1];
+        }
+    }
+
+    return sum;
+}
+
+void MultigridPreconditioner::CreateCoarseLevel(Level &fine, Level &coarse)
+{
+    const int w = fine.w, h = fine.h;
+    const int wc = (w + 1) / 2, hc = (h + 1) / 2;
+    const size_t nc = static_cast<size_t>(wc) * hc;
+
+    fine.ParentsX = CreateParents(w, wc);
+    fine.ParentsY = CreateParents(h, hc);
+
+    coarse.w = wc;
+    coarse.h = hc;
+    coarse.Storage.assign(5 * nc, 0.0f);
+    float *Diagonal  = coarse.Storage.data();
+    float *West      = Diagonal + nc;
+    float *North     = West + nc;
+    float *NorthWest = North + nc;
+    float *NorthEast = NorthWest + nc;
+    coarse.Diagonal  = Diagonal;
+    coarse.West      = West;
+    coarse.North     = North;
+    coarse.NorthWest = NorthWest;
+    coarse.NorthEast = NorthEast;
+    coarse.x.resize(nc);
+    coarse.b.resize(nc);
+    coarse.r.resize(nc);
+
+    const Parents *px = fine.ParentsX.data();
+    const Parents *py = fine.ParentsY.data();
+
+    static const std::vector<GalerkinTerm> Terms = CreateGalerkinTerms();
+
+    //Galerkin product P^t A P, gathered per coarse pixel so that each one writes only its own links. The fine pixels i interpolated
+    //from coarse pixel I are within one pixel of 2 I, the parents of their neighbours j are within one coarse pixel of I.
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for(int Iy = 0; Iy < hc; Iy++) {
+        for(int Ix = 0; Ix < wc; Ix++) {
+            const int I = Iy * wc + Ix;
+
+            if(Ix > 0 && Iy > 0 && 2 * Ix + 2 < w && 2 * Iy + 2 < h) {
+                float a[9][9];
+
+                for(int fy = 0; fy < 3; fy++) {
+                    for(int fx = 0; fx < 3; fx++) {
+                        const int i = (2 * Iy + fy - 1) * w + 2 * Ix + fx - 1;
+                        float *ai = a[fy * 3 + fx];
+                        ai[0] = fine.NorthWest[i - w - 1];
+                        ai[1] = fine.North[i - w];
+                        ai[2] = fine.NorthEast[i - w + 1];
+                        ai[3] = fine.West[i - 1];
+                        ai[4] = fine.Diagonal[i];
+                        ai[5] = fine.West[i];
+                        ai[6] = fine.NorthEast[i];
+                        ai[7] = fine.North[i];
+                        ai[8] = fine.NorthWest[i];
+                    }
+                }
+
+                float Out[5] = {};
+
+                for(const auto &t : Terms) {
+                    Out[t.Out] += t.Weight * a[t.Fine][t.Neighbour];
+                }
+
+                Diagonal[I] = Out[0];
+                West[I - 1] = Out[1];
+                North[I - wc] = Out[2];
+                NorthWest[I - wc - 1] = Out[3];
+                NorthEast[I - wc + 1] = Out[4];
+                continue;
+            }
+
+            float Acc[3][3] = {};
+
+            for(int y = std::max(2 * Iy - 1, 0); y <= std::min(2 * Iy + 1, h - 1); y++) {
+                const float wy = ParentWeight(py[y], Iy);
+
+                for(int x = std::max(2 * Ix - 1, 0); x <= std::min(2 * Ix + 1, w - 1); x++) {
+                    const float wi = wy * ParentWeight(px[x], Ix);
+
+                    if(wi == 0.0f) {
+                        continue;
+                    }
+
+                    const int i = y * w + x;
+
+                    //Entries (i, j) of the fine matrix, j running over the 3 x 3 neighbourhood of i.
+                    float a[3][3] = {};
+                    a[1][1] = fine.Diagonal[i];
+
+                    if(x > 0) {
+                        a[1][0] = fine.West[i - 1];
+                    }
+
+                    if(x < w - 1) {
+                        a[1][2] = fine.West[i];
+                    }
+
+                    if(y > 0) {
+                        a[0][1] = fine.North[i - w];
+
+                        if(x > 0) {
+                            a[0][0] = fine.NorthWest[i - w - 1];
+                        }
+
+                        if(x < w - 1) {
+                            a[0][2] = fine.NorthEast[i - w + 1];
+                        }
+                    }
+
+                    if(y < h - 1) {
+                        a[2][1] = fine.North[i];
+
+                        if(x > 0) {
+                            a[2][0] = fine.NorthEast[i];
+                        }
+
+                        if(x < w - 1) {
+                            a[2][2] = fine.NorthWest[i];
+                        }
+                    }
+
+                    for(int dy = 0; dy < 3; dy++) {
+                        for(int dx = 0; dx < 3; dx++) {
+                            if(a[dy][dx] == 0.0f) {
+                                continue;
+                            }
+
+                            const Parents &qy = py[y + dy - 1];
+                            const Parents &qx = px[x + dx - 1];
+                            const float c = wi * a[dy][dx];
+                            Acc[qy.i0 - Iy + 1][qx.i0 - Ix + 1] += c * qy.w0 * qx.w0;
+                            Acc[qy.i0 - Iy + 1][qx.i1 - Ix + 1] += c * qy.w0 * qx.w1;
+                            Acc[qy.i1 - Iy + 1][qx.i0 - Ix + 1] += c * qy.w1 * qx.w0;
+                            Acc[qy.i1 - Iy + 1][qx.i1 - Ix + 1] += c * qy.w1 * qx.w1;
+                        }
+                    }
+                }
+            }
+
+            //Only the lower triangle is stored, like in MultiDiagonalSymmetricMatrix.
+            Diagonal[I] = Acc[1][1];
+
+            if(Ix > 0) {
+                West[I - 1] = Acc[1][0];
+            }
+
+            if(Iy > 0) {
+                North[I - wc] = Acc[0][1];
+
+                if(Ix > 0) {
+                    NorthWest[I - wc - 1] = Acc[0][0];
+                }
+
+                if(Ix < wc - 1) {
+                    NorthEast[I - wc + 1] = Acc[0][2];
+                }
+            }
+        }
+    }
+}
+
+void MultigridPreconditioner::Smooth(const Level &l, float *x, const float *b, bool Reverse)
+{
+    const int w = l.w, h = l.h;
+
+    //Four colour Gauss-Seidel: pixels of the same colour (x and y parity) are not coupled by the 9 point stencil. The odd columns of
+    //a row only depend on its even columns, so the two colours of a row are relaxed in one go, and the rows of the same parity in
+    //parallel. The post smoothing runs the colours in reverse order, which keeps the V-cycle symmetric as needed by conjugate
+    //gradients.
+    for(int c = 0; c < 2; c++) {
+        const int parity = Reverse ? 1 - c : c;
+
+#ifdef _OPENMP
+        #pragma omp parallel for if(h > 64)
+#endif
+
+        for(int y = parity; y < h; y += 2) {
+            float *RESTRICT xr = x + y * w;
+            const float *RESTRICT br = b + y * w;
+            const float *RESTRICT dr = l.InverseDiagonal.data() + y * w;
+            const bool Interior = y > 0 && y < h - 1;
+
+            for(int k = 0; k < 2; k++) {
+                const int cx = Reverse ? 1 - k : k;
+                int xx = cx;
+
+                if(!Interior || xx == 0) {
+                    xr[xx] = (br[xx] - OffDiagonal(l, x, xx, y)) * dr[xx];
+                    xx += 2;
+                }
+
+                if(Interior) {
+                    for(; xx < w - 1; xx += 2) {
+                        xr[xx] = (br[xx] - OffDiagonalInterior(l, x, y * w + xx)) * dr[xx];
+                    }
+                }
+
+                for(; xx < w; xx += 2) {
+                    xr[xx] = (br[xx] - OffDiagonal(l, x, xx, y)) * dr[xx];
+                }
+            }
+        }
+    }
+}
+
+void MultigridPreconditioner::Cycle(size_t k, float *x, float *b)
+{
+    Level &l = Levels[k];
+    const int w = l.w, h = l.h;
+    const size_t n = static_cast<size_t>(w) * h;
+
+    memset(x, 0, n * sizeof(float));
+
+    if(k == Levels.size() - 1) {
+        for(int i = 0; i < 16; i++) {
+            Smooth(l, x, b, false);
+            Smooth(l, x, b, true);
+        }
+
+        return;
+    }
+
+    Smooth(l, x, b, false);
+
+    //Residual r = b - A x.
+    float *r = l.r.data();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(h > 64)
+#endif
+
+    for(int y = 0; y < h; y++) {
+        r[y * w] = b[y * w] - l.Diagonal[y * w] * x[y * w] - OffDiagonal(l, x, 0, y);
+
+        if(y > 0 && y < h - 1) {
+            for(int xx = 1; xx < w - 1; xx++) {
+                const int i = y * w + xx;
+                r[i] = b[i] - l.Diagonal[i] * x[i] - OffDiagonalInterior(l, x, i);
+            }
+        } else {
+            for(int xx = 1; xx < w - 1; xx++) {
+                const int i = y * w + xx;
+                r[i] = b[i] - l.Diagonal[i] * x[i] - OffDiagonal(l, x, xx, y);
+            }
+        }
+
+        if(w > 1) {
+            const int i = y * w + w - 1;
+            r[i] = b[i] - l.Diagonal[i] * x[i] - OffDiagonal(l, x, w - 1, y);
+        }
+    }
+
+    //Restrict with P^t, solve the coarse correction, interpolate it with P.
+    Level &c = Levels[k + 1];
+    const int wc = c.w, hc = c.h;
+    float *xc = c.x.data();
+    float *bc = c.b.data();
+    const Parents *px = l.ParentsX.data();
+    const Parents *py = l.ParentsY.data();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(hc > 64)
+#endif
+
+    for(int Iy = 0; Iy < hc; Iy++) {
+        for(int Ix = 0; Ix < wc; Ix++) {
+            if(Ix > 0 && Iy > 0 && 2 * Ix + 1 < w - 1 && 2 * Iy + 1 < h - 1) {
+                const float *r0 = r + (2 * Iy - 1) * w + 2 * Ix;
+                const float *r1 = r0 + w;
+                const float *r2 = r1 + w;
+                bc[Iy * wc + Ix] = 0.25f * (r0[-1] + r0[1] + r2[-1] + r2[1]) + 0.5f * (r0[0] + r2[0] + r1[-1] + r1[1]) + r1[0];
+                continue;
+            }
+
+            float sum = 0.0f;
+
+            for(int y = std::max(2 * Iy - 1, 0); y <= std::min(2 * Iy + 1, h - 1); y++) {
+                const float wy = ParentWeight(py[y], Iy);
+
+                for(int xx = std::max(2 * Ix - 1, 0); xx <= std::min(2 * Ix + 1, w - 1); xx++) {
+                    sum += wy * ParentWeight(px[xx], Ix) * r[y * w + xx];
+                }
+            }
+
+            bc[Iy * wc + Ix] = sum;
+        }
+    }
+
+    Cycle(k + 1, xc, bc);
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(h > 64)
+#endif
+
+    for(int y = 0; y < h; y++) {
+        const Parents &qy = py[y];
+        const float *row0 = xc + qy.i0 * wc;
+        const float *row1 = xc + qy.i1 * wc;
+
+        for(int xx = 0; xx < w; xx++) {
+            const Parents &qx = px[xx];
+            x[y * w + xx] += qy.w0 * (qx.w0 * row0[qx.i0] + qx.w1 * row0[qx.i1]) + qy.w1 * (qx.w0 * row1[qx.i0] + qx.w1 * row1[qx.i1]);
+        }
+    }
+
+    Smooth(l, x, b, true);
+}
+
+void MultigridPreconditioner::VCycle(float *x, float *b)
+{
+    Cycle(0, x, b);
+}
+
 EdgePreservingDecomposition::EdgePreservingDecomposition(int width, int height) : a0(nullptr) , a_1(nullptr), a_w(nullptr), a_w_1(nullptr), a_w1(nullptr)
 {
     w = width;
@@ -798,21 +1281,16 @@ float *EdgePreservingDecomposition::CreateBlur(float *Source, float Scale, float
         delete[] a;
     }
 
-    //Solve & return.
-    bool success = A->CreateIncompleteCholeskyFactorization(1); //Fill-in of 1 seems to work really good. More doesn't really help and less hurts (slightly).
-
-    if(!success) {
-        fprintf(stderr, "Error: Tonemapping has failed.\n");
-        memset(Blur, 0, sizeof(float)*n);  // On failure, set the blur to zero.  This is subsequently exponentiated in CompressDynamicRange.
-        return Blur;
-    }
+    //Solve & return. Iterates is meant for the incomplete Cholesky preconditioner. A multigrid preconditioned iterate costs about as much as
+    //two of those and reduces the error much more, so half of them take about the same time and end several times closer to the converged
+    //solution. No tolerance: an absolute one stops too early where the system is close to the identity (small scales).
+    MultigridPreconditioner Preconditioner(A, w, h);
 
     if(!UseBlurForEdgeStop) {
         memcpy(Blur, Source, n * sizeof(float));
     }
 
-    SparseConjugateGradient(A->PassThroughVectorProduct, Source, n, false, Blur, 0.0f, (void *)A, Iterates, A->PassThroughCholeskyBackSolve);
-    A->KillIncompleteCholeskyFactorization();
+    SparseConjugateGradient(Preconditioner.PassThroughVectorProduct, Source, n, false, Blur, 0.0f, (void *)&Preconditioner, (Iterates + 1) / 2, Preconditioner.PassThroughVCycle);
     return Blur;
 }
 
@@ -67,6 +67,7 @@ ben_s or nonbasketless. Enjoy!
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "opthelper.h"
 #include "noncopyable.h"
@@ -134,6 +135,59 @@ public:
 
 };
 
+/* Geometric multigrid preconditioner for SparseConjugateGradient, for the 9 point stencil matrices of EdgePreservingDecomposition.
+The coarse grids keep every other pixel, the coarse matrices are Galerkin products (so they stay 9 point stencils and follow the
+edge stopping function), smoothing is four colour Gauss-Seidel. Unlike the incomplete Cholesky factorization, both the setup and
+a V-cycle run in parallel, and the number of iterates needed doesn't grow with the image size. The matrix A has to be set up with
+the diagonals starting at rows 0, 1, w - 1, w and w + 1, and must stay unchanged during the lifetime of this object. */
+class MultigridPreconditioner :
+    public rtengine::NonCopyable
+{
+public:
+    MultigridPreconditioner(MultiDiagonalSymmetricMatrix *A, int width, int height);
+
+    //Approximately solves A x = b with one symmetric V-cycle.
+    void VCycle(float *x, float *b);
+
+    //Pass throughs for SparseConjugateGradient, which hands the same pass through variable to both functions.
+    static void PassThroughVectorProduct(float *Product, float *x, void *Pass)
+    {
+        (static_cast<MultigridPreconditioner *>(Pass))->A->VectorProduct(Product, x);
+    };
+
+    static void PassThroughVCycle(float *Product, float *x, void *Pass)
+    {
+        (static_cast<MultigridPreconditioner *>(Pass))->VCycle(Product, x);
+    };
+
+    //Interpolation from the next coarser level, for one fine column or row: the coarse columns or rows i0 and i1 with weights w0 and w1.
+    struct Parents {
+        int i0, i1;
+        float w0, w1;
+    };
+
+private:
+    //Same storage as MultiDiagonalSymmetricMatrix: the link between pixel i and its west neighbour is in West[i - 1], the ones to
+    //its north, north west and north east neighbours in North[i - w], NorthWest[i - w - 1] and NorthEast[i - w + 1].
+    struct Level {
+        int w, h;
+        const float *Diagonal, *West, *North, *NorthWest, *NorthEast;
+        std::vector<float> Storage;     //Matrix of the coarse levels.
+        std::vector<float> InverseDiagonal;
+        std::vector<float> x, b, r;     //x and b are supplied by the caller on the finest level.
+        std::vector<Parents> ParentsX, ParentsY;
+    };
+
+    static inline float OffDiagonalInterior(const Level &l, const float *x, int i);
+    static inline float OffDiagonal(const Level &l, const float *x, int xx, int y);
+    void CreateCoarseLevel(Level &fine, Level &coarse);
+    void Smooth(const Level &l, float *x, const float *b, bool Reverse);
+    void Cycle(size_t k, float *x, float *b);
+
+    MultiDiagonalSymmetricMatrix *A;
+    std::vector<Level> Levels;
+};
+
 class EdgePreservingDecomposition :
     public rtengine::NonCopyable
 {
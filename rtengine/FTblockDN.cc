@@ -500,8 +500,6 @@ BENCHFUN
         return;
     }
 
-    MyMutex::MyLock lock(*fftwMutex);
-
     const nrquality nrQuality = (dnparams.smethod == "shal") ? QUALITY_STANDARD : QUALITY_HIGH;//shrink method
     const float qhighFactor = (nrQuality == QUALITY_HIGH) ? 1.f / static_cast<float>(settings->nrhigh) : 1.0f;
     const bool useNoiseCCurve = (noiseCCurve && noiseCCurve.getSum() > 5.f);
@@ -769,6 +767,12 @@ BENCHFUN
                 fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
 
                 // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
+                // Only the planner is not thread-safe, executing the plans is
+                MyMutex::MyLock lock(*fftwMutex);
+#ifdef RT_FFTW3F_OMP
+                // the plans are executed inside the parallel region
+                fftwf_plan_with_nthreads(1);
+#endif
                 plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
                 plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
                 plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
@@ -1756,6 +1760,7 @@ BENCHFUN
 
             if (denoiseLuminance) {
                 // destroy the plans
+                MyMutex::MyLock lock(*fftwMutex);
                 fftwf_destroy_plan(plan_forward_blox[0]);
                 fftwf_destroy_plan(plan_backward_blox[0]);
                 fftwf_destroy_plan(plan_forward_blox[1]);
@@ -22,6 +22,8 @@
 #include <cstdlib>
 #include <utility>
 
+#include "bufferpool.h"
+
 inline size_t padToAlignment(size_t size, size_t align = 16) {
     return align * ((size + align - 1) / align);
 }
@@ -54,7 +56,7 @@ public:
     ~AlignedBuffer ()
     {
         if (real) {
-            free(real);
+            rtengine::BufferPool::getInstance().release(real, allocatedSize + alignment);
         }
     }
 
@@ -76,7 +78,7 @@ public:
             if (!size) {
                 // The user want to free the memory
                 if (real) {
-                    free(real);
+                    rtengine::BufferPool::getInstance().release(real, allocatedSize + alignment);
                 }
 
                 real = nullptr;
@@ -89,28 +91,14 @@ public:
                 size_t oldAllocatedSize = allocatedSize;
                 allocatedSize = size * unitSize;
 
-                // realloc were used here to limit memory fragmentation, specially when the size was smaller than the previous one.
-                // But realloc copies the content to the eventually new location, which is unnecessary. To avoid this performance penalty,
-                // we're freeing the memory and allocate it again if the new size is bigger.
-
-                if (allocatedSize < oldAllocatedSize) {
-                    void *temp = realloc(real, allocatedSize + alignment);
-                    if (temp) { // realloc succeeded
-                        real = temp;
-                    } else { // realloc failed => free old buffer and allocate new one
-                        if (real) {
-                            free (real);
-                        }
-                        real = malloc(allocatedSize + alignment);
-                    }
-                } else {
-                    if (real) {
-                        free (real);
-                    }
-
-                    real = malloc(allocatedSize + alignment);
+                // The large buffers come from the pool, which hands out the buffers released by the previous steps again.
+                // The content is not kept, so the old buffer is released first, which lets the pool reuse it.
+                if (real) {
+                    rtengine::BufferPool::getInstance().release(real, oldAllocatedSize + alignment);
                 }
 
+                real = rtengine::BufferPool::getInstance().allocate(allocatedSize + alignment);
+
                 if (real) {
                     data = (T*)( ( uintptr_t(real) + uintptr_t(alignment - 1)) / alignment * alignment);
                     inUse = true;
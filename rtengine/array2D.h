@@ -56,6 +56,7 @@
 #include <cstring>
 #include <sys/types.h>
 #include <vector>
+#include "bufferpool.h"
 #include "noncopyable.h"
 
 // flags for use
@@ -70,7 +71,7 @@ class array2D
 private:
     ssize_t width;
     std::vector<T*> rows;
-    std::vector<T> buffer;
+    std::vector<T, rtengine::PoolAllocator<T>> buffer;
 
     void initRows(ssize_t h, int offset = 0)
     {
@@ -176,7 +177,8 @@ public:
 
     void free()
     {
-        buffer.clear();
+        // give the memory back to the pool, clear() would keep it
+        std::vector<T, rtengine::PoolAllocator<T>>().swap(buffer);
         rows.clear();
         width = 0;
     }
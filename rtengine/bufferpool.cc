@@ -0,0 +1,196 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "bufferpool.h"
+
+namespace
+{
+
+constexpr std::size_t cacheLineSize = 64;
+constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+// rounds size up to 4 size classes per power of two, so that buffers of similar size can be reused
+std::size_t getSizeClass(std::size_t size)
+{
+    std::size_t base = 1;
+
+    while (base <= size / 2) {
+        base *= 2;
+    }
+
+    const std::size_t step = base / 4;
+    return (size + step - 1) / step * step;
+}
+
+}
+
+namespace rtengine
+{
+
+constexpr std::size_t BufferPool::minPooledSize;
+
+BufferPool& BufferPool::getInstance()
+{
+    // never destroyed, static buffers may be released after the end of main
+    static BufferPool* const instance = new BufferPool;
+    return *instance;
+}
+
+BufferPool::BufferPool() :
+    capacity(0),
+    stats{0, 0, 0, 0, 0}
+{
+}
+
+void* BufferPool::allocatePooled(std::size_t size)
+{
+    const std::size_t sizeClass = getSizeClass(size);
+
+    {
+        MyMutex::MyLock lock(mutex);
+
+        ++stats.allocations;
+
+        for (auto block = idle.begin(); block != idle.end(); ++block) {
+            if (block->size == sizeClass) {
+                void* const data = block->data;
+                used.emplace(data, *block);
+                stats.idle -= sizeClass;
+                stats.inUse += sizeClass;
+                ++stats.reused;
+                idle.erase(block);
+                return data;
+            }
+        }
+    }
+
+    // buffers of at least two huge pages are aligned to the huge page size, the others to the cache line size
+    const std::size_t alignment = sizeClass >= 2 * hugePageSize ? hugePageSize : cacheLineSize;
+    void* real = std::malloc(sizeClass + alignment);
+
+    if (!real) {
+        // give the idle buffers back and try again
+        trim();
+        real = std::malloc(sizeClass + alignment);
+
+        if (!real) {
+            return nullptr;
+        }
+    }
+
+    void* const data = reinterpret_cast<void*>((reinterpret_cast<std::uintptr_t>(real) + alignment) / alignment * alignment);
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (alignment == hugePageSize) {
+        madvise(data, sizeClass / hugePageSize * hugePageSize, MADV_HUGEPAGE);
+    }
+#endif
+
+    MyMutex::MyLock lock(mutex);
+
+    used.emplace(data, Block{real, data, sizeClass});
+    stats.inUse += sizeClass;
+    stats.peak = std::max(stats.peak, stats.inUse + stats.idle);
+    return data;
+}
+
+void BufferPool::releasePooled(void* ptr)
+{
+    std::vector<void*> evicted;
+
+    {
+        MyMutex::MyLock lock(mutex);
+
+        const auto block = used.find(ptr);
+
+        if (block == used.end()) {
+            return;
+        }
+
+        stats.inUse -= block->second.size;
+
+        if (block->second.size <= capacity) {
+            idle.push_front(block->second);
+            stats.idle += block->second.size;
+
+            while (stats.idle > capacity) {
+                evicted.push_back(idle.back().real);
+                stats.idle -= idle.back().size;
+                idle.pop_back();
+            }
+        } else {
+            evicted.push_back(block->second.real);
+        }
+
+        used.erase(block);
+    }
+
+    for (auto real : evicted) {
+        std::free(real);
+    }
+}
+
+void BufferPool::setCapacity(std::size_t capacity)
+{
+    std::vector<void*> evicted;
+
+    {
+        MyMutex::MyLock lock(mutex);
+
+        this->capacity = capacity;
+
+        while (stats.idle > capacity) {
+            evicted.push_back(idle.back().real);
+            stats.idle -= idle.back().size;
+            idle.pop_back();
+        }
+    }
+
+    for (auto real : evicted) {
+        std::free(real);
+    }
+}
+
+void BufferPool::trim()
+{
+    std::list<Block> evicted;
+
+    {
+        MyMutex::MyLock lock(mutex);
+        evicted.swap(idle);
+        stats.idle = 0;
+    }
+
+    for (const auto& block : evicted) {
+        std::free(block.real);
+    }
+}
+
+BufferPool::Stats BufferPool::getStats() const
+{
+    MyMutex::MyLock lock(mutex);
+    return stats;
+}
+
+}
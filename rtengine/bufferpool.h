@@ -0,0 +1,144 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <list>
+#include <new>
+#include <unordered_map>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Pool of the large working buffers of the pipeline
+ *
+ * The image buffers (LabImage, Imagefloat & co through AlignedBuffer, array2D) are allocated and freed
+ * several times per processing run. Large allocations are mapped and unmapped by the system each time,
+ * and the pages are faulted in again on first use. The pool keeps the released buffers (up to a capacity,
+ * see Settings::bufferPoolSize) and hands them out again for requests of the same size class, across the
+ * processing steps and the jobs. Buffers of several MB are aligned to the huge page size, so that the
+ * system can back them with huge pages. Requests below minPooledSize are served by malloc directly.
+ */
+class BufferPool final :
+    public NonCopyable
+{
+public:
+    static constexpr std::size_t minPooledSize = 256 * 1024;
+
+    struct Stats {
+        std::size_t allocations; // pooled requests
+        std::size_t reused;      // pooled requests served from the idle buffers
+        std::size_t inUse;       // bytes of the pooled buffers in use
+        std::size_t idle;        // bytes of the idle buffers
+        std::size_t peak;        // maximum of inUse + idle
+    };
+
+    static BufferPool& getInstance();
+
+    // returns nullptr if the allocation fails
+    void* allocate(std::size_t size)
+    {
+        return size < minPooledSize ? std::malloc(size) : allocatePooled(size);
+    }
+
+    // size has to be the size passed to allocate
+    void release(void* ptr, std::size_t size)
+    {
+        if (size < minPooledSize) {
+            std::free(ptr);
+        } else if (ptr) {
+            releasePooled(ptr);
+        }
+    }
+
+    // maximum size of the idle buffers in bytes, 0 disables the reuse
+    void setCapacity(std::size_t capacity);
+    // frees the idle buffers
+    void trim();
+    Stats getStats() const;
+
+private:
+    struct Block {
+        void* real;
+        void* data;
+        std::size_t size;
+    };
+
+    BufferPool();
+
+    void* allocatePooled(std::size_t size);
+    void releasePooled(void* ptr);
+
+    mutable MyMutex mutex;
+    std::unordered_map<void*, Block> used;
+    std::list<Block> idle; // most recently released first
+    std::size_t capacity;
+    Stats stats;
+};
+
+/**
+ * @brief Allocator for std::vector & co, takes its memory from the BufferPool
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&)
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        T* const ptr = static_cast<T*>(BufferPool::getInstance().allocate(n * sizeof(T)));
+
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+
+        return ptr;
+    }
+
+    void deallocate(T* ptr, std::size_t n)
+    {
+        BufferPool::getInstance().release(ptr, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator ==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator !=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+    return false;
+}
+
+}
@@ -0,0 +1,737 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <locale>
+#include <memory>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <giomm/file.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/miscutils.h>
+
+#include "calibrationcache.h"
+
+#include "rawimage.h"
+#include "rt_math.h"
+#include "settings.h"
+
+#include "../rtgui/options.h"
+
+namespace
+{
+
+using rtengine::RawImage;
+
+constexpr char templateMagic[8] = {'R', 'T', 'C', 'A', 'L', 'I', 'B', '1'};
+
+// memory used for the frames of a median stack, the frames which do not fit are stacked from temporary files
+constexpr std::size_t medianStackMemory = std::size_t(512) << 20;
+
+// total size of the templates and hot pixels files of a cache, the least recently used ones are removed beyond it
+constexpr std::int64_t maxTemplatesSize = std::int64_t(2) << 30;
+
+// loads a frame and converts it to the compressed raw format used by the templates
+RawImage* loadFrame(const Glib::ustring& name)
+{
+    RawImage* const ri = new RawImage(name);
+
+    if (ri->loadRaw(true)) {
+        delete ri;
+        return nullptr;
+    }
+
+    ri->compress_image(0);
+    return ri;
+}
+
+int getRowSize(RawImage* ri)
+{
+    return ri->get_width() * ((ri->getSensorType() == rtengine::ST_BAYER || ri->getSensorType() == rtengine::ST_FUJI_XTRANS || ri->get_colors() == 1) ? 1 : 3);
+}
+
+bool isCompatible(RawImage* ri, RawImage* frame)
+{
+    return frame && frame->get_height() == ri->get_height() && getRowSize(frame) == getRowSize(ri);
+}
+
+// averages the frames into ri, one frame in memory at a time
+void meanStack(RawImage* ri, const std::vector<Glib::ustring>& names)
+{
+    typedef unsigned int acc_t;
+
+    const int H = ri->get_height();
+    const int rSize = getRowSize(ri);
+    std::vector<acc_t> acc(static_cast<std::size_t>(H) * rSize);
+
+    // copy first image into accumulators
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < rSize; col++) {
+            acc[static_cast<std::size_t>(row) * rSize + col] = ri->data[row][col];
+        }
+    }
+
+    int nFiles = 1; // First file data already loaded
+
+    for (const auto& name : names) {
+        const std::unique_ptr<RawImage> temp(loadFrame(name));
+
+        if (!isCompatible(ri, temp.get())) {
+            continue;
+        }
+
+        nFiles++;
+
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+
+        for (int row = 0; row < H; row++) {
+            acc_t* const accRow = acc.data() + static_cast<std::size_t>(row) * rSize;
+
+            for (int col = 0; col < rSize; col++) {
+                accRow[col] += temp->data[row][col];
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < rSize; col++) {
+            ri->data[row][col] = acc[static_cast<std::size_t>(row) * rSize + col] / nFiles;
+        }
+    }
+}
+
+// per pixel median of the rows [y0 ; y1[ of ri and of the frames, getRow(frame, row) returns the row of a frame
+template<typename GetRow>
+void medianRows(RawImage* ri, int y0, int y1, std::size_t frames, const GetRow& getRow)
+{
+    const int rSize = getRowSize(ri);
+    const std::size_t n = frames + 1;
+    const std::size_t mid = n / 2;
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        std::vector<float> values(n);
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 16)
+#endif
+
+        for (int row = y0; row < y1; row++) {
+            for (int col = 0; col < rSize; col++) {
+                values[0] = ri->data[row][col];
+
+                for (std::size_t i = 1; i < n; ++i) {
+                    values[i] = getRow(i - 1, row)[col];
+                }
+
+                std::nth_element(values.begin(), values.begin() + mid, values.end());
+                float median = values[mid];
+
+                if (n % 2 == 0) {
+                    median = 0.5f * (median + *std::max_element(values.begin(), values.begin() + mid));
+                }
+
+                ri->data[row][col] = median;
+            }
+        }
+    }
+}
+
+// per pixel median of the frames into ri, more robust against outliers (cosmic rays, light leaks) than the mean.
+// Frames which do not fit in medianStackMemory together are written to temporary files in tempDir, and the median
+// is computed one band of rows at a time. Returns false if the temporary files could not be written.
+bool medianStack(RawImage* ri, const std::vector<Glib::ustring>& names, const Glib::ustring& tempDir)
+{
+    const int H = ri->get_height();
+    const int rSize = getRowSize(ri);
+    const std::size_t rowBytes = static_cast<std::size_t>(rSize) * sizeof(float);
+    const std::size_t frameBytes = rowBytes * H;
+
+#ifdef _OPENMP
+    const std::size_t threads = omp_get_max_threads();
+#else
+    const std::size_t threads = 1;
+#endif
+
+    // frames loaded at once, in parallel
+    const std::size_t batchSize = std::max<std::size_t>(1, std::min(threads, medianStackMemory / frameBytes));
+
+    if (names.size() <= batchSize) {
+        std::vector<std::unique_ptr<RawImage>> frames(names.size());
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            frames[i].reset(loadFrame(names[i]));
+        }
+
+        frames.erase(std::remove_if(frames.begin(), frames.end(), [ri](const std::unique_ptr<RawImage>& frame) {
+            return !isCompatible(ri, frame.get());
+        }), frames.end());
+
+        medianRows(ri, 0, H, frames.size(), [&frames](std::size_t frame, int row) {
+            return static_cast<const float*>(frames[frame]->data[row]);
+        });
+
+        return true;
+    }
+
+    // one temporary file per frame, so that they are all read sequentially
+    std::vector<FILE*> files;
+    std::vector<std::string> fileNames;
+    bool ok = g_mkdir_with_parents(tempDir.c_str(), 0777) == 0;
+
+    for (std::size_t first = 0; ok && first < names.size(); first += batchSize) {
+        std::vector<std::unique_ptr<RawImage>> frames(std::min(batchSize, names.size() - first));
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            frames[i].reset(loadFrame(names[first + i]));
+        }
+
+        for (const auto& frame : frames) {
+            if (!isCompatible(ri, frame.get())) {
+                continue;
+            }
+
+            std::string fileName = Glib::build_filename(tempDir, "stackXXXXXX");
+            const int fd = g_mkstemp(&fileName[0]);
+            FILE* const file = fd == -1 ? nullptr : fdopen(fd, "w+b");
+
+            if (!file) {
+                if (fd != -1) {
+                    g_close(fd, nullptr);
+                    g_remove(fileName.c_str());
+                }
+
+                ok = false;
+                break;
+            }
+
+            files.push_back(file);
+            fileNames.push_back(fileName);
+
+            for (int row = 0; ok && row < H; ++row) {
+                ok = fwrite(frame->data[row], rowBytes, 1, file) == 1;
+            }
+
+            ok = ok && fflush(file) == 0;
+
+            if (!ok) {
+                break;
+            }
+        }
+    }
+
+    if (ok && !files.empty()) {
+        const int bandRows = rtengine::LIM<std::size_t>(medianStackMemory / (files.size() * rowBytes), 1, H);
+        std::vector<float> band(files.size() * bandRows * rSize);
+
+        for (auto file : files) {
+            rewind(file);
+        }
+
+        for (int y0 = 0; ok && y0 < H; y0 += bandRows) {
+            const int y1 = std::min(y0 + bandRows, H);
+
+            for (std::size_t i = 0; ok && i < files.size(); ++i) {
+                ok = fread(band.data() + i * bandRows * rSize, rowBytes, y1 - y0, files[i]) == static_cast<std::size_t>(y1 - y0);
+            }
+
+            if (ok) {
+                medianRows(ri, y0, y1, files.size(), [&](std::size_t frame, int row) {
+                    return static_cast<const float*>(band.data() + (frame * bandRows + (row - y0)) * rSize);
+                });
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        fclose(files[i]);
+        g_remove(fileNames[i].c_str());
+    }
+
+    return ok;
+}
+
+bool readValue(FILE* file, void* value, std::size_t size)
+{
+    return fread(value, size, 1, file) == 1;
+}
+
+bool readStoredKey(FILE* file, std::string& key)
+{
+    char magic[sizeof(templateMagic)];
+    std::uint32_t keySize;
+
+    if (!readValue(file, magic, sizeof(magic)) || memcmp(magic, templateMagic, sizeof(magic)) || !readValue(file, &keySize, sizeof(keySize)) || keySize > 1 << 20) {
+        return false;
+    }
+
+    key.assign(keySize, '\0');
+    return keySize == 0 || readValue(file, &key[0], keySize);
+}
+
+// the whole key is stored in the files, so that hash collisions are detected
+bool readKey(FILE* file, const std::string& key)
+{
+    std::string fileKey;
+    return readStoredKey(file, fileKey) && fileKey == key;
+}
+
+// true if the file of a stamp made by getFileStamp still has the same size and modification time
+bool isStampCurrent(const std::string& stamp)
+{
+    const std::string::size_type timePos = stamp.rfind('|');
+    const std::string::size_type sizePos = timePos == std::string::npos || timePos == 0 ? std::string::npos : stamp.rfind('|', timePos - 1);
+    return sizePos != std::string::npos && rtengine::CalibrationCache::getFileStamp(stamp.substr(0, sizePos)) == stamp;
+}
+
+void writeKey(FILE* file, const std::string& key)
+{
+    const std::uint32_t keySize = key.size();
+    fwrite(templateMagic, sizeof(templateMagic), 1, file);
+    fwrite(&keySize, sizeof(keySize), 1, file);
+    fwrite(key.data(), 1, key.size(), file);
+}
+
+// writes to a temporary file first, so that a template is never read half written
+bool writeFile(const Glib::ustring& fileName, const std::function<void(FILE*)>& write)
+{
+    g_mkdir_with_parents(Glib::path_get_dirname(fileName).c_str(), 0777);
+    // unique, as several threads or processes may write the same file
+    std::string tempName = fileName + ".XXXXXX";
+    const int fd = g_mkstemp(&tempName[0]);
+    FILE* const file = fd == -1 ? nullptr : fdopen(fd, "wb");
+
+    if (!file) {
+        if (fd != -1) {
+            g_close(fd, nullptr);
+            g_remove(tempName.c_str());
+        }
+
+        return false;
+    }
+
+    write(file);
+    const bool ok = !ferror(file);
+
+    if (fclose(file) || !ok) {
+        g_remove(tempName.c_str());
+        return false;
+    }
+
+    g_remove(fileName.c_str());
+    return g_rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+}
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+CalibrationCache::CalibrationCache(const Glib::ustring& name) :
+    dir(Glib::build_filename(options.cacheBaseDir, name)),
+    shotInfoChanged(false)
+{
+    std::ifstream file(Glib::build_filename(dir, "library").c_str());
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        std::istringstream fieldStream(line);
+        std::string field;
+
+        while (std::getline(fieldStream, field, '\t')) {
+            fields.push_back(field);
+        }
+
+        // the last field terminates the line, so that trailing empty fields are kept
+        if (fields.size() > 1 && fields.back() == ".") {
+            const std::string stamp = fields[0];
+
+            // drop the files which have been removed or changed since, they would never be looked up again
+            if (!isStampCurrent(stamp)) {
+                shotInfoChanged = true;
+                continue;
+            }
+
+            fields.erase(fields.begin());
+            fields.pop_back();
+            shotInfo[stamp] = std::move(fields);
+        }
+    }
+
+    pruneTemplates();
+}
+
+std::string CalibrationCache::getFileStamp(const Glib::ustring& filename)
+{
+    try {
+        const auto info = Gio::File::create_for_path(filename)->query_info("standard::size,time::modified");
+
+        if (!info) {
+            return std::string();
+        }
+
+        std::ostringstream stamp;
+        stamp << filename << '|' << info->get_size() << '|' << info->modification_time().tv_sec;
+        return stamp.str();
+    } catch (Glib::Exception&) {
+        return std::string();
+    }
+}
+
+bool CalibrationCache::getShotInfo(const std::string& stamp, std::vector<std::string>& fields) const
+{
+    const auto iter = shotInfo.find(stamp);
+
+    if (iter == shotInfo.end()) {
+        return false;
+    }
+
+    fields = iter->second;
+    return true;
+}
+
+void CalibrationCache::setShotInfo(const std::string& stamp, const std::vector<std::string>& fields)
+{
+    const auto storable = [](const std::string& s) {
+        return s.find_first_of("\t\n\r") == std::string::npos;
+    };
+
+    if (stamp.empty() || !storable(stamp) || !std::all_of(fields.begin(), fields.end(), storable)) {
+        return;
+    }
+
+    shotInfo[stamp] = fields;
+    shotInfoChanged = true;
+}
+
+void CalibrationCache::saveShotInfo()
+{
+    if (!shotInfoChanged) {
+        return;
+    }
+
+    writeFile(Glib::build_filename(dir, "library"), [this](FILE* file) {
+        for (const auto& entry : shotInfo) {
+            fputs(entry.first.c_str(), file);
+
+            for (const auto& field : entry.second) {
+                fputc('\t', file);
+                fputs(field.c_str(), file);
+            }
+
+            fputs("\t.\n", file);
+        }
+    });
+
+    shotInfoChanged = false;
+}
+
+std::string CalibrationCache::toField(double value)
+{
+    std::ostringstream field;
+    field.imbue(std::locale::classic());
+    field.precision(17);
+    field << value;
+    return field.str();
+}
+
+double CalibrationCache::fromField(const std::string& field)
+{
+    std::istringstream stream(field);
+    stream.imbue(std::locale::classic());
+    double value = 0.0;
+    stream >> value;
+    return value;
+}
+
+std::string CalibrationCache::getTemplateKey(const std::list<Glib::ustring>& pathNames) const
+{
+    std::string key = settings->calibrationStackMedian ? "median" : "mean";
+
+    for (const auto& name : pathNames) {
+        const std::string stamp = getFileStamp(name);
+
+        if (stamp.empty()) {
+            return std::string();
+        }
+
+        key += '\n' + stamp;
+    }
+
+    return key;
+}
+
+Glib::ustring CalibrationCache::getTemplateFileName(const std::string& key, const char* extension) const
+{
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>()(key) << extension;
+    return Glib::build_filename(dir, name.str());
+}
+
+RawImage* CalibrationCache::loadTemplate(const std::list<Glib::ustring>& pathNames, std::vector<badPix>* hotPixels, bool& hotPixelsCached) const
+{
+    hotPixelsCached = false;
+
+    if (pathNames.empty()) {
+        return nullptr;
+    }
+
+    // First file used also for extra pixels information (width, height, shutter, filters etc.. )
+    RawImage* const ri = loadFrame(pathNames.front());
+
+    if (!ri) {
+        return nullptr;
+    }
+
+    const std::string key = getTemplateKey(pathNames);
+
+    if (pathNames.size() > 1) {
+        const int H = ri->get_height();
+        const int rSize = getRowSize(ri);
+        bool cached = false;
+
+        if (!key.empty()) {
+            FILE* const file = g_fopen(getTemplateFileName(key, ".template").c_str(), "rb");
+
+            if (file) {
+                std::int32_t size[2];
+                cached = readKey(file, key) && readValue(file, size, sizeof(size)) && size[0] == H && size[1] == rSize;
+
+                for (int row = 0; cached && row < H; ++row) {
+                    cached = fread(ri->data[row], sizeof(float), rSize, file) == static_cast<std::size_t>(rSize);
+                }
+
+                fclose(file);
+            }
+        }
+
+        if (cached) {
+            // the modification time gives the least recently used templates to pruneTemplates
+            g_utime(getTemplateFileName(key, ".template").c_str(), nullptr);
+
+            if (settings->verbose) {
+                std::cout << "Using cached template of " << pathNames.size() << " frames for " << pathNames.front() << std::endl;
+            }
+        } else {
+            const std::vector<Glib::ustring> names(std::next(pathNames.begin()), pathNames.end());
+
+            if (settings->calibrationStackMedian && !medianStack(ri, names, dir)) {
+                // the temporary files of the median could not be written, ri may hold a partial result.
+                // The mean is used instead, and not cached.
+                std::cerr << "Could not compute the median of the frames of " << pathNames.front() << ", using their mean." << std::endl;
+                delete ri;
+                RawImage* const mean = loadFrame(pathNames.front());
+
+                if (mean) {
+                    meanStack(mean, names);
+                }
+
+                return mean;
+            } else if (!settings->calibrationStackMedian) {
+                meanStack(ri, names);
+            }
+
+            if (!key.empty()) {
+                writeFile(getTemplateFileName(key, ".template"), [&](FILE* file) {
+                    const std::int32_t size[2] = {H, rSize};
+                    writeKey(file, key);
+                    fwrite(size, sizeof(size), 1, file);
+
+                    for (int row = 0; row < H; ++row) {
+                        fwrite(ri->data[row], sizeof(float), rSize, file);
+                    }
+                });
+                pruneTemplates();
+            }
+        }
+    }
+
+    if (hotPixels && !key.empty()) {
+        FILE* const file = g_fopen(getTemplateFileName(key, ".hotpixels").c_str(), "rb");
+
+        if (file) {
+            std::uint32_t count;
+
+            if (readKey(file, key) && readValue(file, &count, sizeof(count))) {
+                std::vector<std::uint16_t> coords(2 * static_cast<std::size_t>(count));
+
+                if (count == 0 || fread(coords.data(), sizeof(std::uint16_t), coords.size(), file) == coords.size()) {
+                    hotPixels->clear();
+                    hotPixels->reserve(count);
+
+                    for (std::size_t i = 0; i < count; ++i) {
+                        hotPixels->emplace_back(coords[2 * i], coords[2 * i + 1]);
+                    }
+
+                    hotPixelsCached = true;
+                }
+            }
+
+            fclose(file);
+
+            if (hotPixelsCached) {
+                g_utime(getTemplateFileName(key, ".hotpixels").c_str(), nullptr);
+            }
+        }
+    }
+
+    return ri;
+}
+
+void CalibrationCache::saveHotPixels(const std::list<Glib::ustring>& pathNames, const std::vector<badPix>& hotPixels) const
+{
+    const std::string key = getTemplateKey(pathNames);
+
+    if (key.empty()) {
+        return;
+    }
+
+    writeFile(getTemplateFileName(key, ".hotpixels"), [&](FILE* file) {
+        const std::uint32_t count = hotPixels.size();
+        writeKey(file, key);
+        fwrite(&count, sizeof(count), 1, file);
+
+        for (const auto& pixel : hotPixels) {
+            const std::uint16_t coords[2] = {pixel.x, pixel.y};
+            fwrite(coords, sizeof(coords), 1, file);
+        }
+    });
+}
+
+void CalibrationCache::pruneTemplates() const
+{
+    MyMutex::MyLock lock(pruneMutex);
+
+    // the template and the hot pixels of a stack share the name of their files, up to the extension
+    struct Entry {
+        std::vector<std::string> files;
+        std::int64_t size = 0;
+        std::int64_t lastUse = 0;
+    };
+
+    std::map<std::string, Entry> entries;
+
+    try {
+        Glib::Dir templates(dir);
+
+        for (const std::string& name : templates) {
+            const std::string::size_type dot = name.rfind('.');
+
+            if (dot == std::string::npos || (name.compare(dot, std::string::npos, ".template") && name.compare(dot, std::string::npos, ".hotpixels"))) {
+                continue;
+            }
+
+            const std::string fileName = Glib::build_filename(dir, name);
+            GStatBuf stat;
+
+            if (g_stat(fileName.c_str(), &stat)) {
+                continue;
+            }
+
+            Entry& entry = entries[name.substr(0, dot)];
+            entry.files.push_back(fileName);
+            entry.size += stat.st_size;
+            entry.lastUse = std::max<std::int64_t>(entry.lastUse, stat.st_mtime);
+        }
+    } catch (Glib::Exception&) {
+        return;
+    }
+
+    const auto remove = [](const Entry& entry) {
+        for (const auto& fileName : entry.files) {
+            g_remove(fileName.c_str());
+        }
+    };
+
+    std::vector<std::pair<std::int64_t, const Entry*>> byLastUse;
+    std::int64_t totalSize = 0;
+
+    for (const auto& entry : entries) {
+        // the key stored in the files holds the stamps of the frames, see getTemplateKey
+        std::string key;
+        FILE* const file = g_fopen(entry.second.files.front().c_str(), "rb");
+        const bool keyRead = file && readStoredKey(file, key);
+
+        if (file) {
+            fclose(file);
+        }
+
+        bool current = keyRead;
+        std::istringstream stamps(key);
+        std::string stamp;
+
+        // skip the stacking mode
+        std::getline(stamps, stamp);
+
+        while (current && std::getline(stamps, stamp)) {
+            current = isStampCurrent(stamp);
+        }
+
+        if (!current) {
+            // a frame has been removed or changed, the template can't be used anymore
+            remove(entry.second);
+        } else {
+            byLastUse.emplace_back(entry.second.lastUse, &entry.second);
+            totalSize += entry.second.size;
+        }
+    }
+
+    std::sort(byLastUse.begin(), byLastUse.end(), [](const std::pair<std::int64_t, const Entry*>& a, const std::pair<std::int64_t, const Entry*>& b) {
+        return a.first < b.first;
+    });
+
+    for (const auto& entry : byLastUse) {
+        if (totalSize <= maxTemplatesSize) {
+            break;
+        }
+
+        remove(*entry.second);
+        totalSize -= entry.second->size;
+    }
+}
+
+}
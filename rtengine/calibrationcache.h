@@ -0,0 +1,87 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glibmm/ustring.h>
+
+#include "noncopyable.h"
+#include "pixelsmap.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+class RawImage;
+
+/**
+ * @brief On-disk cache of a dark frame or flat field library
+ *
+ * Keeps the shot information of each file of the library, so that the files do not have to be
+ * probed again at each start, and the stacked templates (with their hot pixels for dark frames),
+ * so that the frames of a template are loaded and stacked only once. Files are identified by
+ * their name, size and modification time, so changed files are picked up again.
+ * Entries of removed or changed files are dropped, and the least recently used templates are
+ * removed when they take more than a fixed amount of disk space.
+ */
+class CalibrationCache final :
+    public NonCopyable
+{
+public:
+    // name is the folder of the cache inside the cache base dir, e.g. "darkframes"
+    explicit CalibrationCache(const Glib::ustring& name);
+
+    // name, size and modification time of filename, empty if the file can not be queried
+    static std::string getFileStamp(const Glib::ustring& filename);
+
+    // shot information of the library file, as stored by setShotInfo
+    bool getShotInfo(const std::string& stamp, std::vector<std::string>& fields) const;
+    void setShotInfo(const std::string& stamp, const std::vector<std::string>& fields);
+    // writes the shot information to disk if it has changed
+    void saveShotInfo();
+    // locale independent conversion of the numbers of the shot information
+    static std::string toField(double value);
+    static double fromField(const std::string& field);
+
+    /**
+    * @brief Load the template of a stack of frames
+    * @param pathNames the frames, the first one is used for all information other than the pixels
+    * @param hotPixels if not null, receives the cached hot pixels of the template (if any)
+    * @param hotPixelsCached set to true if the hot pixels have been read from the cache
+    * @return the template, or nullptr if the first frame can not be loaded
+    */
+    RawImage* loadTemplate(const std::list<Glib::ustring>& pathNames, std::vector<badPix>* hotPixels, bool& hotPixelsCached) const;
+    void saveHotPixels(const std::list<Glib::ustring>& pathNames, const std::vector<badPix>& hotPixels) const;
+
+private:
+    std::string getTemplateKey(const std::list<Glib::ustring>& pathNames) const;
+    Glib::ustring getTemplateFileName(const std::string& key, const char* extension) const;
+    // removes the templates of frames which are gone, then the least recently used ones beyond the size limit
+    void pruneTemplates() const;
+
+    Glib::ustring dir;
+    mutable MyMutex pruneMutex;
+    std::map<std::string, std::vector<std::string>> shotInfo;
+    bool shotInfoChanged;
+};
+
+}
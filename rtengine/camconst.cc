@@ -761,6 +761,12 @@ CameraConstantsStore::~CameraConstantsStore()
 }
 
 void CameraConstantsStore::init(const Glib::ustring& baseDir, const Glib::ustring& userSettingsDir)
+{
+    this->baseDir = baseDir;
+    this->userSettingsDir = userSettingsDir;
+}
+
+void CameraConstantsStore::load()
 {
     parse_camera_constants_file(Glib::build_filename(baseDir, "camconst.json"));
 
@@ -779,6 +785,10 @@ CameraConstantsStore* CameraConstantsStore::getInstance()
 
 const CameraConst* CameraConstantsStore::get(const char make[], const char model[]) const
 {
+    std::call_once(loaded, [this]() {
+        const_cast<CameraConstantsStore*>(this)->load();
+    });
+
     std::string key(make);
     key += " ";
     key += model;
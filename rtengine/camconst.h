@@ -4,6 +4,7 @@
 #pragma once
 
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -66,9 +67,14 @@ class CameraConstantsStore final
 {
 private:
     std::map<std::string, CameraConst *> mCameraConstants;
+    // the files are only parsed by the first get(), most runs need one camera at most
+    std::string baseDir;
+    std::string userSettingsDir;
+    mutable std::once_flag loaded;
 
     CameraConstantsStore();
     bool parse_camera_constants_file(const Glib::ustring& filename);
+    void load();
 
 public:
     ~CameraConstantsStore();
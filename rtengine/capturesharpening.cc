@@ -16,10 +16,13 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <vector>
 
 #include "rtengine.h"
+#include "capturesharpening.h"
 #include "rawimage.h"
 #include "rawimagesource.h"
 #include "rt_math.h"
@@ -757,29 +760,61 @@ bool checkForStop(float** tmpIThr, float** iterCheck, int fullTileSize, int bord
     return false;
 }
 
-void CaptureDeconvSharpening (float** luminance, const float* const * oldLuminance, const float * const * blend, int W, int H, float sigma, float sigmaCornerOffset, int iterations, bool checkIterStop, rtengine::ProgressListener* plistener, double startVal, double endVal)
+bool isConverged(float** tmpThr, int fullTileSize, int radius)
+{
+    // tmpThr holds the correction ratios of the current iteration. The kernels are normalized,
+    // so the estimate changes at most by the maximum deviation of the ratios from 1.
+    // The whole tile has to be checked, because the changes of the border propagate to the inner pixels
+    constexpr float convergenceLimit = 0.00001f;
+    for (int ii = radius; ii < fullTileSize - radius; ++ii) {
+        float maxDeviation = 0.f;
+        for (int jj = radius; jj < fullTileSize - radius; ++jj) {
+            maxDeviation = std::max(maxDeviation, std::fabs(tmpThr[ii][jj] - 1.f));
+        }
+        if (maxDeviation > convergenceLimit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void gaussDiv(float** src, float** dst, float** divBuffer, int tileSize, const float (&kernel)[3][3]) { gauss3x3div(src, dst, divBuffer, tileSize, kernel); }
+void gaussDiv(float** src, float** dst, float** divBuffer, int tileSize, const float (&kernel)[5][5]) { gauss5x5div(src, dst, divBuffer, tileSize, kernel); }
+void gaussDiv(float** src, float** dst, float** divBuffer, int tileSize, const float (&kernel)[7][7]) { gauss7x7div(src, dst, divBuffer, tileSize, kernel); }
+void gaussDiv(float** src, float** dst, float** divBuffer, int tileSize, const float (&kernel)[9][9]) { gauss9x9div(src, dst, divBuffer, tileSize, kernel); }
+void gaussDiv(float** src, float** dst, float** divBuffer, int tileSize, const float (&kernel)[13][13]) { gauss13x13div(src, dst, divBuffer, tileSize, kernel); }
+
+void gaussMult(float** src, float** dst, int tileSize, const float (&kernel)[3][3]) { gauss3x3mult(src, dst, tileSize, kernel); }
+void gaussMult(float** src, float** dst, int tileSize, const float (&kernel)[5][5]) { gauss5x5mult(src, dst, tileSize, kernel); }
+void gaussMult(float** src, float** dst, int tileSize, const float (&kernel)[7][7]) { gauss7x7mult(src, dst, tileSize, kernel); }
+void gaussMult(float** src, float** dst, int tileSize, const float (&kernel)[9][9]) { gauss9x9mult(src, dst, tileSize, kernel); }
+void gaussMult(float** src, float** dst, int tileSize, const float (&kernel)[13][13]) { gauss13x13mult(src, dst, tileSize, kernel); }
+
+// runs the iterations [iteration, iterations) on a tile, returns true if the tile stopped before the last iteration
+template<int kernelSize>
+bool deconvolveTile(float** tmpIThr, float** tmpThr, float** lumThr, float** iterCheck, int fullTileSize, int border, const float (&kernel)[kernelSize][kernelSize], int& iteration, int iterations, bool checkIterStop)
+{
+    for (; iteration < iterations; ++iteration) {
+        if (checkIterStop && iteration > 0 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
+            return true;
+        }
+        // apply gaussian blur and divide luminance by result of gaussian blur
+        gaussDiv(tmpIThr, tmpThr, lumThr, fullTileSize, kernel);
+        if (isConverged(tmpThr, fullTileSize, kernelSize / 2)) {
+            return true;
+        }
+        gaussMult(tmpThr, tmpIThr, fullTileSize, kernel);
+    }
+    return false;
+}
+
+void CaptureDeconvSharpening (float** luminance, const float* const * oldLuminance, const float * const * blend, int W, int H, float sigma, float sigmaCornerOffset, int iterations, bool checkIterStop, float contrast, rtengine::CaptureSharpeningCache* cache, rtengine::ProgressListener* plistener, double startVal, double endVal)
 {
 BENCHFUN
     const bool is9x9 = (sigma <= 1.5f && sigmaCornerOffset == 0.f);
     const bool is7x7 = (sigma <= 1.15f && sigmaCornerOffset == 0.f);
     const bool is5x5 = (sigma <= 0.84f && sigmaCornerOffset == 0.f);
     const bool is3x3 = (sigma < 0.6f && sigmaCornerOffset == 0.f);
-    float kernel13[13][13];
-    float kernel9[9][9];
-    float kernel7[7][7];
-    float kernel5[5][5];
-    float kernel3[3][3];
-    if (is3x3) {
-        compute3x3kernel(sigma, kernel3);
-    } else if (is5x5) {
-        compute5x5kernel(sigma, kernel5);
-    } else if (is7x7) {
-        compute7x7kernel(sigma, kernel7);
-    } else if (is9x9) {
-        compute9x9kernel(sigma, kernel9);
-    } else {
-        compute13x13kernel(sigma, kernel13);
-    }
 
     constexpr int tileSize = 32;
     const int border = (is3x3 || is5x5 || is7x7) ? iterations <= 30 ? 5 : 7 : 8;
@@ -788,6 +823,10 @@ BENCHFUN
     const float cornerDistance = sqrt(rtengine::SQR(W * 0.5f) + rtengine::SQR(H * 0.5f));
     const float distanceFactor = (cornerRadius - sigma) / cornerDistance;
 
+    const int tilesPerRow = std::max((W - 2 * border + tileSize - 1) / tileSize, 0);
+    const int tilesPerCol = std::max((H - 2 * border + tileSize - 1) / tileSize, 0);
+    std::vector<rtengine::CaptureSharpeningCache::Tile>* const cachedTiles = cache ? &cache->getTiles(tilesPerRow * tilesPerCol, border, checkIterStop, contrast) : nullptr;
+
     double progress = startVal;
     const double progressStep = (endVal - startVal) * rtengine::SQR(tileSize) / (W * H);
 
@@ -808,173 +847,116 @@ BENCHFUN
 #endif
         for (int i = border; i < H - border; i+= tileSize) {
             for(int j = border; j < W - border; j+= tileSize) {
-                const bool endOfCol = (i + tileSize + border) >= H;
-                const bool endOfRow = (j + tileSize + border) >= W;
+                // special handling for small tiles at end of row or column: they are shifted to fit into the image
+                const int tileRow = (i + tileSize + border) >= H ? H - fullTileSize : i - border;
+                const int tileCol = (j + tileSize + border) >= W ? W - fullTileSize : j - border;
                 // fill tiles
-                if (endOfRow || endOfCol) {
-                    // special handling for small tiles at end of row or column
-                    float maxVal = 0.f;
-                    if (checkIterStop) {
-                        for (int k = 0, ii = endOfCol ? H - fullTileSize + border : i; k < tileSize; ++k, ++ii) {
-                            for (int l = 0, jj = endOfRow ? W - fullTileSize + border : j; l < tileSize; ++l, ++jj) {
-                                iterCheck[k][l] = oldLuminance[ii][jj] * blend[ii][jj] * 0.5f;
-                                maxVal = std::max(maxVal, blend[ii][jj]);
-                            }
-                        }
-                    } else {
-                        for (int k = 0, ii = endOfCol ? H - fullTileSize + border : i; k < tileSize; ++k, ++ii) {
-                            for (int l = 0, jj = endOfRow ? W - fullTileSize + border : j; l < tileSize; ++l, ++jj) {
-                                maxVal = std::max(maxVal, blend[ii][jj]);
-                            }
-                        }
-                    }
-                    if (maxVal < minBlend) {
-                        // no pixel of the tile has a blend factor >= minBlend => skip the tile
-                        continue;
-                    }
-                    for (int k = 0, ii = endOfCol ? H - fullTileSize : i - border; k < fullTileSize; ++k, ++ii) {
-                        for (int l = 0, jj = endOfRow ? W - fullTileSize : j - border; l < fullTileSize; ++l, ++jj) {
-                            tmpIThr[k][l] = oldLuminance[ii][jj];
-                            lumThr[k][l] = oldLuminance[ii][jj];
+                float maxVal = 0.f;
+                if (checkIterStop) {
+                    for (int k = 0, ii = tileRow + border; k < tileSize; ++k, ++ii) {
+                        for (int l = 0, jj = tileCol + border; l < tileSize; ++l, ++jj) {
+                            iterCheck[k][l] = oldLuminance[ii][jj] * blend[ii][jj] * 0.5f;
+                            maxVal = std::max(maxVal, blend[ii][jj]);
                         }
                     }
                 } else {
-                    float maxVal = 0.f;
-                    if (checkIterStop) {
-                        for (int ii = 0; ii < tileSize; ++ii) {
-                            for (int jj = 0; jj < tileSize; ++jj) {
-                                iterCheck[ii][jj] = oldLuminance[i + ii][j + jj] * blend[i + ii][j + jj] * 0.5f;
-                                maxVal = std::max(maxVal, blend[i + ii][j + jj]);
-                            }
-                        }
-                    } else {
-                        for (int ii = 0; ii < tileSize; ++ii) {
-                            for (int jj = 0; jj < tileSize; ++jj) {
-                                maxVal = std::max(maxVal, blend[i + ii][j + jj]);
-                            }
+                    for (int ii = tileRow + border; ii < tileRow + border + tileSize; ++ii) {
+                        for (int jj = tileCol + border; jj < tileCol + border + tileSize; ++jj) {
+                            maxVal = std::max(maxVal, blend[ii][jj]);
                         }
                     }
-                    if (maxVal < minBlend) {
-                        // no pixel of the tile has a blend factor >= minBlend => skip the tile
-                        continue;
-                    }
-                    for (int ii = i; ii < i + fullTileSize; ++ii) {
-                        for (int jj = j; jj < j + fullTileSize; ++jj) {
-                            tmpIThr[ii - i][jj - j] = oldLuminance[ii - border][jj - border];
-                            lumThr[ii - i][jj - j] = oldLuminance[ii - border][jj - border];
-                        }
+                }
+                if (maxVal < minBlend) {
+                    // no pixel of the tile has a blend factor >= minBlend => skip the tile
+                    continue;
+                }
+                for (int k = 0; k < fullTileSize; ++k) {
+                    for (int l = 0; l < fullTileSize; ++l) {
+                        tmpIThr[k][l] = oldLuminance[tileRow + k][tileCol + l];
+                        lumThr[k][l] = oldLuminance[tileRow + k][tileCol + l];
                     }
                 }
+
+                int kernelSize;
+                float sigmaTile = sigma;
                 if (is3x3) {
-                    for (int k = 0; k < iterations; ++k) {
-                        // apply 3x3 gaussian blur and divide luminance by result of gaussian blur
-                        gauss3x3div(tmpIThr, tmpThr, lumThr, fullTileSize, kernel3);
-                        gauss3x3mult(tmpThr, tmpIThr, fullTileSize, kernel3);
-                        if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                            break;
-                        }
-                    }
+                    kernelSize = 3;
                 } else if (is5x5) {
-                    for (int k = 0; k < iterations; ++k) {
-                        // apply 5x5 gaussian blur and divide luminance by result of gaussian blur
-                        gauss5x5div(tmpIThr, tmpThr, lumThr, fullTileSize, kernel5);
-                        gauss5x5mult(tmpThr, tmpIThr, fullTileSize, kernel5);
-                        if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                            break;
-                        }
-                    }
+                    kernelSize = 5;
                 } else if (is7x7) {
-                    for (int k = 0; k < iterations; ++k) {
-                        // apply 5x5 gaussian blur and divide luminance by result of gaussian blur
-                        gauss7x7div(tmpIThr, tmpThr, lumThr, fullTileSize, kernel7);
-                        gauss7x7mult(tmpThr, tmpIThr, fullTileSize, kernel7);
-                        if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                            break;
-                        }
-                    }
+                    kernelSize = 7;
                 } else if (is9x9) {
-                    for (int k = 0; k < iterations; ++k) {
-                        // apply 5x5 gaussian blur and divide luminance by result of gaussian blur
-                        gauss9x9div(tmpIThr, tmpThr, lumThr, fullTileSize, kernel9);
-                        gauss9x9mult(tmpThr, tmpIThr, fullTileSize, kernel9);
-                        if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                            break;
+                    kernelSize = 9;
+                } else if (sigmaCornerOffset != 0.f) {
+                    const float distance = sqrt(rtengine::SQR(i + tileSize / 2 - H / 2) + rtengine::SQR(j + tileSize / 2 - W / 2));
+                    sigmaTile = static_cast<float>(sigma) + distanceFactor * distance;
+                    kernelSize = sigmaTile < 0.4f ? 0 : sigmaTile > 1.5f ? 13 : sigmaTile > 1.15f ? 9 : sigmaTile > 0.84f ? 7 : 5;
+                    // the kernel size changes from tile to tile => reset the ratios outside of the area of the current kernel
+                    tmpThr.fill(1.f);
+                } else {
+                    kernelSize = 13;
+                }
+
+                if (kernelSize) {
+                    int iteration = 0;
+                    bool finished = false;
+                    rtengine::CaptureSharpeningCache::Tile* const cachedTile = cachedTiles ? &(*cachedTiles)[(i - border) / tileSize * tilesPerRow + (j - border) / tileSize] : nullptr;
+                    if (cachedTile && cachedTile->kernelSize == kernelSize && cachedTile->sigma == sigmaTile && cachedTile->iterations <= iterations) {
+                        // continue from the state of the last run
+                        for (int k = 0; k < fullTileSize; ++k) {
+                            std::copy_n(cachedTile->state.data() + k * fullTileSize, fullTileSize, tmpIThr[k]);
                         }
+                        iteration = cachedTile->iterations;
+                        finished = cachedTile->finished;
                     }
-                } else {
-                    if (sigmaCornerOffset != 0.f) {
-                        const float distance = sqrt(rtengine::SQR(i + tileSize / 2 - H / 2) + rtengine::SQR(j + tileSize / 2 - W / 2));
-                        const float sigmaTile = static_cast<float>(sigma) + distanceFactor * distance;
-                        if (sigmaTile >= 0.4f) {
-                            if (sigmaTile > 1.5f) { // have to use 13x13 kernel
-                                float lkernel13[13][13];
-                                compute13x13kernel(static_cast<float>(sigma) + distanceFactor * distance, lkernel13);
-                                for (int k = 0; k < iterations; ++k) {
-                                    // apply 13x13 gaussian blur and divide luminance by result of gaussian blur
-                                    gauss13x13div(tmpIThr, tmpThr, lumThr, fullTileSize, lkernel13);
-                                    gauss13x13mult(tmpThr, tmpIThr, fullTileSize, lkernel13);
-                                    if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                                        break;
-                                    }
-                                }
-                            } else if (sigmaTile > 1.15f) { // have to use 9x9 kernel
-                                float lkernel9[9][9];
-                                compute9x9kernel(static_cast<float>(sigma) + distanceFactor * distance, lkernel9);
-                                for (int k = 0; k < iterations; ++k) {
-                                    // apply 9x9 gaussian blur and divide luminance by result of gaussian blur
-                                    gauss9x9div(tmpIThr, tmpThr, lumThr, fullTileSize, lkernel9);
-                                    gauss9x9mult(tmpThr, tmpIThr, fullTileSize, lkernel9);
-                                    if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                                        break;
-                                    }
-                                }
-                            } else if (sigmaTile > 0.84f) { // have to use 7x7 kernel
-                                float lkernel7[7][7];
-                                compute7x7kernel(static_cast<float>(sigma) + distanceFactor * distance, lkernel7);
-                                for (int k = 0; k < iterations; ++k) {
-                                    // apply 7x7 gaussian blur and divide luminance by result of gaussian blur
-                                    gauss7x7div(tmpIThr, tmpThr, lumThr, fullTileSize, lkernel7);
-                                    gauss7x7mult(tmpThr, tmpIThr, fullTileSize, lkernel7);
-                                    if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                                        break;
-                                    }
-                                }
-                            } else { // can use 5x5 kernel
-                                float lkernel5[5][5];
-                                compute5x5kernel(static_cast<float>(sigma) + distanceFactor * distance, lkernel5);
-                                for (int k = 0; k < iterations; ++k) {
-                                    // apply 7x7 gaussian blur and divide luminance by result of gaussian blur
-                                    gauss5x5div(tmpIThr, tmpThr, lumThr, fullTileSize, lkernel5);
-                                    gauss5x5mult(tmpThr, tmpIThr, fullTileSize, lkernel5);
-                                    if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
-                                        break;
-                                    }
-                                }
+                    if (!finished && iteration < iterations) {
+                        switch (kernelSize) {
+                            case 3: {
+                                float kernel[3][3];
+                                compute3x3kernel(sigmaTile, kernel);
+                                finished = deconvolveTile(tmpIThr, tmpThr, lumThr, iterCheck, fullTileSize, border, kernel, iteration, iterations, checkIterStop);
+                                break;
                             }
-                        }
-                    } else {
-                        for (int k = 0; k < iterations; ++k) {
-                            // apply 13x13 gaussian blur and divide luminance by result of gaussian blur
-                            gauss13x13div(tmpIThr, tmpThr, lumThr, fullTileSize, kernel13);
-                            gauss13x13mult(tmpThr, tmpIThr, fullTileSize, kernel13);
-                            if (checkIterStop && k < iterations - 1 && checkForStop(tmpIThr, iterCheck, fullTileSize, border)) {
+                            case 5: {
+                                float kernel[5][5];
+                                compute5x5kernel(sigmaTile, kernel);
+                                finished = deconvolveTile(tmpIThr, tmpThr, lumThr, iterCheck, fullTileSize, border, kernel, iteration, iterations, checkIterStop);
+                                break;
+                            }
+                            case 7: {
+                                float kernel[7][7];
+                                compute7x7kernel(sigmaTile, kernel);
+                                finished = deconvolveTile(tmpIThr, tmpThr, lumThr, iterCheck, fullTileSize, border, kernel, iteration, iterations, checkIterStop);
                                 break;
                             }
+                            case 9: {
+                                float kernel[9][9];
+                                compute9x9kernel(sigmaTile, kernel);
+                                finished = deconvolveTile(tmpIThr, tmpThr, lumThr, iterCheck, fullTileSize, border, kernel, iteration, iterations, checkIterStop);
+                                break;
+                            }
+                            default: {
+                                float kernel[13][13];
+                                compute13x13kernel(sigmaTile, kernel);
+                                finished = deconvolveTile(tmpIThr, tmpThr, lumThr, iterCheck, fullTileSize, border, kernel, iteration, iterations, checkIterStop);
+                            }
                         }
-                    }
-                }
-                if (endOfRow || endOfCol) {
-                    // special handling for small tiles at end of row or column
-                    for (int k = border, ii = endOfCol ? H - fullTileSize : i - border; k < fullTileSize - border; ++k) {
-                        for (int l = border, jj = endOfRow ? W - fullTileSize : j - border; l < fullTileSize - border; ++l) {
-                            luminance[ii + k][jj + l] = rtengine::intp(blend[ii + k][jj + l], tmpIThr[k][l], luminance[ii + k][jj + l]);
+                        if (cachedTile) {
+                            cachedTile->kernelSize = kernelSize;
+                            cachedTile->sigma = sigmaTile;
+                            cachedTile->iterations = iteration;
+                            cachedTile->finished = finished;
+                            cachedTile->state.resize(rtengine::SQR(fullTileSize));
+                            for (int k = 0; k < fullTileSize; ++k) {
+                                std::copy_n(tmpIThr[k], fullTileSize, cachedTile->state.data() + k * fullTileSize);
+                            }
                         }
                     }
-                } else {
-                    for (int ii = border; ii < fullTileSize - border; ++ii) {
-                        for (int jj = border; jj < fullTileSize - border; ++jj) {
-                            luminance[i + ii - border][j + jj - border] = rtengine::intp(blend[i + ii - border][j + jj - border], tmpIThr[ii][jj], luminance[i + ii - border][j + jj - border]);
-                        }
+                }
+
+                for (int k = border; k < fullTileSize - border; ++k) {
+                    for (int l = border; l < fullTileSize - border; ++l) {
+                        luminance[tileRow + k][tileCol + l] = rtengine::intp(blend[tileRow + k][tileCol + l], tmpIThr[k][l], luminance[tileRow + k][tileCol + l]);
                     }
                 }
                 if (plistener) {
@@ -1147,7 +1129,8 @@ BENCHFUN
         plistener->setProgress(0.2);
     }
     conrastThreshold = contrast * 100.f;
-    CaptureDeconvSharpening(YNew, YOld, clipMask, W, H, radius, sharpeningParams.deconvradiusOffset, sharpeningParams.deconviter, sharpeningParams.deconvitercheck, plistener, 0.2, 0.9);
+    // with cached demosaic output the deconvolution of the last run can be continued
+    CaptureDeconvSharpening(YNew, YOld, clipMask, W, H, radius, sharpeningParams.deconvradiusOffset, sharpeningParams.deconviter, sharpeningParams.deconvitercheck, contrast, redCache ? &captureSharpeningCache : nullptr, plistener, 0.2, 0.9);
     if (plistener) {
         plistener->setProgress(0.9);
     }
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace rtengine
+{
+
+/**
+ * @brief Deconvolution state of the tiles of the last capture sharpening run
+ *
+ * Keeps the Richardson-Lucy estimate of each tile, so that a change of the iterations, the corner radius offset
+ * or the contrast threshold continues from the last state of the tiles instead of starting again at iteration 0.
+ * Has to be cleared when the demosaiced image changes.
+ */
+class CaptureSharpeningCache
+{
+public:
+    struct Tile {
+        int kernelSize = 0;     // 0 => no state
+        float sigma = 0.f;
+        int iterations = 0;     // done iterations
+        bool finished = false;  // stopped before the requested iterations, more iterations would not change the state
+        std::vector<float> state;
+    };
+
+    CaptureSharpeningCache() :
+        border(0),
+        checkIterStop(false),
+        contrast(0.f)
+    {
+    }
+
+    void clear()
+    {
+        std::vector<Tile>().swap(tiles);
+    }
+
+    // returns the tiles of the last run, or empty tiles if the last run used another tiling or stop criterion
+    std::vector<Tile>& getTiles(std::size_t count, int border, bool checkIterStop, float contrast)
+    {
+        // the stop criterion of checkIterStop depends on the blend mask and thus on the contrast threshold
+        if (tiles.size() != count || border != this->border || checkIterStop != this->checkIterStop || (checkIterStop && contrast != this->contrast)) {
+            clear();
+            tiles.resize(count);
+            this->border = border;
+            this->checkIterStop = checkIterStop;
+            this->contrast = contrast;
+        }
+
+        return tiles;
+    }
+
+private:
+    int border;
+    bool checkIterStop;
+    float contrast;
+    std::vector<Tile> tiles;
+};
+
+}
@@ -1,16 +1,21 @@
 #include <algorithm>
+#include <locale>
+#include <sstream>
+#include <string>
 
 #include <glibmm/fileutils.h>
 #include <glibmm/miscutils.h>
 
 #include "clutstore.h"
 
+#include "color.h"
 #include "colortemp.h"
 #include "iccstore.h"
 #include "imagefloat.h"
 #include "opthelper.h"
 #include "procparams.h"
 #include "rt_math.h"
+#include "settings.h"
 #include "stdimagesource.h"
 
 #include "../rtgui/options.h"
@@ -18,12 +23,25 @@
 namespace
 {
 
-bool loadFile(
-    const Glib::ustring& filename,
-    const Glib::ustring& working_color_space,
-    AlignedBuffer<std::uint16_t>& clut_image,
-    unsigned int& clut_level
-)
+// Largest number of nodes per axis kept in memory (the size of a level 12 Hald CLUT). Larger tables are resampled.
+constexpr unsigned int max_clut_size = 144;
+
+// CLUT as loaded from the file, values in the [0 ; 65535] range of the sRGB gamma encoded CLUT's profile
+struct SourceClut {
+    explicit SourceClut(rtengine::LUT3D& lut) :
+        lut(lut),
+        domain_min{0.f, 0.f, 0.f},
+        domain_max{1.f, 1.f, 1.f}
+    {
+    }
+
+    rtengine::LUT3D& lut;
+    // input range of each channel, in the [0 ; 1] range
+    float domain_min[3];
+    float domain_max[3];
+};
+
+bool loadHaldFile(const Glib::ustring& filename, SourceClut& source)
 {
     rtengine::StdImageSource img_src;
 
@@ -34,91 +52,170 @@ bool loadFile(
     int fw, fh;
     img_src.getFullSize(fw, fh, TR_NONE);
 
-    bool res = false;
+    if (fw != fh) {
+        return false;
+    }
+
+    int level = 1;
 
-    if (fw == fh) {
-        int level = 1;
+    while (level * level * level < fw) {
+        ++level;
+    }
 
-        while (level * level * level < fw) {
-            ++level;
-        }
+    if (level * level * level != fw || level < 2) {
+        return false;
+    }
+
+    const unsigned int size = level * level;
 
-        if (level * level * level == fw && level > 1) {
-            clut_level = level;
-            res = true;
+    if (!source.lut.init(size)) {
+        return false;
+    }
+
+    rtengine::ColorTemp curr_wb = img_src.getWB();
+    std::unique_ptr<rtengine::Imagefloat> img_float = std::unique_ptr<rtengine::Imagefloat>(new rtengine::Imagefloat(fw, fh));
+    const PreviewProps pp(0, 0, fw, fh, 1);
+
+    img_src.getImage(curr_wb, TR_NONE, img_float.get(), pp, rtengine::procparams::ToneCurveParams(), rtengine::procparams::RAWParams());
+
+    // Hald layout: red varies fastest, then green, then blue
+    std::size_t index = 0;
+
+    for (int y = 0; y < fh; ++y) {
+        for (int x = 0; x < fw; ++x, ++index) {
+            float* const node = source.lut.node(index % size, (index / size) % size, index / (size * size));
+            node[0] = img_float->r(y, x);
+            node[1] = img_float->g(y, x);
+            node[2] = img_float->b(y, x);
+            node[3] = 0.f;
         }
     }
 
-    if (res) {
-        rtengine::ColorTemp curr_wb = img_src.getWB();
-        std::unique_ptr<rtengine::Imagefloat> img_float = std::unique_ptr<rtengine::Imagefloat>(new rtengine::Imagefloat(fw, fh));
-        const PreviewProps pp(0, 0, fw, fh, 1);
+    return true;
+}
+
+bool loadCubeFile(const Glib::ustring& filename, SourceClut& source)
+{
+    std::string contents;
+
+    try {
+        contents = Glib::file_get_contents(filename);
+    } catch (Glib::Exception&) {
+        return false;
+    }
+
+    std::istringstream stream(contents);
+    stream.imbue(std::locale::classic());
 
-        rtengine::procparams::ColorManagementParams icm;
-        icm.workingProfile = working_color_space;
+    unsigned int size = 0;
+    std::size_t index = 0;
+    std::string line;
 
-        img_src.getImage(curr_wb, TR_NONE, img_float.get(), pp, rtengine::procparams::ToneCurveParams(), rtengine::procparams::RAWParams());
+    while (std::getline(stream, line)) {
+        const std::string::size_type first = line.find_first_not_of(" \t\r");
 
-        if (!working_color_space.empty()) {
-            img_src.convertColorSpace(img_float.get(), icm, curr_wb);
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
         }
 
-        AlignedBuffer<std::uint16_t> image(fw * fh * 4 + 4); // getClutValues() loads one pixel in advance
+        std::istringstream line_stream(line.substr(first));
+        line_stream.imbue(std::locale::classic());
 
-        std::size_t index = 0;
+        if (line[first] == '-' || line[first] == '.' || (line[first] >= '0' && line[first] <= '9')) {
+            // data line, red varies fastest
+            float values[3];
 
-        for (int y = 0; y < fh; ++y) {
-            for (int x = 0; x < fw; ++x) {
-                image.data[index] = img_float->r(y, x);
-                ++index;
-                image.data[index] = img_float->g(y, x);
-                ++index;
-                image.data[index] = img_float->b(y, x);
-                index += 2;
+            if (!size || index >= static_cast<std::size_t>(size) * size * size || !(line_stream >> values[0] >> values[1] >> values[2])) {
+                return false;
             }
+
+            float* const node = source.lut.node(index % size, (index / size) % size, index / (size * size));
+
+            for (int c = 0; c < 3; ++c) {
+                node[c] = values[c] * 65535.f;
+            }
+
+            node[3] = 0.f;
+            ++index;
+            continue;
+        }
+
+        std::string keyword;
+        line_stream >> keyword;
+
+        if (keyword == "LUT_3D_SIZE") {
+            int new_size = 0;
+
+            if (size || !(line_stream >> new_size) || new_size < 2 || new_size > 256 || !source.lut.init(new_size)) {
+                return false;
+            }
+
+            size = new_size;
+        } else if (keyword == "DOMAIN_MIN") {
+            if (!(line_stream >> source.domain_min[0] >> source.domain_min[1] >> source.domain_min[2])) {
+                return false;
+            }
+        } else if (keyword == "DOMAIN_MAX") {
+            if (!(line_stream >> source.domain_max[0] >> source.domain_max[1] >> source.domain_max[2])) {
+                return false;
+            }
+        } else if (keyword == "LUT_3D_INPUT_RANGE") {
+            float range_min, range_max;
+
+            if (!(line_stream >> range_min >> range_max)) {
+                return false;
+            }
+
+            std::fill_n(source.domain_min, 3, range_min);
+            std::fill_n(source.domain_max, 3, range_max);
+        } else if (keyword != "TITLE") {
+            // LUT_1D_SIZE and unknown keywords: 1D LUTs and shaper LUTs are not supported
+            return false;
         }
+    }
 
-        clut_image.swap(image);
+    for (int c = 0; c < 3; ++c) {
+        if (!(source.domain_max[c] > source.domain_min[c])) {
+            return false;
+        }
     }
 
-    return res;
+    return size && index == static_cast<std::size_t>(size) * size * size;
 }
 
-#ifdef __SSE2__
-vfloat2 getClutValues(const AlignedBuffer<std::uint16_t>& clut_image, size_t index)
+bool resampleClut(rtengine::LUT3D& lut, unsigned int new_size)
 {
-    const vint v_values = _mm_loadu_si128(reinterpret_cast<const vint*>(clut_image.data + index));
-#ifdef __SSE4_1__
-    return {
-        _mm_cvtepi32_ps(_mm_cvtepu16_epi32(v_values)),
-        _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(v_values, 8)))
-    };
-#else
-    const vint v_mask = _mm_set1_epi32(0x0000FFFF);
-
-    vint v_low = _mm_shuffle_epi32(v_values, _MM_SHUFFLE(1, 0, 1, 0));
-    vint v_high = _mm_shuffle_epi32(v_values, _MM_SHUFFLE(3, 2, 3, 2));
-    v_low = _mm_shufflelo_epi16(v_low, _MM_SHUFFLE(1, 1, 0, 0));
-    v_high = _mm_shufflelo_epi16(v_high, _MM_SHUFFLE(1, 1, 0, 0));
-    v_low = _mm_shufflehi_epi16(v_low, _MM_SHUFFLE(3, 3, 2, 2));
-    v_high = _mm_shufflehi_epi16(v_high, _MM_SHUFFLE(3, 3, 2, 2));
-    v_low = vandm(v_low, v_mask);
-    v_high = vandm(v_high, v_mask);
-
-    return {
-        _mm_cvtepi32_ps(v_low),
-        _mm_cvtepi32_ps(v_high)
-    };
+    rtengine::LUT3D resampled;
+
+    if (!resampled.init(new_size)) {
+        return false;
+    }
+
+    const float step = static_cast<float>(lut.getSize() - 1) / (new_size - 1);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
 #endif
+    for (unsigned int r = 0; r < new_size; ++r) {
+        for (unsigned int g = 0; g < new_size; ++g) {
+            for (unsigned int b = 0; b < new_size; ++b) {
+                lut.getValues(r * step, g * step, b * step, resampled.node(r, g, b));
+            }
+        }
+    }
+
+    lut.swap(resampled);
+    return true;
 }
-#endif
 
 }
 
 rtengine::HaldCLUT::HaldCLUT() :
-    clut_level(0),
-    flevel_minus_one(0.0f),
-    flevel_minus_two(0.0f),
+    coord_scale{},
+    coord_offset{},
+    same_profiles(true),
+    work2clut{},
+    clut2work{},
     clut_profile("sRGB")
 {
 }
@@ -127,25 +224,68 @@ rtengine::HaldCLUT::~HaldCLUT()
 {
 }
 
-bool rtengine::HaldCLUT::load(const Glib::ustring& filename)
+bool rtengine::HaldCLUT::load(const Glib::ustring& filename, const Glib::ustring& working_profile)
 {
-    if (loadFile(filename, "", clut_image, clut_level)) {
-        Glib::ustring name, ext;
-        splitClutFilename(filename, name, ext, clut_profile);
-
-        clut_filename = filename;
-        clut_level *= clut_level;
-        flevel_minus_one = static_cast<float>(clut_level - 1) / 65535.0f;
-        flevel_minus_two = static_cast<float>(clut_level - 2);
-        return true;
+    Glib::ustring name, ext, profile;
+    splitClutFilename(filename, name, ext, profile);
+
+    SourceClut source(clut);
+
+    if (!(ext.casefold() == "cube" ? loadCubeFile(filename, source) : loadHaldFile(filename, source))) {
+        if (settings->verbose) {
+            printf("HaldCLUT: could not load \"%s\"\n", filename.c_str());
+        }
+
+        clut.init(0);
+        return false;
+    }
+
+    if (clut.getSize() > max_clut_size) {
+        if (settings->verbose) {
+            printf("HaldCLUT: resampling \"%s\" from %u to %u nodes per axis\n", filename.c_str(), clut.getSize(), max_clut_size);
+        }
+
+        if (!resampleClut(clut, max_clut_size)) {
+            clut.init(0);
+            return false;
+        }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        coord_scale[c] = (clut.getSize() - 1) / (65535.f * (source.domain_max[c] - source.domain_min[c]));
+        coord_offset[c] = -source.domain_min[c] * 65535.f * coord_scale[c];
     }
 
-    return false;
+    // Combined working -> CLUT profile and CLUT profile -> working matrices
+    same_profiles = profile == working_profile;
+
+    if (!same_profiles) {
+        const TMatrix wprof = ICCStore::getInstance()->workingSpaceMatrix(working_profile);
+        const TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix(working_profile);
+        const TMatrix cprof = ICCStore::getInstance()->workingSpaceMatrix(profile);
+        const TMatrix ciprof = ICCStore::getInstance()->workingSpaceInverseMatrix(profile);
+
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                work2clut[i][j] = 0.f;
+                clut2work[i][j] = 0.f;
+
+                for (int k = 0; k < 3; ++k) {
+                    work2clut[i][j] += ciprof[i][k] * wprof[k][j];
+                    clut2work[i][j] += wiprof[i][k] * cprof[k][j];
+                }
+            }
+        }
+    }
+
+    clut_filename = filename;
+    clut_profile = profile;
+    return true;
 }
 
 rtengine::HaldCLUT::operator bool() const
 {
-    return !clut_image.isEmpty();
+    return static_cast<bool>(clut);
 }
 
 Glib::ustring rtengine::HaldCLUT::getFilename() const
@@ -167,106 +307,113 @@ void rtengine::HaldCLUT::getRGB(
     float* out_rgbx
 ) const
 {
-    const unsigned int level = clut_level; // This is important
-
-    const unsigned int level_square = level * level;
+    const bool blend = strength < 1.f;
+    std::size_t column = 0;
 
 #ifdef __SSE2__
     const vfloat v_strength = F2V(strength);
-#endif
-
-    for (std::size_t column = 0; column < line_size; ++column, ++r, ++g, ++b, out_rgbx += 4) {
-        const unsigned int red = std::min(flevel_minus_two, *r * flevel_minus_one);
-        const unsigned int green = std::min(flevel_minus_two, *g * flevel_minus_one);
-        const unsigned int blue = std::min(flevel_minus_two, *b * flevel_minus_one);
-
-        const unsigned int color = red + green * level + blue * level_square;
+    vfloat v_work2clut[3][3];
+    vfloat v_clut2work[3][3];
 
-#ifndef __SSE2__
-        const float re = *r * flevel_minus_one - red;
-        const float gr = *g * flevel_minus_one - green;
-        const float bl = *b * flevel_minus_one - blue;
-
-        size_t index = color * 4;
-
-        float tmp1[4] ALIGNED16;
-        tmp1[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp1[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp1[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
-
-        index = (color + level) * 4;
-
-        float tmp2[4] ALIGNED16;
-        tmp2[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp2[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp2[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
-
-        out_rgbx[0] = intp<float>(gr, tmp2[0], tmp1[0]);
-        out_rgbx[1] = intp<float>(gr, tmp2[1], tmp1[1]);
-        out_rgbx[2] = intp<float>(gr, tmp2[2], tmp1[2]);
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            v_work2clut[i][j] = F2V(work2clut[i][j]);
+            v_clut2work[i][j] = F2V(clut2work[i][j]);
+        }
+    }
 
-        index = (color + level_square) * 4;
+    const vfloat v_coord_scale[3] = {F2V(coord_scale[0]), F2V(coord_scale[1]), F2V(coord_scale[2])};
+    const vfloat v_coord_offset[3] = {F2V(coord_offset[0]), F2V(coord_offset[1]), F2V(coord_offset[2])};
 
-        tmp1[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp1[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp1[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+    // 4 pixels at a time: the conversions, gamma and blend work on planar vectors, only the CLUT lookups are per pixel
+    for (; column + 3 < line_size; column += 4, r += 4, g += 4, b += 4, out_rgbx += 16) {
+        vfloat in[3] = {LVFU(*r), LVFU(*g), LVFU(*b)};
 
-        index = (color + level + level_square) * 4;
+        if (!same_profiles) {
+            const vfloat tmp[3] = {in[0], in[1], in[2]};
 
-        tmp2[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp2[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp2[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+            for (int i = 0; i < 3; ++i) {
+                in[i] = v_work2clut[i][0] * tmp[0] + v_work2clut[i][1] * tmp[1] + v_work2clut[i][2] * tmp[2];
+            }
+        }
 
-        tmp1[0] = intp<float>(gr, tmp2[0], tmp1[0]);
-        tmp1[1] = intp<float>(gr, tmp2[1], tmp1[1]);
-        tmp1[2] = intp<float>(gr, tmp2[2], tmp1[2]);
+        float coords[3][4] ALIGNED16;
 
-        out_rgbx[0] = intp<float>(bl, tmp1[0], out_rgbx[0]);
-        out_rgbx[1] = intp<float>(bl, tmp1[1], out_rgbx[1]);
-        out_rgbx[2] = intp<float>(bl, tmp1[2], out_rgbx[2]);
+        for (int c = 0; c < 3; ++c) {
+            in[c] = Color::gamma2curve[in[c]];
+            STVF(coords[c][0], in[c] * v_coord_scale[c] + v_coord_offset[c]);
+        }
 
-        out_rgbx[0] = intp<float>(strength, out_rgbx[0], *r);
-        out_rgbx[1] = intp<float>(strength, out_rgbx[1], *g);
-        out_rgbx[2] = intp<float>(strength, out_rgbx[2], *b);
-#else
-        const vfloat v_in = _mm_set_ps(0.0f, *b, *g, *r);
-        const vfloat v_tmp = v_in * F2V(flevel_minus_one);
-        const vfloat v_rgb = v_tmp - _mm_cvtepi32_ps(_mm_cvttps_epi32(vminf(v_tmp, F2V(flevel_minus_two))));
+        for (int i = 0; i < 4; ++i) {
+            clut.getValues(coords[0][i], coords[1][i], coords[2][i], out_rgbx + 4 * i);
+        }
 
-        size_t index = color * 4;
+        vfloat out[4] = {LVF(out_rgbx[0]), LVF(out_rgbx[4]), LVF(out_rgbx[8]), LVF(out_rgbx[12])};
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
 
-        const vfloat v_r = PERMUTEPS(v_rgb, _MM_SHUFFLE(0, 0, 0, 0));
+        for (int c = 0; c < 3; ++c) {
+            if (blend) {
+                out[c] = vintpf(v_strength, out[c], in[c]);
+            }
 
-        vfloat2 v_clut_values = getClutValues(clut_image, index);
-        vfloat v_tmp1 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
+            out[c] = Color::igammatab_srgb(out[c]);
+        }
 
-        index = (color + level) * 4;
+        if (!same_profiles) {
+            const vfloat tmp[3] = {out[0], out[1], out[2]};
 
-        v_clut_values = getClutValues(clut_image, index);
-        vfloat v_tmp2 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
+            for (int i = 0; i < 3; ++i) {
+                out[i] = v_clut2work[i][0] * tmp[0] + v_clut2work[i][1] * tmp[1] + v_clut2work[i][2] * tmp[2];
+            }
+        }
 
-        const vfloat v_g = PERMUTEPS(v_rgb, _MM_SHUFFLE(1, 1, 1, 1));
+        out[3] = ZEROV;
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
 
-        vfloat v_out = vintpf(v_g, v_tmp2, v_tmp1);
+        for (int i = 0; i < 4; ++i) {
+            STVF(out_rgbx[4 * i], out[i]);
+        }
+    }
+#endif
 
-        index = (color + level_square) * 4;
+    for (; column < line_size; ++column, ++r, ++g, ++b, out_rgbx += 4) {
+        float in[3] = {*r, *g, *b};
 
-        v_clut_values = getClutValues(clut_image, index);
-        v_tmp1 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
+        if (!same_profiles) {
+            const float tmp[3] = {in[0], in[1], in[2]};
 
-        index = (color + level + level_square) * 4;
+            for (int i = 0; i < 3; ++i) {
+                in[i] = work2clut[i][0] * tmp[0] + work2clut[i][1] * tmp[1] + work2clut[i][2] * tmp[2];
+            }
+        }
 
-        v_clut_values = getClutValues(clut_image, index);
-        v_tmp2 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
+        // the CLUT is addressed by sRGB gamma encoded values of its profile, and returns values in the same encoding
+        for (int c = 0; c < 3; ++c) {
+            in[c] = Color::gamma_srgbclipped(in[c]);
+        }
 
-        v_tmp1 = vintpf(v_g, v_tmp2, v_tmp1);
+        clut.getValues(
+            in[0] * coord_scale[0] + coord_offset[0],
+            in[1] * coord_scale[1] + coord_offset[1],
+            in[2] * coord_scale[2] + coord_offset[2],
+            out_rgbx
+        );
 
-        const vfloat v_b = PERMUTEPS(v_rgb, _MM_SHUFFLE(2, 2, 2, 2));
+        float out[3];
 
-        v_out = vintpf(v_b, v_tmp1, v_out);
+        for (int c = 0; c < 3; ++c) {
+            out[c] = Color::igamma_srgb(blend ? intp(strength, out_rgbx[c], in[c]) : out_rgbx[c]);
+        }
 
-        STVF(*out_rgbx, vintpf(v_strength, v_out, v_in));
-#endif
+        if (!same_profiles) {
+            for (int i = 0; i < 3; ++i) {
+                out_rgbx[i] = clut2work[i][0] * out[0] + clut2work[i][1] * out[1] + clut2work[i][2] * out[2];
+            }
+        } else {
+            out_rgbx[0] = out[0];
+            out_rgbx[1] = out[1];
+            out_rgbx[2] = out[2];
+        }
     }
 }
 
@@ -313,7 +460,7 @@ rtengine::CLUTStore& rtengine::CLUTStore::getInstance()
     return instance;
 }
 
-std::shared_ptr<rtengine::HaldCLUT> rtengine::CLUTStore::getClut(const Glib::ustring& filename) const
+std::shared_ptr<rtengine::HaldCLUT> rtengine::CLUTStore::getClut(const Glib::ustring& filename, const Glib::ustring& working_profile) const
 {
     std::shared_ptr<rtengine::HaldCLUT> result;
 
@@ -322,12 +469,15 @@ std::shared_ptr<rtengine::HaldCLUT> rtengine::CLUTStore::getClut(const Glib::ust
             ? Glib::ustring(Glib::build_filename(options.clutsDir, filename))
             : filename;
 
-    if (!cache.get(full_filename, result)) {
+    // The conversions from and to the working space are set up at load time, so there is one entry per working space
+    const Glib::ustring key = full_filename + '\n' + working_profile;
+
+    if (!cache.get(key, result)) {
         std::unique_ptr<rtengine::HaldCLUT> clut(new rtengine::HaldCLUT);
 
-        if (clut->load(full_filename)) {
+        if (clut->load(full_filename, working_profile)) {
             result = std::move(clut);
-            cache.insert(full_filename, result);
+            cache.insert(key, result);
         }
     }
 
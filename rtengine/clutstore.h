@@ -4,12 +4,22 @@
 #include <cstdint>
 
 #include "cache.h"
-#include "alignedbuffer.h"
+#include "lut3d.h"
 #include "noncopyable.h"
 
 namespace rtengine
 {
 
+/**
+ * @brief 3D colour lookup table used by the film simulation
+ *
+ * Loaded from a Hald CLUT image (PNG, TIFF) or from a .cube file, and applied at
+ * its native size up to 144 nodes per axis. Larger tables are resampled to that
+ * size to bound the memory of a cache entry. Its input and output are sRGB gamma
+ * encoded values of the CLUT's profile, which is also where the strength is
+ * blended. The conversions from and to the working space are combined into one
+ * matrix each at load time.
+ */
 class HaldCLUT final :
     public NonCopyable
 {
@@ -17,13 +27,18 @@ public:
     HaldCLUT();
     ~HaldCLUT();
 
-    bool load(const Glib::ustring& filename);
+    bool load(const Glib::ustring& filename, const Glib::ustring& working_profile);
 
     explicit operator bool() const;
 
     Glib::ustring getFilename() const;
     Glib::ustring getProfile() const;
 
+    /**
+    * @brief Apply the CLUT to a line of pixels
+    * @param r,g,b linear working space values [0 ; 65535]
+    * @param out_rgbx receives the linear working space result, 4 floats per pixel (16 byte aligned)
+    */
     void getRGB(
         float strength,
         std::size_t line_size,
@@ -42,10 +57,13 @@ public:
     );
 
 private:
-    AlignedBuffer<std::uint16_t> clut_image;
-    unsigned int clut_level;
-    float flevel_minus_one;
-    float flevel_minus_two;
+    LUT3D clut;
+    // maps the [0 ; 65535] range of each channel to the CLUT's domain, in node units
+    float coord_scale[3];
+    float coord_offset[3];
+    bool same_profiles;
+    float work2clut[3][3];
+    float clut2work[3][3];
     Glib::ustring clut_filename;
     Glib::ustring clut_profile;
 };
@@ -56,7 +74,7 @@ class CLUTStore final :
 public:
     static CLUTStore& getInstance();
 
-    std::shared_ptr<HaldCLUT> getClut(const Glib::ustring& filename) const;
+    std::shared_ptr<HaldCLUT> getClut(const Glib::ustring& filename, const Glib::ustring& working_profile) const;
 
     void clearCache();
 
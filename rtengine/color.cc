@@ -16,14 +16,23 @@
 *  You should have received a copy of the GNU General Public License
 *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <cstdio>
+
+#include <glib/gstdio.h>
+#include <glibmm/miscutils.h>
 #include <glibmm/ustring.h>
 
 #include "rtengine.h"
 #include "color.h"
+#include "gamutboundary.h"
 #include "iccmatrices.h"
 #include "sleef.h"
 #include "opthelper.h"
 #include "iccstore.h"
+#include "settings.h"
+#include "../rtgui/options.h"
+#include "../rtgui/version.h"
 
 using namespace std;
 
@@ -134,6 +143,25 @@ void Color::init ()
     gammatab_145_3(maxindex, 0);
     igammatab_145_3(maxindex, 0);
 
+    const Glib::ustring snapshotFile = settings->colorTablesSnapshot ? Glib::build_filename(options.cacheBaseDir, "colortables") : Glib::ustring();
+
+    if (snapshotFile.empty() || !readTables(snapshotFile)) {
+        computeTables();
+
+        if (!snapshotFile.empty()) {
+            writeTables(snapshotFile);
+        }
+    }
+
+    gamma2curve.share(gammatab_srgb, LUT_CLIP_BELOW | LUT_CLIP_ABOVE); // shares the buffer with gammatab_srgb but has different clip flags
+    initMunsell();
+    linearGammaTRC = cmsBuildGamma(nullptr, 1.0);
+}
+
+void Color::computeTables ()
+{
+    constexpr auto maxindex = 65536;
+
 #ifdef _OPENMP
     #pragma omp parallel sections
 #endif
@@ -181,7 +209,6 @@ void Color::init ()
                 gammatab_srgb[i] = gammatab_srgb1[i] = gamma2(i / 65535.0);
             }
             gammatab_srgb *= 65535.f;
-            gamma2curve.share(gammatab_srgb, LUT_CLIP_BELOW | LUT_CLIP_ABOVE); // shares the buffer with gammatab_srgb but has different clip flags
         }
 #ifdef _OPENMP
         #pragma omp section
@@ -362,17 +389,87 @@ void Color::init ()
         for (int i = 0; i < maxindex; i++) {
             igammatab_24_17[i] = 65535.0 * igamma24_17 (i / 65535.0);
         }
+    }
+}
 
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        initMunsell();
+std::vector<std::pair<void*, std::size_t>> Color::getTables ()
+{
+    std::vector<std::pair<void*, std::size_t>> tables;
 
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        linearGammaTRC = cmsBuildGamma(nullptr, 1.0);
+    for (LUTf* lut : {
+        &cachef, &cachefy, &gammatab, &gammatab_srgb, &gammatab_srgb1, &gammatab_srgb327, &igammatab_srgb, &igammatab_srgb1,
+        &denoiseGammaTab, &denoiseIGammaTab, &gammatab_bt709, &igammatab_bt709, &gammatab_13_2, &igammatab_13_2,
+        &gammatab_115_2, &igammatab_115_2, &gammatab_145_3, &igammatab_145_3, &gammatab_24_17a, &igammatab_24_17
+    }) {
+        tables.emplace_back(&(*lut)[0], lut->getSize() * sizeof(float));
+    }
+
+    tables.emplace_back(&gammatabThumb[0], gammatabThumb.getSize() * sizeof(unsigned char));
+    return tables;
+}
+
+bool Color::readTables (const Glib::ustring &fileName)
+{
+    FILE* const file = g_fopen(fileName.c_str(), "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    const std::string header = getTablesHeader();
+    std::vector<char> fileHeader(header.size());
+    bool ok = fread(fileHeader.data(), 1, fileHeader.size(), file) == fileHeader.size() && std::equal(fileHeader.begin(), fileHeader.end(), header.begin());
+
+    for (const auto& table : getTables()) {
+        ok = ok && fread(table.first, 1, table.second, file) == table.second;
     }
+
+    ok = ok && fgetc(file) == EOF;
+    fclose(file);
+
+    if (settings->verbose) {
+        printf("Color tables %s %s\n", ok ? "read from" : "could not be read from", fileName.c_str());
+    }
+
+    return ok;
+}
+
+void Color::writeTables (const Glib::ustring &fileName)
+{
+    // written to a temporary file first, so that concurrent starts never read a partial snapshot
+    g_mkdir_with_parents(Glib::path_get_dirname(fileName).c_str(), 0777);
+    const Glib::ustring tempName = fileName + ".tmp";
+    FILE* const file = g_fopen(tempName.c_str(), "wb");
+
+    if (!file) {
+        return;
+    }
+
+    const std::string header = getTablesHeader();
+    fwrite(header.data(), 1, header.size(), file);
+
+    for (const auto& table : getTables()) {
+        fwrite(table.first, 1, table.second, file);
+    }
+
+    const bool ok = !ferror(file);
+
+    if (fclose(file) || !ok) {
+        g_remove(tempName.c_str());
+        return;
+    }
+
+    g_remove(fileName.c_str());
+    g_rename(tempName.c_str(), fileName.c_str());
+}
+
+std::string Color::getTablesHeader ()
+{
+    // the tables depend on the version (the gamma functions) and on the denoise gamma setting
+    std::string header("RTCOLORTABLES1 " RTVERSION " ");
+    header += std::to_string(settings->denoiselabgamma);
+    header += '\n';
+    return header;
 }
 
 void Color::cleanup ()
@@ -2163,6 +2260,105 @@ void Color::AllMunsellLch(float Lprov1, float HH, float Chprov1, float CC, float
     }
 }
 
+namespace
+{
+
+enum class GamutSide {
+    BELOW,  // a channel is negative
+    ABOVE   // a channel is above the clip level, but not all
+};
+
+// Lab -> XYZ conversion of gamutLchonly, for the given chroma at the hue sincosval, with XYZ scaled to scale.
+// Its rounding can differ slightly from the overloads' own conversions, which is covered by the margin of the tests.
+void chromaToXyz(float L, float chroma, float2 sincosval, float scale, float xyz[3])
+{
+    const float aprov1 = chroma * sincosval.y;
+    const float bprov1 = chroma * sincosval.x;
+    const float fy = Color::c1By116 * L + Color::c16By116;
+    const float fx = 0.002f * aprov1 + fy;
+    const float fz = fy - 0.005f * bprov1;
+    xyz[0] = scale * Color::f2xyz(fx) * Color::D50x;
+    xyz[1] = (L > Color::epskap) ? scale * fy * fy * fy : scale * L / Color::kappaf;
+    xyz[2] = scale * Color::f2xyz(fz) * Color::D50z;
+}
+
+/*
+ * Used by gamutLchonly to skip the tests of chroma reductions which are out of gamut anyway.
+ *
+ * chroma is the chroma of the next test of the loop, after an iteration which was out of gamut on the given side.
+ * The gamut boundary estimates how many reductions (chroma * coef^n) are still out of gamut. They are only skipped if
+ * they are proven to be out of gamut on the same side: x and z are monotone in the chroma, so the channels of all
+ * skipped chromas are bounded by the channels of the first and the last one. The luminance corrections of the skipped
+ * iterations are no-ops (the chroma stays above 3 and lower chromas do not lift L more), so the loop ends with the
+ * same result as without skipping.
+ * Returns the chroma after the skipped reductions, or chroma if nothing was skipped.
+ */
+template<typename Matrix>
+float skipChromaReductions(const GamutBoundary& boundary, float L, float HH, float2 sincosval, float chroma, float coef, bool isHLEnabled, GamutSide side, Matrix wip, float clipLevel)
+{
+    const float limit = rtengine::max(boundary.getMaxChroma(L, HH, isHLEnabled), 3.f);
+
+    if (chroma * coef <= limit) {
+        return chroma;
+    }
+
+    int steps = 2;
+
+    for (float next = chroma * coef * coef; next > limit; next *= coef) {
+        ++steps;
+    }
+
+    float xyzFirst[3];
+    chromaToXyz(L, chroma, sincosval, clipLevel, xyzFirst);
+
+    // the boundary is only an estimate, try again with less reductions if they can not be proven out of gamut
+    for (int attempt = 0; attempt < 3 && steps > 1; ++attempt, steps /= 2) {
+        // same sequence of multiplications as in the loop, to get the same values
+        float last = chroma;
+
+        for (int i = 1; i < steps; ++i) {
+            last *= coef;
+        }
+
+        float xyzLast[3];
+        chromaToXyz(L, last, sincosval, clipLevel, xyzLast);
+
+        bool below = false;
+        bool allAboveZero = true;
+        bool oneAboveClip = false;
+        bool oneBelowClip = false;
+
+        for (int c = 0; c < 3; ++c) {
+            float lo = 0.f;
+            float hi = 0.f;
+            float magnitude = 0.f;
+
+            for (int j = 0; j < 3; ++j) {
+                const float first = wip[c][j] * xyzFirst[j];
+                const float second = wip[c][j] * xyzLast[j];
+                lo += rtengine::min(first, second);
+                hi += rtengine::max(first, second);
+                magnitude += rtengine::max(std::fabs(first), std::fabs(second));
+            }
+
+            // margin for the rounding errors of the tests in the loop
+            const float eps = 1e-4f * magnitude;
+            below = below || hi < -eps;
+            allAboveZero = allAboveZero && lo > eps;
+            oneAboveClip = oneAboveClip || lo > clipLevel + eps;
+            oneBelowClip = oneBelowClip || hi < clipLevel - eps;
+        }
+
+        if (side == GamutSide::BELOW ? below : allAboveZero && oneAboveClip && oneBelowClip) {
+            return last * coef;
+        }
+    }
+
+    return chroma;
+}
+
+}
+
 /*
  * GamutLchonly correction
  * Copyright (c)2012  Jacques Desmis <jdesmis@gmail.com> and Jean-Christophe Frisch <natureh@free.fr>
@@ -2179,11 +2375,15 @@ void Color::AllMunsellLch(float Lprov1, float HH, float Chprov1, float CC, float
  * float coef : a float number between [0.95 ; 1.0[... the nearest it is from 1.0, the more precise it will be... and the longer too as more iteration will be necessary)
  * bool neg and moreRGB : only in DEBUG mode to calculate iterations for negatives values and > 65535
  */
-void Color::gamutLchonly (float HH, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef)
+void Color::gamutLchonly (float HH, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef, const GamutBoundary* boundary)
 {
     const float ClipLevel = 65535.0f;
     bool inGamut;
     float2  sincosval = xsincosf(HH);
+
+
+    bool trySkip = boundary != nullptr;
+
     do {
         inGamut = true;
 
@@ -2242,6 +2442,11 @@ void Color::gamutLchonly (float HH, float &Lprov1, float &Chprov1, float &R, flo
 
             Chprov1 *= higherCoef; // decrease the chromaticity value
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::BELOW, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.0f) {
                 Lprov1 += lowerCoef;
             }
@@ -2256,6 +2461,11 @@ void Color::gamutLchonly (float HH, float &Lprov1, float &Chprov1, float &R, flo
 
             Chprov1 *= higherCoef;
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::ABOVE, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.0f) {
                 Lprov1 -= lowerCoef;
             }
@@ -2284,12 +2494,15 @@ void Color::gamutLchonly (float HH, float &Lprov1, float &Chprov1, float &R, flo
  * float coef : a float number between [0.95 ; 1.0[... the nearest it is from 1.0, the more precise it will be... and the longer too as more iteration will be necessary)
  * bool neg and moreRGB : only in DEBUG mode to calculate iterations for negatives values and > 65535
  */
-void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef)
+void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef, const GamutBoundary* boundary)
 {
     constexpr float ClipLevel = 65535.0f;
     bool inGamut;
     float ChprovSave = Chprov1;
 
+
+    bool trySkip = boundary != nullptr;
+
     do {
         inGamut = true;
 
@@ -2351,8 +2564,12 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
                     }
             }
 
-                Chprov1 *= higherCoef; // decrease the chromaticity value
-           
+            Chprov1 *= higherCoef; // decrease the chromaticity value
+
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, isnan(HH) ? xatan2f(sincosval.x, sincosval.y) : HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::BELOW, wip, ClipLevel);
+                trySkip = false;
+            }
 
             if (Chprov1 <= 3.0f) {
                 Lprov1 += lowerCoef;
@@ -2368,6 +2585,11 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
 
             Chprov1 *= higherCoef;
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, isnan(HH) ? xatan2f(sincosval.x, sincosval.y) : HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::ABOVE, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.0f) {
                 Lprov1 -= lowerCoef;
             }
@@ -2394,12 +2616,15 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
  * bool isHLEnabled : if "highlight reconstruction " is enabled
  * float coef : a float number between [0.95 ; 1.0[... the nearest it is from 1.0, the more precise it will be... and the longer too as more iteration will be necessary)
  */
-void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &saturation, const float wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef)
+void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &saturation, const float wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef, const GamutBoundary* boundary)
 {
     constexpr float ClipLevel = 1.f;
     bool inGamut;
     float R, G, B;
 
+
+    bool trySkip = boundary != nullptr;
+
     do {
         inGamut = true;
 
@@ -2455,6 +2680,11 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
 
             Chprov1 *= higherCoef; // decrease the chromaticity value
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::BELOW, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.f) {
                 Lprov1 += lowerCoef;
             }
@@ -2470,6 +2700,11 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
 
             Chprov1 *= higherCoef;
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, HH, sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::ABOVE, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.f) {
                 Lprov1 -= lowerCoef;
             }
@@ -2483,11 +2718,14 @@ void Color::gamutLchonly (float HH, float2 sincosval, float &Lprov1, float &Chpr
 }
 
 
-void Color::gamutLchonly (float2 sincosval, float &Lprov1, float &Chprov1, const float wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef)
+void Color::gamutLchonly (float2 sincosval, float &Lprov1, float &Chprov1, const float wip[3][3], const bool isHLEnabled, const float lowerCoef, const float higherCoef, const GamutBoundary* boundary)
 {
     const float ClipLevel = 65535.0f;
     bool inGamut;
 
+
+    bool trySkip = boundary != nullptr;
+
     do {
         inGamut = true;
 
@@ -2516,6 +2754,11 @@ void Color::gamutLchonly (float2 sincosval, float &Lprov1, float &Chprov1, const
 
             Chprov1 *= higherCoef; // decrease the chromaticity value
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, xatan2f(sincosval.x, sincosval.y), sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::BELOW, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.0f) {
                 Lprov1 += lowerCoef;
             }
@@ -2530,6 +2773,11 @@ void Color::gamutLchonly (float2 sincosval, float &Lprov1, float &Chprov1, const
 
             Chprov1 *= higherCoef;
 
+            if (trySkip) {
+                Chprov1 = skipChromaReductions(*boundary, Lprov1, xatan2f(sincosval.x, sincosval.y), sincosval, Chprov1, higherCoef, isHLEnabled, GamutSide::ABOVE, wip, ClipLevel);
+                trySkip = false;
+            }
+
             if (Chprov1 <= 3.0f) {
                 Lprov1 -= lowerCoef;
             }
@@ -2561,7 +2809,7 @@ void Color::gamutLchonly (float2 sincosval, float &Lprov1, float &Chprov1, const
  *    const double wip[3][3]: matrix for working profile
  *    bool multiThread      : parallelize the loop
  */
-void Color::LabGamutMunsell(float *labL, float *laba, float *labb, const int N, bool corMunsell, bool lumaMuns, bool isHLEnabled, bool gamut, const double wip[3][3])
+void Color::LabGamutMunsell(float *labL, float *laba, float *labb, const int N, bool corMunsell, bool lumaMuns, bool isHLEnabled, bool gamut, const double wip[3][3], const GamutBoundary* boundary)
 {
 #ifdef __SSE2__
     // precalculate H and C using SSE
@@ -2611,7 +2859,7 @@ void Color::LabGamutMunsell(float *labL, float *laba, float *labb, const int N,
             }
 
             //gamut control : Lab values are in gamut
-            gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, isHLEnabled, 0.15f, 0.96f);
+            gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, isHLEnabled, 0.15f, 0.96f, boundary);
         }
 
         labL[j] = Lprov1 * 327.68f;
@@ -20,6 +20,10 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "rt_math.h"
 #include "LUT.h"
@@ -36,6 +40,8 @@ namespace rtengine
 
 typedef std::array<double, 7> GammaValues;
 
+class GamutBoundary;
+
 class Color
 {
 
@@ -77,6 +83,12 @@ private:
 
     // Separated from init() to keep the code clear
     static void initMunsell ();
+    // the tables filled by computeTables, possibly read from or written to a snapshot file by init
+    static void computeTables ();
+    static std::vector<std::pair<void*, std::size_t>> getTables ();
+    static std::string getTablesHeader ();
+    static bool readTables (const Glib::ustring &fileName);
+    static void writeTables (const Glib::ustring &fileName);
     static double hue2rgb(double p, double q, double t);
     static float hue2rgbfloat(float p, float q, float t);
 #ifdef __SSE2__
@@ -1444,11 +1456,13 @@ static inline void Lab2XYZ(vfloat L, vfloat a, vfloat b, vfloat &x, vfloat &y, v
     *                   The nearest it is from 1.0, the more precise it will be, and the longer too as more iteration will be necessary
     * @param neg (Debug target only) to calculate iterations for negatives values
     * @param moreRGB (Debug target only) to calculate iterations for values >65535
+    * @param boundary if not null, the precomputed gamut boundary of the working profile is used to skip the chroma
+    *                 reductions which are out of gamut anyway, without changing the result (see GamutBoundary)
     */
-    static void gamutLchonly  (float HH, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef);
-    static void gamutLchonly  (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef);
-    static void gamutLchonly  (float2 sincosval, float &Lprov1, float &Chprov1, const float wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef);
-    static void gamutLchonly  (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &saturation, const float wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef);
+    static void gamutLchonly  (float HH, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef, const GamutBoundary* boundary = nullptr);
+    static void gamutLchonly  (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &R, float &G, float &B, const double wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef, const GamutBoundary* boundary = nullptr);
+    static void gamutLchonly  (float2 sincosval, float &Lprov1, float &Chprov1, const float wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef, const GamutBoundary* boundary = nullptr);
+    static void gamutLchonly  (float HH, float2 sincosval, float &Lprov1, float &Chprov1, float &saturation, const float wip[3][3], bool isHLEnabled, float lowerCoef, float higherCoef, const GamutBoundary* boundary = nullptr);
 
 
     /**
@@ -1472,7 +1486,7 @@ static inline void Lab2XYZ(vfloat L, vfloat a, vfloat b, vfloat &x, vfloat &y, v
     * @param wip matrix for working profile
     * @param multiThread whether to parallelize the loop or not
     */
-    static void LabGamutMunsell (float *labL, float *laba, float *labb, int N, bool corMunsell, bool lumaMuns, bool isHLEnabled, bool gamut, const double wip[3][3]);
+    static void LabGamutMunsell (float *labL, float *laba, float *labb, int N, bool corMunsell, bool lumaMuns, bool isHLEnabled, bool gamut, const double wip[3][3], const GamutBoundary* boundary = nullptr);
 
 
     /*
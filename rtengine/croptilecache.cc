@@ -0,0 +1,235 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "croptilecache.h"
+
+#include "image8.h"
+
+namespace rtengine
+{
+
+struct CropTileCache::Tile {
+    int width;
+    int height;
+    std::vector<unsigned char> rgb;
+    std::vector<unsigned char> rgbTrue;
+};
+
+CropTileCache::CropTileCache() :
+    valid(false),
+    version(0),
+    fullWidth(0),
+    fullHeight(0),
+    tiles(1)
+{
+}
+
+bool CropTileCache::validate(unsigned int version, int fullWidth, int fullHeight)
+{
+    MyMutex::MyLock lock(mutex);
+
+    if (valid && version == this->version && fullWidth == this->fullWidth && fullHeight == this->fullHeight) {
+        return true;
+    }
+
+    tiles.clear();
+    valid = true;
+    this->version = version;
+    this->fullWidth = fullWidth;
+    this->fullHeight = fullHeight;
+    return false;
+}
+
+bool CropTileCache::isValid(unsigned int version) const
+{
+    MyMutex::MyLock lock(mutex);
+
+    return valid && version == this->version;
+}
+
+void CropTileCache::setArea(const void* crop, int width, int height)
+{
+    MyMutex::MyLock lock(mutex);
+
+    // the tiles of the visible area, plus the partially visible ones and the ring around it
+    const unsigned long count = static_cast<unsigned long>((width + tileSize - 1) / tileSize + 3) * ((height + tileSize - 1) / tileSize + 3);
+    unsigned long& area = areas[crop];
+
+    if (area != count) {
+        area = count;
+        resize();
+    }
+}
+
+void CropTileCache::removeArea(const void* crop)
+{
+    MyMutex::MyLock lock(mutex);
+
+    if (areas.erase(crop)) {
+        resize();
+    }
+}
+
+bool CropTileCache::getMissing(int x, int y, int w, int h, int& missingX, int& missingY, int& missingW, int& missingH) const
+{
+    MyMutex::MyLock lock(mutex);
+
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    w = std::min(x + w, fullWidth) - x;
+    h = std::min(y + h, fullHeight) - y;
+
+    if (w <= 0 || h <= 0) {
+        return false;
+    }
+
+    int minX = fullWidth, minY = fullHeight, maxX = -1, maxY = -1;
+    std::shared_ptr<const Tile> tile;
+
+    for (int tileY = y / tileSize; tileY <= (y + h - 1) / tileSize; ++tileY) {
+        for (int tileX = x / tileSize; tileX <= (x + w - 1) / tileSize; ++tileX) {
+            if (!tiles.get(getKey(tileX, tileY), tile)) {
+                minX = std::min(minX, tileX);
+                maxX = std::max(maxX, tileX);
+                minY = std::min(minY, tileY);
+                maxY = std::max(maxY, tileY);
+            }
+        }
+    }
+
+    if (maxX < 0) {
+        return false;
+    }
+
+    missingX = minX * tileSize;
+    missingY = minY * tileSize;
+    missingW = std::min((maxX + 1) * tileSize, fullWidth) - missingX;
+    missingH = std::min((maxY + 1) * tileSize, fullHeight) - missingY;
+    return true;
+}
+
+void CropTileCache::store(const Image8* img, const Image8* imgTrue, int imgX, int imgY, int x, int y, int w, int h)
+{
+    MyMutex::MyLock lock(mutex);
+
+    if (!valid || w <= 0 || h <= 0) {
+        return;
+    }
+
+    const int imgW = img->getWidth();
+
+    for (int tileY = y / tileSize; tileY <= (y + h - 1) / tileSize; ++tileY) {
+        const int tileY0 = tileY * tileSize;
+        const int tileH = std::min(tileSize, fullHeight - tileY0);
+
+        if (tileY0 < y || tileY0 + tileH > y + h) {
+            continue;
+        }
+
+        for (int tileX = x / tileSize; tileX <= (x + w - 1) / tileSize; ++tileX) {
+            const int tileX0 = tileX * tileSize;
+            const int tileW = std::min(tileSize, fullWidth - tileX0);
+
+            if (tileX0 < x || tileX0 + tileW > x + w) {
+                continue;
+            }
+
+            const std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+            tile->width = tileW;
+            tile->height = tileH;
+            tile->rgb.resize(3 * tileW * tileH);
+            tile->rgbTrue.resize(3 * tileW * tileH);
+
+            for (int row = 0; row < tileH; ++row) {
+                const std::size_t offset = 3 * (static_cast<std::size_t>(imgY + tileY0 - y + row) * imgW + imgX + tileX0 - x);
+                std::memcpy(tile->rgb.data() + 3 * row * tileW, img->data + offset, 3 * tileW);
+                std::memcpy(tile->rgbTrue.data() + 3 * row * tileW, imgTrue->data + offset, 3 * tileW);
+            }
+
+            tiles.set(getKey(tileX, tileY), tile);
+        }
+    }
+}
+
+bool CropTileCache::get(int x, int y, Image8* img, Image8* imgTrue) const
+{
+    MyMutex::MyLock lock(mutex);
+
+    const int w = img->getWidth();
+    const int h = img->getHeight();
+
+    if (!valid || x < 0 || y < 0 || x + w > fullWidth || y + h > fullHeight) {
+        return false;
+    }
+
+    std::shared_ptr<const Tile> tile;
+
+    for (int tileY = y / tileSize; tileY <= (y + h - 1) / tileSize; ++tileY) {
+        const int tileY0 = tileY * tileSize;
+        const int rowBegin = std::max(y, tileY0);
+        const int rowEnd = std::min(y + h, tileY0 + tileSize);
+
+        for (int tileX = x / tileSize; tileX <= (x + w - 1) / tileSize; ++tileX) {
+            if (!tiles.get(getKey(tileX, tileY), tile)) {
+                return false;
+            }
+
+            const int tileX0 = tileX * tileSize;
+            const int colBegin = std::max(x, tileX0);
+            const int count = std::min(x + w, tileX0 + tileSize) - colBegin;
+
+            for (int row = rowBegin; row < rowEnd; ++row) {
+                const std::size_t src = 3 * (static_cast<std::size_t>(row - tileY0) * tile->width + colBegin - tileX0);
+                const std::size_t dst = 3 * (static_cast<std::size_t>(row - y) * w + colBegin - x);
+                std::memcpy(img->data + dst, tile->rgb.data() + src, 3 * count);
+                std::memcpy(imgTrue->data + dst, tile->rgbTrue.data() + src, 3 * count);
+            }
+        }
+    }
+
+    return true;
+}
+
+void CropTileCache::clear()
+{
+    MyMutex::MyLock lock(mutex);
+
+    tiles.clear();
+    valid = false;
+}
+
+std::uint64_t CropTileCache::getKey(int tileX, int tileY) const
+{
+    return static_cast<std::uint64_t>(tileY) << 32 | static_cast<std::uint32_t>(tileX);
+}
+
+void CropTileCache::resize()
+{
+    unsigned long count = 0;
+
+    for (const auto& area : areas) {
+        count += area.second;
+    }
+
+    // twice the tiles, so that panning back and forth stays in the cache
+    tiles.resize(std::max(2 * count, 1UL));
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+
+#include "cache.h"
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+class Image8;
+
+/**
+ * @brief Rendered tiles of the 100% crops
+ *
+ * Keeps the displayed and the output space image of the crops in tiles of tileSize x tileSize image
+ * pixels, aligned to the top left corner of the image. The tiles are only valid for one version of the
+ * processing (see ImProcCoordinator::imageVersion), so that panning over already rendered areas does not
+ * run the pipeline again, and the crops of an ImProcCoordinator share them, so that overlapping crops
+ * compute each area once. Tiles rendered with different crop windows are only stitched together when no enabled
+ * tool depends on the window beyond its margins (wavelets, dehaze, tone mapping, local contrast,
+ * shadows/highlights, contrast by detail levels, noise reduction, retinex and local adjustments do), see
+ * Crop::updateFromTiles. So the tiles do not speed up the pipelines which use one of these tools.
+ * Thread safe: the crops are also created and destroyed by the GUI thread while another one updates them.
+ */
+class CropTileCache final :
+    public NonCopyable
+{
+public:
+    static constexpr int tileSize = 256;
+
+    CropTileCache();
+
+    /**
+    * @brief Drop the tiles of an older version
+    * @param version version of the processing the tiles have to belong to
+    * @param fullWidth,fullHeight size of the image
+    * @return false if the tiles have been dropped
+    */
+    bool validate(unsigned int version, int fullWidth, int fullHeight);
+    bool isValid(unsigned int version) const;
+
+    // sizes the cache for the visible areas of the crops, it keeps twice their tiles plus a one tile ring
+    void setArea(const void* crop, int width, int height);
+    void removeArea(const void* crop);
+
+    // bounding box of the missing tiles in [x, x + w) x [y, y + h), returns false if none is missing
+    bool getMissing(int x, int y, int w, int h, int& missingX, int& missingY, int& missingW, int& missingH) const;
+
+    /**
+    * @brief Store the tiles completely inside an area
+    * @param img,imgTrue displayed and output space image
+    * @param imgX,imgY position of the area in img and imgTrue
+    * @param x,y,w,h area in image coordinates
+    */
+    void store(const Image8* img, const Image8* imgTrue, int imgX, int imgY, int x, int y, int w, int h);
+
+    // copies the area at (x, y) of the size of img from the tiles, returns false if a tile is missing
+    bool get(int x, int y, Image8* img, Image8* imgTrue) const;
+
+    void clear();
+
+private:
+    struct Tile;
+
+    std::uint64_t getKey(int tileX, int tileY) const;
+    void resize();
+
+    mutable MyMutex mutex;
+    bool valid;
+    unsigned int version;
+    int fullWidth;
+    int fullHeight;
+    std::map<const void*, unsigned long> areas;
+    mutable Cache<std::uint64_t, std::shared_ptr<const Tile>> tiles;
+};
+
+}
@@ -20,6 +20,7 @@
 
 #include "cieimage.h"
 #include "color.h"
+#include "croptilecache.h"
 #include "curves.h"
 #include "dcp.h"
 #include "dcrop.h"
@@ -35,6 +36,7 @@
 #include "utils.h"
 
 #include "../rtgui/editcallbacks.h"
+#include "../rtgui/options.h"
 
 #pragma GCC diagnostic warning "-Wall"
 #pragma GCC diagnostic warning "-Wextra"
@@ -53,7 +55,7 @@ constexpr T skips(T a, T b)
 namespace rtengine
 {
 
-Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool isDetailWindow)
+Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool isDetailWindow, CropTileCache* tileTarget)
     : PipetteBuffer(editDataProvider), origCrop(nullptr), spotCrop(nullptr), laboCrop(nullptr), labnCrop(nullptr),
       cropImg(nullptr), shbuf_real(nullptr), transCrop(nullptr), cieCrop(nullptr), shbuffer(nullptr),
       updating(false), newUpdatePending(false), skip(10),
@@ -62,9 +64,15 @@ Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool i
       rqcropx(0), rqcropy(0), rqcropw(-1), rqcroph(-1),
       borderRequested(32), upperBorder(0), leftBorder(0),
       cropAllocated(false),
-      cropImageListener(nullptr), parent(parent), isDetailWindow(isDetailWindow)
+      cropImageListener(nullptr),
+      tileTarget(tileTarget), storeTiles(false),
+      tileWindowX(0), tileWindowY(0), tileWindowW(0), tileWindowH(0),
+      bufferVersion(0), buffersOutdated(false),
+      parent(parent), isDetailWindow(isDetailWindow)
 {
-    parent->crops.push_back(this);
+    if (!tileTarget) {
+        parent->crops.push_back(this);
+    }
 }
 
 Crop::~Crop()
@@ -78,6 +86,8 @@ Crop::~Crop()
         parent->crops.erase(i);
     }
 
+    parent->cropTiles->removeArea(this);
+
     MyMutex::MyLock processingLock(parent->mProcessing);
     freeAll();
 }
@@ -85,6 +95,7 @@ Crop::~Crop()
 void Crop::destroy()
 {
     MyMutex::MyLock lock(cropMutex);
+    parent->cropTiles->removeArea(this);
     MyMutex::MyLock processingLock(parent->mProcessing);
     freeAll();
 }
@@ -157,6 +168,10 @@ void Crop::update(int todo)
 
     if (overrideWindow) {
         cropImageListener->getWindow(wx, wy, ww, wh, ws);
+
+        if (updateFromTiles(wx, wy, ww, wh, ws)) {
+            return;
+        }
     }
 
     // re-allocate sub-images and arrays if their dimensions changed
@@ -169,10 +184,13 @@ void Crop::update(int todo)
     }
 
     // it something has been reallocated, all processing steps have to be performed
-    if (needsinitupdate || (todo & M_HIGHQUAL)) {
+    if (needsinitupdate || buffersOutdated || (todo & M_HIGHQUAL)) {
         todo = ALL;
     }
 
+    buffersOutdated = false;
+    bufferVersion = parent->imageVersion;
+
     // Tells to the ImProcFunctions' tool what is the preview scale, which may lead to some simplifications
     parent->ipf.setScale(skip);
 
@@ -663,7 +681,7 @@ void Crop::update(int todo)
                 float nresi, highresi;
                 parent->ipf.RGB_denoise(0, origCrop, origCrop, calclum, parent->denoiseInfoStore.ch_M, parent->denoiseInfoStore.max_r, parent->denoiseInfoStore.max_b, parent->imgsrc->isRAW(), /*Roffset,*/ denoiseParams, parent->imgsrc->getDirPyrDenoiseExpComp(), noiseLCurve, noiseCCurve, nresi, highresi);
 
-                if (parent->adnListener) {
+                if (parent->adnListener && !tileTarget) {
                     parent->adnListener->noiseChanged(nresi, highresi);
                 }
 
@@ -1253,10 +1271,17 @@ void Crop::update(int todo)
         DCPProfile *dcpProf = parent->imgsrc->getDCP(params.icm, as);
 
         LUTu histToneCurve;
-        parent->ipf.rgbProc (baseCrop, laboCrop, this, parent->hltonecurve, parent->shtonecurve, parent->tonecurve,
-                            params.toneCurve.saturation, parent->rCurve, parent->gCurve, parent->bCurve, parent->colourToningSatLimit, parent->colourToningSatLimitOpacity, parent->ctColorCurve, parent->ctOpacityCurve, parent->opautili, parent->clToningcurve, parent->cl2Toningcurve,
-                            parent->customToneCurve1, parent->customToneCurve2, parent->beforeToneCurveBW, parent->afterToneCurveBW, rrm, ggm, bbm,
-                            parent->bwAutoR, parent->bwAutoG, parent->bwAutoB, dcpProf, as, histToneCurve);
+        if (options.rgbProcFusedLutSize > 0) {
+            parent->ipf.rgbProcFused (options.rgbProcFusedLutSize, baseCrop, laboCrop, this, parent->hltonecurve, parent->shtonecurve, parent->tonecurve,
+                                params.toneCurve.saturation, parent->rCurve, parent->gCurve, parent->bCurve, parent->colourToningSatLimit, parent->colourToningSatLimitOpacity, parent->ctColorCurve, parent->ctOpacityCurve, parent->opautili, parent->clToningcurve, parent->cl2Toningcurve,
+                                parent->customToneCurve1, parent->customToneCurve2, parent->beforeToneCurveBW, parent->afterToneCurveBW, rrm, ggm, bbm,
+                                parent->bwAutoR, parent->bwAutoG, parent->bwAutoB, params.toneCurve.expcomp, params.toneCurve.hlcompr, params.toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+        } else {
+            parent->ipf.rgbProc (baseCrop, laboCrop, this, parent->hltonecurve, parent->shtonecurve, parent->tonecurve,
+                                params.toneCurve.saturation, parent->rCurve, parent->gCurve, parent->bCurve, parent->colourToningSatLimit, parent->colourToningSatLimitOpacity, parent->ctColorCurve, parent->ctOpacityCurve, parent->opautili, parent->clToningcurve, parent->cl2Toningcurve,
+                                parent->customToneCurve1, parent->customToneCurve2, parent->beforeToneCurveBW, parent->afterToneCurveBW, rrm, ggm, bbm,
+                                parent->bwAutoR, parent->bwAutoG, parent->bwAutoB, dcpProf, as, histToneCurve);
+        }
     }
 
     // apply luminance operations
@@ -1662,7 +1687,9 @@ void Crop::update(int todo)
     // Computing the preview image, i.e. converting from lab->Monitor color space (soft-proofing disabled) or lab->Output profile->Monitor color space (soft-proofing enabled)
     parent->ipf.lab2monitorRgb(labnCrop, cropImg);
 
-    if (cropImageListener) {
+    CropTileCache* const tileCache = tileTarget ? tileTarget : storeTiles ? parent->cropTiles.get() : nullptr;
+
+    if (cropImageListener || tileCache) {
         // Computing the internal image for analysis, i.e. conversion from lab->Output profile (rtSettings.HistogramWorking disabled) or lab->WCS (rtSettings.HistogramWorking enabled)
 
         // internal image in output color space for analysis
@@ -1680,21 +1707,194 @@ void Crop::update(int todo)
             finalH = cropImg->getHeight() - upperBorder;
         }
 
-        Image8* final = new Image8(finalW, finalH);
-        Image8* finaltrue = new Image8(finalW, finalH);
+        if (tileCache) {
+            // skip == 1, the crop coordinates are image coordinates
+            tileCache->store(cropImg, cropImgtrue, leftBorder, upperBorder, cropx + leftBorder, cropy + upperBorder, finalW, finalH);
+        }
+
+        if (cropImageListener) {
+            Image8* final = new Image8(finalW, finalH);
+            Image8* finaltrue = new Image8(finalW, finalH);
 
-        for (int i = 0; i < finalH; i++) {
-            memcpy(final->data + 3 * i * finalW, cropImg->data + 3 * (i + upperBorder)*cropw + 3 * leftBorder, 3 * finalW);
-            memcpy(finaltrue->data + 3 * i * finalW, cropImgtrue->data + 3 * (i + upperBorder)*cropw + 3 * leftBorder, 3 * finalW);
+            for (int i = 0; i < finalH; i++) {
+                memcpy(final->data + 3 * i * finalW, cropImg->data + 3 * (i + upperBorder)*cropw + 3 * leftBorder, 3 * finalW);
+                memcpy(finaltrue->data + 3 * i * finalW, cropImgtrue->data + 3 * (i + upperBorder)*cropw + 3 * leftBorder, 3 * finalW);
+            }
+
+            cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
+            delete final;
+            delete finaltrue;
         }
 
-        cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
-        delete final;
-        delete finaltrue;
         delete cropImgtrue;
     }
 }
 
+bool Crop::pipetteInUse() const
+{
+    const EditSubscriber *subscriber = PipetteBuffer::dataProvider ? PipetteBuffer::dataProvider->getCurrSubscriber() : nullptr;
+    return subscriber && subscriber->getEditingType() == ET_PIPETTE;
+}
+
+namespace
+{
+
+/** @brief Tell whether tiles rendered with different crop windows can be stitched together
+ *
+ * The tiles only match if no tool looks further than the margin of the crop window, or adapts itself to the
+ * size or content of the window: wavelets (number of levels), dehaze (dark channel and airlight of the window),
+ * Fattal and EPD tone mapping, local contrast, shadows/highlights and contrast by detail levels (large radii),
+ * noise reduction, retinex and local adjustments would leave seams between the tiles.
+ */
+bool tilesMatch(const ProcParams& params)
+{
+    return
+        !params.wavelet.enabled
+        && !params.dehaze.enabled
+        && !params.fattal.enabled
+        && !params.epd.enabled
+        && !params.localContrast.enabled
+        && !params.sh.enabled
+        && !params.dirpyrequalizer.enabled
+        && !params.dirpyrDenoise.enabled
+        && !params.retinex.enabled
+        && !(params.locallab.enabled && !params.locallab.spots.empty());
+}
+
+}
+
+/** @brief Deliver the 100% crop from the rendered tiles, if possible
+ *
+ * As long as the processing did not change (see ImProcCoordinator::imageVersion), the visible area is assembled
+ * from the tiles shared by the crops of the parent, and only the missing ones are rendered, by the tile renderer
+ * of the parent so that the buffers of this crop still match its visible area for the next partial update.
+ * Otherwise the visible area is processed as usual and update stores the complete tiles it has rendered.
+ * Not used for the other scales, while the pipette buffer is needed and when a tool depends on the crop window
+ * beyond its margins (see tilesMatch).
+ *
+ * @return true if the crop has been delivered to the listener, false if update has to process the visible area
+ */
+bool Crop::updateFromTiles(int cropX, int cropY, int cropW, int cropH, int skip)
+{
+    CropTileCache* const tiles = parent->cropTiles.get();
+    storeTiles = false;
+
+    if (skip != 1 || pipetteInUse() || !tilesMatch(*parent->params)) {
+        tiles->removeArea(this);
+        return false;
+    }
+
+    const int x = LIM(cropX, 0, parent->fullw - 1);
+    const int y = LIM(cropY, 0, parent->fullh - 1);
+    const int w = std::min(cropW, parent->fullw - x);
+    const int h = std::min(cropH, parent->fullh - y);
+
+    if (w <= 0 || h <= 0) {
+        return false;
+    }
+
+    storeTiles = true;
+    tileWindowX = x;
+    tileWindowY = y;
+    tileWindowW = w;
+    tileWindowH = h;
+    tiles->setArea(this, w, h);
+
+    if (!tiles->validate(parent->imageVersion, parent->fullw, parent->fullh)) {
+        // the processing changed and no other crop rendered tiles yet, the visible area is processed as usual
+        return false;
+    }
+
+    int missingX, missingY, missingW, missingH;
+
+    if (tiles->getMissing(x, y, w, h, missingX, missingY, missingW, missingH)) {
+        if (missingX <= x && missingY <= y && missingX + missingW >= x + w && missingY + missingH >= y + h) {
+            // nothing to reuse, processing the visible area is cheaper than its tiles
+            return false;
+        }
+
+        renderTiles(missingX, missingY, missingW, missingH);
+    }
+
+    Image8 final(w, h);
+    Image8 finaltrue(w, h);
+
+    if (!tiles->get(x, y, &final, &finaltrue)) {
+        return false;
+    }
+
+    if (bufferVersion != parent->imageVersion) {
+        // the buffers will be processed from scratch anyway, release them meanwhile
+        buffersOutdated = true;
+        freeAll();
+        cropw = croph = trafw = trafh = -1;
+    }
+
+    const ProcParams& params = *parent->params;
+    cropImageListener->setDetailedCrop(&final, &finaltrue, params.icm, params.crop, cropX, cropY, cropW, cropH, skip);
+    return true;
+}
+
+void Crop::renderTiles(int x, int y, int w, int h)
+{
+    if (!parent->tileRenderer) {
+        parent->tileRenderer = new Crop(parent, nullptr, true, parent->cropTiles.get());
+    }
+
+    parent->tileRenderer->setWindow(x, y, w, h, 1);
+    parent->tileRenderer->update(ALL);
+}
+
+/** @brief Render one strip of the missing tiles around the visible area
+ *
+ * Called by the updater thread between the updates, so that panning by less than a tile is served from the tiles.
+ *
+ * @return true if a strip has been rendered, false if there is nothing (more) to do
+ */
+bool Crop::prefetchTiles()
+{
+    MyMutex::MyLock cropLock(cropMutex);
+
+    CropTileCache* const tiles = parent->cropTiles.get();
+
+    if (!storeTiles || !cropImageListener || !tiles->isValid(parent->imageVersion)) {
+        return false;
+    }
+
+    {
+        // don't delay a pending processing
+        MyMutex::MyLock lock(parent->paramsUpdateMutex);
+
+        if (parent->changeSinceLast) {
+            return false;
+        }
+    }
+
+    constexpr int ring = CropTileCache::tileSize;
+    const int x = tileWindowX;
+    const int y = tileWindowY;
+    const int w = tileWindowW;
+    const int h = tileWindowH;
+    // top, bottom, left and right of the visible area
+    const int strips[4][4] = {
+        {x - ring, y - ring, w + 2 * ring, ring},
+        {x - ring, y + h, w + 2 * ring, ring},
+        {x - ring, y, ring, h},
+        {x + w, y, ring, h}
+    };
+
+    for (const auto& strip : strips) {
+        int missingX, missingY, missingW, missingH;
+
+        if (tiles->getMissing(strip[0], strip[1], strip[2], strip[3], missingX, missingY, missingW, missingH)) {
+            renderTiles(missingX, missingY, missingW, missingH);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void Crop::freeAll()
 {
 
@@ -1978,7 +2178,8 @@ bool Crop::tryUpdate()
 void Crop::fullUpdate()
 {
 
-    parent->updaterThreadStart.lock();
+    parent->lockUpdaterThreadStart();
+    parent->updaterThreadStartMissed = false;
 
     if (parent->updaterRunning && parent->thread) {
         // Do NOT reset changes here, since in a long chain of events it will lead to chroma_scale not being updated,
@@ -1997,6 +2198,11 @@ void Crop::fullUpdate()
     while (newUpdatePending) {
         newUpdatePending = false;
         update(ALL);
+
+        // until something else is requested, render the tiles around the visible area. updaterThreadStart is held
+        // meanwhile, so the prefetching stops as soon as another thread (e.g. the GUI starting the processing) wants it
+        while (!newUpdatePending && !parent->updaterThreadStartWaiters && !parent->updaterThreadStartMissed && prefetchTiles()) {
+        }
     }
 
     updating = false;  // end of crop update
@@ -2014,6 +2220,12 @@ int Crop::get_skip()
     return skip;
 }
 
+PreviewProps Crop::getSourceArea()
+{
+    MyMutex::MyLock lock(cropMutex);
+    return PreviewProps(trafx, trafy, trafw * skip, trafh * skip, skip);
+}
+
 int Crop::getLeftBorder()
 {
     MyMutex::MyLock lock(cropMutex);
@@ -27,6 +27,7 @@ namespace rtengine
 
 class Image8;
 class CieImage;
+class CropTileCache;
 
 using namespace procparams;
 
@@ -62,15 +63,30 @@ protected:
     bool cropAllocated;
     DetailedCropListener* cropImageListener;
 
+    // --- tiles of the 100% crops (ImProcCoordinator::cropTiles), so that panning and overlapping crops only process the missing areas
+    CropTileCache* const tileTarget;        /// if not null, this crop is the tile renderer of the parent storing its result there
+    bool storeTiles;                        /// update stores the tiles it has rendered in the parent's tiles
+    int tileWindowX, tileWindowY, tileWindowW, tileWindowH; /// visible area of the last update from the tiles
+    unsigned int bufferVersion;             /// ImProcCoordinator::imageVersion the buffers have been processed for
+    bool buffersOutdated;                   /// a version has been delivered from the tiles, the next update has to process everything
+
     MyMutex cropMutex;
     ImProcCoordinator* const parent;
     const bool isDetailWindow;
     EditUniqueID getCurrEditID() const;
     bool setCropSizes(int cropX, int cropY, int cropW, int cropH, int skip, bool internal);
     void freeAll();
+    bool pipetteInUse() const;
+    bool updateFromTiles(int cropX, int cropY, int cropW, int cropH, int skip);
+    void renderTiles(int x, int y, int w, int h);
+    bool prefetchTiles();
 
 public:
-    Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool isDetailWindow);
+    /**
+    * @param tileTarget if not null, the crop is not registered in the parent and is only used to render
+    *                   the tiles of another crop, see Crop::updateFromTiles
+    */
+    Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool isDetailWindow, CropTileCache* tileTarget = nullptr);
     ~Crop    () override;
 //   MyMutex* locMutex;
     void setEditSubscriber(EditSubscriber* newSubscriber);
@@ -91,6 +107,8 @@ public:
     void setListener    (DetailedCropListener* il) override;
     void destroy        () override;
     int get_skip();
+    /// area of the image source (in coarse transformed coordinates) the crop is currently computed from
+    PreviewProps getSourceArea();
     int getLeftBorder();
     int getUpperBorder();
 };
@@ -921,6 +921,59 @@ void RawImageSource::nodemosaic(bool bw)
     }
 }
 
+/*
+ * Superpixel demosaic for the preview at <100% zoom.
+ * Each Bayer 2x2 cell (resp. X-Trans 3x3 cell, i.e. a quarter of the 6x6 pattern, which holds all three colours
+ * wherever it starts) is reduced to one RGB value which is written to all its pixels. This is just a few
+ * additions per pixel, but sufficient as long as the preview is downscaled anyway.
+ */
+void RawImageSource::superpixel_demosaic()
+{
+    BENCHFUN
+
+    red(W, H);
+    green(W, H);
+    blue(W, H);
+
+    const bool isBayer = ri->getSensorType() == ST_BAYER;
+    const int cellSize = isBayer ? 2 : 3;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16)
+#endif
+
+    for (int row = 0; row < H; row += cellSize) {
+        const int rowEnd = std::min(row + cellSize, H);
+
+        for (int col = 0; col < W; col += cellSize) {
+            const int colEnd = std::min(col + cellSize, W);
+            float sum[3] = {};
+            int count[3] = {};
+
+            for (int i = row; i < rowEnd; ++i) {
+                for (int j = col; j < colEnd; ++j) {
+                    const unsigned int c = isBayer ? FC(i, j) : ri->XTRANSFC(i, j);
+                    sum[c] += rawData[i][j];
+                    ++count[c];
+                }
+            }
+
+            // cells cut by the image border may miss a colour, take the green value then
+            const float g = count[1] ? sum[1] / count[1] : 0.f;
+            const float r = count[0] ? sum[0] / count[0] : g;
+            const float b = count[2] ? sum[2] / count[2] : g;
+
+            for (int i = row; i < rowEnd; ++i) {
+                for (int j = col; j < colEnd; ++j) {
+                    red[i][j] = r;
+                    green[i][j] = g;
+                    blue[i][j] = b;
+                }
+            }
+        }
+    }
+}
+
 /*
  *      Redistribution and use in source and binary forms, with or without
  *      modification, are permitted provided that the following conditions are
@@ -1403,7 +1456,7 @@ void RawImageSource::dcb_color_full(float (*image)[3], int x0, int y0, float (*c
 }
 
 // DCB demosaicing main routine
-void RawImageSource::dcb_demosaic(int iterations, bool dcb_enhance)
+void RawImageSource::dcb_demosaic(int winx, int winy, int winw, int winh, int iterations, bool dcb_enhance)
 {
 BENCHFUN
     double currentProgress = 0.0;
@@ -1443,6 +1496,11 @@ BENCHFUN
         int x0 = xTile * TILESIZE;
         int y0 = yTile * TILESIZE;
 
+        if (x0 + TILESIZE <= winx || x0 >= winx + winw || y0 + TILESIZE <= winy || y0 >= winy + winh) {
+            // tile does not intersect the requested window
+            continue;
+        }
+
         memset(tile, 0, CACHESIZE * CACHESIZE * sizeof * tile);
         memset(map, 0, CACHESIZE * CACHESIZE * sizeof * map);
 
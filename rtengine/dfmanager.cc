@@ -25,6 +25,7 @@
 
 #include "dfmanager.h"
 #include "../rtgui/options.h"
+#include "calibrationcache.h"
 #include "rawimage.h"
 #include "imagedata.h"
 #include "utils.h"
@@ -109,107 +110,39 @@ double dfInfo::distance(const std::string &mak, const std::string &mod, int iso,
     return sqrt( dISO * dISO +  dShutter * dShutter);
 }
 
-RawImage* dfInfo::getRawImage()
+RawImage* dfInfo::getRawImage(const CalibrationCache &cache)
 {
     if(ri) {
         return ri;
     }
 
-    updateRawImage();
-    updateBadPixelList( ri );
+    updateRawImage(cache);
 
     return ri;
 }
 
-std::vector<badPix>& dfInfo::getHotPixels()
+std::vector<badPix>& dfInfo::getHotPixels(const CalibrationCache &cache)
 {
     if( !ri ) {
-        updateRawImage();
-        updateBadPixelList( ri );
+        updateRawImage(cache);
     }
 
     return badPixels;
 }
 /* updateRawImage() load into ri the actual pixel data from pathname if there is a single shot
- * otherwise load each file from the pathNames list and extract a template from the media;
+ * otherwise the template of the files from the pathNames list, stacked or from the cache;
  * the first file is used also for reading all information other than pixels
  */
-void dfInfo::updateRawImage()
+void dfInfo::updateRawImage(const CalibrationCache &cache)
 {
-    typedef unsigned int acc_t;
+    const std::list<Glib::ustring> names = pathNames.empty() ? std::list<Glib::ustring>(1, pathname) : pathNames;
+    bool hotPixelsCached;
 
-    if( !pathNames.empty() ) {
-        std::list<Glib::ustring>::iterator iName = pathNames.begin();
-        ri = new RawImage(*iName); // First file used also for extra pixels information (width,height, shutter, filters etc.. )
+    ri = cache.loadTemplate(names, &badPixels, hotPixelsCached);
 
-        if( ri->loadRaw(true)) {
-            delete ri;
-            ri = nullptr;
-        } else {
-            int H = ri->get_height();
-            int W = ri->get_width();
-            ri->compress_image(0);
-            int rSize = W * ((ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS) ? 1 : 3);
-            acc_t **acc = new acc_t*[H];
-
-            for( int row = 0; row < H; row++) {
-                acc[row] = new acc_t[rSize ];
-            }
-
-            // copy first image into accumulators
-            for (int row = 0; row < H; row++)
-                for (int col = 0; col < rSize; col++) {
-                    acc[row][col] = ri->data[row][col];
-                }
-
-            int nFiles = 1; // First file data already loaded
-
-            for( ++iName; iName != pathNames.end(); ++iName) {
-                RawImage* temp = new RawImage(*iName);
-
-                if( !temp->loadRaw(true)) {
-                    temp->compress_image(0);     //\ TODO would be better working on original, because is temporary
-                    nFiles++;
-
-                    if( ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS ) {
-                        for( int row = 0; row < H; row++) {
-                            for( int col = 0; col < W; col++) {
-                                acc[row][col] += temp->data[row][col];
-                            }
-                        }
-                    } else {
-                        for( int row = 0; row < H; row++) {
-                            for( int col = 0; col < W; col++) {
-                                acc[row][3 * col + 0] += temp->data[row][3 * col + 0];
-                                acc[row][3 * col + 1] += temp->data[row][3 * col + 1];
-                                acc[row][3 * col + 2] += temp->data[row][3 * col + 2];
-                            }
-                        }
-                    }
-                }
-
-                delete temp;
-            }
-
-            for (int row = 0; row < H; row++) {
-                for (int col = 0; col < rSize; col++) {
-                    ri->data[row][col] = acc[row][col] / nFiles;
-                }
-
-                delete [] acc[row];
-            }
-
-            delete [] acc;
-        }
-    } else {
-        ri = new RawImage(pathname);
-
-        if( ri->loadRaw(true)) {
-            delete ri;
-            ri = nullptr;
-        } else {
-            ri->compress_image(0);
-        }
+    if (ri && !hotPixelsCached) {
+        updateBadPixelList(ri);
+        cache.saveHotPixels(names, badPixels);
     }
 }
 
@@ -274,8 +207,37 @@ void dfInfo::updateBadPixelList( RawImage *df )
 
 // ************************* class DFManager *********************************
 
+DFManager::DFManager() = default;
+
+DFManager::~DFManager() = default;
+
+CalibrationCache& DFManager::getCache()
+{
+    if (!cache) {
+        cache.reset(new CalibrationCache("darkframes"));
+    }
+
+    return *cache;
+}
+
 void DFManager::init(const Glib::ustring& pathname)
 {
+    MyMutex::MyLock lock(scanMutex);
+    pendingPath = pathname;
+    initialized = false;
+}
+
+void DFManager::scan()
+{
+    MyMutex::MyLock lock(scanMutex);
+
+    if (initialized) {
+        return;
+    }
+
+    initialized = true;
+    const Glib::ustring pathname = pendingPath;
+
     if (pathname.empty()) {
         return;
     }
@@ -317,6 +279,8 @@ void DFManager::init(const Glib::ustring& pathname)
         } catch( std::exception& e ) {}
     }
 
+    getCache().saveShotInfo();
+
     // Where multiple shots exist for same group, move filename to list
     for( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         dfInfo &i = iter->second;
@@ -375,38 +339,71 @@ dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
             return nullptr;
         }
 
-        RawImage ri(filename);
-        int res = ri.loadRaw(false); // Read information about shot
-
-        if (res != 0) {
-            return nullptr;
-        }
-
         dfList_t::iterator iter;
 
         if(!pool) {
+            RawImage ri(filename);
+
+            if (ri.loadRaw(false)) { // Read information about shot
+                return nullptr;
+            }
+
             dfInfo n(filename, "", "", 0, 0, 0);
             iter = dfList.emplace("", n);
             return &(iter->second);
         }
 
-        FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+        // Read information about shot, from the cache if the file is unchanged
+        const std::string stamp = CalibrationCache::getFileStamp(filename);
+        std::vector<std::string> fields;
+        std::string maker, model;
+        int iso = 0;
+        double shutter = 0.0;
+        time_t timestamp = 0;
+
+        if (getCache().getShotInfo(stamp, fields) && !fields.empty() && (fields[0] == "0" || fields.size() == 6)) {
+            if (fields[0] == "0") { // not a raw file
+                return nullptr;
+            }
+
+            maker = fields[1];
+            model = fields[2];
+            iso = CalibrationCache::fromField(fields[3]);
+            shutter = CalibrationCache::fromField(fields[4]);
+            timestamp = CalibrationCache::fromField(fields[5]);
+        } else {
+            RawImage ri(filename);
+
+            if (ri.loadRaw(false)) {
+                getCache().setShotInfo(stamp, {"0"});
+                return nullptr;
+            }
+
+            FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+            maker = ((Glib::ustring)idata.getMake()).uppercase();
+            model = ((Glib::ustring)idata.getModel()).uppercase();
+            iso = idata.getISOSpeed();
+            shutter = idata.getShutterSpeed();
+            timestamp = idata.getDateTimeAsTS();
+            getCache().setShotInfo(stamp, {"1", maker, model, CalibrationCache::toField(iso), CalibrationCache::toField(shutter), CalibrationCache::toField(timestamp)});
+        }
+
         /* Files are added in the map, divided by same maker/model,ISO and shutter*/
-        std::string key(dfInfo::key(((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed()));
+        std::string key(dfInfo::key(maker, model, iso, shutter));
         iter = dfList.find(key);
 
         if(iter == dfList.end()) {
-            dfInfo n(filename, ((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed(), idata.getDateTimeAsTS());
+            dfInfo n(filename, maker, model, iso, shutter, timestamp);
             iter = dfList.emplace(key, n);
         } else {
-            while(iter != dfList.end() && iter->second.key() == key && ABS(iter->second.timestamp - idata.getDateTimeAsTS()) > 60 * 60 * 6) { // 6 hour difference
+            while(iter != dfList.end() && iter->second.key() == key && ABS(iter->second.timestamp - timestamp) > 60 * 60 * 6) { // 6 hour difference
                 ++iter;
             }
 
             if(iter != dfList.end()) {
                 iter->second.pathNames.push_back(filename);
             } else {
-                dfInfo n(filename, ((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed(), idata.getDateTimeAsTS());
+                dfInfo n(filename, maker, model, iso, shutter, timestamp);
                 iter = dfList.emplace(key, n);
             }
         }
@@ -420,6 +417,9 @@ dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 
 void DFManager::getStat( int &totFiles, int &totTemplates)
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     totFiles = 0;
     totTemplates = 0;
 
@@ -482,10 +482,13 @@ dfInfo* DFManager::find( const std::string &mak, const std::string &mod, int iso
 
 RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     dfInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
-        return df->getRawImage();
+        return df->getRawImage(getCache());
     } else {
         return nullptr;
     }
@@ -493,25 +496,31 @@ RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string
 
 RawImage* DFManager::searchDarkFrame( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
-            return iter->second.getRawImage();
+            return iter->second.getRawImage(getCache());
         }
     }
 
     dfInfo *df = addFileInfo( filename, false );
 
     if(df) {
-        return df->getRawImage();
+        return df->getRawImage(getCache());
     }
 
     return nullptr;
 }
 std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
-            return &iter->second.getHotPixels();
+            return &iter->second.getHotPixels(getCache());
         }
     }
 
@@ -519,6 +528,9 @@ std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 }
 std::vector<badPix> *DFManager::getHotPixels ( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     dfInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
@@ -532,7 +544,7 @@ std::vector<badPix> *DFManager::getHotPixels ( const std::string &mak, const std
             }
         }
 
-        return &df->getHotPixels();
+        return &df->getHotPixels(getCache());
     } else {
         return nullptr;
     }
@@ -592,6 +604,9 @@ int DFManager::scanBadPixelsFile( Glib::ustring filename )
 
 std::vector<badPix> *DFManager::getBadPixels ( const std::string &mak, const std::string &mod, const std::string &serial)
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     bpList_t::iterator iter;
     bool found = false;
 
@@ -21,15 +21,19 @@
 #include <cmath>
 #include <list>
 #include <map>
+#include <memory>
 #include <string>
 
 #include <glibmm/ustring.h>
 
 #include "pixelsmap.h"
 
+#include "../rtgui/threadutils.h"
+
 namespace rtengine
 {
 
+class CalibrationCache;
 class RawImage;
 class dfInfo final
 {
@@ -63,23 +67,27 @@ public:
         return key( maker, model, iso, shutter);
     }
 
-    RawImage *getRawImage();
-    std::vector<badPix> &getHotPixels();
+    RawImage *getRawImage(const CalibrationCache &cache);
+    std::vector<badPix> &getHotPixels(const CalibrationCache &cache);
 
 protected:
     RawImage *ri; ///< Dark Frame raw data
     std::vector<badPix> badPixels; ///< Extracted hot pixels
 
     void updateBadPixelList( RawImage *df );
-    void updateRawImage();
+    void updateRawImage(const CalibrationCache &cache);
 };
 
 class DFManager final
 {
 public:
+    DFManager();
+    ~DFManager();
+
     void init(const Glib::ustring &pathname);
     Glib::ustring getPathname()
     {
+        scan();
         return currentPath;
     };
     void getStat( int &totFiles, int &totTemplate);
@@ -94,11 +102,17 @@ protected:
     typedef std::map<std::string, std::vector<badPix> > bpList_t;
     dfList_t dfList;
     bpList_t bpList;
-    bool initialized;
+    bool initialized = true;
     Glib::ustring currentPath;
+    Glib::ustring pendingPath; ///< Folder given to init(), only scanned when the library is first used
+    MyMutex scanMutex;
+    MyMutex libraryMutex; ///< Serialises the lookups, they add files to the list and load the templates on first use
+    std::unique_ptr<CalibrationCache> cache; ///< Shot information and templates of the library, created on first use
     dfInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     dfInfo *find( const std::string &mak, const std::string &mod, int isospeed, double shut, time_t t );
     int scanBadPixelsFile( Glib::ustring filename );
+    CalibrationCache &getCache();
+    void scan();
 };
 
 extern DFManager dfm;
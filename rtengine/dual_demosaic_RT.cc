@@ -49,16 +49,16 @@ void RawImageSource::dual_demosaic_RT(bool isBayer, const procparams::RAWParams
                 amaze_demosaic_RT(0, 0, winw, winh, rawData, red, green, blue, options.chunkSizeAMAZE, options.measure);
             } else if (raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::DCBBILINEAR) ||
                        raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::DCBVNG4)) {
-                dcb_demosaic(raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
+                dcb_demosaic(0, 0, winw, winh, raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
             } else if (raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::RCDBILINEAR) ||
                        raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::RCDVNG4)) {
-                rcd_demosaic(options.chunkSizeRCD, options.measure);
+                rcd_demosaic(0, 0, winw, winh, options.chunkSizeRCD, options.measure);
             }
         } else {
             if (raw.xtranssensor.method == procparams::RAWParams::XTransSensor::getMethodString(procparams::RAWParams::XTransSensor::Method::FOUR_PASS)) {
-                xtrans_interpolate (3, true, options.chunkSizeXT, options.measure);
+                xtrans_interpolate (0, 0, winw, winh, 3, true, options.chunkSizeXT, options.measure);
             } else {
-                xtrans_interpolate (1, false, options.chunkSizeXT, options.measure);
+                xtrans_interpolate (0, 0, winw, winh, 1, false, options.chunkSizeXT, options.measure);
             }
         }
 
@@ -74,16 +74,16 @@ void RawImageSource::dual_demosaic_RT(bool isBayer, const procparams::RAWParams
             amaze_demosaic_RT(0, 0, winw, winh, rawData, red, green, blue, options.chunkSizeAMAZE, options.measure);
         } else if (raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::DCBBILINEAR) ||
                    raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::DCBVNG4)) {
-            dcb_demosaic(raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
+            dcb_demosaic(0, 0, winw, winh, raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
         } else if (raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::RCDBILINEAR) ||
                    raw.bayersensor.method == procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::RCDVNG4)) {
-            rcd_demosaic(options.chunkSizeRCD, options.measure);
+            rcd_demosaic(0, 0, winw, winh, options.chunkSizeRCD, options.measure);
         }
     } else {
         if (raw.xtranssensor.method == procparams::RAWParams::XTransSensor::getMethodString(procparams::RAWParams::XTransSensor::Method::FOUR_PASS)) {
-            xtrans_interpolate (3, true, options.chunkSizeXT, options.measure);
+            xtrans_interpolate (0, 0, winw, winh, 3, true, options.chunkSizeXT, options.measure);
         } else {
-            xtrans_interpolate (1, false, options.chunkSizeXT, options.measure);
+            xtrans_interpolate (0, 0, winw, winh, 1, false, options.chunkSizeXT, options.measure);
         }
     }
 
@@ -22,6 +22,7 @@
 
 #include "ffmanager.h"
 #include "../rtgui/options.h"
+#include "calibrationcache.h"
 #include "rawimage.h"
 #include "imagedata.h"
 #include "median.h"
@@ -114,98 +115,27 @@ double ffInfo::distance(const std::string &mak, const std::string &mod, const st
     return sqrt( dfocallength * dfocallength + dAperture * dAperture);
 }
 
-RawImage* ffInfo::getRawImage()
+RawImage* ffInfo::getRawImage(const CalibrationCache &cache)
 {
     if(ri) {
         return ri;
     }
 
-    updateRawImage();
+    updateRawImage(cache);
 
     return ri;
 }
 
 /* updateRawImage() load into ri the actual pixel data from pathname if there is a single shot
- * otherwise load each file from the pathNames list and extract a template from the media;
+ * otherwise the template of the files from the pathNames list, stacked or from the cache;
  * the first file is used also for reading all information other than pixels
  */
-void ffInfo::updateRawImage()
+void ffInfo::updateRawImage(const CalibrationCache &cache)
 {
-    typedef unsigned int acc_t;
-
     // averaging of flatfields if more than one is found matching the same key.
     // this may not be necessary, as flatfield is further blurred before being applied to the processed image.
-    if( !pathNames.empty() ) {
-        std::list<Glib::ustring>::iterator iName = pathNames.begin();
-        ri = new RawImage(*iName); // First file used also for extra pixels information (width, height, shutter, filters etc.. )
-        if( ri->loadRaw(true)) {
-            delete ri;
-            ri = nullptr;
-        } else {
-            int H = ri->get_height();
-            int W = ri->get_width();
-            ri->compress_image(0);
-            int rSize = W * ((ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS || ri->get_colors() == 1) ? 1 : 3);
-            acc_t **acc = new acc_t*[H];
-
-            for( int row = 0; row < H; row++) {
-                acc[row] = new acc_t[rSize ];
-            }
-
-            // copy first image into accumulators
-            for (int row = 0; row < H; row++)
-                for (int col = 0; col < rSize; col++) {
-                    acc[row][col] = ri->data[row][col];
-                }
-
-            int nFiles = 1; // First file data already loaded
-
-            for( ++iName; iName != pathNames.end(); ++iName) {
-                RawImage* temp = new RawImage(*iName);
-
-                if( !temp->loadRaw(true)) {
-                    temp->compress_image(0);     //\ TODO would be better working on original, because is temporary
-                    nFiles++;
-
-                    if( ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS || ri->get_colors() == 1 ) {
-                        for( int row = 0; row < H; row++) {
-                            for( int col = 0; col < W; col++) {
-                                acc[row][col] += temp->data[row][col];
-                            }
-                        }
-                    } else {
-                        for( int row = 0; row < H; row++) {
-                            for( int col = 0; col < W; col++) {
-                                acc[row][3 * col + 0] += temp->data[row][3 * col + 0];
-                                acc[row][3 * col + 1] += temp->data[row][3 * col + 1];
-                                acc[row][3 * col + 2] += temp->data[row][3 * col + 2];
-                            }
-                        }
-                    }
-                }
-
-                delete temp;
-            }
-
-            for (int row = 0; row < H; row++) {
-                for (int col = 0; col < rSize; col++) {
-                    ri->data[row][col] = acc[row][col] / nFiles;
-                }
-
-                delete [] acc[row];
-            }
-
-            delete [] acc;
-        }
-    } else {
-        ri = new RawImage(pathname);
-        if( ri->loadRaw(true)) {
-            delete ri;
-            ri = nullptr;
-        } else {
-            ri->compress_image(0);
-        }
-    }
+    bool hotPixelsCached;
+    ri = cache.loadTemplate(pathNames.empty() ? std::list<Glib::ustring>(1, pathname) : pathNames, nullptr, hotPixelsCached);
 
     if(ri) {
         // apply median to avoid this step being executed each time a flat field gets applied
@@ -238,8 +168,37 @@ void ffInfo::updateRawImage()
 
 // ************************* class FFManager *********************************
 
+FFManager::FFManager() = default;
+
+FFManager::~FFManager() = default;
+
+CalibrationCache& FFManager::getCache()
+{
+    if (!cache) {
+        cache.reset(new CalibrationCache("flatfields"));
+    }
+
+    return *cache;
+}
+
 void FFManager::init(const Glib::ustring& pathname)
 {
+    MyMutex::MyLock lock(scanMutex);
+    pendingPath = pathname;
+    initialized = false;
+}
+
+void FFManager::scan()
+{
+    MyMutex::MyLock lock(scanMutex);
+
+    if (initialized) {
+        return;
+    }
+
+    initialized = true;
+    const Glib::ustring pathname = pendingPath;
+
     if (pathname.empty()) {
         return;
     }
@@ -269,6 +228,8 @@ void FFManager::init(const Glib::ustring& pathname)
         } catch( std::exception& e ) {}
     }
 
+    getCache().saveShotInfo();
+
     // Where multiple shots exist for same group, move filename to list
     for( ffList_t::iterator iter = ffList.begin(); iter != ffList.end(); ++iter ) {
         ffInfo &i = iter->second;
@@ -327,38 +288,76 @@ ffInfo* FFManager::addFileInfo (const Glib::ustring& filename, bool pool)
             return nullptr;
         }
 
-        RawImage ri(filename);
-        int res = ri.loadRaw(false); // Read information about shot
-
-        if (res != 0) {
-            return nullptr;
-        }
-
         ffList_t::iterator iter;
 
         if(!pool) {
+            RawImage ri(filename);
+
+            if (ri.loadRaw(false)) { // Read information about shot
+                return nullptr;
+            }
+
             ffInfo n(filename, "", "", "", 0, 0, 0);
             iter = ffList.emplace("", n);
             return &(iter->second);
         }
 
-        FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+        // Read information about shot, from the cache if the file is unchanged
+        const std::string stamp = CalibrationCache::getFileStamp(filename);
+        std::vector<std::string> fields;
+        std::string maker, model, lens;
+        double focallength = 0.0;
+        double aperture = 0.0;
+        time_t timestamp = 0;
+        time_t rawTimestamp = 0;
+
+        if (getCache().getShotInfo(stamp, fields) && !fields.empty() && (fields[0] == "0" || fields.size() == 8)) {
+            if (fields[0] == "0") { // not a raw file
+                return nullptr;
+            }
+
+            maker = fields[1];
+            model = fields[2];
+            lens = fields[3];
+            focallength = CalibrationCache::fromField(fields[4]);
+            aperture = CalibrationCache::fromField(fields[5]);
+            timestamp = CalibrationCache::fromField(fields[6]);
+            rawTimestamp = CalibrationCache::fromField(fields[7]);
+        } else {
+            RawImage ri(filename);
+
+            if (ri.loadRaw(false)) {
+                getCache().setShotInfo(stamp, {"0"});
+                return nullptr;
+            }
+
+            FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+            maker = idata.getMake();
+            model = idata.getModel();
+            lens = idata.getLens();
+            focallength = idata.getFocalLen();
+            aperture = idata.getFNumber();
+            timestamp = idata.getDateTimeAsTS();
+            rawTimestamp = ri.get_timestamp();
+            getCache().setShotInfo(stamp, {"1", maker, model, lens, CalibrationCache::toField(focallength), CalibrationCache::toField(aperture), CalibrationCache::toField(timestamp), CalibrationCache::toField(rawTimestamp)});
+        }
+
         /* Files are added in the map, divided by same maker/model,lens and aperture*/
-        std::string key(ffInfo::key(idata.getMake(), idata.getModel(), idata.getLens(), idata.getFocalLen(), idata.getFNumber()));
+        std::string key(ffInfo::key(maker, model, lens, focallength, aperture));
         iter = ffList.find(key);
 
         if(iter == ffList.end()) {
-            ffInfo n(filename, idata.getMake(), idata.getModel(), idata.getLens(), idata.getFocalLen(), idata.getFNumber(), idata.getDateTimeAsTS());
+            ffInfo n(filename, maker, model, lens, focallength, aperture, timestamp);
             iter = ffList.emplace(key, n);
         } else {
-            while(iter != ffList.end() && iter->second.key() == key && ABS(iter->second.timestamp - ri.get_timestamp()) > 60 * 60 * 6) { // 6 hour difference
+            while(iter != ffList.end() && iter->second.key() == key && ABS(iter->second.timestamp - rawTimestamp) > 60 * 60 * 6) { // 6 hour difference
                 ++iter;
             }
 
             if(iter != ffList.end()) {
                 iter->second.pathNames.push_back(filename);
             } else {
-                ffInfo n(filename, idata.getMake(), idata.getModel(), idata.getLens(), idata.getFocalLen(), idata.getFNumber(), idata.getDateTimeAsTS());
+                ffInfo n(filename, maker, model, lens, focallength, aperture, timestamp);
                 iter = ffList.emplace(key, n);
             }
         }
@@ -372,6 +371,9 @@ ffInfo* FFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 
 void FFManager::getStat( int &totFiles, int &totTemplates)
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     totFiles = 0;
     totTemplates = 0;
 
@@ -434,10 +436,13 @@ ffInfo* FFManager::find( const std::string &mak, const std::string &mod, const s
 
 RawImage* FFManager::searchFlatField( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     ffInfo *ff = find( mak, mod, len, focal, apert, t );
 
     if( ff ) {
-        return ff->getRawImage();
+        return ff->getRawImage(getCache());
     } else {
         return nullptr;
     }
@@ -445,16 +450,19 @@ RawImage* FFManager::searchFlatField( const std::string &mak, const std::string
 
 RawImage* FFManager::searchFlatField( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(libraryMutex);
+    scan();
+
     for ( ffList_t::iterator iter = ffList.begin(); iter != ffList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
-            return iter->second.getRawImage();
+            return iter->second.getRawImage(getCache());
         }
     }
 
     ffInfo *ff = addFileInfo( filename , false);
 
     if(ff) {
-        return ff->getRawImage();
+        return ff->getRawImage(getCache());
     }
 
     return nullptr;
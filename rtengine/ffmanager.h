@@ -21,13 +21,17 @@
 #include <cmath>
 #include <list>
 #include <map>
+#include <memory>
 #include <string>
 
 #include <glibmm/ustring.h>
 
+#include "../rtgui/threadutils.h"
+
 namespace rtengine
 {
 
+class CalibrationCache;
 class RawImage;
 class ffInfo final
 {
@@ -63,20 +67,24 @@ public:
         return key( maker, model, lens, focallength, aperture);
     }
 
-    RawImage *getRawImage();
+    RawImage *getRawImage(const CalibrationCache &cache);
 
 protected:
     RawImage *ri; ///< Flat Field raw data
 
-    void updateRawImage();
+    void updateRawImage(const CalibrationCache &cache);
 };
 
 class FFManager final
 {
 public:
+    FFManager();
+    ~FFManager();
+
     void init(const Glib::ustring &pathname);
     Glib::ustring getPathname()
     {
+        scan();
         return currentPath;
     };
     void getStat( int &totFiles, int &totTemplate);
@@ -86,10 +94,16 @@ public:
 protected:
     typedef std::multimap<std::string, ffInfo> ffList_t;
     ffList_t ffList;
-    bool initialized;
+    bool initialized = true;
     Glib::ustring currentPath;
+    Glib::ustring pendingPath; ///< Folder given to init(), only scanned when the library is first used
+    MyMutex scanMutex;
+    MyMutex libraryMutex; ///< Serialises the lookups, they add files to the list and load the templates on first use
+    std::unique_ptr<CalibrationCache> cache; ///< Shot information and templates of the library, created on first use
     ffInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     ffInfo *find( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t );
+    CalibrationCache &getCache();
+    void scan();
 };
 
 extern FFManager ffm;
@@ -0,0 +1,105 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "lut3d.h"
+#include "noncopyable.h"
+#include "procparams.h"
+
+namespace rtengine
+{
+
+class DCPProfile;
+
+/**
+ * @brief The 3D LUT baked by ImProcFunctions::rgbProcFused, kept for the next calls
+ *
+ * The LUT only depends on the curves and parameters which feed rgbProc, so it is rebuilt only when one
+ * of them changes, and not when the same settings are applied to another image (e.g. the preview and
+ * the detail windows, or the detail window being panned).
+ * Not thread safe: the calls on one ImProcFunctions instance are serialised by their callers.
+ */
+class FusedRgbLut final :
+    public NonCopyable
+{
+public:
+    struct Key {
+        int lutSize = 0;
+        // hashes of the contents of the LUTf curves
+        std::array<std::uint64_t, 8> curves{};
+        int sat = 0;
+        float satLimit = 0.f;
+        float satLimitOpacity = 0.f;
+        bool opautili = false;
+        float autor = 0.f;
+        float autog = 0.f;
+        float autob = 0.f;
+        double expcomp = 0.0;
+        int hlcompr = 0;
+        int hlcomprthresh = 0;
+        const DCPProfile* dcpProf = nullptr;
+
+        procparams::ToneCurveParams toneCurve;
+        procparams::RGBCurvesParams rgbCurves;
+        procparams::ColorToningParams colorToning;
+        procparams::ChannelMixerParams chmixer;
+        procparams::BlackWhiteParams blackwhite;
+        procparams::HSVEqualizerParams hsvequalizer;
+        procparams::FilmSimulationParams filmSimulation;
+        procparams::DirPyrEqualizerParams dirpyrequalizer;
+        procparams::ColorManagementParams icm;
+
+        bool operator ==(const Key& other) const
+        {
+            return
+                lutSize == other.lutSize
+                && curves == other.curves
+                && sat == other.sat
+                && satLimit == other.satLimit
+                && satLimitOpacity == other.satLimitOpacity
+                && opautili == other.opautili
+                && autor == other.autor
+                && autog == other.autog
+                && autob == other.autob
+                && expcomp == other.expcomp
+                && hlcompr == other.hlcompr
+                && hlcomprthresh == other.hlcomprthresh
+                && dcpProf == other.dcpProf
+                && toneCurve == other.toneCurve
+                && rgbCurves == other.rgbCurves
+                && colorToning == other.colorToning
+                && chmixer == other.chmixer
+                && blackwhite == other.blackwhite
+                && hsvequalizer == other.hsvequalizer
+                && filmSimulation == other.filmSimulation
+                && dirpyrequalizer == other.dirpyrequalizer
+                && icm == other.icm;
+        }
+    };
+
+    Key key;
+    LUT3D lut;
+    // values returned by rgbProc when the LUT was baked
+    double rrm = 0.0;
+    double ggm = 0.0;
+    double bbm = 0.0;
+};
+
+}
@@ -0,0 +1,144 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <map>
+#include <memory>
+
+#include "gamutboundary.h"
+
+#include "color.h"
+#include "iccstore.h"
+#include "sleef.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace
+{
+
+constexpr float maxSearchChroma = 250.f;
+constexpr float searchStep = 2.f;
+constexpr int bisectionSteps = 12;
+
+// Same test as Color::gamutLchonly, without the iteration
+bool isOutOfGamut(float L, float C, float sinh, float cosh, const float wip[3][3], bool checkUpper)
+{
+    using rtengine::Color;
+
+    const float a = C * cosh;
+    const float b = C * sinh;
+
+    const float fy = Color::c1By116 * L + Color::c16By116;
+    const float fx = 0.002f * a + fy;
+    const float fz = fy - 0.005f * b;
+
+    const float x = Color::f2xyz(fx) * Color::D50x;
+    const float z = Color::f2xyz(fz) * Color::D50z;
+    const float y = (L > Color::epskapf) ? fy * fy * fy : L / Color::kappaf;
+
+    float R, G, B;
+    Color::xyz2rgb(x, y, z, R, G, B, wip);
+
+    if (rtengine::min(R, G, B) < 0.f) {
+        return true;
+    }
+
+    return checkUpper && rtengine::max(R, G, B) > 1.f && rtengine::min(R, G, B) <= 1.f;
+}
+
+float findMaxChroma(float L, float HH, const float wip[3][3], bool checkUpper)
+{
+    const float2 sincosval = xsincosf(HH);
+
+    if (isOutOfGamut(L, 0.f, sincosval.x, sincosval.y, wip, checkUpper)) {
+        return 0.f;
+    }
+
+    // coarse search for the first out of gamut chroma, then refine by bisection
+    float lo = 0.f;
+    float hi = searchStep;
+
+    while (hi <= maxSearchChroma && !isOutOfGamut(L, hi, sincosval.x, sincosval.y, wip, checkUpper)) {
+        lo = hi;
+        hi += searchStep;
+    }
+
+    if (hi > maxSearchChroma) {
+        return maxSearchChroma;
+    }
+
+    for (int i = 0; i < bisectionSteps; ++i) {
+        const float mid = 0.5f * (lo + hi);
+
+        if (isOutOfGamut(L, mid, sincosval.x, sincosval.y, wip, checkUpper)) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+
+    return lo;
+}
+
+}
+
+namespace rtengine
+{
+
+GamutBoundary::GamutBoundary(const double wip[3][3]) :
+    wipf{
+        {static_cast<float>(wip[0][0]), static_cast<float>(wip[0][1]), static_cast<float>(wip[0][2])},
+        {static_cast<float>(wip[1][0]), static_cast<float>(wip[1][1]), static_cast<float>(wip[1][2])},
+        {static_cast<float>(wip[2][0]), static_cast<float>(wip[2][1]), static_cast<float>(wip[2][2])}
+    }
+{
+}
+
+void GamutBoundary::compute() const
+{
+    lowerOnly.resize(L_STEPS * H_STEPS);
+    bothBounds.resize(L_STEPS * H_STEPS);
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+#endif
+
+    for (int l = 0; l < L_STEPS; ++l) {
+        for (int h = 0; h < H_STEPS; ++h) {
+            const float HH = -RT_PI_F + h * (2.f * RT_PI_F / H_STEPS);
+            lowerOnly.data[l * H_STEPS + h] = findMaxChroma(l, HH, wipf, false);
+            bothBounds.data[l * H_STEPS + h] = findMaxChroma(l, HH, wipf, true);
+        }
+    }
+}
+
+const GamutBoundary& GamutBoundary::get(const Glib::ustring& workingProfile)
+{
+    static MyMutex mutex;
+    static std::map<Glib::ustring, std::unique_ptr<GamutBoundary>> boundaries;
+
+    MyMutex::MyLock lock(mutex);
+
+    auto& boundary = boundaries[workingProfile];
+
+    if (!boundary) {
+        const TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix(workingProfile);
+        boundary.reset(new GamutBoundary(wiprof));
+    }
+
+    return *boundary;
+}
+
+}
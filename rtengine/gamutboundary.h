@@ -0,0 +1,100 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <mutex>
+
+#include <glibmm/ustring.h>
+
+#include "alignedbuffer.h"
+#include "noncopyable.h"
+#include "opthelper.h"
+#include "rt_math.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Gamut boundary descriptor of a working profile
+ *
+ * Holds the maximum chroma that stays inside the working profile's RGB cube as a function
+ * of (L, hue), sampled on a regular grid. Color::gamutLchonly uses it as an estimate to skip
+ * the chroma reductions of its loop which are certainly out of gamut. The loop keeps its exact
+ * tests, so the result does not depend on the precision of the table.
+ *
+ * Two tables are kept: one bounded by R,G,B >= 0 only (highlight reconstruction enabled)
+ * and one which also bounds the channels to the clip level (highlight reconstruction disabled),
+ * matching the two conditions tested in gamutLchonly.
+ *
+ * The tables are only computed on the first call of getMaxChroma, i.e. when gamutLchonly meets
+ * the first out of gamut colour, so that callers which only see in gamut colours don't pay for them.
+ */
+class GamutBoundary final :
+    public NonCopyable
+{
+public:
+    static constexpr int L_STEPS = 101; // L = 0, 1, ..., 100
+    static constexpr int H_STEPS = 256; // hue = -PI ... +PI, wrapped
+
+    /**
+    * @brief Return the (cached) boundary of a working profile
+    * @param workingProfile name of the working profile, as in ICCStore::workingSpaceInverseMatrix
+    */
+    static const GamutBoundary& get(const Glib::ustring& workingProfile);
+
+    /**
+    * @brief Estimated maximum in-gamut chroma for given L [0 ; 100] and hue [-PI ; +PI] (radians)
+    * Bilinear interpolation of the samples, the exact boundary may be slightly above or below.
+    */
+    float getMaxChroma(float L, float HH, bool isHLEnabled) const
+    {
+        std::call_once(computed, [this]() {
+            compute();
+        });
+
+        const float* const table = isHLEnabled ? lowerOnly.data : bothBounds.data;
+
+        const float fl = LIM(L, 0.f, static_cast<float>(L_STEPS - 1));
+        const int il = rtengine::min(static_cast<int>(fl), L_STEPS - 2);
+        const float dl = fl - il;
+
+        float fh = (HH + RT_PI_F) * (H_STEPS / (2.f * RT_PI_F));
+        fh = LIM(fh, 0.f, static_cast<float>(H_STEPS));
+        int ih = static_cast<int>(fh);
+        const float dh = fh - ih;
+        ih = ih & (H_STEPS - 1);
+        const int ih1 = (ih + 1) & (H_STEPS - 1);
+
+        const float* const row0 = table + il * H_STEPS;
+        const float* const row1 = row0 + H_STEPS;
+        const float c0 = intp(dh, row0[ih1], row0[ih]);
+        const float c1 = intp(dh, row1[ih1], row1[ih]);
+        return intp(dl, c1, c0);
+    }
+
+private:
+    explicit GamutBoundary(const double wip[3][3]);
+
+    void compute() const;
+
+    float wipf[3][3];
+    mutable std::once_flag computed;
+    mutable AlignedBuffer<float> lowerOnly;
+    mutable AlignedBuffer<float> bothBounds;
+};
+
+}
@@ -27,8 +27,10 @@
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <vector>
 
 #include "array2D.h"
+#include "boxblur.h"
 #include "opthelper.h"
 #include "rawimagesource.h"
 #include "rt_math.h"
@@ -44,89 +46,6 @@
 namespace
 {
 
-void boxblur2(const float* const* src, float** dst, float** temp, int startY, int startX, int H, int W, int bufferW, int box)
-{
-    constexpr int numCols = 16;
-    assert((bufferW % numCols) == 0);
-
-    //box blur image channel; box size = 2*box+1
-    //horizontal blur
-#ifdef _OPENMP
-    #pragma omp parallel for
-#endif
-    for (int row = 0; row < H; ++row) {
-        int len = box + 1;
-        temp[row][0] = src[row + startY][startX] / len;
-
-        for (int j = 1; j <= box; ++j) {
-            temp[row][0] += src[row + startY][j + startX] / len;
-        }
-
-        for (int col = 1; col <= box; ++col, ++len) {
-            temp[row][col] = (temp[row][col - 1] * len + src[row + startY][col + box + startX]) / (len + 1);
-        }
-
-        for (int col = box + 1; col < W - box; ++col) {
-            temp[row][col] = temp[row][col - 1] + (src[row + startY][col + box + startX] - src[row + startY][col - box - 1 + startX]) / len;
-        }
-
-        for (int col = W - box; col < W; ++col, --len) {
-            temp[row][col] = (temp[row][col - 1] * len - src[row + startY][col - box - 1 + startX]) / (len - 1);
-        }
-    }
-
-    //vertical blur
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        float tempvalN[numCols] ALIGNED64;
-#ifdef _OPENMP
-    #pragma omp for
-#endif
-        for (int col = 0; col < bufferW - numCols + 1; col += numCols) {
-            float len = box + 1;
-
-            for (int n = 0; n < numCols; ++n) {
-                tempvalN[n] = temp[0][col + n] / len;
-            }
-
-            for (int i = 1; i <= box; ++i) {
-                for (int n = 0; n < numCols; ++n) {
-                    tempvalN[n] += temp[i][col + n] / len;
-                }
-            }
-
-            for (int n = 0; n < numCols; ++n) {
-                dst[0][col + n] = tempvalN[n];
-            }
-
-            for (int row = 1; row <= box; ++row, ++len) {
-                for (int n = 0; n < numCols; ++n) {
-                    tempvalN[n] = (tempvalN[n] * len + temp[(row + box)][col + n]) / (len + 1);
-                    dst[row][col + n] = tempvalN[n];
-                }
-            }
-
-            const float rlen = 1.f / len;
-
-            for (int row = box + 1; row < H - box; ++row) {
-                for (int n = 0; n < numCols; ++n) {
-                    tempvalN[n] += (temp[(row + box)][col + n] - temp[(row - box - 1)][col + n]) * rlen;
-                    dst[row][col + n] = tempvalN[n];
-                }
-            }
-
-            for (int row = H - box; row < H; ++row, --len) {
-                for (int n = 0; n < numCols; ++n) {
-                    tempvalN[n] = (dst[(row - 1)][col + n] * len - temp[(row - box - 1)][col + n]) / (len - 1);
-                    dst[row][col + n] = tempvalN[n];
-                }
-            }
-        }
-    }
-}
-
 void boxblur_resamp(const float* const* src, float** dst, float** temp, int H, int W, int box, int samp)
 {
     assert(samp != 0);
@@ -184,13 +103,62 @@ void boxblur_resamp(const float* const* src, float** dst, float** temp, int H, i
     #pragma omp parallel
 #endif
     {
+#ifdef __SSE2__
+        const vfloat onev = F2V(1.f);
+#else
         float tempvalN[numCols] ALIGNED64;
+#endif
 
 #ifdef _OPENMP
         #pragma omp for nowait
 #endif
         //vertical blur
         for (int col = 0; col < (W / samp) - (numCols - 1); col += numCols) {
+#ifdef __SSE2__
+            vfloat lenv = F2V(box + 1);
+            vfloat tempv = LVFU(temp[0][col]) / lenv;
+            vfloat temp1v = LVFU(temp[0][col + 4]) / lenv;
+
+            for (int i = 1; i <= box; ++i) {
+                tempv += LVFU(temp[i][col]) / lenv;
+                temp1v += LVFU(temp[i][col + 4]) / lenv;
+            }
+
+            STVFU(dst[0][col], tempv);
+            STVFU(dst[0][col + 4], temp1v);
+
+            for (int row = 1; row <= box; ++row, lenv += onev) {
+                tempv = (tempv * lenv + LVFU(temp[(row + box)][col])) / (lenv + onev);
+                temp1v = (temp1v * lenv + LVFU(temp[(row + box)][col + 4])) / (lenv + onev);
+
+                if (row % samp == 0) {
+                    STVFU(dst[row / samp][col], tempv);
+                    STVFU(dst[row / samp][col + 4], temp1v);
+                }
+            }
+
+            const vfloat rlenv = onev / lenv;
+
+            for (int row = box + 1; row < H - box; ++row) {
+                tempv += (LVFU(temp[(row + box)][col]) - LVFU(temp[(row - box - 1)][col])) * rlenv;
+                temp1v += (LVFU(temp[(row + box)][col + 4]) - LVFU(temp[(row - box - 1)][col + 4])) * rlenv;
+
+                if (row % samp == 0) {
+                    STVFU(dst[row / samp][col], tempv);
+                    STVFU(dst[row / samp][col + 4], temp1v);
+                }
+            }
+
+            for (int row = H - box; row < H; ++row, lenv -= onev) {
+                tempv = (tempv * lenv - LVFU(temp[(row - box - 1)][col])) / (lenv - onev);
+                temp1v = (temp1v * lenv - LVFU(temp[(row - box - 1)][col + 4])) / (lenv - onev);
+
+                if (row % samp == 0) {
+                    STVFU(dst[row / samp][col], tempv);
+                    STVFU(dst[row / samp][col + 4], temp1v);
+                }
+            }
+#else
             float len = box + 1;
 
             for (int n = 0; n < numCols; ++n) {
@@ -244,6 +212,7 @@ void boxblur_resamp(const float* const* src, float** dst, float** temp, int H, i
                     }
                 }
             }
+#endif
         }
 
         // process remaining columns
@@ -433,31 +402,34 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
     const int blurHeight = maxy - miny + 1;
     const int bufferWidth = blurWidth + ((16 - (blurWidth % 16)) & 15);
 
-    multi_array2D<float, 3> channelblur(bufferWidth, blurHeight, 0, 48);
-    array2D<float> temp(bufferWidth, blurHeight); // allocate temporary buffer
+    // the channels are blurred one after the other, only the sum of the differences to the blurred channels is kept
+    array2D<float> channelblur(bufferWidth, blurHeight);
+    array2D<float> blurbuffer(bufferWidth, blurHeight);
+    std::vector<float*> roi(blurHeight);
 
-    // blur RGB channels
-    boxblur2(red, channelblur[0], temp, miny, minx, blurHeight, blurWidth, bufferWidth, 4);
-    boxblur2(green, channelblur[1], temp, miny, minx, blurHeight, blurWidth, bufferWidth, 4);
-    boxblur2(blue, channelblur[2], temp, miny, minx, blurHeight, blurWidth, bufferWidth, 4);
- 
-    if (plistener) {
-        progress += 0.07;
-        plistener->setProgress(progress);
-    }
+    for (int c = 0; c < 3; ++c) {
+        float** const channel = c == 0 ? red : c == 1 ? green : blue;
+
+        for (int i = 0; i < blurHeight; ++i) {
+            roi[i] = channel[i + miny] + minx;
+        }
+
+        boxblur(roi.data(), static_cast<float**>(blurbuffer), 4, blurWidth, blurHeight, true);
 
-    // reduce channel blur to one array
 #ifdef _OPENMP
-    #pragma omp parallel for
+        #pragma omp parallel for
 #endif
-    for (int i = 0; i < blurHeight; ++i) {
-        for (int j = 0; j < blurWidth; ++j) {
-            channelblur[0][i][j] = std::fabs(channelblur[0][i][j] - red[i + miny][j + minx]) + std::fabs(channelblur[1][i][j] - green[i + miny][j + minx]) + std::fabs(channelblur[2][i][j] - blue[i + miny][j + minx]);
+        for (int i = 0; i < blurHeight; ++i) {
+            for (int j = 0; j < blurWidth; ++j) {
+                const float diff = std::fabs(blurbuffer[i][j] - roi[i][j]);
+                channelblur[i][j] = c == 0 ? diff : channelblur[i][j] + diff;
+            }
         }
     }
-
-    for (int c = 1; c < 3; ++c) {
-        channelblur[c].free();    //free up some memory
+ 
+    if (plistener) {
+        progress += 0.07;
+        plistener->setProgress(progress);
     }
 
     if (plistener) {
@@ -492,7 +464,7 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
                 && blue[i + miny][j + minx] < max_f[2]
             ) {
                 // if one or more channels is highlight but none are blown, add to highlight accumulator
-                hipass_sum += static_cast<double>(channelblur[0][i][j]);
+                hipass_sum += static_cast<double>(channelblur[i][j]);
                 ++hipass_norm;
 
                 hilite_full[0][i][j] = red[i + miny][j + minx];
@@ -510,12 +482,9 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
         plistener->setProgress(progress);
     }
 
-    array2D<float> hilite_full4(bufferWidth, blurHeight);
-
     //blur highlight data
-    boxblur2(hilite_full[3], hilite_full4, temp, 0, 0, blurHeight, blurWidth, bufferWidth, 1);
-
-    temp.free(); // free temporary buffer
+    array2D<float>& hilite_full4 = blurbuffer;
+    boxblur(static_cast<float**>(hilite_full[3]), static_cast<float**>(hilite_full4), 1, blurWidth, blurHeight, true);
 
     if (plistener) {
         progress += 0.07;
@@ -527,7 +496,7 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
 #endif
     for (int i = 0; i < blurHeight; ++i) {
         for (int j = 0; j < blurWidth; ++j) {
-            if (channelblur[0][i][j] > hipass_ave) {
+            if (channelblur[i][j] > hipass_ave) {
                 //too much variation
                 hilite_full[0][i][j] = hilite_full[1][i][j] = hilite_full[2][i][j] = hilite_full[3][i][j] = 0.f;
                 continue;
@@ -540,7 +509,7 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
         }
     }
 
-    channelblur[0].free();    //free up some memory
+    channelblur.free();    //free up some memory
     hilite_full4.free();    //free up some memory
 
     const int hfh = (blurHeight - blurHeight % pitch) / pitch;
@@ -1877,6 +1877,16 @@ public:
       * @param quality is the quality of the jpeg (0...100), set it to -1 to use default
         @return the error code, 0 if none */
     virtual int saveAsJPEG (const Glib::ustring &fname, int quality = 100, int subSamp = 3 ) const = 0;
+    /** @brief Encodes the image in a png format into a buffer, without touching the filesystem.
+      * @param buffer receives the content of the png file
+      * @param bps can be 8 or 16 depending on the bits per pixels the output will have
+        @return the error code, 0 if none */
+    virtual int saveAsPNG (std::vector<unsigned char> &buffer, int bps = -1) const = 0;
+    /** @brief Encodes the image in a jpg format into a buffer, without touching the filesystem.
+      * @param buffer receives the content of the jpg file
+      * @param quality is the quality of the jpeg (0...100), set it to -1 to use default
+        @return the error code, 0 if none */
+    virtual int saveAsJPEG (std::vector<unsigned char> &buffer, int quality = 100, int subSamp = 3) const = 0;
     /** @brief Saves the image to file in a tif format.
       * @param fname is the name of the file
       * @param bps can be 8 or 16 depending on the bits per pixels the output file will have
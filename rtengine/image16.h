@@ -81,6 +81,16 @@ public:
         return saveJPEG(fname, quality, subSamp);
     }
 
+    int saveAsPNG(std::vector<unsigned char> &buffer, int bps = -1) const override
+    {
+        return savePNG(buffer, bps);
+    }
+
+    int saveAsJPEG(std::vector<unsigned char> &buffer, int quality = 100, int subSamp = 3) const override
+    {
+        return saveJPEG(buffer, quality, subSamp);
+    }
+
     int saveAsTIFF(const Glib::ustring &fname, int bps = -1, bool isFloat = false, bool uncompressed = false) const override
     {
         return saveTIFF(fname, bps, isFloat, uncompressed);
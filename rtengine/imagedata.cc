@@ -29,6 +29,7 @@
 #include "imagedata.h"
 #include "imagesource.h"
 #include "iptcpairs.h"
+#include "myfile.h"
 #include "procparams.h"
 #include "rt_math.h"
 #include "utils.h"
@@ -1367,7 +1368,7 @@ FramesData::FramesData(const Glib::ustring& fname, std::unique_ptr<RawMetaDataLo
     iptc(nullptr), dcrawFrameCount(0)
 {
     if (rml && (rml->exifBase >= 0 || rml->ciffBase >= 0)) {
-        FILE* f = g_fopen(fname.c_str(), "rb");
+        FILE* f = gfopen_stdio(fname.c_str());
 
         if (f) {
             rtexif::ExifManager exifManager(f, std::move(rml), firstFrameOnly);
@@ -1400,7 +1401,7 @@ FramesData::FramesData(const Glib::ustring& fname, std::unique_ptr<RawMetaDataLo
             fclose(f);
         }
     } else if (hasJpegExtension(fname)) {
-        FILE* f = g_fopen(fname.c_str(), "rb");
+        FILE* f = gfopen_stdio(fname.c_str());
 
         if (f) {
             rtexif::ExifManager exifManager(f, std::move(rml), true);
@@ -1420,7 +1421,7 @@ FramesData::FramesData(const Glib::ustring& fname, std::unique_ptr<RawMetaDataLo
             fclose(f);
         }
     } else if (hasTiffExtension(fname)) {
-        FILE* f = g_fopen(fname.c_str(), "rb");
+        FILE* f = gfopen_stdio(fname.c_str());
 
         if (f) {
             rtexif::ExifManager exifManager(f, std::move(rml), firstFrameOnly);
@@ -42,6 +42,7 @@
 #include "imageio.h"
 #include "iptcpairs.h"
 #include "iccjpeg.h"
+#include "myfile.h"
 #include "color.h"
 
 #include "jpeg.h"
@@ -79,6 +80,49 @@ FILE* g_fopen_withBinaryAndLock(const Glib::ustring& fname)
     return f;
 }
 
+// libjpeg destination manager appending to a buffer
+struct BufferDestination {
+    jpeg_destination_mgr pub;
+    std::vector<unsigned char>* buffer;
+};
+
+void initBufferDestination (j_compress_ptr cinfo)
+{
+    BufferDestination* const dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    dest->buffer->resize(65536);
+    dest->pub.next_output_byte = dest->buffer->data();
+    dest->pub.free_in_buffer = dest->buffer->size();
+}
+
+boolean emptyBufferDestination (j_compress_ptr cinfo)
+{
+    BufferDestination* const dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    const std::size_t used = dest->buffer->size();
+    dest->buffer->resize(2 * used);
+    dest->pub.next_output_byte = dest->buffer->data() + used;
+    dest->pub.free_in_buffer = dest->buffer->size() - used;
+    return TRUE;
+}
+
+void termBufferDestination (j_compress_ptr cinfo)
+{
+    BufferDestination* const dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    dest->buffer->resize(dest->buffer->size() - dest->pub.free_in_buffer);
+}
+
+void jpeg_buffer_dest (j_compress_ptr cinfo, std::vector<unsigned char>* buffer)
+{
+    if (!cinfo->dest) {
+        cinfo->dest = static_cast<jpeg_destination_mgr*>((*cinfo->mem->alloc_small)(reinterpret_cast<j_common_ptr>(cinfo), JPOOL_PERMANENT, sizeof(BufferDestination)));
+    }
+
+    BufferDestination* const dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    dest->pub.init_destination = initBufferDestination;
+    dest->pub.empty_output_buffer = emptyBufferDestination;
+    dest->pub.term_destination = termBufferDestination;
+    dest->buffer = buffer;
+}
+
 }
 
 Glib::ustring ImageIO::errorMsg[6] = {"Success", "Cannot read file.", "Invalid header.", "Error while reading header.", "File reading error", "Image format not supported."};
@@ -219,10 +263,12 @@ ImageIO::~ImageIO ()
 void png_read_data(png_struct_def  *png_ptr, unsigned char *data, size_t length);
 void png_write_data(png_struct_def *png_ptr, unsigned char *data, size_t length);
 void png_flush(png_struct_def *png_ptr);
+void png_write_buffer(png_struct_def *png_ptr, unsigned char *data, size_t length);
+void png_flush_buffer(png_struct_def *png_ptr);
 
 int ImageIO::getPNGSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement)
 {
-    FILE *file = g_fopen (fname.c_str (), "rb");
+    FILE *file = gfopen_stdio (fname.c_str ());
 
     if (!file) {
         return IMIO_CANNOTREADFILE;
@@ -295,7 +341,7 @@ int ImageIO::getPNGSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sF
 int ImageIO::loadPNG  (const Glib::ustring &fname)
 {
 
-    FILE *file = g_fopen (fname.c_str (), "rb");
+    FILE *file = gfopen_stdio (fname.c_str ());
 
     if (!file) {
         return IMIO_CANNOTREADFILE;
@@ -563,7 +609,7 @@ int ImageIO::loadJPEGFromMemory (const char* buffer, int bufsize)
 
 int ImageIO::loadJPEG (const Glib::ustring &fname)
 {
-    FILE *file = g_fopen(fname.c_str (), "rb");
+    FILE *file = gfopen_stdio (fname.c_str ());
 
     if (!file) {
         return IMIO_CANNOTREADFILE;
@@ -1011,6 +1057,23 @@ int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
         return IMIO_CANNOTWRITEFILE;
     }
 
+    const int result = writePNG (file, nullptr, bps);
+    fclose (file);
+    return result;
+}
+
+int ImageIO::savePNG (std::vector<unsigned char> &buffer, int bps) const
+{
+    if (getWidth() < 1 || getHeight() < 1) {
+        return IMIO_HEADERERROR;
+    }
+
+    buffer.clear();
+    return writePNG (nullptr, &buffer, bps);
+}
+
+int ImageIO::writePNG (FILE* file, std::vector<unsigned char>* buffer, int bps) const
+{
     if (pl) {
         pl->setProgressStr ("PROGRESSBAR_SAVEPNG");
         pl->setProgress (0.0);
@@ -1019,7 +1082,6 @@ int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
     png_structp png = png_create_write_struct (PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
 
     if (!png) {
-        fclose (file);
         return IMIO_HEADERERROR;
     }
 
@@ -1032,17 +1094,19 @@ int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
 
     if (!info) {
         png_destroy_write_struct (&png, nullptr);
-        fclose (file);
         return IMIO_HEADERERROR;
     }
 
     if (setjmp(png_jmpbuf(png))) {
         png_destroy_write_struct (&png, &info);
-        fclose(file);
         return IMIO_CANNOTWRITEFILE;
     }
 
-    png_set_write_fn (png, file, png_write_data, png_flush);
+    if (file) {
+        png_set_write_fn (png, file, png_write_data, png_flush);
+    } else {
+        png_set_write_fn (png, buffer, png_write_buffer, png_flush_buffer);
+    }
 
     png_set_filter(png, 0, PNG_FILTER_PAETH);
     png_set_compression_level(png, 6);
@@ -1125,7 +1189,6 @@ int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
     png_destroy_write_struct(&png, &info);
 
     delete [] row;
-    fclose (file);
 
     if (pl) {
         pl->setProgressStr ("PROGRESSBAR_READY");
@@ -1150,6 +1213,29 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
         return IMIO_CANNOTWRITEFILE;
     }
 
+    const int result = writeJPEG (file, nullptr, quality, subSamp);
+    fclose (file);
+
+    if (result != IMIO_SUCCESS) {
+        // remove the already saved part of the file
+        g_remove (fname.c_str());
+    }
+
+    return result;
+}
+
+int ImageIO::saveJPEG (std::vector<unsigned char> &buffer, int quality, int subSamp) const
+{
+    if (getWidth() < 1 || getHeight() < 1) {
+        return IMIO_HEADERERROR;
+    }
+
+    buffer.clear();
+    return writeJPEG (nullptr, &buffer, quality, subSamp);
+}
+
+int ImageIO::writeJPEG (FILE* file, std::vector<unsigned char>* buffer, int quality, int subSamp) const
+{
     jpeg_compress_struct cinfo;
     /* We use our private extension JPEG error handler.
        Note that this struct must live as long as the main JPEG parameter
@@ -1169,11 +1255,9 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
     if (setjmp(jerr.setjmp_buffer)) {
 #endif
         /* If we get here, the JPEG code has signaled an error.
-           We need to clean up the JPEG object, close the file, remove the already saved part of the file and return.
+           We need to clean up the JPEG object and return.
         */
         jpeg_destroy_compress(&cinfo);
-        fclose(file);
-        g_remove (fname.c_str());
         return IMIO_CANNOTWRITEFILE;
     }
 
@@ -1186,7 +1270,11 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
         pl->setProgress (0.0);
     }
 
-    jpeg_stdio_dest (&cinfo, file);
+    if (file) {
+        jpeg_stdio_dest (&cinfo, file);
+    } else {
+        jpeg_buffer_dest (&cinfo, buffer);
+    }
 
     int width = getWidth ();
     int height = getHeight ();
@@ -1287,12 +1375,10 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
     if (setjmp(jerr.setjmp_buffer)) {
 #endif
         /* If we get here, the JPEG code has signaled an error.
-           We need to clean up the JPEG object, close the file, remove the already saved part of the file and return.
+           We need to clean up the JPEG object and return.
         */
         delete [] row;
         jpeg_destroy_compress(&cinfo);
-        fclose(file);
-        g_remove (fname.c_str());
         return IMIO_CANNOTWRITEFILE;
     }
 
@@ -1303,8 +1389,6 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
         if (jpeg_write_scanlines (&cinfo, &row, 1) < 1) {
             jpeg_destroy_compress (&cinfo);
             delete [] row;
-            fclose (file);
-            g_remove (fname.c_str());
             return IMIO_CANNOTWRITEFILE;
         }
 
@@ -1318,8 +1402,6 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
 
     delete [] row;
 
-    fclose (file);
-
     if (pl) {
         pl->setProgressStr ("PROGRESSBAR_READY");
         pl->setProgress (1.0);
@@ -1636,6 +1718,16 @@ void png_flush(png_structp png_ptr)
     }
 }
 
+void png_write_buffer(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    std::vector<unsigned char>* const buffer = static_cast<std::vector<unsigned char>*>(png_get_io_ptr(png_ptr));
+    buffer->insert(buffer->end(), data, data + length);
+}
+
+void png_flush_buffer(png_structp png_ptr)
+{
+}
+
 int ImageIO::load (const Glib::ustring &fname)
 {
 
@@ -18,7 +18,9 @@
  */
 #pragma once
 
+#include <cstdio>
 #include <memory>
+#include <vector>
 
 #include <glibmm/ustring.h>
 
@@ -80,6 +82,9 @@ protected:
 
 private:
     void deleteLoadedProfileData( );
+    // write to file, or to buffer if file is null
+    int writePNG (FILE* file, std::vector<unsigned char>* buffer, int bps) const;
+    int writeJPEG (FILE* file, std::vector<unsigned char>* buffer, int quality, int subSamp) const;
 
 public:
     static Glib::ustring errorMsg[6];
@@ -112,7 +117,9 @@ public:
     int loadPPMFromMemory(const char* buffer, int width, int height, bool swap, int bps);
 
     int savePNG (const Glib::ustring &fname, int bps = -1) const;
+    int savePNG (std::vector<unsigned char> &buffer, int bps = -1) const;
     int saveJPEG (const Glib::ustring &fname, int quality = 100, int subSamp = 3) const;
+    int saveJPEG (std::vector<unsigned char> &buffer, int quality = 100, int subSamp = 3) const;
     int saveTIFF (const Glib::ustring &fname, int bps = -1, bool isFloat = false, bool uncompressed = false) const;
 
     cmsHPROFILE getEmbeddedProfile () const;
@@ -16,6 +16,7 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <fstream>
 
 #include <glibmm/thread.h>
@@ -26,6 +27,7 @@
 #include "cieimage.h"
 #include "color.h"
 #include "colortemp.h"
+#include "croptilecache.h"
 #include "curves.h"
 #include "dcp.h"
 #include "guidedfilter.h"
@@ -78,6 +80,7 @@ ImProcCoordinator::ImProcCoordinator() :
     scale(10),
     highDetailPreprocessComputed(false),
     highDetailRawComputed(false),
+    superpixelPreviewDone(false),
     allocated(false),
     bwAutoR(-9000.f),
     bwAutoG(-9000.f),
@@ -167,6 +170,10 @@ ImProcCoordinator::ImProcCoordinator() :
     awavListener(nullptr),
     dehaListener(nullptr),
     hListener(nullptr),
+    imageVersion(0),
+    cropTiles(new CropTileCache),
+    tileRenderer(nullptr),
+    sourceVersion(0),
     resultValid(false),
     params(new procparams::ProcParams),
     tweakOperator(nullptr),
@@ -176,6 +183,8 @@ ImProcCoordinator::ImProcCoordinator() :
     thread(nullptr),
     changeSinceLast(0),
     updaterRunning(false),
+    updaterThreadStartWaiters(0),
+    updaterThreadStartMissed(false),
     nextParams(new procparams::ProcParams),
     destroying(false),
     utili(false),
@@ -249,7 +258,7 @@ ImProcCoordinator::~ImProcCoordinator()
 {
 
     destroying = true;
-    updaterThreadStart.lock();
+    lockUpdaterThreadStart();
 
     if (updaterRunning && thread) {
         thread->join();
@@ -270,6 +279,8 @@ ImProcCoordinator::~ImProcCoordinator()
         delete toDel[i];
     }
 
+    delete tileRenderer;
+
     imgsrc->decreaseRef();
 
     if (customTransformIn) {
@@ -332,7 +343,21 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
     MyMutex::MyLock processingLock(mProcessing);
 
-    bool highDetailNeeded = options.prevdemo == PD_Sidecar ? true : (todo & M_HIGHQUAL);
+    ++imageVersion;
+
+    // The superpixel preview is only used for the first demosaic of a Bayer or X-Trans raw, and never replaces the NONE and MONO methods.
+    // Once it has been shown, the preview is demosaiced as in PP3.
+    const bool superpixelPreview =
+        options.prevdemo == PD_Superpixel && !superpixelPreviewDone
+        && ((imgsrc->getSensorType() == ST_BAYER
+             && params->raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::NONE)
+             && params->raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO))
+            || (imgsrc->getSensorType() == ST_FUJI_XTRANS
+             && params->raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::NONE)
+             && params->raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::MONO)));
+    const bool sidecarPreview = options.prevdemo == PD_Sidecar || (options.prevdemo == PD_Superpixel && !superpixelPreview);
+    bool highDetailNeeded = sidecarPreview ? true : (todo & M_HIGHQUAL);
+    bool regionDemosaiced = false;
                 //    printf("metwb=%s \n", params->wb.method.c_str());
 
     // Check if any detail crops need high detail. If not, take a fast path short cut
@@ -345,7 +370,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
     }
 
-    if (((todo & ALL) == ALL) || (todo & M_MONITOR) || panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar)) {
+    if (((todo & ALL) == ALL) || (todo & M_MONITOR) || panningRelatedChange || (highDetailNeeded && (!sidecarPreview || !highDetailRawComputed))) {
         bwAutoR = bwAutoG = bwAutoB = -9000.f;
 
         if (todo == CROP && ipf.needsPCVignetting()) {
@@ -383,6 +408,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             imgsrc->setCurrentFrame(params->raw.bayersensor.imageNum);
 
             imgsrc->preprocess(rp, params->lensProf, params->coarse);
+            ++sourceVersion;
 
             if (flatFieldAutoClipListener && rp.ff_AutoClipControl) {
                 flatFieldAutoClipListener->flatFieldAutoClipValueChanged(imgsrc->getFlatFieldAutoClipValue());
@@ -435,7 +461,41 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
             bool autoContrast = imgsrc->getSensorType() == ST_BAYER ? params->raw.bayersensor.dualDemosaicAutoContrast : params->raw.xtranssensor.dualDemosaicAutoContrast;
             double contrastThreshold = imgsrc->getSensorType() == ST_BAYER ? params->raw.bayersensor.dualDemosaicContrast : params->raw.xtranssensor.dualDemosaicContrast;
-            imgsrc->demosaic(rp, autoContrast, contrastThreshold, params->pdsharpening.enabled);
+            // below 100% magnification, the superpixel preview is shown until the full demosaic is done, see end of this function
+            const bool superpixel = !highDetailNeeded && superpixelPreview;
+
+            // When a 100% detail window is opened on top of a fast demosaic, first demosaic only the areas shown in
+            // the detail windows. The full demosaic is queued at the end of this function.
+            // Tools which need the whole demosaiced frame rule this out.
+            if (!(todo & M_RAW) && !highDetailRawComputed && highDetailNeeded && !sidecarPreview
+                    && !imgsrc->isRGBSourceModified() && !autoContrast && !params->pdsharpening.enabled && !params->retinex.enabled
+                    && !params->fattal.enabled && !(params->toneCurve.hrenabled && params->toneCurve.method == "Color")
+                    && !(params->dirpyrDenoise.enabled && ((settings->leveldnautsimpl == 1 && params->dirpyrDenoise.Cmethod == "AUT") || (settings->leveldnautsimpl == 0 && params->dirpyrDenoise.C2method == "AUTO")))) {
+                const int tr = getCoarseBitMask(params->coarse);
+                bool detailCrops = false;
+                regionDemosaiced = true;
+
+                for (auto crop : crops) {
+                    if (crop->get_skip() == 1) {
+                        const PreviewProps pp = crop->getSourceArea();
+                        detailCrops = true;
+
+                        if (pp.getWidth() <= 0 || pp.getHeight() <= 0 || !imgsrc->demosaicRegion(rp, pp, tr)) {
+                            regionDemosaiced = false;
+                            break;
+                        }
+                    }
+                }
+
+                regionDemosaiced = regionDemosaiced && detailCrops;
+            }
+
+            if (!regionDemosaiced) {
+                imgsrc->demosaic(rp, autoContrast, contrastThreshold, params->pdsharpening.enabled, superpixel);
+                superpixelPreviewDone = true;
+            }
+
+            ++sourceVersion;
 
             if (imgsrc->getSensorType() == ST_BAYER && bayerAutoContrastListener && autoContrast) {
                 bayerAutoContrastListener->autoContrastChanged(contrastThreshold);
@@ -453,6 +513,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             double pdSharpencontrastThreshold = params->pdsharpening.contrast;
             double pdSharpenRadius = params->pdsharpening.deconvradius;
             imgsrc->captureSharpening(params->pdsharpening, sharpMask, pdSharpencontrastThreshold, pdSharpenRadius);
+            ++sourceVersion;
 
             if (pdSharpenAutoContrastListener && params->pdsharpening.autoContrast) {
                 pdSharpenAutoContrastListener->autoContrastChanged(pdSharpencontrastThreshold);
@@ -468,7 +529,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 || (!highDetailRawComputed && highDetailNeeded)
                 || (params->toneCurve.hrenabled && params->toneCurve.method != "Color" && imgsrc->isRGBSourceModified())
                 || (!params->toneCurve.hrenabled && params->toneCurve.method == "Color" && imgsrc->isRGBSourceModified())) {
-            if (highDetailNeeded) {
+            if (highDetailNeeded && !regionDemosaiced) {
                 highDetailRawComputed = true;
             } else {
                 highDetailRawComputed = false;
@@ -479,6 +540,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 lhist16RETI.clear();
 
                 imgsrc->retinexPrepareBuffers(params->icm, params->retinex, conversionBuffer, lhist16RETI);
+                ++sourceVersion;
             }
         }
 
@@ -498,6 +560,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             imgsrc->retinexPrepareCurves(params->retinex, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, dehacontlutili, mapcontlutili, useHsl, lhist16RETI, histLRETI);
             float minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax;
             imgsrc->retinex(params->icm, params->retinex,  params->toneCurve, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, conversionBuffer, dehacontlutili, mapcontlutili, useHsl, minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax, histLRETI);   //enabled Retinex
+            ++sourceVersion;
 
             if (dehaListener) {
                 dehaListener->minmaxChanged(maxCD, minCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax);
@@ -618,78 +681,100 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             // Tells to the ImProcFunctions' tools what is the preview scale, which may lead to some simplifications
             ipf.setScale(scale);
 
-            imgsrc->getImage(currWB, tr, orig_prev, pp, params->toneCurve, params->raw);
+            const bool spotsApplied = (todo & M_SPOT) && params->spot.enabled && !params->spot.entries.empty();
+            const PreviewInitKey initKey = getPreviewInitKey(spotsApplied);
+            const auto previewInit = std::find_if(previewInits.begin(), previewInits.end(), [&initKey](const std::pair<PreviewInitKey, std::unique_ptr<Imagefloat>>& entry) {
+                return entry.first == initKey;
+            });
+
+            if (previewInit != previewInits.end()) {
+                // already computed for this scale and coarse transform
+                previewInit->second->copyData(orig_prev);
+                previewInits.splice(previewInits.begin(), previewInits, previewInit);
+                spotsDone = spotsApplied;
+                denoiseInfoStore.valid = false;
+            } else {
+                imgsrc->getImage(currWB, tr, orig_prev, pp, params->toneCurve, params->raw);
 
-            if ((todo & M_SPOT) && params->spot.enabled && !params->spot.entries.empty()) {
-                spotsDone = true;
-                PreviewProps pp(0, 0, fw, fh, scale);
-                ipf.removeSpots(orig_prev, imgsrc, params->spot.entries, pp, currWB, nullptr, tr);
-            }
+                if (spotsApplied) {
+                    spotsDone = true;
+                    PreviewProps pp(0, 0, fw, fh, scale);
+                    ipf.removeSpots(orig_prev, imgsrc, params->spot.entries, pp, currWB, nullptr, tr);
+                }
 
-            denoiseInfoStore.valid = false;
-            //ColorTemp::CAT02 (orig_prev, &params) ;
-            //   printf("orig_prevW=%d\n  scale=%d",orig_prev->width, scale);
-            /* Issue 2785, disabled some 1:1 tools
-                    if (todo & M_LINDENOISE) {
-                        DirPyrDenoiseParams denoiseParams = params->dirpyrDenoise;
-                        if (denoiseParams.enabled && (scale==1)) {
-                            Imagefloat *calclum = NULL ;
-
-                            denoiseParams.getCurves(noiseLCurve,noiseCCurve);
-                            int nbw=6;//nb tile W
-                            int nbh=4;//
-
-                            float ch_M[nbw*nbh];
-                            float max_r[nbw*nbh];
-                            float max_b[nbw*nbh];
-
-                            if (denoiseParams.Lmethod == "CUR") {
-                                if (noiseLCurve)
-                                    denoiseParams.luma = 0.5f;
-                                else
-                                    denoiseParams.luma = 0.0f;
-                            } else if (denoiseParams.Lmethod == "SLI")
-                                noiseLCurve.Reset();
-
-
-                            if (noiseLCurve || noiseCCurve){//only allocate memory if enabled and scale=1
-                                // we only need image reduced to 1/4 here
-                                calclum = new Imagefloat ((pW+1)/2, (pH+1)/2);//for luminance denoise curve
-                                for(int ii=0;ii<pH;ii+=2){
-                                    for(int jj=0;jj<pW;jj+=2){
-                                        calclum->r(ii>>1,jj>>1) = orig_prev->r(ii,jj);
-                                        calclum->g(ii>>1,jj>>1) = orig_prev->g(ii,jj);
-                                        calclum->b(ii>>1,jj>>1) = orig_prev->b(ii,jj);
+                denoiseInfoStore.valid = false;
+                //ColorTemp::CAT02 (orig_prev, &params) ;
+                //   printf("orig_prevW=%d\n  scale=%d",orig_prev->width, scale);
+                /* Issue 2785, disabled some 1:1 tools
+                        if (todo & M_LINDENOISE) {
+                            DirPyrDenoiseParams denoiseParams = params->dirpyrDenoise;
+                            if (denoiseParams.enabled && (scale==1)) {
+                                Imagefloat *calclum = NULL ;
+
+                                denoiseParams.getCurves(noiseLCurve,noiseCCurve);
+                                int nbw=6;//nb tile W
+                                int nbh=4;//
+
+                                float ch_M[nbw*nbh];
+                                float max_r[nbw*nbh];
+                                float max_b[nbw*nbh];
+
+                                if (denoiseParams.Lmethod == "CUR") {
+                                    if (noiseLCurve)
+                                        denoiseParams.luma = 0.5f;
+                                    else
+                                        denoiseParams.luma = 0.0f;
+                                } else if (denoiseParams.Lmethod == "SLI")
+                                    noiseLCurve.Reset();
+
+
+                                if (noiseLCurve || noiseCCurve){//only allocate memory if enabled and scale=1
+                                    // we only need image reduced to 1/4 here
+                                    calclum = new Imagefloat ((pW+1)/2, (pH+1)/2);//for luminance denoise curve
+                                    for(int ii=0;ii<pH;ii+=2){
+                                        for(int jj=0;jj<pW;jj+=2){
+                                            calclum->r(ii>>1,jj>>1) = orig_prev->r(ii,jj);
+                                            calclum->g(ii>>1,jj>>1) = orig_prev->g(ii,jj);
+                                            calclum->b(ii>>1,jj>>1) = orig_prev->b(ii,jj);
+                                        }
                                     }
+                                    imgsrc->convertColorSpace(calclum, params->icm, currWB);//calculate values after colorspace conversion
                                 }
-                                imgsrc->convertColorSpace(calclum, params->icm, currWB);//calculate values after colorspace conversion
-                            }
 
-                            int kall=1;
-                            ipf.RGB_denoise(kall, orig_prev, orig_prev, calclum, ch_M, max_r, max_b, imgsrc->isRAW(), denoiseParams, imgsrc->getDirPyrDenoiseExpComp(), noiseLCurve, noiseCCurve, chaut, redaut, blueaut, maxredaut, maxblueaut, nresi, highresi);
+                                int kall=1;
+                                ipf.RGB_denoise(kall, orig_prev, orig_prev, calclum, ch_M, max_r, max_b, imgsrc->isRAW(), denoiseParams, imgsrc->getDirPyrDenoiseExpComp(), noiseLCurve, noiseCCurve, chaut, redaut, blueaut, maxredaut, maxblueaut, nresi, highresi);
+                            }
                         }
+                */
+
+                if (params->filmNegative.enabled) {
+
+                    // Process film negative AFTER colorspace conversion
+                    if (params->filmNegative.colorSpace != FilmNegativeParams::ColorSpace::INPUT) {
+                        imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
                     }
-            */
 
-            if (params->filmNegative.enabled) {
+                    // Perform negative inversion. If needed, upgrade filmNegative params for backwards compatibility with old profiles
+                    if (ipf.filmNegativeProcess(orig_prev, orig_prev, params->filmNegative, params->raw, imgsrc, currWB) && filmNegListener) {
+                        filmNegListener->filmRefValuesChanged(params->filmNegative.refInput, params->filmNegative.refOutput);
+                    }
 
-                // Process film negative AFTER colorspace conversion
-                if (params->filmNegative.colorSpace != FilmNegativeParams::ColorSpace::INPUT) {
-                    imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
-                }
+                    // Process film negative BEFORE colorspace conversion (legacy mode)
+                    if (params->filmNegative.colorSpace == FilmNegativeParams::ColorSpace::INPUT) {
+                        imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
+                    }
 
-                // Perform negative inversion. If needed, upgrade filmNegative params for backwards compatibility with old profiles
-                if (ipf.filmNegativeProcess(orig_prev, orig_prev, params->filmNegative, params->raw, imgsrc, currWB) && filmNegListener) {
-                    filmNegListener->filmRefValuesChanged(params->filmNegative.refInput, params->filmNegative.refOutput);
+                } else {
+                    imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
                 }
 
-                // Process film negative BEFORE colorspace conversion (legacy mode)
-                if (params->filmNegative.colorSpace == FilmNegativeParams::ColorSpace::INPUT) {
-                    imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
+                if (previewInits.size() == maxPreviewInits) {
+                    previewInits.pop_back();
                 }
 
-            } else {
-                imgsrc->convertColorSpace(orig_prev, params->icm, currWB);
+                Imagefloat* const copy = new Imagefloat;
+                orig_prev->copyData(copy);
+                previewInits.emplace_front(initKey, std::unique_ptr<Imagefloat>(copy));
             }
 
             ipf.firstAnalysis(orig_prev, *params, vhist16);
@@ -1419,8 +1504,13 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 DCPProfileApplyState as;
                 DCPProfile *dcpProf = imgsrc->getDCP(params->icm, as);
 
-                ipf.rgbProc(oprevi, oprevl, nullptr, hltonecurve, shtonecurve, tonecurve, params->toneCurve.saturation,
-                            rCurve, gCurve, bCurve, colourToningSatLimit, colourToningSatLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, beforeToneCurveBW, afterToneCurveBW, rrm, ggm, bbm, bwAutoR, bwAutoG, bwAutoB, params->toneCurve.expcomp, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+                if (options.rgbProcFusedLutSize > 0) {
+                    ipf.rgbProcFused(options.rgbProcFusedLutSize, oprevi, oprevl, nullptr, hltonecurve, shtonecurve, tonecurve, params->toneCurve.saturation,
+                                rCurve, gCurve, bCurve, colourToningSatLimit, colourToningSatLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, beforeToneCurveBW, afterToneCurveBW, rrm, ggm, bbm, bwAutoR, bwAutoG, bwAutoB, params->toneCurve.expcomp, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+                } else {
+                    ipf.rgbProc(oprevi, oprevl, nullptr, hltonecurve, shtonecurve, tonecurve, params->toneCurve.saturation,
+                                rCurve, gCurve, bCurve, colourToningSatLimit, colourToningSatLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, beforeToneCurveBW, afterToneCurveBW, rrm, ggm, bbm, bwAutoR, bwAutoG, bwAutoB, params->toneCurve.expcomp, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+                }
 
                 if (params->blackwhite.enabled && params->blackwhite.autoc && abwListener) {
                     if (settings->verbose) {
@@ -1976,7 +2066,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
 // process crop, if needed
     for (size_t i = 0; i < crops.size(); i++)
-        if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
+        if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && !sidecarPreview) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
             crops[i]->update(todo);     // may call ourselves
         }
 
@@ -2014,18 +2104,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
         hist_lrgb_dirty = vectorscope_hc_dirty = vectorscope_hs_dirty = waveform_dirty = true;
         if (hListener) {
-            if (hListener->updateHistogram()) {
-                updateLRGBHistograms();
-            }
-            if (hListener->updateVectorscopeHC()) {
-                updateVectorscopeHC();
-            }
-            if (hListener->updateVectorscopeHS()) {
-                updateVectorscopeHS();
-            }
-            if (hListener->updateWaveform()) {
-                updateWaveforms();
-            }
+            updateScopes(hListener->updateHistogram(), hListener->updateVectorscopeHC(), hListener->updateVectorscopeHS(), hListener->updateWaveform());
             notifyHistogramChanged();
         }
     }
@@ -2034,6 +2113,21 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         delete oprevi;
         oprevi = nullptr;
     }
+
+    if (regionDemosaiced) {
+        // Only the detail windows got the full quality demosaic, queue the demosaic of the whole frame.
+        // M_RAW makes sure the next pass does not take the region path again.
+        paramsUpdateMutex.lock();
+        changeSinceLast |= M_HIGHQUAL | M_RAW;
+        paramsUpdateMutex.unlock();
+    } else if (superpixelPreview && !highDetailRawComputed) {
+        // The superpixel preview is displayed now, queue the full quality update.
+        // It is processed by the loop in process() after the changes which may have arrived meanwhile.
+        paramsUpdateMutex.lock();
+        changeSinceLast |= M_HIGHQUAL;
+        paramsUpdateMutex.unlock();
+        setHighQualComputed();
+    }
 }
 
 void ImProcCoordinator::setTweakOperator (TweakOperator *tOperator)
@@ -2100,8 +2194,45 @@ void ImProcCoordinator::allocCache (Imagefloat* &imgfloat)
     }
 }
 
+bool ImProcCoordinator::PreviewInitKey::operator ==(const PreviewInitKey& other) const
+{
+    return
+        sourceVersion == other.sourceVersion
+        && scale == other.scale
+        && tr == other.tr
+        && wbMul[0] == other.wbMul[0]
+        && wbMul[1] == other.wbMul[1]
+        && wbMul[2] == other.wbMul[2]
+        && hrenabled == other.hrenabled
+        && hrMethod == other.hrMethod
+        && clampOOG == other.clampOOG
+        && spotsApplied == other.spotsApplied
+        && raw == other.raw
+        && icm == other.icm
+        && (!spotsApplied || spot == other.spot)
+        && filmNegative == other.filmNegative;
+}
+
+ImProcCoordinator::PreviewInitKey ImProcCoordinator::getPreviewInitKey(bool spotsApplied) const
+{
+    PreviewInitKey key;
+    key.sourceVersion = sourceVersion;
+    key.scale = scale;
+    key.tr = getCoarseBitMask(params->coarse);
+    currWB.getMultipliers(key.wbMul[0], key.wbMul[1], key.wbMul[2]);
+    key.hrenabled = params->toneCurve.hrenabled;
+    key.hrMethod = params->toneCurve.method;
+    key.clampOOG = params->toneCurve.clampOOG;
+    key.spotsApplied = spotsApplied;
+    key.raw = params->raw;
+    key.icm = params->icm;
+    key.spot = params->spot;
+    key.filmNegative = params->filmNegative;
+    return key;
+}
+
 /** @brief Handles image buffer (re)allocation and trigger sizeChanged of SizeListener[s]
- * If the scale change, this method will free all buffers and reallocate ones of the new size.
+ * If the scale change, this method will resize all buffers to the new size.
  * It will then tell to the SizeListener that size has changed (sizeChanged)
  *
  * @param prevscale New Preview's scale.
@@ -2124,21 +2255,51 @@ void ImProcCoordinator::setScale(int prevscale)
 
     if (nW != pW || nH != pH) {
 
-        freeAll();
-
         pW = nW;
         pH = nH;
 
-        orig_prev = new Imagefloat(pW, pH);
-        oprevi = orig_prev;
-        oprevl = new LabImage(pW, pH);
-        nprevl = new LabImage(pW, pH);
+        if (allocated) {
+            // the size mostly changes with the coarse rotation, which keeps the number of pixels,
+            // so the buffers are resized in place instead of being freed and allocated again
+            if (spotprev && spotprev != oprevi) {
+                delete spotprev;
+            }
+
+            spotprev = nullptr;
+
+            if (orig_prev != oprevi) {
+                delete oprevi;
+            }
 
-        //ncie is only used in ImProcCoordinator::updatePreviewImage, it will be allocated on first use and deleted if not used anymore
-        previmg = new Image8(pW, pH);
-        workimg = new Image8(pW, pH);
+            orig_prev->allocate(pW, pH);
+            oprevi = orig_prev;
+            oprevl->allocate(pW, pH);
+            nprevl->allocate(pW, pH);
 
-        allocated = true;
+            delete ncie;
+            ncie = nullptr;
+
+            // previmg is handed to the image listener, so it is replaced
+            if (imageListener) {
+                imageListener->delImage(previmg);
+            } else {
+                delete previmg;
+            }
+
+            previmg = new Image8(pW, pH);
+            workimg->allocate(pW, pH);
+        } else {
+            orig_prev = new Imagefloat(pW, pH);
+            oprevi = orig_prev;
+            oprevl = new LabImage(pW, pH);
+            nprevl = new LabImage(pW, pH);
+
+            //ncie is only used in ImProcCoordinator::updatePreviewImage, it will be allocated on first use and deleted if not used anymore
+            previmg = new Image8(pW, pH);
+            workimg = new Image8(pW, pH);
+
+            allocated = true;
+        }
     }
 
     scale = prevscale;
@@ -2185,219 +2346,304 @@ void ImProcCoordinator::notifyHistogramChanged()
 
 bool ImProcCoordinator::updateLRGBHistograms()
 {
+    return updateScopes(true, false, false, false);
+}
+
+bool ImProcCoordinator::updateVectorscopeHC()
+{
+    return updateScopes(false, true, false, false);
+}
 
-    if (!hist_lrgb_dirty) {
+bool ImProcCoordinator::updateVectorscopeHS()
+{
+    return updateScopes(false, false, true, false);
+}
+
+bool ImProcCoordinator::updateWaveforms()
+{
+    if (!workimg) {
+        // free memory
+        waveformRed.free();
+        waveformGreen.free();
+        waveformBlue.free();
+        waveformLuma.free();
+        return true;
+    }
+
+    return updateScopes(false, false, false, true);
+}
+
+bool ImProcCoordinator::updateScopes(bool histogram, bool vectorscopeHC, bool vectorscopeHS, bool waveform)
+{
+    // only the scopes which are shown and not up to date with the current preview
+    histogram = histogram && hist_lrgb_dirty;
+    vectorscopeHC = vectorscopeHC && vectorscope_hc_dirty && workimg;
+    vectorscopeHS = vectorscopeHS && vectorscope_hs_dirty && workimg;
+    waveform = waveform && waveform_dirty && workimg;
+
+    if (!histogram && !vectorscopeHC && !vectorscopeHS && !waveform) {
         return false;
     }
 
     int x1, y1, x2, y2;
     params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
+    const int width = x2 - x1;
+
+    constexpr int size = VECTORSCOPE_SIZE;
+    constexpr float norm_factor = size / (128.f * 655.36f);
+    constexpr float luma_factor = 255.f / 32768.f;
+
+    // the H-C vectorscope uses the Lab values of the output image, converted by lcms beforehand
+    std::unique_ptr<float[]> outL, outa, outb;
+
+    if (vectorscopeHC) {
+        outL.reset(new float[width * (y2 - y1)]);
+        outa.reset(new float[width * (y2 - y1)]);
+        outb.reset(new float[width * (y2 - y1)]);
+        ipf.rgb2lab(*workimg, x1, y1, width, y2 - y1, outL.get(), outa.get(), outb.get(), params->icm);
+        vectorscope_hc.fill(0);
+    }
+
+    if (histogram) {
+        histChroma.clear();
+        histLuma.clear();
+        histRed.clear();
+        histGreen.clear();
+        histBlue.clear();
+    }
+
+    if (vectorscopeHS) {
+        vectorscope_hs.fill(0);
+    }
+
+    if (vectorscopeHC || vectorscopeHS) {
+        vectorscopeScale = width * (y2 - y1);
+    }
+
+    if (waveform) {
+        if (waveformRed.getWidth() != width) {
+            // Resize waveform arrays.
+            waveformRed(width, 256);
+            waveformGreen(width, 256);
+            waveformBlue(width, 256);
+            waveformLuma(width, 256);
+        }
+
+        // Start with zero.
+        waveformRed.fill(0);
+        waveformGreen.fill(0);
+        waveformBlue.fill(0);
+        waveformLuma.fill(0);
+    }
+
+    // The image is split into vertical strips, so that each waveform column is owned by one thread,
+    // while the histograms and vectorscopes are accumulated per thread.
+    constexpr int stripWidth = 64;
+    const int strips = (width + stripWidth - 1) / stripWidth;
 
 #ifdef _OPENMP
-    #pragma omp parallel sections
+    #pragma omp parallel
 #endif
     {
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histChroma.clear();
+        LUTu chromaThr(256, LUT_CLIP_BELOW | LUT_CLIP_ABOVE, true);
+        LUTu lumaThr(256, LUT_CLIP_BELOW | LUT_CLIP_ABOVE, true);
+        LUTu redThr(256, LUT_CLIP_BELOW | LUT_CLIP_ABOVE, true);
+        LUTu greenThr(256, LUT_CLIP_BELOW | LUT_CLIP_ABOVE, true);
+        LUTu blueThr(256, LUT_CLIP_BELOW | LUT_CLIP_ABOVE, true);
+        array2D<int> vectorscopeHCThr(vectorscopeHC ? size : 0, vectorscopeHC ? size : 0, ARRAY2D_CLEAR_DATA);
+        array2D<int> vectorscopeHSThr(vectorscopeHS ? size : 0, vectorscopeHS ? size : 0, ARRAY2D_CLEAR_DATA);
+        ALIGNED16 float red[stripWidth];
+        ALIGNED16 float green[stripWidth];
+        ALIGNED16 float blue[stripWidth];
+        ALIGNED16 int index0[stripWidth];
+        ALIGNED16 int index1[stripWidth];
 
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    histChroma[(int)(sqrtf(SQR(nprevl->a[i][j]) + SQR(nprevl->b[i][j])) / 188.f)]++;      //188 = 48000/256
-                }
-        }
 #ifdef _OPENMP
-        #pragma omp section
+        #pragma omp for schedule(dynamic) nowait
 #endif
-        {
-            histLuma.clear();
 
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    histLuma[(int)(nprevl->L[i][j] / 128.f)]++;
-                }
-        }
-#ifdef _OPENMP
-        #pragma omp section
+        for (int strip = 0; strip < strips; ++strip) {
+            const int xs = x1 + strip * stripWidth;
+            const int w = std::min(stripWidth, x2 - xs);
+
+            for (int i = y1; i < y2; ++i) {
+                const unsigned char* const rgb = workimg ? workimg->data + (i * pW + xs) * 3 : nullptr;
+                const float* const L = nprevl->L[i] + xs;
+
+                if (histogram) {
+                    const float* const a = nprevl->a[i] + xs;
+                    const float* const b = nprevl->b[i] + xs;
+                    int j = 0;
+#ifdef __SSE2__
+                    const vfloat chromaDivv = F2V(188.f); // 188 = 48000/256
+                    const vfloat lumaDivv = F2V(128.f);
+
+                    for (; j < w - 3; j += 4) {
+                        const vfloat av = LVFU(a[j]);
+                        const vfloat bv = LVFU(b[j]);
+                        _mm_store_si128(reinterpret_cast<vint*>(&index0[j]), _mm_cvttps_epi32(vsqrtf(SQRV(av) + SQRV(bv)) / chromaDivv));
+                        _mm_store_si128(reinterpret_cast<vint*>(&index1[j]), _mm_cvttps_epi32(LVFU(L[j]) / lumaDivv));
+                    }
+
 #endif
-        {
-            histRed.clear();
-            histGreen.clear();
-            histBlue.clear();
 
-            for (int i = y1; i < y2; i++)
-            {
-                int ofs = (i * pW + x1) * 3;
+                    for (; j < w; ++j) {
+                        index0[j] = sqrtf(SQR(a[j]) + SQR(b[j])) / 188.f;
+                        index1[j] = L[j] / 128.f;
+                    }
 
-                for (int j = x1; j < x2; j++) {
-                    int r = workimg->data[ofs++];
-                    int g = workimg->data[ofs++];
-                    int b = workimg->data[ofs++];
+                    for (j = 0; j < w; ++j) {
+                        chromaThr[index0[j]]++;
+                        lumaThr[index1[j]]++;
+                    }
 
-                    histRed[r]++;
-                    histGreen[g]++;
-                    histBlue[b]++;
+                    if (rgb) {
+                        for (j = 0; j < w; ++j) {
+                            redThr[rgb[3 * j]]++;
+                            greenThr[rgb[3 * j + 1]]++;
+                            blueThr[rgb[3 * j + 2]]++;
+                        }
+                    }
                 }
-            }
-        }
-    }
-
-    hist_lrgb_dirty = false;
-    return true;
 
-}
+                if (waveform) {
+                    int j = 0;
+#ifdef __SSE2__
+                    const vfloat luma_factorv = F2V(luma_factor);
+                    const vfloat maxv = F2V(255.f);
 
-bool ImProcCoordinator::updateVectorscopeHC()
-{
-    if (!workimg || !vectorscope_hc_dirty) {
-        return false;
-    }
+                    for (; j < w - 3; j += 4) {
+                        _mm_store_si128(reinterpret_cast<vint*>(&index0[j]), _mm_cvttps_epi32(vminf(vmaxf(LVFU(L[j]) * luma_factorv, ZEROV), maxv)));
+                    }
 
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
+#endif
 
-    constexpr int size = VECTORSCOPE_SIZE;
-    constexpr float norm_factor = size / (128.f * 655.36f);
-    vectorscope_hc.fill(0);
+                    for (; j < w; ++j) {
+                        index0[j] = LIM<int>(L[j] * luma_factor, 0, 255);
+                    }
 
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
+                    const int col0 = xs - x1;
 
-    const std::unique_ptr<float[]> a(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> b(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> L(new float[vectorscopeScale]);
-    ipf.rgb2lab(*workimg, x1, y1, x2 - x1, y2 - y1, L.get(), a.get(), b.get(), params->icm);
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            for (int j = x1, ofs_lab = (i - y1) * (x2 - x1); j < x2; ++j, ++ofs_lab) {
-                const int col = norm_factor * a[ofs_lab] + size / 2 + 0.5f;
-                const int row = norm_factor * b[ofs_lab] + size / 2 + 0.5f;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
+                    for (j = 0; j < w; ++j) {
+                        waveformRed[rgb[3 * j]][col0 + j]++;
+                        waveformGreen[rgb[3 * j + 1]][col0 + j]++;
+                        waveformBlue[rgb[3 * j + 2]][col0 + j]++;
+                        waveformLuma[index0[j]][col0 + j]++;
+                    }
                 }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
+
+                if (vectorscopeHC) {
+                    const int ofs_lab = (i - y1) * width + xs - x1;
+                    const float* const a = outa.get() + ofs_lab;
+                    const float* const b = outb.get() + ofs_lab;
+                    int j = 0;
+#ifdef __SSE2__
+                    const vfloat norm_factorv = F2V(norm_factor);
+                    const vfloat offsetv = F2V(size / 2 + 0.5f);
+
+                    for (; j < w - 3; j += 4) {
+                        _mm_store_si128(reinterpret_cast<vint*>(&index0[j]), _mm_cvttps_epi32(norm_factorv * LVFU(a[j]) + offsetv));
+                        _mm_store_si128(reinterpret_cast<vint*>(&index1[j]), _mm_cvttps_epi32(norm_factorv * LVFU(b[j]) + offsetv));
+                    }
+
 #endif
-        {
-            vectorscope_hc += vectorscopeThr;
-        }
-    }
 
-    vectorscope_hc_dirty = false;
-    return true;
-}
+                    for (; j < w; ++j) {
+                        index0[j] = norm_factor * a[j] + size / 2 + 0.5f;
+                        index1[j] = norm_factor * b[j] + size / 2 + 0.5f;
+                    }
 
-bool ImProcCoordinator::updateVectorscopeHS()
-{
-    if (!workimg || !vectorscope_hs_dirty) {
-        return false;
-    }
+                    for (j = 0; j < w; ++j) {
+                        const int col = index0[j];
+                        const int row = index1[j];
 
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
+                        if (col >= 0 && col < size && row >= 0 && row < size) {
+                            vectorscopeHCThr[row][col]++;
+                        }
+                    }
+                }
 
-    constexpr int size = VECTORSCOPE_SIZE;
-    vectorscope_hs.fill(0);
+                if (vectorscopeHS) {
+                    for (int j = 0; j < w; ++j) {
+                        red[j] = 257.f * rgb[3 * j];
+                        green[j] = 257.f * rgb[3 * j + 1];
+                        blue[j] = 257.f * rgb[3 * j + 2];
+                    }
 
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
+                    int j = 0;
+#ifdef __SSE2__
+                    const vfloat twoPiv = F2V(2.f * RT_PI_F);
+                    const vfloat halfSizev = F2V(size / 2);
+
+                    for (; j < w - 3; j += 4) {
+                        vfloat hv, sv, lv;
+                        Color::rgb2hsl(LVF(red[j]), LVF(green[j]), LVF(blue[j]), hv, sv, lv);
+                        const vfloat2 sincosv = xsincosf(twoPiv * hv);
+                        _mm_store_si128(reinterpret_cast<vint*>(&index0[j]), _mm_cvttps_epi32(sv * sincosv.y * halfSizev + halfSizev));
+                        _mm_store_si128(reinterpret_cast<vint*>(&index1[j]), _mm_cvttps_epi32(sv * sincosv.x * halfSizev + halfSizev));
+                    }
 
-#ifdef _OPENMP
-    #pragma omp parallel
 #endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            int ofs = (i * pW + x1) * 3;
-            for (int j = x1; j < x2; ++j) {
-                const float red = 257.f * workimg->data[ofs++];
-                const float green = 257.f * workimg->data[ofs++];
-                const float blue = 257.f * workimg->data[ofs++];
-                float h, s, l;
-                Color::rgb2hslfloat(red, green, blue, h, s, l);
-                const auto sincosval = xsincosf(2.f * RT_PI_F * h);
-                const int col = s * sincosval.y * (size / 2) + size / 2;
-                const int row = s * sincosval.x * (size / 2) + size / 2;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
+
+                    for (; j < w; ++j) {
+                        float h, s, l;
+                        Color::rgb2hslfloat(red[j], green[j], blue[j], h, s, l);
+                        const auto sincosval = xsincosf(2.f * RT_PI_F * h);
+                        index0[j] = s * sincosval.y * (size / 2) + size / 2;
+                        index1[j] = s * sincosval.x * (size / 2) + size / 2;
+                    }
+
+                    for (j = 0; j < w; ++j) {
+                        const int col = index0[j];
+                        const int row = index1[j];
+
+                        if (col >= 0 && col < size && row >= 0 && row < size) {
+                            vectorscopeHSThr[row][col]++;
+                        }
+                    }
                 }
             }
         }
+
 #ifdef _OPENMP
         #pragma omp critical
 #endif
         {
-            vectorscope_hs += vectorscopeThr;
-        }
-    }
+            if (histogram) {
+                histChroma += chromaThr;
+                histLuma += lumaThr;
+                histRed += redThr;
+                histGreen += greenThr;
+                histBlue += blueThr;
+            }
 
-    vectorscope_hs_dirty = false;
-    return true;
-}
+            if (vectorscopeHC) {
+                vectorscope_hc += vectorscopeHCThr;
+            }
 
-bool ImProcCoordinator::updateWaveforms()
-{
-    if (!workimg) {
-        // free memory
-        waveformRed.free();
-        waveformGreen.free();
-        waveformBlue.free();
-        waveformLuma.free();
-        return true;
+            if (vectorscopeHS) {
+                vectorscope_hs += vectorscopeHSThr;
+            }
+        }
     }
 
-    if (!waveform_dirty) {
-        return false;
+    if (histogram) {
+        hist_lrgb_dirty = false;
     }
 
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-    int waveform_width = waveformRed.getWidth();
-
-    if (waveform_width != x2 - x1) {
-        // Resize waveform arrays.
-        waveform_width = x2 - x1;
-        waveformRed(waveform_width, 256);
-        waveformGreen(waveform_width, 256);
-        waveformBlue(waveform_width, 256);
-        waveformLuma(waveform_width, 256);
+    if (vectorscopeHC) {
+        vectorscope_hc_dirty = false;
     }
 
-    // Start with zero.
-    waveformRed.fill(0);
-    waveformGreen.fill(0);
-    waveformBlue.fill(0);
-    waveformLuma.fill(0);
+    if (vectorscopeHS) {
+        vectorscope_hs_dirty = false;
+    }
 
-    constexpr float luma_factor = 255.f / 32768.f;
-    for (int i = y1; i < y2; i++) {
-        int ofs = (i * pW + x1) * 3;
-        float* L_row = nprevl->L[i] + x1;
-
-        for (int j = 0; j < waveform_width; j++) {
-            waveformRed[workimg->data[ofs++]][j]++;
-            waveformGreen[workimg->data[ofs++]][j]++;
-            waveformBlue[workimg->data[ofs++]][j]++;
-            waveformLuma[LIM<int>(L_row[j] * luma_factor, 0, 255)][j]++;
-        }
+    if (waveform) {
+        waveformScale = y2 - y1;
+        waveform_dirty = false;
     }
 
-    waveformScale = y2 - y1;
-    waveform_dirty = false;
     return true;
 }
 
@@ -2673,7 +2919,7 @@ void ImProcCoordinator::saveInputICCReference(const Glib::ustring& fname, bool a
 void ImProcCoordinator::stopProcessing()
 {
 
-    updaterThreadStart.lock();
+    lockUpdaterThreadStart();
 
     if (updaterRunning && thread) {
         changeSinceLast = 0;
@@ -2690,7 +2936,7 @@ void ImProcCoordinator::startProcessing()
 
     if (!destroying) {
         if (!updaterRunning) {
-            updaterThreadStart.lock();
+            lockUpdaterThreadStart();
             thread = nullptr;
             updaterRunning = true;
             updaterThreadStart.unlock();
@@ -18,6 +18,8 @@
  */
 #pragma once
 
+#include <atomic>
+#include <list>
 #include <memory>
 
 #include "array2D.h"
@@ -42,6 +44,7 @@ namespace rtengine
 using namespace procparams;
 
 class Crop;
+class CropTileCache;
 class TweakOperator;
 
 /** @brief Manages the image processing, espc. of the preview windows
@@ -92,6 +95,8 @@ protected:
     int scale;
     bool highDetailPreprocessComputed;
     bool highDetailRawComputed;
+    // with the superpixel preview demosaic, only the first demosaic is a superpixel one
+    bool superpixelPreviewDone;
     bool allocated;
 
     void freeAll();
@@ -203,6 +208,35 @@ protected:
     std::vector<SizeListener*> sizeListeners;
 
     std::vector<Crop*> crops;
+    unsigned int imageVersion; // incremented by each updatePreviewImage, the tiles of the crops belong to one version
+    const std::unique_ptr<CropTileCache> cropTiles; // rendered tiles of the 100% crops, shared by them
+    Crop* tileRenderer; // renders the missing tiles of cropTiles, not part of crops
+
+    // what the initial preview image (orig_prev after the conversion to the working space) depends on
+    struct PreviewInitKey {
+        unsigned int sourceVersion;
+        int scale;
+        int tr;
+        double wbMul[3];
+        bool hrenabled;
+        Glib::ustring hrMethod;
+        bool clampOOG;
+        bool spotsApplied;
+        procparams::RAWParams raw;
+        procparams::ColorManagementParams icm;
+        procparams::SpotParams spot;
+        procparams::FilmNegativeParams filmNegative;
+
+        bool operator ==(const PreviewInitKey& other) const;
+    };
+
+    static constexpr std::size_t maxPreviewInits = 3;
+    unsigned int sourceVersion; // incremented whenever the data of imgsrc changes
+    // initial preview images of the recently used scales and coarse transforms, most recently used first,
+    // so that going back to one of them (e.g. rotating back) does not convert the raw data again
+    std::list<std::pair<PreviewInitKey, std::unique_ptr<Imagefloat>>> previewInits;
+
+    PreviewInitKey getPreviewInitKey(bool spotsApplied) const;
 
     bool resultValid;
 
@@ -221,6 +255,8 @@ protected:
     bool updateVectorscopeHS();
     /// Updates all waveforms. Returns true unless not updated.
     bool updateWaveforms();
+    /// Updates the requested scopes in a single pass over the preview. Returns true unless none was updated.
+    bool updateScopes(bool histogram, bool vectorscopeHC, bool vectorscopeHS, bool waveform);
     void setScale(int prevscale);
     void updatePreviewImage (int todo, bool panningRelatedChange);
 
@@ -242,6 +278,17 @@ protected:
     MyMutex paramsUpdateMutex;
     int  changeSinceLast;
     bool updaterRunning;
+    // the threads waiting for updaterThreadStart, and whether an updateTryLock failed since the last crop update:
+    // the crop updaters stop prefetching their tiles for them (see Crop::fullUpdate)
+    std::atomic<int> updaterThreadStartWaiters;
+    std::atomic<bool> updaterThreadStartMissed;
+
+    void lockUpdaterThreadStart()
+    {
+        ++updaterThreadStartWaiters;
+        updaterThreadStart.lock();
+        --updaterThreadStartWaiters;
+    }
     const std::unique_ptr<ProcParams> nextParams;
     bool destroying;
     bool utili;
@@ -447,7 +494,12 @@ public:
     ProcEvent setSharpMask (bool sharpMask) override;
     bool updateTryLock () override
     {
-        return updaterThreadStart.trylock();
+        if (updaterThreadStart.trylock()) {
+            return true;
+        }
+
+        updaterThreadStartMissed = true;
+        return false;
     }
     void updateUnLock () override
     {
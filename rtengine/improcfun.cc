@@ -35,6 +35,8 @@
 #include "curves.h"
 #include "dcp.h"
 #include "EdgePreservingDecomposition.h"
+#include "fusedrgblut.h"
+#include "gamutboundary.h"
 #include "iccmatrices.h"
 #include "iccstore.h"
 #include "imagesource.h"
@@ -1017,6 +1019,7 @@ void ImProcFunctions::ciecam_02float(CieImage* ncie, float adap, int pW, int pwb
             { (float)wiprof[1][0], (float)wiprof[1][1], (float)wiprof[1][2]},
             { (float)wiprof[2][0], (float)wiprof[2][1], (float)wiprof[2][2]}
         };
+        const GamutBoundary* const gamutBoundary = gamu == 1 ? &GamutBoundary::get(params->icm.workingProfile) : nullptr;
 
 #ifdef __SSE2__
         int bufferLength = ((width + 3) / 4) * 4; // bufferLength has to be a multiple of 4
@@ -1486,7 +1489,7 @@ void ImProcFunctions::ciecam_02float(CieImage* ncie, float adap, int pW, int pwb
 
 
                                 //gamut control : Lab values are in gamut
-                                Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f);
+                                Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                                 lab->L[i][j] = Lprov1 * 327.68f;
                                 lab->a[i][j] = 327.68f * Chprov1 * sincosval.y;
                                 lab->b[i][j] = 327.68f * Chprov1 * sincosval.x;
@@ -1541,7 +1544,7 @@ void ImProcFunctions::ciecam_02float(CieImage* ncie, float adap, int pW, int pwb
                         }
 
                         //gamut control : Lab values are in gamut
-                        Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f);
+                        Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                         lab->L[i][j] = Lprov1 * 327.68f;
                         lab->a[i][j] = 327.68f * Chprov1 * sincosval.y;
                         lab->b[i][j] = 327.68f * Chprov1 * sincosval.x;
@@ -1793,7 +1796,7 @@ void ImProcFunctions::ciecam_02float(CieImage* ncie, float adap, int pW, int pwb
 
 
                             //gamut control : Lab values are in gamut
-                            Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f);
+                            Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f, gamutBoundary);
 
                             lab->L[i][j] = Lprov1 * 327.68f;
                             lab->a[i][j] = 327.68f * Chprov1 * sincosval.y;
@@ -1848,7 +1851,7 @@ void ImProcFunctions::ciecam_02float(CieImage* ncie, float adap, int pW, int pwb
                             }
 
                             //gamut control : Lab values are in gamut
-                            Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f);
+                            Color::gamutLchonly(sincosval, Lprov1, Chprov1, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                             lab->L[i][j] = Lprov1 * 327.68f;
                             lab->a[i][j] = 327.68f * Chprov1 * sincosval.y;
                             lab->b[i][j] = 327.68f * Chprov1 * sincosval.x;
@@ -1964,7 +1967,8 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                                const ColorGradientCurve& ctColorCurve, const OpacityCurve& ctOpacityCurve, bool opautili, const LUTf& clToningcurve, const LUTf& cl2Toningcurve,
                                const ToneCurve& customToneCurve1, const ToneCurve& customToneCurve2, const ToneCurve& customToneCurvebw1, const ToneCurve& customToneCurvebw2,
                                double &rrm, double &ggm, double &bbm, float &autor, float &autog, float &autob, double expcomp, int hlcompr, int hlcomprthresh,
-                               DCPProfile *dcpProf, const DCPProfileApplyState& asIn, LUTu& histToneCurve, size_t chunkSize, bool measure)
+                               DCPProfile *dcpProf, const DCPProfileApplyState& asIn, LUTu& histToneCurve, size_t chunkSize, bool measure,
+                               float* histToneCurveValues)
 {
 
     std::unique_ptr<StopWatch> stop;
@@ -2092,40 +2096,9 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
     }
 
     std::shared_ptr<HaldCLUT> hald_clut;
-    bool clutAndWorkingProfilesAreSame = false;
-    TMatrix xyz2clut = {}, clut2xyz = {};
-#ifdef __SSE2__
-    vfloat v_work2xyz[3][3] ALIGNED16;
-    vfloat v_xyz2clut[3][3] ALIGNED16;
-    vfloat v_clut2xyz[3][3] ALIGNED16;
-    vfloat v_xyz2work[3][3] ALIGNED16;
-#endif
 
     if (params->filmSimulation.enabled && !params->filmSimulation.clutFilename.empty()) {
-        hald_clut = CLUTStore::getInstance().getClut(params->filmSimulation.clutFilename);
-
-        if (hald_clut) {
-            clutAndWorkingProfilesAreSame = hald_clut->getProfile() == params->icm.workingProfile;
-
-            if (!clutAndWorkingProfilesAreSame) {
-                xyz2clut = ICCStore::getInstance()->workingSpaceInverseMatrix(hald_clut->getProfile());
-                clut2xyz = ICCStore::getInstance()->workingSpaceMatrix(hald_clut->getProfile());
-
-#ifdef __SSE2__
-
-                for (int i = 0; i < 3; ++i) {
-                    for (int j = 0; j < 3; ++j) {
-                        v_work2xyz[i][j] = F2V(wprof[i][j]);
-                        v_xyz2clut[i][j] = F2V(xyz2clut[i][j]);
-                        v_xyz2work[i][j] = F2V(wiprof[i][j]);
-                        v_clut2xyz[i][j] = F2V(clut2xyz[i][j]);
-                    }
-                }
-
-#endif
-
-            }
-        }
+        hald_clut = CLUTStore::getInstance().getClut(params->filmSimulation.clutFilename, params->icm.workingProfile);
     }
 
     const float film_simulation_strength = static_cast<float>(params->filmSimulation.strength) / 100.0f;
@@ -2139,6 +2112,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
     ToneCurveMode curveMode = params->toneCurve.curveMode;
     ToneCurveMode curveMode2 = params->toneCurve.curveMode2;
     bool highlight = params->toneCurve.hrenabled;//Get the value if "highlight reconstruction" is activated
+    const GamutBoundary* const gamutBoundary = settings->rgbcurveslumamode_gamut || params->blackwhite.enabled ? &GamutBoundary::get(params->icm.workingProfile) : nullptr;
     bool hasToneCurve1 = bool (customToneCurve1);
     bool hasToneCurve2 = bool (customToneCurve2);
     BlackWhiteParams::TcMode beforeCurveMode = params->blackwhite.beforeCurveMode;
@@ -2300,9 +2274,6 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
         }
 
         float out_rgbx[4 * TS] ALIGNED16; // Line buffer for CLUT
-        float clutr[TS] ALIGNED16;
-        float clutg[TS] ALIGNED16;
-        float clutb[TS] ALIGNED16;
 
         LUTu histToneCurveThr;
 
@@ -2391,6 +2362,10 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                             int y = CLIP<int> (lumimulf[0] * Color::gamma2curve[rtemp[ti * TS + tj]] + lumimulf[1] * Color::gamma2curve[gtemp[ti * TS + tj]] + lumimulf[2] * Color::gamma2curve[btemp[ti * TS + tj]]);
                             histToneCurveThr[y >> histToneCurveCompression]++;
 
+                            if (histToneCurveValues) {
+                                histToneCurveValues[static_cast<size_t>(i) * working->getWidth() + j] = y;
+                            }
+
                             setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], r, g, b);
                         }
                     }
@@ -2539,7 +2514,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                                     }
 
                                     //gamut control : Lab values are in gamut
-                                    Color::gamutLchonly(HH, sincosval, Lpro, Chpro, r, g, b, wip, highlight, 0.15f, 0.96f);
+                                    Color::gamutLchonly(HH, sincosval, Lpro, Chpro, r, g, b, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                                     //end of gamut control
                                 } else {
                                     float x_, y_, z_;
@@ -2942,7 +2917,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                                 float RR, GG, BB;
                                 L /= 327.68f;
                                 //gamut control : Lab values are in gamut
-                                Color::gamutLchonly(HH, sincosval, L, CC, RR, GG, BB, wip, highlight, 0.15f, 0.96f);
+                                Color::gamutLchonly(HH, sincosval, L, CC, RR, GG, BB, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                                 L *= 327.68f;
                                 //convert l => rgb
                                 Color::L2XYZ(L, X, Y, Z);
@@ -2976,115 +2951,18 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                 if (hald_clut) {
 
                     for (int i = istart, ti = 0; i < tH; i++, ti++) {
-                        if (!clutAndWorkingProfilesAreSame) {
-                            // Convert from working to clut profile
-                            int j = jstart;
-                            int tj = 0;
-
-#ifdef __SSE2__
-
-                            for (; j < tW - 3; j += 4, tj += 4) {
-                                vfloat sourceR = LVF(rtemp[ti * TS + tj]);
-                                vfloat sourceG = LVF(gtemp[ti * TS + tj]);
-                                vfloat sourceB = LVF(btemp[ti * TS + tj]);
-
-                                vfloat x;
-                                vfloat y;
-                                vfloat z;
-                                Color::rgbxyz(sourceR, sourceG, sourceB, x, y, z, v_work2xyz);
-                                Color::xyz2rgb(x, y, z, sourceR, sourceG, sourceB, v_xyz2clut);
-
-                                STVF(clutr[tj], sourceR);
-                                STVF(clutg[tj], sourceG);
-                                STVF(clutb[tj], sourceB);
-                            }
-
-#endif
-
-                            for (; j < tW; j++, tj++) {
-                                float sourceR = rtemp[ti * TS + tj];
-                                float sourceG = gtemp[ti * TS + tj];
-                                float sourceB = btemp[ti * TS + tj];
-
-                                float x, y, z;
-                                Color::rgbxyz(sourceR, sourceG, sourceB, x, y, z, wprof);
-                                Color::xyz2rgb(x, y, z, clutr[tj], clutg[tj], clutb[tj], xyz2clut);
-                            }
-                        } else {
-                            memcpy(clutr, &rtemp[ti * TS], sizeof(float) * TS);
-                            memcpy(clutg, &gtemp[ti * TS], sizeof(float) * TS);
-                            memcpy(clutb, &btemp[ti * TS], sizeof(float) * TS);
-                        }
-
-                        for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            float &sourceR = clutr[tj];
-                            float &sourceG = clutg[tj];
-                            float &sourceB = clutb[tj];
-
-                            // Apply gamma sRGB (default RT)
-                            sourceR = Color::gamma_srgbclipped(sourceR);
-                            sourceG = Color::gamma_srgbclipped(sourceG);
-                            sourceB = Color::gamma_srgbclipped(sourceB);
-                        }
-
+                        // the conversions from and to the CLUT's profile are done by getRGB
                         hald_clut->getRGB(
                             film_simulation_strength,
                             std::min(TS, tW - jstart),
-                            clutr,
-                            clutg,
-                            clutb,
+                            &rtemp[ti * TS],
+                            &gtemp[ti * TS],
+                            &btemp[ti * TS],
                             out_rgbx
                         );
 
                         for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            float &sourceR = clutr[tj];
-                            float &sourceG = clutg[tj];
-                            float &sourceB = clutb[tj];
-
-                            // Apply inverse gamma sRGB
-                            sourceR = Color::igamma_srgb(out_rgbx[tj * 4 + 0]);
-                            sourceG = Color::igamma_srgb(out_rgbx[tj * 4 + 1]);
-                            sourceB = Color::igamma_srgb(out_rgbx[tj * 4 + 2]);
-                        }
-
-                        if (!clutAndWorkingProfilesAreSame) {
-                            // Convert from clut to working profile
-                            int j = jstart;
-                            int tj = 0;
-
-#ifdef __SSE2__
-
-                            for (; j < tW - 3; j += 4, tj += 4) {
-                                vfloat sourceR = LVF(clutr[tj]);
-                                vfloat sourceG = LVF(clutg[tj]);
-                                vfloat sourceB = LVF(clutb[tj]);
-
-                                vfloat x;
-                                vfloat y;
-                                vfloat z;
-                                Color::rgbxyz(sourceR, sourceG, sourceB, x, y, z, v_clut2xyz);
-                                Color::xyz2rgb(x, y, z, sourceR, sourceG, sourceB, v_xyz2work);
-
-                                STVF(clutr[tj], sourceR);
-                                STVF(clutg[tj], sourceG);
-                                STVF(clutb[tj], sourceB);
-                            }
-
-#endif
-
-                            for (; j < tW; j++, tj++) {
-                                float &sourceR = clutr[tj];
-                                float &sourceG = clutg[tj];
-                                float &sourceB = clutb[tj];
-
-                                float x, y, z;
-                                Color::rgbxyz(sourceR, sourceG, sourceB, x, y, z, clut2xyz);
-                                Color::xyz2rgb(x, y, z, sourceR, sourceG, sourceB, wiprof);
-                            }
-                        }
-
-                        for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], clutr[tj], clutg[tj], clutb[tj]);
+                            setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], out_rgbx[tj * 4 + 0], out_rgbx[tj * 4 + 1], out_rgbx[tj * 4 + 2]);
                         }
                     }
                 }
@@ -4229,6 +4107,7 @@ void ImProcFunctions::chromiLuminanceCurve (PipetteBuffer *pipetteBuffer, int pW
 
 
     const bool gamutLch = settings->gamutLch;
+    const GamutBoundary* const gamutBoundary = avoidColorShift ? &GamutBoundary::get(params->icm.workingProfile) : nullptr;
     const float amountchroma = (float) settings->amchroma;
 
     TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix (params->icm.workingProfile);
@@ -4262,7 +4141,7 @@ void ImProcFunctions::chromiLuminanceCurve (PipetteBuffer *pipetteBuffer, int pW
 
                 // only if user activate Lab adjustments
                 if (autili || butili || ccutili ||  cclutili || chutili || lhutili || hhutili || clcutili || utili || chromaticity) {
-                    Color::LabGamutMunsell(lold->L[i], lold->a[i], lold->b[i], W, /*corMunsell*/true, /*lumaMuns*/false, params->toneCurve.hrenabled, /*gamut*/true, wip);
+                    Color::LabGamutMunsell(lold->L[i], lold->a[i], lold->b[i], W, /*corMunsell*/true, /*lumaMuns*/false, params->toneCurve.hrenabled, /*gamut*/true, wip, gamutBoundary);
                 }
 
 #ifdef __SSE2__
@@ -4709,7 +4588,7 @@ void ImProcFunctions::chromiLuminanceCurve (PipetteBuffer *pipetteBuffer, int pW
                     if (gamutLch) {
                         float R, G, B;
                         //gamut control : Lab values are in gamut
-                        Color::gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f);
+                        Color::gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f, gamutBoundary);
                         lnew->L[i][j] = Lprov1 * 327.68f;
                         lnew->a[i][j] = 327.68f * Chprov1 * sincosval.y;
                         lnew->b[i][j] = 327.68f * Chprov1 * sincosval.x;
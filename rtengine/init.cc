@@ -16,8 +16,10 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <cstdio>
 #include <fftw3.h>
 #include "../rtgui/profilestorecombobox.h"
+#include "bufferpool.h"
 #include "color.h"
 #include "rtengine.h"
 #include "iccstore.h"
@@ -46,66 +48,55 @@ MyMutex *fftwMutex = nullptr;
 int init (const Settings* s, const Glib::ustring& baseDir, const Glib::ustring& userSettingsDir, bool loadAll)
 {
     settings = s;
+    BufferPool::getInstance().setCapacity(static_cast<std::size_t>(std::max(s->bufferPoolSize, 0)) * 1024 * 1024);
     ProcParams::init();
     PerceptualToneCurve::init();
     RawImageSource::init();
 
-#ifdef _OPENMP
-#pragma omp parallel sections if (!settings->verbose)
-#endif
-{
-#ifdef _OPENMP
-#pragma omp section
-#endif
-{
+    // these only record their paths, the lens database, the camera constants and the
+    // dark frame and flat field folders are read when they are first needed
     if (s->lensfunDbDirectory.empty() || Glib::path_is_absolute(s->lensfunDbDirectory)) {
         LFDatabase::init(s->lensfunDbDirectory);
     } else {
         LFDatabase::init(Glib::build_filename(baseDir, s->lensfunDbDirectory));
     }
-}
-#ifdef _OPENMP
-#pragma omp section
-#endif
-{
-    ProfileStore::getInstance()->init(loadAll);
-}
-#ifdef _OPENMP
-#pragma omp section
-#endif
-{
-    ICCStore::getInstance()->init(s->iccDirectory, Glib::build_filename (baseDir, "iccprofiles"), loadAll);
-}
+
+    CameraConstantsStore::getInstance()->init(baseDir, userSettingsDir);
+    dfm.init(s->darkFramesPath);
+    ffm.init(s->flatFieldsPath);
+
 #ifdef _OPENMP
-#pragma omp section
+#pragma omp parallel sections if (!settings->verbose)
 #endif
 {
-    DCPStore::getInstance()->init(Glib::build_filename (baseDir, "dcpprofiles"), loadAll);
-}
 #ifdef _OPENMP
 #pragma omp section
 #endif
 {
-    CameraConstantsStore::getInstance()->init(baseDir, userSettingsDir);
+    ProfileStore::getInstance()->init(loadAll);
 }
 #ifdef _OPENMP
 #pragma omp section
 #endif
 {
-    dfm.init(s->darkFramesPath);
+    ICCStore::getInstance()->init(s->iccDirectory, Glib::build_filename (baseDir, "iccprofiles"), loadAll);
 }
 #ifdef _OPENMP
 #pragma omp section
 #endif
 {
-    ffm.init(s->flatFieldsPath);
+    DCPStore::getInstance()->init(Glib::build_filename (baseDir, "dcpprofiles"), loadAll);
 }
 }
 
     Color::init ();
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
+    // fftwMutex only serialises the FFTW planner, the plans are executed concurrently
     fftwMutex = new MyMutex;
+#ifdef RT_FFTW3F_OMP
+    fftwf_init_threads();
+#endif
     return 0;
 }
 
@@ -121,6 +112,12 @@ void cleanup ()
     fftwf_cleanup();
 #endif
 
+    if (settings->verbose) {
+        const BufferPool::Stats stats = BufferPool::getInstance().getStats();
+        printf("Buffer pool: %zu of %zu buffers reused, peak %zu MB\n", stats.reused, stats.allocations, stats.peak >> 20);
+    }
+
+    BufferPool::getInstance().trim();
 }
 
 StagedImageProcessor* StagedImageProcessor::create (InitialImage* initialImage)
@@ -0,0 +1,356 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fused version of rgbProc
+ *
+ * All the operations of rgbProc (channel mixer, exposure and tone curves, DCP look table, RGB curves,
+ * HSV equalizer, colour toning, black & white, film simulation) are point-wise, so their combined
+ * effect is a function of the input RGB triplet only. That function is evaluated once on a regular
+ * grid by running rgbProc itself on a small image holding the grid nodes, and the resulting 3D LUT is
+ * then applied to the whole image with tetrahedral interpolation.
+ *
+ * The tone curve histogram (which is computed in the middle of rgbProc) is baked as a fourth channel.
+ * Pixels outside of the grid's domain (negative or above 65535) go through the exact path.
+ *
+ * The LUT is kept in the ImProcFunctions instance and only rebuilt when the curves or the parameters it
+ * depends on change, so the preview, the detail windows and their panning share a single baking.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "color.h"
+#include "fusedrgblut.h"
+#include "imagefloat.h"
+#include "improcfun.h"
+#include "labimage.h"
+#include "LUT.h"
+#include "lut3d.h"
+#include "pipettebuffer.h"
+#include "procparams.h"
+#include "rt_math.h"
+#include "settings.h"
+#include "StopWatch.h"
+
+#include "../rtgui/editcallbacks.h"
+
+namespace
+{
+
+// The grid is not linear in the input: the nodes are distributed along a gamma curve
+// to get more of them in the shadows, where the tone curves are the steepest.
+constexpr float fusedLutGamma = 2.4f;
+
+float gridToValue(int index, int lutSize)
+{
+    return 65535.f * std::pow(static_cast<float>(index) / (lutSize - 1), fusedLutGamma);
+}
+
+// FNV-1a hash of the values of a curve
+std::uint64_t hashCurve(const LUTf& curve)
+{
+    const unsigned int size = curve ? curve.getSize() : 0;
+    std::uint64_t hash = 14695981039346656037ULL ^ size;
+
+    for (unsigned int i = 0; i < size; ++i) {
+        std::uint32_t bits;
+        const float value = curve[static_cast<int>(i)];
+        std::memcpy(&bits, &value, sizeof(bits));
+        hash = (hash ^ bits) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+}
+
+namespace rtengine
+{
+
+using namespace procparams;
+
+void ImProcFunctions::rgbProcFused(int lutSize, Imagefloat* working, LabImage* lab, PipetteBuffer *pipetteBuffer, const LUTf& hltonecurve, const LUTf& shtonecurve, const LUTf& tonecurve,
+                                   int sat, const LUTf& rCurve, const LUTf& gCurve, const LUTf& bCurve, float satLimit, float satLimitOpacity,
+                                   const ColorGradientCurve& ctColorCurve, const OpacityCurve& ctOpacityCurve, bool opautili, const LUTf& clToningcurve, const LUTf& cl2Toningcurve,
+                                   const ToneCurve& customToneCurve1, const ToneCurve& customToneCurve2, const ToneCurve& customToneCurvebw1, const ToneCurve& customToneCurvebw2,
+                                   double &rrm, double &ggm, double &bbm, float &autor, float &autog, float &autob, double expcomp, int hlcompr, int hlcomprthresh,
+                                   DCPProfile *dcpProf, const DCPProfileApplyState& asIn, LUTu& histToneCurve)
+{
+    const int W = working->getWidth();
+    const int H = working->getHeight();
+
+    const bool editing = pipetteBuffer && pipetteBuffer->getEditID() != EUID_None;
+    // the auto channel mixer of B&W needs statistics of the whole image
+    const bool bwAutoMixer = params->blackwhite.enabled && params->blackwhite.autoc && autor < -5000.f;
+
+    if (editing || bwAutoMixer || lutSize < 2) {
+        rgbProc(working, lab, pipetteBuffer, hltonecurve, shtonecurve, tonecurve, sat, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili,
+                clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob,
+                expcomp, hlcompr, hlcomprthresh, dcpProf, asIn, histToneCurve);
+        return;
+    }
+
+    // everything rgbProc depends on, apart from the pixels. The ToneCurve, ColorGradientCurve and OpacityCurve objects
+    // are built from the parameters, so they are covered by them.
+    FusedRgbLut::Key key;
+    key.lutSize = lutSize;
+    key.curves = {{
+        hashCurve(hltonecurve), hashCurve(shtonecurve), hashCurve(tonecurve), hashCurve(rCurve),
+        hashCurve(gCurve), hashCurve(bCurve), hashCurve(clToningcurve), hashCurve(cl2Toningcurve)
+    }};
+    key.sat = sat;
+    key.satLimit = satLimit;
+    key.satLimitOpacity = satLimitOpacity;
+    key.opautili = opautili;
+    key.autor = autor;
+    key.autog = autog;
+    key.autob = autob;
+    key.expcomp = expcomp;
+    key.hlcompr = hlcompr;
+    key.hlcomprthresh = hlcomprthresh;
+    key.dcpProf = dcpProf;
+    key.toneCurve = params->toneCurve;
+    key.rgbCurves = params->rgbCurves;
+    key.colorToning = params->colorToning;
+    key.chmixer = params->chmixer;
+    key.blackwhite = params->blackwhite;
+    key.hsvequalizer = params->hsvequalizer;
+    key.filmSimulation = params->filmSimulation;
+    key.dirpyrequalizer = params->dirpyrequalizer;
+    key.icm = params->icm;
+
+    if (!fusedRgbLut) {
+        fusedRgbLut.reset(new FusedRgbLut);
+    }
+
+    FusedRgbLut& cache = *fusedRgbLut;
+    const bool cached = cache.lut && cache.key == key;
+
+    // baking costs about one rgbProc call on lutSize^3 pixels, which is paid back by the next calls with the same settings
+    const bool worthIt = static_cast<std::size_t>(W) * H >= static_cast<std::size_t>(lutSize) * lutSize * lutSize;
+
+    if (!cached && (!worthIt || !cache.lut.init(lutSize))) {
+        rgbProc(working, lab, pipetteBuffer, hltonecurve, shtonecurve, tonecurve, sat, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili,
+                clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob,
+                expcomp, hlcompr, hlcomprthresh, dcpProf, asIn, histToneCurve);
+        return;
+    }
+
+    BENCHFUN
+
+    const int toneCurveHistSize = histToneCurve ? histToneCurve.getSize() : 0;
+    const int histToneCurveCompression = toneCurveHistSize > 0 ? log2(65536 / toneCurveHistSize) : 0;
+    LUT3D& lut = cache.lut;
+
+    if (cached) {
+        rrm = cache.rrm;
+        ggm = cache.ggm;
+        bbm = cache.bbm;
+    } else {
+        // bake the LUT: one grid node per pixel, r varies along the rows, g and b inside the rows
+        Imagefloat grid(lutSize * lutSize, lutSize);
+        std::vector<float> gridValues(lutSize);
+
+        for (int k = 0; k < lutSize; ++k) {
+            gridValues[k] = gridToValue(k, lutSize);
+        }
+
+        for (int ir = 0; ir < lutSize; ++ir) {
+            for (int ig = 0; ig < lutSize; ++ig) {
+                for (int ib = 0; ib < lutSize; ++ib) {
+                    grid.r(ir, ig * lutSize + ib) = gridValues[ir];
+                    grid.g(ir, ig * lutSize + ib) = gridValues[ig];
+                    grid.b(ir, ig * lutSize + ib) = gridValues[ib];
+                }
+            }
+        }
+
+        LabImage gridLab(lutSize * lutSize, lutSize);
+        // full resolution histogram, so that the per pixel values are not compressed.
+        // Always baked, so that the LUT can be reused by the calls which need the histogram.
+        LUTu gridHist(65536);
+        std::vector<float> gridHistValues(static_cast<std::size_t>(lutSize) * lutSize * lutSize);
+
+        rgbProc(&grid, &gridLab, nullptr, hltonecurve, shtonecurve, tonecurve, sat, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili,
+                clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob,
+                expcomp, hlcompr, hlcomprthresh, dcpProf, asIn, gridHist, 1, false, gridHistValues.data());
+
+        for (int ir = 0; ir < lutSize; ++ir) {
+            for (int ig = 0; ig < lutSize; ++ig) {
+                for (int ib = 0; ib < lutSize; ++ib) {
+                    const int col = ig * lutSize + ib;
+                    float* const node = lut.node(ir, ig, ib);
+                    node[0] = gridLab.L[ir][col];
+                    node[1] = gridLab.a[ir][col];
+                    node[2] = gridLab.b[ir][col];
+                    node[3] = gridHistValues[static_cast<std::size_t>(ir) * lutSize * lutSize + col];
+                }
+            }
+        }
+
+        cache.key = key;
+        cache.rrm = rrm;
+        cache.ggm = ggm;
+        cache.bbm = bbm;
+    }
+
+    // maps the [0 ; 65535] input range to node units
+    LUTf toGrid(65536);
+
+    for (int i = 0; i < 65536; ++i) {
+        toGrid[i] = (lutSize - 1) * std::pow(i / 65535.f, 1.f / fusedLutGamma);
+    }
+
+    if (toneCurveHistSize > 0) {
+        histToneCurve.clear();
+    }
+
+    // indexes of the pixels which are not covered by the LUT
+    std::vector<std::size_t> outOfDomain;
+
+#ifdef _OPENMP
+    #pragma omp parallel if (multiThread)
+#endif
+    {
+        LUTu histToneCurveThr;
+
+        if (toneCurveHistSize > 0) {
+            histToneCurveThr(toneCurveHistSize);
+            histToneCurveThr.clear();
+        }
+
+        std::vector<std::size_t> outOfDomainThr;
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 16) nowait
+#endif
+
+        for (int i = 0; i < H; ++i) {
+            for (int j = 0; j < W; ++j) {
+                const float r = working->r(i, j);
+                const float g = working->g(i, j);
+                const float b = working->b(i, j);
+
+                // also catches NaN
+                if (!(r >= 0.f && r <= 65535.f && g >= 0.f && g <= 65535.f && b >= 0.f && b <= 65535.f)) {
+                    outOfDomainThr.push_back(static_cast<std::size_t>(i) * W + j);
+                    continue;
+                }
+
+                float out[4] ALIGNED16;
+                lut.getValues(toGrid[r], toGrid[g], toGrid[b], out);
+                lab->L[i][j] = out[0];
+                lab->a[i][j] = out[1];
+                lab->b[i][j] = out[2];
+
+                if (histToneCurveThr) {
+                    histToneCurveThr[static_cast<int>(LIM(out[3], 0.f, 65535.f)) >> histToneCurveCompression]++;
+                }
+            }
+        }
+
+#ifdef _OPENMP
+        #pragma omp critical
+#endif
+        {
+            if (toneCurveHistSize > 0) {
+                histToneCurve += histToneCurveThr;
+            }
+
+            outOfDomain.insert(outOfDomain.end(), outOfDomainThr.begin(), outOfDomainThr.end());
+        }
+    }
+
+    // process the remaining pixels through the exact path, packed in a single row
+    const auto processExact =
+        [&](const std::vector<std::size_t>& indexes, LabImage& result, LUTu& hist)
+        {
+            const int n = indexes.size();
+            Imagefloat packed(n, 1);
+
+            for (int k = 0; k < n; ++k) {
+                const int i = indexes[k] / W;
+                const int j = indexes[k] % W;
+                packed.r(0, k) = working->r(i, j);
+                packed.g(0, k) = working->g(i, j);
+                packed.b(0, k) = working->b(i, j);
+            }
+
+            double rrmTmp = rrm, ggmTmp = ggm, bbmTmp = bbm;
+            float autorTmp = autor, autogTmp = autog, autobTmp = autob;
+            rgbProc(&packed, &result, nullptr, hltonecurve, shtonecurve, tonecurve, sat, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili,
+                    clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrmTmp, ggmTmp, bbmTmp, autorTmp, autogTmp, autobTmp,
+                    expcomp, hlcompr, hlcomprthresh, dcpProf, asIn, hist);
+        };
+
+    if (!outOfDomain.empty()) {
+        LabImage exactLab(outOfDomain.size(), 1);
+        LUTu exactHist;
+
+        if (toneCurveHistSize > 0) {
+            exactHist(toneCurveHistSize);
+        }
+
+        processExact(outOfDomain, exactLab, exactHist);
+
+        for (std::size_t k = 0; k < outOfDomain.size(); ++k) {
+            const int i = outOfDomain[k] / W;
+            const int j = outOfDomain[k] % W;
+            lab->L[i][j] = exactLab.L[0][k];
+            lab->a[i][j] = exactLab.a[0][k];
+            lab->b[i][j] = exactLab.b[0][k];
+        }
+
+        if (toneCurveHistSize > 0) {
+            histToneCurve += exactHist;
+        }
+    }
+
+    if (settings->verbose) {
+        // accuracy check of the fused path against the exact one on a subset of the pixels
+        const std::size_t step = rtengine::max<std::size_t>(1, static_cast<std::size_t>(W) * H / 4096);
+        std::vector<std::size_t> samples;
+
+        for (std::size_t k = 0; k < static_cast<std::size_t>(W) * H; k += step) {
+            samples.push_back(k);
+        }
+
+        LabImage exactLab(samples.size(), 1);
+        LUTu exactHist;
+        processExact(samples, exactLab, exactHist);
+
+        double sumDE = 0.0;
+        float maxDE = 0.f;
+
+        for (std::size_t k = 0; k < samples.size(); ++k) {
+            const int i = samples[k] / W;
+            const int j = samples[k] % W;
+            const float dE = std::sqrt(SQR(lab->L[i][j] - exactLab.L[0][k]) + SQR(lab->a[i][j] - exactLab.a[0][k]) + SQR(lab->b[i][j] - exactLab.b[0][k])) / 327.68f;
+            sumDE += dE;
+            maxDE = rtengine::max(maxDE, dE);
+        }
+
+        printf("rgbProcFused: %d^3 LUT, %zu of %d pixels through the exact path, deltaE against exact path: mean %.3f, max %.3f\n",
+               lutSize, outOfDomain.size(), W * H, sumDE / rtengine::max<std::size_t>(samples.size(), 1), static_cast<double>(maxDE));
+    }
+}
+
+}
@@ -31,6 +31,7 @@
 #include "imagefloat.h"
 #include "labimage.h"
 #include "color.h"
+#include "gamutboundary.h"
 #include "rt_math.h"
 #include "jaggedarray.h"
 #include "rt_algo.h"
@@ -448,6 +449,22 @@ extern MyMutex *fftwMutex;
 
 using namespace procparams;
 
+// Only the FFTW planner is not thread-safe, executing the plans is
+static fftwf_plan plan_dct_2d(int bfh, int bfw, float *in, float *out, fftwf_r2r_kind kind, unsigned flags, bool multiThread)
+{
+    MyMutex::MyLock lock(*fftwMutex);
+#ifdef RT_FFTW3F_OMP
+    fftwf_plan_with_nthreads(multiThread ? omp_get_max_threads() : 1);
+#endif
+    return fftwf_plan_r2r_2d(bfh, bfw, in, out, kind, kind, flags);
+}
+
+static void destroy_plan(fftwf_plan plan)
+{
+    MyMutex::MyLock lock(*fftwMutex);
+    fftwf_destroy_plan(plan);
+}
+
 struct local_params {
     float yc, xc;
     float lx, ly;
@@ -4600,7 +4617,6 @@ void ImProcFunctions::exlabLocal(local_params& lp, float strlap, int bfh, int bf
                 }
             }
 
-            MyMutex::MyLock lock(*fftwMutex);
             ImProcFunctions::retinex_pde(datain.get(), dataout.get(), bfwr, bfhr, lap, 1.f, dE.get(), 0, 1, 1);//350 arbitrary value about 45% strength Laplacian
 #ifdef _OPENMP
         #pragma omp parallel for schedule(dynamic,16) if (multiThread)
@@ -5988,12 +6004,6 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
 
    // BENCHFUN
    
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-#endif
 
     float *datashow = nullptr;
     if (show != 0) {
@@ -6028,9 +6038,9 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
     }
 
     //execute first
-    const auto dct_fw = fftwf_plan_r2r_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
+    const auto dct_fw = plan_dct_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, multiThread);
     fftwf_execute(dct_fw);
-    fftwf_destroy_plan(dct_fw);
+    destroy_plan(dct_fw);
 
     //execute second
     if (dEenable == 1) {
@@ -6042,9 +6052,9 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
         }
         //second call to laplacian with 40% strength ==> reduce effect if we are far from ref (deltaE)
         discrete_laplacian_threshold(data_tmp04, datain, bfw, bfh, 0.4f * thresh);
-        const auto dct_fw04 = fftwf_plan_r2r_2d(bfh, bfw, data_tmp04, data_fft04, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
+        const auto dct_fw04 = plan_dct_2d(bfh, bfw, data_tmp04, data_fft04, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, multiThread);
         fftwf_execute(dct_fw04);
-        fftwf_destroy_plan(dct_fw04);
+        destroy_plan(dct_fw04);
         constexpr float exponent = 4.5f;
 
 #ifdef _OPENMP
@@ -6092,9 +6102,9 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
         }
     }
 
-    const auto dct_bw = fftwf_plan_r2r_2d(bfh, bfw, data_fft, data_tmp, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
+    const auto dct_bw = plan_dct_2d(bfh, bfw, data_fft, data_tmp, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, multiThread);
     fftwf_execute(dct_bw);
-    fftwf_destroy_plan(dct_bw);
+    destroy_plan(dct_bw);
     fftwf_free(data_fft);
 
     if (show != 4 && normalize == 1) {
@@ -6123,13 +6133,6 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
     if (datashow) {
         fftwf_free(datashow);
     }
-    fftwf_cleanup();
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 }
 
 void ImProcFunctions::maskcalccol(bool invmask, bool pde, int bfw, int bfh, int xstart, int ystart, int sk, int cx, int cy, LabImage* bufcolorig, LabImage* bufmaskblurcol, LabImage* originalmaskcol, LabImage* original, LabImage* reserved, int inv, struct local_params & lp,
@@ -8934,13 +8937,6 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
 {
 
     //BENCHFUN
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-
-#endif
     float *data_fft, *data_tmp, *data;
 
     if (NULL == (data_tmp = (float *) fftwf_malloc(sizeof(float) * bfw * bfh))) {
@@ -8960,7 +8956,7 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
         abort();
     }
 
-    const auto dct_fw = fftwf_plan_r2r_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
+    const auto dct_fw = plan_dct_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, multiThread);
     fftwf_execute(dct_fw);
 
     fftwf_free(data_tmp);
@@ -8969,18 +8965,11 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
     /* 1. / (float) (bfw * bfh)) is the DCT normalisation term, see libfftw */
     ImProcFunctions::rex_poisson_dct(data_fft, bfw, bfh, 1. / (double)(bfw * bfh));
 
-    const auto dct_bw = fftwf_plan_r2r_2d(bfh, bfw, data_fft, data, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
+    const auto dct_bw = plan_dct_2d(bfh, bfw, data_fft, data, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, multiThread);
     fftwf_execute(dct_bw);
-    fftwf_destroy_plan(dct_fw);
-    fftwf_destroy_plan(dct_bw);
+    destroy_plan(dct_fw);
+    destroy_plan(dct_bw);
     fftwf_free(data_fft);
-    fftwf_cleanup();
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 
     normalize_mean_dt(data, dataor, bfw * bfh, mod, 1.f, 0.f, 0.f, 0.f, 0.f);
     {
@@ -9020,12 +9009,6 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
     */
     //BENCHFUN
 
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-#endif
 
 
     float *out; //for FFT data
@@ -9048,10 +9031,10 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
 
     /*compute the Fourier transform of the input data*/
 
-    p = fftwf_plan_r2r_2d(bfh, bfw, input, out, FFTW_REDFT10, FFTW_REDFT10,  FFTW_ESTIMATE);//FFT 2 dimensions forward  FFTW_MEASURE FFTW_ESTIMATE
+    p = plan_dct_2d(bfh, bfw, input, out, FFTW_REDFT10,  FFTW_ESTIMATE, multiThread);//FFT 2 dimensions forward  FFTW_MEASURE FFTW_ESTIMATE
 
     fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    destroy_plan(p);
 
     /*define the gaussian constants for the convolution kernel*/
     if (algo == 0) {
@@ -9085,9 +9068,9 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         }
 
         /*compute the Fourier transform of the kernel data*/
-        pkern = fftwf_plan_r2r_2d(bfh, bfw, kern, outkern, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE); //FFT 2 dimensions forward
+        pkern = plan_dct_2d(bfh, bfw, kern, outkern, FFTW_REDFT10, FFTW_ESTIMATE, multiThread); //FFT 2 dimensions forward
         fftwf_execute(pkern);
-        fftwf_destroy_plan(pkern);
+        destroy_plan(pkern);
 
 #ifdef _OPENMP
         #pragma omp parallel for if (multiThread)
@@ -9131,7 +9114,7 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         }
     }
 
-    p = fftwf_plan_r2r_2d(bfh, bfw, out, output, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE);//FFT 2 dimensions backward
+    p = plan_dct_2d(bfh, bfw, out, output, FFTW_REDFT01, FFTW_ESTIMATE, multiThread);//FFT 2 dimensions backward
     fftwf_execute(p);
 
 #ifdef _OPENMP
@@ -9141,20 +9124,12 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         output[index] /= image_sizechange;
     }
 
-    fftwf_destroy_plan(p);
+    destroy_plan(p);
     fftwf_free(out);
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 }
 
 void ImProcFunctions::fftw_convol_blur2(float **input2, float **output2, int bfw, int bfh, float radius, int fftkern, int algo)
 {
-    MyMutex::MyLock lock(*fftwMutex);
-
     float *input = nullptr;
 
     if (NULL == (input = (float *) fftwf_malloc(sizeof(float) * bfw * bfh))) {
@@ -9214,10 +9189,17 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
     fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
 
     // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-    plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+    {
+        MyMutex::MyLock lock(*fftwMutex);
+#ifdef RT_FFTW3F_OMP
+        // the plans are executed inside the parallel region
+        fftwf_plan_with_nthreads(1);
+#endif
+        plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+    }
     fftwf_free(Lbloxtmp);
     fftwf_free(fLbloxtmp);
     const int border = rtengine::max(2, tilssize / 16);
@@ -9391,11 +9373,13 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
         fftwf_free(fLbloxArray[i]);
     }
 
-    fftwf_destroy_plan(plan_forward_blox[0]);
-    fftwf_destroy_plan(plan_backward_blox[0]);
-    fftwf_destroy_plan(plan_forward_blox[1]);
-    fftwf_destroy_plan(plan_backward_blox[1]);
-    fftwf_cleanup();
+    {
+        MyMutex::MyLock lock(*fftwMutex);
+        fftwf_destroy_plan(plan_forward_blox[0]);
+        fftwf_destroy_plan(plan_backward_blox[0]);
+        fftwf_destroy_plan(plan_forward_blox[1]);
+        fftwf_destroy_plan(plan_backward_blox[1]);
+    }
 }
 
 void ImProcFunctions::wavcbd(wavelet_decomposition &wdspot, int level_bl, int maxlvl,
@@ -10584,10 +10568,17 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
     fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
 
     // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-    plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+    {
+        MyMutex::MyLock lock(*fftwMutex);
+#ifdef RT_FFTW3F_OMP
+        // the plans are executed inside the parallel region
+        fftwf_plan_with_nthreads(1);
+#endif
+        plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+        plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+    }
     fftwf_free(Lbloxtmp);
     fftwf_free(fLbloxtmp);
     const int border = rtengine::max(2, TS / 16);
@@ -10818,11 +10809,13 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
         fftwf_free(fLbloxArray[i]);
     }
 
-    fftwf_destroy_plan(plan_forward_blox[0]);
-    fftwf_destroy_plan(plan_backward_blox[0]);
-    fftwf_destroy_plan(plan_forward_blox[1]);
-    fftwf_destroy_plan(plan_backward_blox[1]);
-    fftwf_cleanup();
+    {
+        MyMutex::MyLock lock(*fftwMutex);
+        fftwf_destroy_plan(plan_forward_blox[0]);
+        fftwf_destroy_plan(plan_backward_blox[0]);
+        fftwf_destroy_plan(plan_forward_blox[1]);
+        fftwf_destroy_plan(plan_backward_blox[1]);
+    }
 
 
 }
@@ -10851,10 +10844,6 @@ void ImProcFunctions::DeNoise(int call, float * slidL, float * slida, float * sl
 
         StopWatch Stop1("locallab Denoise called");
 
-        if (aut == 0) {
-            MyMutex::MyLock lock(*fftwMutex);
-        }
-
         if (lp.noisecf >= 0.01f || lp.noisecc >= 0.01f || aut == 1 || aut == 2) {
             noiscfactiv = false;
             levred = 7;
@@ -12513,6 +12502,7 @@ void ImProcFunctions::avoidcolshi(const struct local_params& lp, int sp, LabImag
 
         const float softr = params->locallab.spots.at(sp).avoidrad;//max softr = 30
         const bool muns = params->locallab.spots.at(sp).avoidmun;//Munsell control with 200 LUT
+        const GamutBoundary* const gamutBoundary = muns ? nullptr : &GamutBoundary::get(params->icm.workingProfile);
         //improve precision with mint and maxt
         const float tr = std::min(2.f, softr);
         const float mint = 0.15f - 0.06f * tr;//between 0.15f and 0.03f 
@@ -12636,7 +12626,7 @@ void ImProcFunctions::avoidcolshi(const struct local_params& lp, int sp, LabImag
                     Chprov1 = rtengine::min(Chprov1, chr);
                     if(!muns) {
                        float R, G, B;
-                        Color::gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, highlight, mint, maxt);//replace for best results
+                        Color::gamutLchonly(HH, sincosval, Lprov1, Chprov1, R, G, B, wip, highlight, mint, maxt, gamutBoundary);//replace for best results
                     }
                     transformed->L[y][x] = Lprov1 * 327.68f;
                     transformed->a[y][x] = 327.68f * Chprov1 * sincosval.y;
@@ -16181,7 +16171,6 @@ void ImProcFunctions::Lab_Local(
                 }
 
                 const int showorig = lp.showmasksoftmet >= 5 ? 0 : lp.showmasksoftmet;
-                MyMutex::MyLock lock(*fftwMutex);
                 ImProcFunctions::retinex_pde(datain.get(), dataout.get(), bfwr, bfhr, 8.f * lp.strng, 1.f, dE.get(), showorig, 1, 1);
 #ifdef _OPENMP
                 #pragma omp parallel for schedule(dynamic,16) if (multiThread)
@@ -17234,7 +17223,6 @@ void ImProcFunctions::Lab_Local(
 
                         if (lp.laplacexp > 0.1f) {
 
-                            MyMutex::MyLock lock(*fftwMutex);
                             std::unique_ptr<float[]> datain(new float[bfwr * bfhr]);
                             std::unique_ptr<float[]> dataout(new float[bfwr * bfhr]);
                             const float gam = params->locallab.spots.at(sp).gamm;
@@ -20,6 +20,7 @@
 #include "improcfun.h"
 
 #include "alignedbuffer.h"
+#include "array2D.h"
 #include "imagefloat.h"
 #include "labimage.h"
 #include "opthelper.h"
@@ -37,300 +38,313 @@
 namespace rtengine
 {
 
-static inline float Lanc (float x, float a)
+namespace
 {
+
+enum class ResizeKernel {
+    LANCZOS3,
+    LANCZOS2,
+    MITCHELL
+};
+
+ResizeKernel getResizeKernel(const Glib::ustring& method)
+{
+    if (method == "Lanczos2") {
+        return ResizeKernel::LANCZOS2;
+    } else if (method == "Mitchell") {
+        return ResizeKernel::MITCHELL;
+    }
+
+    return ResizeKernel::LANCZOS3;
+}
+
+float kernelRadius(ResizeKernel kernel)
+{
+    return kernel == ResizeKernel::LANCZOS3 ? 3.f : 2.f;
+}
+
+float kernelValue(ResizeKernel kernel, float x)
+{
+    if (kernel == ResizeKernel::MITCHELL) {
+        // Mitchell-Netravali, B = C = 1/3
+        x = std::fabs(x);
+
+        if (x < 1.f) {
+            return (7.f * x * x * x - 12.f * x * x + 16.f / 3.f) / 6.f;
+        } else if (x < 2.f) {
+            return (-7.f / 3.f * x * x * x + 12.f * x * x - 20.f * x + 32.f / 3.f) / 6.f;
+        }
+
+        return 0.f;
+    }
+
+    const float a = kernelRadius(kernel);
+
     if (x * x < 1e-6f) {
         return 1.0f;
     } else if (x * x > a * a) {
         return 0.0f;
     } else {
-        x = static_cast<float> (rtengine::RT_PI) * x;
-        return a * xsinf (x) * xsinf (x / a) / (x * x);
+        x = static_cast<float>(RT_PI) * x;
+        return a * xsinf(x) * xsinf(x / a) / (x * x);
     }
 }
 
-void ImProcFunctions::Lanczos (const Imagefloat* src, Imagefloat* dst, float scale)
+// Filter coefficients of one axis, computed once and shared by all threads.
+// Each output uses the same number of taps starting at start[i], weights of the taps outside the image are 0.
+class ResizeCoefficients
 {
-
-    const float delta = 1.0f / scale;
-    const float a = 3.0f;
-    const float sc = min (scale, 1.0f);
-    const int support = static_cast<int> (2.0f * a / sc) + 1;
-
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
+public:
+    ResizeCoefficients(int srcSize, int dstSize, float scale, ResizeKernel kernel) :
+        taps(1),
+        start(dstSize)
     {
-        // storage for precomputed parameters for horisontal interpolation
-        float * wwh = new float[support * dst->getWidth()];
-        int * jj0 = new int[dst->getWidth()];
-        int * jj1 = new int[dst->getWidth()];
-
-        // temporal storage for vertically-interpolated row of pixels
-        float * lr = new float[src->getWidth()];
-        float * lg = new float[src->getWidth()];
-        float * lb = new float[src->getWidth()];
-
-        // Phase 1: precompute coefficients for horisontal interpolation
-
-        for (int j = 0; j < dst->getWidth(); j++) {
-
-            // x coord of the center of pixel on src image
-            float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
-
-            // weights for interpolation in horisontal direction
-            float * w = wwh + j * support;
+        const float delta = 1.0f / scale;
+        const float sc = min(scale, 1.0f);
+        const float radius = kernelRadius(kernel) / sc;
+
+        std::vector<int> first(dstSize);
+        std::vector<int> last(dstSize);
+
+        for (int i = 0; i < dstSize; ++i) {
+            // coordinate of the center of the pixel on the source image
+            const float x0 = (static_cast<float>(i) + 0.5f) * delta - 0.5f;
+            first[i] = LIM(static_cast<int>(std::floor(x0 - radius)) + 1, 0, srcSize - 1);
+            last[i] = LIM(static_cast<int>(std::floor(x0 + radius)) + 1, first[i] + 1, srcSize);
+            taps = max(taps, last[i] - first[i]);
+        }
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
+        weights.resize(static_cast<std::size_t>(taps) * dstSize);
 
-            jj0[j] = max (0, static_cast<int> (floorf (x0 - a / sc)) + 1);
-            jj1[j] = min (src->getWidth(), static_cast<int> (floorf (x0 + a / sc)) + 1);
+        for (int i = 0; i < dstSize; ++i) {
+            const float x0 = (static_cast<float>(i) + 0.5f) * delta - 0.5f;
+            start[i] = min(first[i], srcSize - taps);
+            float* const w = weights.data() + static_cast<std::size_t>(i) * taps;
+            float ws = 0.f;
 
-            // calculate weights
-            for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                int k = jj - jj0[j];
-                float z = sc * (x0 - static_cast<float> (jj));
-                w[k] = Lanc (z, a);
+            for (int k = 0; k < taps; ++k) {
+                const int j = start[i] + k;
+                w[k] = j >= first[i] && j < last[i] ? kernelValue(kernel, sc * (x0 - static_cast<float>(j))) : 0.f;
                 ws += w[k];
             }
 
             // normalize weights
-            for (int k = 0; k < support; k++) {
+            for (int k = 0; k < taps; ++k) {
                 w[k] /= ws;
             }
         }
+    }
 
-        // Phase 2: do actual interpolation
-#ifdef _OPENMP
-        #pragma omp for
-#endif
-
-        for (int i = 0; i < dst->getHeight(); i++) {
-
-            // y coord of the center of pixel on src image
-            float y0 = (static_cast<float> (i) + 0.5f) * delta - 0.5f;
-
-            // weights for interpolation in y direction
-            float w[support];
-            for (auto& f : w) {
-                f = 0.f;
-            }
-
-            // sum of weights used for normalization
-            float ws = 0.0f;
+    int getTaps() const
+    {
+        return taps;
+    }
 
-            int ii0 = max (0, static_cast<int> (floorf (y0 - a / sc)) + 1);
-            int ii1 = min (src->getHeight(), static_cast<int> (floorf (y0 + a / sc)) + 1);
+    int getStart(int i) const
+    {
+        return start[i];
+    }
 
-            // calculate weights for vertical interpolation
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-                float z = sc * (y0 - static_cast<float> (ii));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
+    const float* getWeights(int i) const
+    {
+        return weights.data() + static_cast<std::size_t>(i) * taps;
+    }
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
-            }
+private:
+    int taps;
+    std::vector<int> start;
+    std::vector<float> weights;
+};
 
-            // Do vertical interpolation. Store results.
-            for (int j = 0; j < src->getWidth(); j++) {
+// Average n x n blocks, the last row and column of blocks may be incomplete
+void boxDownscale(const float* const* const src[3], int srcW, int srcH, int n, float** const dst[3], bool multiThread)
+{
+    const int dstW = (srcW + n - 1) / n;
+    const int dstH = (srcH + n - 1) / n;
 
-                float r = 0.0f, g = 0.0f, b = 0.0f;
+#ifdef _OPENMP
+    #pragma omp parallel for if (multiThread)
+#endif
 
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
+    for (int i = 0; i < dstH; ++i) {
+        const int y0 = i * n;
+        const int y1 = min(y0 + n, srcH);
 
-                    r += w[k] * src->r (ii, j);
-                    g += w[k] * src->g (ii, j);
-                    b += w[k] * src->b (ii, j);
-                }
+        for (int c = 0; c < 3; ++c) {
+            float* const out = dst[c][i];
 
-                lr[j] = r;
-                lg[j] = g;
-                lb[j] = b;
+            for (int j = 0; j < dstW; ++j) {
+                out[j] = 0.f;
             }
 
-            // Do horizontal interpolation
-            for (int j = 0; j < dst->getWidth(); j++) {
-
-                float * wh = wwh + support * j;
+            for (int y = y0; y < y1; ++y) {
+                const float* const in = src[c][y];
 
-                float r = 0.0f, g = 0.0f, b = 0.0f;
+                for (int j = 0; j < dstW; ++j) {
+                    const int x0 = j * n;
+                    const int x1 = min(x0 + n, srcW);
+                    float sum = 0.f;
 
-                for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                    int k = jj - jj0[j];
+                    for (int x = x0; x < x1; ++x) {
+                        sum += in[x];
+                    }
 
-                    r += wh[k] * lr[jj];
-                    g += wh[k] * lg[jj];
-                    b += wh[k] * lb[jj];
+                    out[j] += sum;
                 }
+            }
 
-                dst->r (i, j) = /*CLIP*/ (r);//static_cast<int> (r));
-                dst->g (i, j) = /*CLIP*/ (g);//static_cast<int> (g));
-                dst->b (i, j) = /*CLIP*/ (b);//static_cast<int> (b));
+            for (int j = 0; j < dstW; ++j) {
+                out[j] /= (y1 - y0) * (min(j * n + n, srcW) - j * n);
             }
         }
-
-        delete[] wwh;
-        delete[] jj0;
-        delete[] jj1;
-        delete[] lr;
-        delete[] lg;
-        delete[] lb;
     }
 }
 
-
-void ImProcFunctions::Lanczos (const LabImage* src, LabImage* dst, float scale)
+// Separable resampling of three planes. The vertical pass writes the source columns needed by a tile of
+// destination columns as interleaved RGBx pixels, so that the horizontal pass filters all channels at once.
+void resamplePlanes(const float* const* const src[3], int srcW, int srcH, float** const dst[3], int dstW, int dstH, float scale, ResizeKernel kernel, bool multiThread)
 {
-    const float delta = 1.0f / scale;
-    constexpr float a = 3.0f;
-    const float sc = min(scale, 1.0f);
-    const int support = static_cast<int> (2.0f * a / sc) + 1;
-
-    // storage for precomputed parameters for horizontal interpolation
-    float* const wwh = new float[support * dst->W];
-    int* const jj0 = new int[dst->W];
-    int* const jj1 = new int[dst->W];
-
-    // Phase 1: precompute coefficients for horizontal interpolation
-    for (int j = 0; j < dst->W; j++) {
-
-        // x coord of the center of pixel on src image
-        float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
-
-        // weights for interpolation in horizontal direction
-        float * w = wwh + j * support;
-
-        // sum of weights used for normalization
-        float ws = 0.0f;
+    // For big reductions most of the time is spent in the vertical pass, with a support of several dozen rows.
+    // An integer box average down to between 2x and 4x of the output size first gives nearly the same result.
+    // Not done for Lanczos-3, whose output must not change: the default method gets no speedup for big
+    // reductions and its cost stays proportional to the source size times the kernel radius.
+    if (scale < 0.25f && kernel != ResizeKernel::LANCZOS3) {
+        const int n = 0.5f / scale;
+        const int boxW = (srcW + n - 1) / n;
+        const int boxH = (srcH + n - 1) / n;
+        array2D<float> boxR(boxW, boxH);
+        array2D<float> boxG(boxW, boxH);
+        array2D<float> boxB(boxW, boxH);
+        float** const box[3] = {boxR, boxG, boxB};
+        boxDownscale(src, srcW, srcH, n, box, multiThread);
+        resamplePlanes(box, boxW, boxH, dst, dstW, dstH, scale * n, kernel, multiThread);
+        return;
+    }
 
-        jj0[j] = max (0, static_cast<int> (floorf (x0 - a / sc)) + 1);
-        jj1[j] = min (src->W, static_cast<int> (floorf (x0 + a / sc)) + 1);
+    constexpr int tileSize = 256; // destination columns per tile
 
-        // calculate weights
-        for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-            int k = jj - jj0[j];
-            float z = sc * (x0 - static_cast<float> (jj));
-            w[k] = Lanc (z, a);
-            ws += w[k];
-        }
-
-        // normalize weights
-        for (int k = 0; k < support; k++) {
-            w[k] /= ws;
-        }
-    }
+    const ResizeCoefficients horizontal(srcW, dstW, scale, kernel);
+    const ResizeCoefficients vertical(srcH, dstH, scale, kernel);
+    const int hTaps = horizontal.getTaps();
+    const int vTaps = vertical.getTaps();
 
 #ifdef _OPENMP
-    #pragma omp parallel
+    #pragma omp parallel if (multiThread)
 #endif
     {
-        // temporal storage for vertically-interpolated row of pixels
-        AlignedBuffer<float> aligned_buffer_ll(src->W);
-        AlignedBuffer<float> aligned_buffer_la(src->W);
-        AlignedBuffer<float> aligned_buffer_lb(src->W);
-        float* const lL = aligned_buffer_ll.data;
-        float* const la = aligned_buffer_la.data;
-        float* const lb = aligned_buffer_lb.data;
-        // weights for interpolation in y direction
-        float w[support] ALIGNED64;
-        memset(w, 0, sizeof(w));
-
-        // Phase 2: do actual interpolation
-#ifdef _OPENMP
-        #pragma omp for
-#endif
+        // vertically filtered source pixels of the current tile, RGBx
+        int maxSpan = 0;
 
-        for (int i = 0; i < dst->H; i++) {
-            // y coord of the center of pixel on src image
-            float y0 = (static_cast<float> (i) + 0.5f) * delta - 0.5f;
+        for (int tx = 0; tx < dstW; tx += tileSize) {
+            const int tw = min(tileSize, dstW - tx);
+            maxSpan = max(maxSpan, horizontal.getStart(tx + tw - 1) + hTaps - horizontal.getStart(tx));
+        }
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
+        AlignedBuffer<float> buffer(4 * maxSpan);
+        float* const row = buffer.data;
 
-            int ii0 = max (0, static_cast<int> (floorf (y0 - a / sc)) + 1);
-            int ii1 = min (src->H, static_cast<int> (floorf (y0 + a / sc)) + 1);
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 4)
+#endif
 
-            // calculate weights for vertical interpolation
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-                float z = sc * (y0 - static_cast<float> (ii));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
+        for (int i = 0; i < dstH; ++i) {
+            const int y0 = vertical.getStart(i);
+            const float* const wv = vertical.getWeights(i);
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
-            }
+            for (int tx = 0; tx < dstW; tx += tileSize) {
+                const int tw = min(tileSize, dstW - tx);
+                const int x0 = horizontal.getStart(tx);
+                const int x1 = horizontal.getStart(tx + tw - 1) + hTaps;
 
-            // Do vertical interpolation. Store results.
-            int j = 0;
+                // vertical pass
+                int x = x0;
 #ifdef __SSE2__
-            __m128 Lv, av, bv, wkv;
-
-            for (j = 0; j < src->W - 3; j += 4) {
-                Lv = ZEROV;
-                av = ZEROV;
-                bv = ZEROV;
-
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
-                    wkv = F2V(w[k]);
-                    Lv += wkv * LVFU(src->L[ii][j]);
-                    av += wkv * LVFU(src->a[ii][j]);
-                    bv += wkv * LVFU(src->b[ii][j]);
+
+                for (; x < x1 - 3; x += 4) {
+                    vfloat rv = ZEROV;
+                    vfloat gv = ZEROV;
+                    vfloat bv = ZEROV;
+                    vfloat zv = ZEROV;
+
+                    for (int k = 0; k < vTaps; ++k) {
+                        const vfloat wkv = F2V(wv[k]);
+                        rv += wkv * LVFU(src[0][y0 + k][x]);
+                        gv += wkv * LVFU(src[1][y0 + k][x]);
+                        bv += wkv * LVFU(src[2][y0 + k][x]);
+                    }
+
+                    _MM_TRANSPOSE4_PS(rv, gv, bv, zv);
+                    float* const out = row + 4 * (x - x0);
+                    STVF(out[0], rv);
+                    STVF(out[4], gv);
+                    STVF(out[8], bv);
+                    STVF(out[12], zv);
                 }
 
-                STVF(lL[j], Lv);
-                STVF(la[j], av);
-                STVF(lb[j], bv);
-            }
 #endif
 
-            for (; j < src->W; ++j) {
-                float Ll = 0.0f, La = 0.0f, Lb = 0.0f;
+                for (; x < x1; ++x) {
+                    float r = 0.f, g = 0.f, b = 0.f;
 
-                for (int ii = ii0; ii < ii1; ++ii) {
-                    int k = ii - ii0;
+                    for (int k = 0; k < vTaps; ++k) {
+                        r += wv[k] * src[0][y0 + k][x];
+                        g += wv[k] * src[1][y0 + k][x];
+                        b += wv[k] * src[2][y0 + k][x];
+                    }
 
-                    Ll += w[k] * src->L[ii][j];
-                    La += w[k] * src->a[ii][j];
-                    Lb += w[k] * src->b[ii][j];
+                    float* const out = row + 4 * (x - x0);
+                    out[0] = r;
+                    out[1] = g;
+                    out[2] = b;
+                    out[3] = 0.f;
                 }
 
-                lL[j] = Ll;
-                la[j] = La;
-                lb[j] = Lb;
-            }
+                // horizontal pass
+                for (int j = tx; j < tx + tw; ++j) {
+                    const float* const wh = horizontal.getWeights(j);
+                    const float* const in = row + 4 * (horizontal.getStart(j) - x0);
+#ifdef __SSE2__
+                    vfloat accv = ZEROV;
 
-            // Do horizontal interpolation
-            for (int x = 0; x < dst->W; ++x) {
-                float * wh = wwh + support * x;
-                float Ll = 0.0f, La = 0.0f, Lb = 0.0f;
+                    for (int k = 0; k < hTaps; ++k) {
+                        accv += F2V(wh[k]) * LVF(in[4 * k]);
+                    }
 
-                for (int jj = jj0[x]; jj < jj1[x]; ++jj) {
-                    int k = jj - jj0[x];
+                    float acc[4] ALIGNED16;
+                    STVF(acc[0], accv);
+#else
+                    float acc[4] = {0.f, 0.f, 0.f, 0.f};
 
-                    Ll += wh[k] * lL[jj];
-                    La += wh[k] * la[jj];
-                    Lb += wh[k] * lb[jj];
-                }
+                    for (int k = 0; k < hTaps; ++k) {
+                        acc[0] += wh[k] * in[4 * k];
+                        acc[1] += wh[k] * in[4 * k + 1];
+                        acc[2] += wh[k] * in[4 * k + 2];
+                    }
 
-                dst->L[i][x] = Ll;
-                dst->a[i][x] = La;
-                dst->b[i][x] = Lb;
+#endif
+                    dst[0][i][j] = acc[0];
+                    dst[1][i][j] = acc[1];
+                    dst[2][i][j] = acc[2];
+                }
             }
         }
     }
-    delete[] jj0;
-    delete[] jj1;
-    delete[] wwh;
+}
+
+}
+
+void ImProcFunctions::resample(const Imagefloat* src, Imagefloat* dst, float scale)
+{
+    const float* const* const srcPlanes[3] = {src->r.ptrs, src->g.ptrs, src->b.ptrs};
+    float** const dstPlanes[3] = {dst->r.ptrs, dst->g.ptrs, dst->b.ptrs};
+    resamplePlanes(srcPlanes, src->getWidth(), src->getHeight(), dstPlanes, dst->getWidth(), dst->getHeight(), scale, getResizeKernel(params->resize.method), multiThread);
+}
+
+void ImProcFunctions::resample(const LabImage* src, LabImage* dst, float scale)
+{
+    const float* const* const srcPlanes[3] = {src->L, src->a, src->b};
+    float** const dstPlanes[3] = {dst->L, dst->a, dst->b};
+    resamplePlanes(srcPlanes, src->W, src->H, dstPlanes, dst->W, dst->H, scale, getResizeKernel(params->resize.method), multiThread);
 }
 
 float ImProcFunctions::resizeScale (const ProcParams* params, int fw, int fh, int &imw, int &imh)
@@ -430,7 +444,7 @@ void ImProcFunctions::resize (Imagefloat* src, Imagefloat* dst, float dScale)
 #endif
 
     if (params->resize.method != "Nearest" ) {
-        Lanczos (src, dst, dScale);
+        resample(src, dst, dScale);
     } else {
         // Nearest neighbour algorithm
 #ifdef _OPENMP
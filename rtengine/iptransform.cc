@@ -17,6 +17,7 @@
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include <array>
+#include <sstream>
 
 #include "imagefloat.h"
 #include "improcfun.h"
@@ -27,6 +28,7 @@
 #include "rtengine.h"
 #include "rtlensfun.h"
 #include "sleef.h"
+#include "warpmesh.h"
 
 using namespace std;
 
@@ -676,6 +678,20 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
         }
     }
 
+    // identifies the lens correction in the warp mesh cache
+    std::string lensKey;
+
+    if (pLCPMap) {
+        std::ostringstream key;
+        key.precision(17);
+        key << static_cast<int>(params->lensProf.lcMode) << '\n' << params->lensProf.lcpFile.raw() << '\n'
+            << params->lensProf.lfCameraMake.raw() << '\n' << params->lensProf.lfCameraModel.raw() << '\n' << params->lensProf.lfLens.raw() << '\n'
+            << metadata->getMake() << '\n' << metadata->getModel() << '\n' << metadata->getLens() << '\n'
+            << focalLen << ' ' << focalLen35mm << ' ' << focusDist << ' ' << fNumber << ' ' << rawRotationDeg << ' '
+            << params->coarse.rotate << ' ' << params->coarse.hflip << ' ' << params->coarse.vflip << ' ' << oW << ' ' << oH;
+        lensKey = key.str();
+    }
+
     if (! (needsCA() || needsDistortion() || needsRotation() || needsPerspective() || needsLCP() || needsLensfun()) && (needsVignetting() || needsPCVignetting() || needsGradient())) {
         transformLuminanceOnly (original, transformed, cx, cy, oW, oH, fW, fH);
     } else {
@@ -699,10 +715,10 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
                 dest = tmpimg.get();
             }
         }
-        transformGeneral(highQuality, original, dest, cx, cy, sx, sy, oW, oH, fW, fH, pLCPMap.get(), useOriginalBuffer);
+        transformGeneral(highQuality, original, dest, cx, cy, sx, sy, oW, oH, fW, fH, pLCPMap.get(), lensKey, useOriginalBuffer);
         
         if (highQuality && dest != transformed) {
-            transformLCPCAOnly(dest, transformed, cx, cy, pLCPMap.get(), useOriginalBuffer);
+            transformLCPCAOnly(dest, transformed, cx, cy, oW, oH, pLCPMap.get(), lensKey, useOriginalBuffer);
         }
     }
 }
@@ -1089,7 +1105,7 @@ void ImProcFunctions::transformLuminanceOnly (Imagefloat* original, Imagefloat*
 }
 
 
-void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, bool useOriginalBuffer)
+void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const std::string &lensKey, bool useOriginalBuffer)
 {
 
     // set up stuff, depending on the mode we are
@@ -1186,8 +1202,6 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 
     const bool darkening = (params->vignetting.amount <= 0.0);
     const bool useLog = params->commonTrans.method == "log" && highQuality;
-    const double centerFactorx = cx - w2;
-    const double centerFactory = cy - h2;
 
     std::unique_ptr<Imagefloat> tempLog;
     if (useLog) {
@@ -1206,150 +1220,247 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
         original->b.ptrs
     };
 
-    // main cycle
-#ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic, 16) if(multiThread)
-#endif
+    // maps an output position (in full image coordinates) to the centred and rotated source position and the distortion scale
+    const auto mapPosition = [&](double xa, double ya, double &Dxc, double &Dyc, double &s) {
+        double x_d = ascale * (xa - w2);     // centering x coord & scale
+        double y_d = ascale * (ya - h2);     // centering y coord & scale
 
-    for (int y = 0; y < transformed->getHeight(); ++y) {
-        for (int x = 0; x < transformed->getWidth(); ++x) {
-            double x_d = x;
-            double y_d = y;
-
-            x_d = ascale * (x_d + centerFactorx);     // centering x coord & scale
-            y_d = ascale * (y_d + centerFactory);     // centering y coord & scale
-
-            switch (perspectiveType) {
-                case PerspType::NONE:
-                    break;
-                case PerspType::SIMPLE:
-                    // horizontal perspective transformation
-                    y_d *= maxRadius / (maxRadius + x_d * hptanpt);
-                    x_d *= maxRadius * hpcospt / (maxRadius + x_d * hptanpt);
-
-                    // vertical perspective transformation
-                    x_d *= maxRadius / (maxRadius - y_d * vptanpt);
-                    y_d *= maxRadius * vpcospt / (maxRadius - y_d * vptanpt);
-                    break;
-                case PerspType::CAMERA_BASED:
-                    const double w = p_matrix[3][0] * x_d + p_matrix[3][1] * y_d + p_matrix[3][3];
-                    const double xw = p_matrix[0][0] * x_d + p_matrix[0][1] * y_d + p_matrix[0][3];
-                    const double yw = p_matrix[1][0] * x_d + p_matrix[1][1] * y_d + p_matrix[1][3];
-                    x_d = xw / w;
-                    y_d = yw / w;
-                    break;
-            }
+        switch (perspectiveType) {
+            case PerspType::NONE:
+                break;
+            case PerspType::SIMPLE:
+                // horizontal perspective transformation
+                y_d *= maxRadius / (maxRadius + x_d * hptanpt);
+                x_d *= maxRadius * hpcospt / (maxRadius + x_d * hptanpt);
+
+                // vertical perspective transformation
+                x_d *= maxRadius / (maxRadius - y_d * vptanpt);
+                y_d *= maxRadius * vpcospt / (maxRadius - y_d * vptanpt);
+                break;
+            case PerspType::CAMERA_BASED:
+                const double w = p_matrix[3][0] * x_d + p_matrix[3][1] * y_d + p_matrix[3][3];
+                const double xw = p_matrix[0][0] * x_d + p_matrix[0][1] * y_d + p_matrix[0][3];
+                const double yw = p_matrix[1][0] * x_d + p_matrix[1][1] * y_d + p_matrix[1][3];
+                x_d = xw / w;
+                y_d = yw / w;
+                break;
+        }
+
+        if (enableLCPDist) {
+            pLCPMap->correctDistortion(x_d, y_d, w2, h2);
+        }
+
+        // rotate
+        Dxc = x_d * cost - y_d * sint;
+        Dyc = x_d * sint + y_d * cost;
+
+        // distortion correction
+        s = 1.0;
+
+        if (enableDistortion) {
+            const double r = sqrt(Dxc * Dxc + Dyc * Dyc) / maxRadius;
+            s = 1.0 - distAmount + distAmount * r;
+        }
+    };
 
-            if (enableLCPDist) {
-                pLCPMap->correctDistortion(x_d, y_d, w2, h2);
+    // The mapping is sampled on a coarse mesh, which is cached per lens, geometry and scale.
+    // Planes: source offset x and y per channel, then the distortion scale if needed for vignetting.
+    const int channels = enableCA ? 3 : 1;
+    const bool meshScale = enableVignetting && enableDistortion;
+    const int width = transformed->getWidth();
+    const int height = transformed->getHeight();
+    std::shared_ptr<const WarpMesh> mesh;
+
+    if (cx >= 0 && cy >= 0 && cx + width <= oW && cy + height <= oH) {
+        std::ostringstream key;
+        key.precision(17);
+        key << lensKey << '\n' << oW << ' ' << oH << ' ' << enableLCPDist << ' ' << ascale << ' ' << cost << ' ' << sint << ' ' << static_cast<int>(perspectiveType);
+
+        if (perspectiveType == PerspType::SIMPLE) {
+            key << ' ' << maxRadius << ' ' << hptanpt << ' ' << hpcospt << ' ' << vptanpt << ' ' << vpcospt;
+        } else if (perspectiveType == PerspType::CAMERA_BASED) {
+            for (const auto &row : p_matrix) {
+                for (const auto value : row) {
+                    key << ' ' << value;
+                }
             }
+        }
+
+        if (enableDistortion) {
+            key << ' ' << maxRadius << ' ' << distAmount;
+        }
+
+        key << ' ' << chDist[0] << ' ' << chDist[2] << ' ' << channels << ' ' << meshScale;
 
-            // rotate
-            const double Dxc = x_d * cost - y_d * sint;
-            const double Dyc = x_d * sint + y_d * cost;
+        mesh = WarpMeshCache::getInstance().getMesh(key.str(), oW, oH, 2 * channels + (meshScale ? 1 : 0),
+            [&](double xa, double ya, double *values) {
+                double Dxc, Dyc, s;
+                mapPosition(xa, ya, Dxc, Dyc, s);
 
-            // distortion correction
-            double s = 1.0;
+                for (int c = 0; c < channels; ++c) {
+                    values[2 * c] = Dxc * (s + chDist[c]) + w2 - xa;
+                    values[2 * c + 1] = Dyc * (s + chDist[c]) + h2 - ya;
+                }
+
+                if (meshScale) {
+                    values[2 * channels] = (s - 1.0) * maxRadius;
+                }
 
-            if (enableDistortion) {
-                const double r = sqrt(Dxc * Dxc + Dyc * Dyc) / maxRadius;
-                s = 1.0 - distAmount + distAmount * r;
+                return true;
             }
+        );
 
-            for (int c = 0; c < (enableCA ? 3 : 1); ++c) {
-                double Dx = Dxc * (s + chDist[c]);
-                double Dy = Dyc * (s + chDist[c]);
-
-                // de-center
-                Dx += w2;
-                Dy += h2;
-
-                // Extract integer and fractions of source screen coordinates
-                int xc = Dx;
-                Dx -= xc;
-                xc -= sx;
-                int yc = Dy;
-                Dy -= yc;
-                yc -= sy;
-
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
-                    // multiplier for vignetting correction
-                    double vignmul = 1.0;
-
-                    if (enableVignetting) {
-                        const double vig_x_d = ascale * (x + cx - vig_w2); // centering x coord & scale
-                        const double vig_y_d = ascale * (y + cy - vig_h2); // centering y coord & scale
-                        const double vig_Dx = vig_x_d * cost - vig_y_d * sint;
-                        const double vig_Dy = vig_x_d * sint + vig_y_d * cost;
-                        const double r2 = sqrt(vig_Dx * vig_Dx + vig_Dy * vig_Dy);
-                        if (darkening) {
-                            vignmul /= std::max(v + mul * tanh(b * (maxRadius - s * r2) / maxRadius), 0.001);
-                        } else {
-                            vignmul *= (v + mul * tanh(b * (maxRadius - s * r2) / maxRadius));
-                        }
-                    }
+        if (!mesh->isValid()) {
+            mesh.reset();
+        }
+    }
+
+    // main cycle
+#ifdef _OPENMP
+    #pragma omp parallel if(multiThread)
+#endif
+    {
+        // source positions and distortion scale of the current row
+        std::vector<double> rowX(channels * width);
+        std::vector<double> rowY(channels * width);
+        std::vector<double> rowScale(width, 1.0);
+        std::vector<float> meshBuffer(mesh ? mesh->getRowBufferSize() : 0);
+        std::vector<float> meshValues(mesh ? mesh->getPlanes() * width : 0);
+        std::vector<float*> meshRow(mesh ? mesh->getPlanes() : 0);
+
+        for (size_t p = 0; p < meshRow.size(); ++p) {
+            meshRow[p] = meshValues.data() + p * width;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 16)
+#endif
 
-                    if (enableGradient) {
-                        vignmul *= static_cast<double>(calcGradientFactor(gp, cx + x, cy + y));
+        for (int y = 0; y < height; ++y) {
+            if (mesh) {
+                mesh->getRow(y + cy, cx, width, meshBuffer.data(), meshRow.data());
+
+                for (int c = 0; c < channels; ++c) {
+                    for (int x = 0; x < width; ++x) {
+                        rowX[c * width + x] = (x + cx) + static_cast<double>(meshRow[2 * c][x]);
+                        rowY[c * width + x] = (y + cy) + static_cast<double>(meshRow[2 * c + 1][x]);
                     }
+                }
 
-                    if (enablePCVignetting) {
-                        vignmul *= static_cast<double>(calcPCVignetteFactor(pcv, cx + x, cy + y));
+                if (meshScale) {
+                    for (int x = 0; x < width; ++x) {
+                        rowScale[x] = 1.0 + meshRow[2 * channels][x] / maxRadius;
+                    }
+                }
+            } else {
+                for (int x = 0; x < width; ++x) {
+                    double Dxc, Dyc, s;
+                    mapPosition(x + cx, y + cy, Dxc, Dyc, s);
+
+                    for (int c = 0; c < channels; ++c) {
+                        // de-center
+                        rowX[c * width + x] = Dxc * (s + chDist[c]) + w2;
+                        rowY[c * width + x] = Dyc * (s + chDist[c]) + h2;
                     }
 
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        if (!highQuality) {
-                            transformed->r(y, x) = vignmul * (original->r(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r(yc, xc + 1) * Dx * (1.0 - Dy) + original->r(yc + 1, xc) * (1.0 - Dx) * Dy + original->r(yc + 1, xc + 1) * Dx * Dy);
-                            transformed->g(y, x) = vignmul * (original->g(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g(yc, xc + 1) * Dx * (1.0 - Dy) + original->g(yc + 1, xc) * (1.0 - Dx) * Dy + original->g(yc + 1, xc + 1) * Dx * Dy);
-                            transformed->b(y, x) = vignmul * (original->b(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b(yc, xc + 1) * Dx * (1.0 - Dy) + original->b(yc + 1, xc) * (1.0 - Dx) * Dy + original->b(yc + 1, xc + 1) * Dx * Dy);
-                        } else if (!useLog) {
-                            if (enableCA) {
-                                interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], vignmul);
-                            } else {
-                                interpolateTransformCubic(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x), vignmul);
-                            }
-                        } else {
-                            if (enableCA) {
-                                interpolateTransformChannelsCubicLog(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], vignmul);
+                    rowScale[x] = s;
+                }
+            }
+
+            for (int x = 0; x < width; ++x) {
+                const double s = rowScale[x];
+
+                for (int c = 0; c < channels; ++c) {
+                    double Dx = rowX[c * width + x];
+                    double Dy = rowY[c * width + x];
+
+                    // Extract integer and fractions of source screen coordinates
+                    int xc = Dx;
+                    Dx -= xc;
+                    xc -= sx;
+                    int yc = Dy;
+                    Dy -= yc;
+                    yc -= sy;
+
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+                        // multiplier for vignetting correction
+                        double vignmul = 1.0;
+
+                        if (enableVignetting) {
+                            const double vig_x_d = ascale * (x + cx - vig_w2); // centering x coord & scale
+                            const double vig_y_d = ascale * (y + cy - vig_h2); // centering y coord & scale
+                            const double vig_Dx = vig_x_d * cost - vig_y_d * sint;
+                            const double vig_Dy = vig_x_d * sint + vig_y_d * cost;
+                            const double r2 = sqrt(vig_Dx * vig_Dx + vig_Dy * vig_Dy);
+                            if (darkening) {
+                                vignmul /= std::max(v + mul * tanh(b * (maxRadius - s * r2) / maxRadius), 0.001);
                             } else {
-                                interpolateTransformCubicLog(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x), vignmul);
+                                vignmul *= (v + mul * tanh(b * (maxRadius - s * r2) / maxRadius));
                             }
                         }
-                    } else {
-                        // edge pixels
-                        const int y1 = LIM(yc, 0, original->getHeight() - 1);
-                        const int y2 = LIM(yc + 1, 0, original->getHeight() - 1);
-                        const int x1 = LIM(xc, 0, original->getWidth() - 1);
-                        const int x2 = LIM(xc + 1, 0, original->getWidth() - 1);
-
-                        if (useLog) {
-                            if (enableCA) {
-                                chTrans[c][y][x] = vignmul * xexpf(chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+
+                        if (enableGradient) {
+                            vignmul *= static_cast<double>(calcGradientFactor(gp, cx + x, cy + y));
+                        }
+
+                        if (enablePCVignetting) {
+                            vignmul *= static_cast<double>(calcPCVignetteFactor(pcv, cx + x, cy + y));
+                        }
+
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            if (!highQuality) {
+                                transformed->r(y, x) = vignmul * (original->r(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r(yc, xc + 1) * Dx * (1.0 - Dy) + original->r(yc + 1, xc) * (1.0 - Dx) * Dy + original->r(yc + 1, xc + 1) * Dx * Dy);
+                                transformed->g(y, x) = vignmul * (original->g(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g(yc, xc + 1) * Dx * (1.0 - Dy) + original->g(yc + 1, xc) * (1.0 - Dx) * Dy + original->g(yc + 1, xc + 1) * Dx * Dy);
+                                transformed->b(y, x) = vignmul * (original->b(yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b(yc, xc + 1) * Dx * (1.0 - Dy) + original->b(yc + 1, xc) * (1.0 - Dx) * Dy + original->b(yc + 1, xc + 1) * Dx * Dy);
+                            } else if (!useLog) {
+                                if (enableCA) {
+                                    interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], vignmul);
+                                } else {
+                                    interpolateTransformCubic(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x), vignmul);
+                                }
                             } else {
-                                transformed->r(y, x) = vignmul * xexpf(original->r(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r(y1, x2) * Dx * (1.0 - Dy) + original->r(y2, x1) * (1.0 - Dx) * Dy + original->r(y2, x2) * Dx * Dy);
-                                transformed->g(y, x) = vignmul * xexpf(original->g(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g(y1, x2) * Dx * (1.0 - Dy) + original->g(y2, x1) * (1.0 - Dx) * Dy + original->g(y2, x2) * Dx * Dy);
-                                transformed->b(y, x) = vignmul * xexpf(original->b(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b(y1, x2) * Dx * (1.0 - Dy) + original->b(y2, x1) * (1.0 - Dx) * Dy + original->b(y2, x2) * Dx * Dy);
+                                if (enableCA) {
+                                    interpolateTransformChannelsCubicLog(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], vignmul);
+                                } else {
+                                    interpolateTransformCubicLog(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x), vignmul);
+                                }
                             }
                         } else {
-                            if (enableCA) {
-                                chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            // edge pixels
+                            const int y1 = LIM(yc, 0, original->getHeight() - 1);
+                            const int y2 = LIM(yc + 1, 0, original->getHeight() - 1);
+                            const int x1 = LIM(xc, 0, original->getWidth() - 1);
+                            const int x2 = LIM(xc + 1, 0, original->getWidth() - 1);
+
+                            if (useLog) {
+                                if (enableCA) {
+                                    chTrans[c][y][x] = vignmul * xexpf(chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                                } else {
+                                    transformed->r(y, x) = vignmul * xexpf(original->r(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r(y1, x2) * Dx * (1.0 - Dy) + original->r(y2, x1) * (1.0 - Dx) * Dy + original->r(y2, x2) * Dx * Dy);
+                                    transformed->g(y, x) = vignmul * xexpf(original->g(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g(y1, x2) * Dx * (1.0 - Dy) + original->g(y2, x1) * (1.0 - Dx) * Dy + original->g(y2, x2) * Dx * Dy);
+                                    transformed->b(y, x) = vignmul * xexpf(original->b(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b(y1, x2) * Dx * (1.0 - Dy) + original->b(y2, x1) * (1.0 - Dx) * Dy + original->b(y2, x2) * Dx * Dy);
+                                }
                             } else {
-                                transformed->r(y, x) = vignmul * (original->r(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r(y1, x2) * Dx * (1.0 - Dy) + original->r(y2, x1) * (1.0 - Dx) * Dy + original->r(y2, x2) * Dx * Dy);
-                                transformed->g(y, x) = vignmul * (original->g(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g(y1, x2) * Dx * (1.0 - Dy) + original->g(y2, x1) * (1.0 - Dx) * Dy + original->g(y2, x2) * Dx * Dy);
-                                transformed->b(y, x) = vignmul * (original->b(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b(y1, x2) * Dx * (1.0 - Dy) + original->b(y2, x1) * (1.0 - Dx) * Dy + original->b(y2, x2) * Dx * Dy);
+                                if (enableCA) {
+                                    chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                                } else {
+                                    transformed->r(y, x) = vignmul * (original->r(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r(y1, x2) * Dx * (1.0 - Dy) + original->r(y2, x1) * (1.0 - Dx) * Dy + original->r(y2, x2) * Dx * Dy);
+                                    transformed->g(y, x) = vignmul * (original->g(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g(y1, x2) * Dx * (1.0 - Dy) + original->g(y2, x1) * (1.0 - Dx) * Dy + original->g(y2, x2) * Dx * Dy);
+                                    transformed->b(y, x) = vignmul * (original->b(y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b(y1, x2) * Dx * (1.0 - Dy) + original->b(y2, x1) * (1.0 - Dx) * Dy + original->b(y2, x2) * Dx * Dy);
+                                }
                             }
                         }
-                    }
-                } else {
-                    if (enableCA) {
-                        // not valid (source pixel x,y not inside source image, etc.)
-                        chTrans[c][y][x] = 0;
                     } else {
-                        transformed->r(y, x) = 0;
-                        transformed->g(y, x) = 0;
-                        transformed->b(y, x) = 0;
+                        if (enableCA) {
+                            // not valid (source pixel x,y not inside source image, etc.)
+                            chTrans[c][y][x] = 0;
+                        } else {
+                            transformed->r(y, x) = 0;
+                            transformed->g(y, x) = 0;
+                            transformed->b(y, x) = 0;
+                        }
                     }
                 }
             }
@@ -1358,7 +1469,7 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 }
 
 
-void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap, bool useOriginalBuffer)
+void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int oW, int oH, const LensCorrection *pLCPMap, const std::string &lensKey, bool useOriginalBuffer)
 {
     assert(pLCPMap && params->lensProf.useCA && pLCPMap->isCACorrectionAvailable());
     const bool useLog = params->commonTrans.method == "log";
@@ -1377,50 +1488,97 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
     }
     float** chOrig[3] = {original->r.ptrs, original->g.ptrs, original->b.ptrs};
 
+    const int width = transformed->getWidth();
+    const int height = transformed->getHeight();
+    std::shared_ptr<const WarpMesh> mesh;
+
+    if (cx >= 0 && cy >= 0 && cx + width <= oW && cy + height <= oH) {
+        // source offsets x and y per channel, in full image coordinates
+        mesh = WarpMeshCache::getInstance().getMesh(lensKey + "\nCA", oW, oH, 6,
+            [pLCPMap](double xa, double ya, double *values) {
+                for (int c = 0; c < 3; ++c) {
+                    double Dx = xa;
+                    double Dy = ya;
+                    pLCPMap->correctCA(Dx, Dy, 0, 0, c);
+                    values[2 * c] = Dx - xa;
+                    values[2 * c + 1] = Dy - ya;
+                }
+
+                return true;
+            }
+        );
+
+        if (!mesh->isValid()) {
+            mesh.reset();
+        }
+    }
+
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
+    {
+        std::vector<float> meshBuffer(mesh ? mesh->getRowBufferSize() : 0);
+        std::vector<float> meshValues(mesh ? 6 * width : 0);
+        float* meshRow[6];
 
-    for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
-            for (int c = 0; c < 3; c++) {
-                double Dx = x;
-                double Dy = y;
-                
-                pLCPMap->correctCA(Dx, Dy, cx, cy, c);
-
-                // Extract integer and fractions of coordinates
-                int xc = (int)Dx;
-                Dx -= (double)xc;
-                int yc = (int)Dy;
-                Dy -= (double)yc;
-
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
-
-                    // multiplier for vignetting correction
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        if (!useLog) {
-                            interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], 1.0);
-                        } else {
-                            interpolateTransformChannelsCubicLog(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], 1.0);
-                        }
+        for (int p = 0; p < 6; ++p) {
+            meshRow[p] = mesh ? meshValues.data() + p * width : nullptr;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+
+        for (int y = 0; y < height; y++) {
+            if (mesh) {
+                mesh->getRow(y + cy, cx, width, meshBuffer.data(), meshRow);
+            }
+
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    double Dx = x;
+                    double Dy = y;
+
+                    if (mesh) {
+                        Dx += meshRow[2 * c][x];
+                        Dy += meshRow[2 * c + 1][x];
                     } else {
-                        // edge pixels
-                        int y1 = LIM (yc,   0, original->getHeight() - 1);
-                        int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
-                        int x1 = LIM (xc,   0, original->getWidth() - 1);
-                        int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
-                        if (!useLog) {
-                            chTrans[c][y][x] = (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                        pLCPMap->correctCA(Dx, Dy, cx, cy, c);
+                    }
+
+                    // Extract integer and fractions of coordinates
+                    int xc = (int)Dx;
+                    Dx -= (double)xc;
+                    int yc = (int)Dy;
+                    Dy -= (double)yc;
+
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+
+                        // multiplier for vignetting correction
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            if (!useLog) {
+                                interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], 1.0);
+                            } else {
+                                interpolateTransformChannelsCubicLog(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x], 1.0);
+                            }
                         } else {
-                            chTrans[c][y][x] = xexpf(chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            // edge pixels
+                            int y1 = LIM (yc,   0, original->getHeight() - 1);
+                            int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
+                            int x1 = LIM (xc,   0, original->getWidth() - 1);
+                            int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
+                            if (!useLog) {
+                                chTrans[c][y][x] = (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            } else {
+                                chTrans[c][y][x] = xexpf(chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            }
                         }
+                    } else {
+                        // not valid (source pixel x,y not inside source image, etc.)
+                        chTrans[c][y][x] = 0;
                     }
-                } else {
-                    // not valid (source pixel x,y not inside source image, etc.)
-                    chTrans[c][y][x] = 0;
                 }
             }
         }
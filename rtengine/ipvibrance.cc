@@ -26,6 +26,7 @@
 #include "labimage.h"
 #include "curves.h"
 #include "color.h"
+#include "gamutboundary.h"
 #include "procparams.h"
 #include "StopWatch.h"
 
@@ -162,6 +163,8 @@ void ImProcFunctions::vibrance (LabImage* lab, const procparams::VibranceParams
         {static_cast<float>(wiprof[1][0]), static_cast<float>(wiprof[1][1]), static_cast<float>(wiprof[1][2])},
         {static_cast<float>(wiprof[2][0]), static_cast<float>(wiprof[2][1]), static_cast<float>(wiprof[2][2])}
     };
+    // its tables are only computed when gamutLchonly meets the first out of gamut colour
+    const GamutBoundary& gamutBoundary = GamutBoundary::get(workingProfile);
 
 #ifdef _OPENMP
     #pragma omp parallel if (multiThread)
@@ -221,7 +224,7 @@ void ImProcFunctions::vibrance (LabImage* lab, const procparams::VibranceParams
 
                 //gamut control : Lab values are in gamut
                 float saturation;
-                Color::gamutLchonly(HH, sincosval, Lprov, Chprov, saturation, wip, highlight, 0.15f, 0.98f);
+                Color::gamutLchonly(HH, sincosval, Lprov, Chprov, saturation, wip, highlight, 0.15f, 0.98f, &gamutBoundary);
 
                 if (Chprov > 6.f) {
                     float satredu = 1.f; //reduct sat in function of skin
@@ -18,9 +18,12 @@
  */
 
 #include <memory>
+#include <new>
 
 #include "labimage.h"
 
+#include "bufferpool.h"
+
 namespace rtengine
 {
 
@@ -85,12 +88,23 @@ void LabImage::getPipetteData (float &v1, float &v2, float &v3, int posX, int po
 }
 
 void LabImage::allocLab(size_t w, size_t h)
+{
+    dataSize = w * h * 3 * sizeof(float);
+    data = static_cast<float*>(BufferPool::getInstance().allocate(dataSize));
+
+    if (!data) {
+        throw std::bad_alloc();
+    }
+
+    setRows(w, h);
+}
+
+void LabImage::setRows(size_t w, size_t h)
 {
     L = new float*[h];
     a = new float*[h];
     b = new float*[h];
 
-    data = new float [w * h * 3];
     float * index = data;
 
     for (size_t i = 0; i < h; i++) {
@@ -115,7 +129,7 @@ void LabImage::deleteLab()
     delete [] L;
     delete [] a;
     delete [] b;
-    delete [] data;
+    BufferPool::getInstance().release(data, dataSize);
 }
 
 void LabImage::reallocLab()
@@ -123,6 +137,27 @@ void LabImage::reallocLab()
     allocLab(W, H);
 }
 
+void LabImage::allocate(int w, int h)
+{
+    if (w == W && h == H) {
+        return;
+    }
+
+    if (static_cast<size_t>(w) * h * 3 * sizeof(float) > dataSize) {
+        deleteLab();
+        allocLab(w, h);
+    } else {
+        // the buffer is large enough, only the rows change
+        delete [] L;
+        delete [] a;
+        delete [] b;
+        setRows(w, h);
+    }
+
+    W = w;
+    H = h;
+}
+
 void LabImage::clear(bool multiThread) {
 #ifdef _OPENMP
         #pragma omp parallel for if(multiThread)
@@ -27,6 +27,9 @@ class LabImage final
 {
 private:
     void allocLab(size_t w, size_t h);
+    void setRows(size_t w, size_t h);
+
+    size_t dataSize; // in bytes, data comes from the BufferPool
 
 public:
     int W, H;
@@ -44,6 +47,8 @@ public:
     void getPipetteData (float &L, float &a, float &b, int posX, int posY, int squareSize) const;
     void deleteLab();
     void reallocLab();
+    // changes the size, the buffer is kept if the new size fits into it
+    void allocate(int w, int h);
     void clear(bool multiThread = false);
 };
 
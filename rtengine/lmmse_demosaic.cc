@@ -39,7 +39,8 @@ namespace rtengine
 // Adapted to RawTherapee by Jacques Desmis 3/2013
 // Improved speed and reduced memory consumption by Ingo Weyrich 2/2015
 // TODO Tiles to reduce memory consumption
-void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, int iterations)
+// Only the window starting at (winx, winy) is demosaiced, winx and winy have to be even
+void RawImageSource::lmmse_interpolate_omp(int winx, int winy, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, int iterations)
 {
     // Test for RGB cfa
     for (int i = 0; i < 2; i++) {
@@ -47,7 +48,7 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
             if (FC(i, j) == 3) {
                 // avoid crash
                 std::cout << "lmmse_interpolate_omp supports only RGB Colour filter arrays. Falling back to igv_interpolate" << std::endl;
-                igv_interpolate(winw, winh);
+                igv_interpolate(winx + winw, winy + winh);
                 return;
             }
         }
@@ -121,7 +122,7 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
                 }
             }
 
-            igv_interpolate(winw, winh);
+            igv_interpolate(winx + winw, winy + winh);
             return;
         }
     } else {
@@ -160,7 +161,7 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
             for (int ccc = ba, row = rrr - ba; ccc < cc1 - ba; ccc++) {
                 int col = ccc - ba;
                 float *rix = qix[4] + rrr * cc1 + ccc;
-                rix[0] = (*gamtab)[rawData[row][col]];
+                rix[0] = (*gamtab)[rawData[winy + row][winx + col]];
             }
         }
 
@@ -410,7 +411,7 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
                 rix[c] = qix[c] + rr * cc1 + cc;
 
                 if ((row >= 0) & (row < height) & (col >= 0) & (col < width)) {
-                    rix[c][0] = (*gamtab)[rawData[row][col]];
+                    rix[c][0] = (*gamtab)[rawData[winy + row][winx + col]];
                 } else {
                     rix[c][0] = 0.f;
                 }
@@ -630,14 +631,14 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
     for (int row = 0; row < height; row++) {
         for (int col = 0, rr = row + ba; col < width; col++) {
             int cc = col + ba;
-            int c = FC(row, col);
+            int c = FC(winy + row, winx + col);
 
             for (int ii = 0; ii < 3; ii++)
                 if (ii != c) {
                     float *rix = qix[ii] + rr * cc1 + cc;
-                    (*(rgb[ii]))[row][col] = std::max(0.f, (*gamtab)[65535.f * rix[0]]);
+                    (*(rgb[ii]))[winy + row][winx + col] = std::max(0.f, (*gamtab)[65535.f * rix[0]]);
                 } else {
-                    (*(rgb[ii]))[row][col] = CLIP(rawData[row][col]);
+                    (*(rgb[ii]))[winy + row][winx + col] = CLIP(rawData[winy + row][winx + col]);
                 }
         }
     }
@@ -658,16 +659,16 @@ void RawImageSource::lmmse_interpolate_omp(int winw, int winh, const array2D<flo
     }
 
     if (iterations > 4) {
-        refinement(passref);
+        refinement(passref, winx, winy, winw, winh);
     }
 
 }
 
-void RawImageSource::refinement(int PassCount)
+void RawImageSource::refinement(int PassCount, int winx, int winy, int winw, int winh)
 {
-    int width = W;
-    int height = H;
-    int w1 = width;
+    const int rowEnd = winy + winh;
+    const int colEnd = winx + winw;
+    const int w1 = W;
     int w2 = 2 * w1;
 
     if (plistener) {
@@ -696,16 +697,16 @@ void RawImageSource::refinement(int PassCount)
             #pragma omp for
 #endif
 
-            for (int row = 2; row < height - 2; row++) {
-                int col = 2 + (FC(row, 2) & 1);
+            for (int row = winy + 2; row < rowEnd - 2; row++) {
+                int col = winx + 2 + (FC(row, winx + 2) & 1);
                 int c = FC(row, col);
 #ifdef __SSE2__
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 vfloat onev = F2V(1.f);
                 vfloat zd5v = F2V(0.5f);
 
-                for (; col < width - 8; col += 8) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 8; col += 8) {
+                    int indx = row * W + col;
                     pix[c] = (float*)(*rgb[c]) + indx;
                     pix[1] = (float*)(*rgb[1]) + indx;
                     dLv = onev / (onev + vabsf(LC2VFU(pix[c][ -2]) - LC2VFU(pix[c][0])) + vabsf(LC2VFU(pix[1][ 1]) - LC2VFU(pix[1][ -1])));
@@ -718,8 +719,8 @@ void RawImageSource::refinement(int PassCount)
 
 #endif
 
-                for (; col < width - 2; col += 2) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 2; col += 2) {
+                    int indx = row * W + col;
                     pix[c] = (float*)(*rgb[c]) + indx;
                     pix[1] = (float*)(*rgb[1]) + indx;
                     float dL = 1.f / (1.f + fabsf(pix[c][ -2] - pix[c][0]) + fabsf(pix[1][ 1] - pix[1][ -1]));
@@ -736,16 +737,16 @@ void RawImageSource::refinement(int PassCount)
             #pragma omp for
 #endif
 
-            for (int row = 2; row < height - 2; row++) {
-                int col = 2 + (FC(row, 3) & 1);
+            for (int row = winy + 2; row < rowEnd - 2; row++) {
+                int col = winx + 2 + (FC(row, winx + 3) & 1);
                 int c = FC(row, col + 1);
 #ifdef __SSE2__
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 vfloat onev = F2V(1.f);
                 vfloat zd5v = F2V(0.5f);
 
-                for (; col < width - 8; col += 8) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 8; col += 8) {
+                    int indx = row * W + col;
                     pix[1] = (float*)(*rgb[1]) + indx;
 
                     for (int i = 0; i < 2; c = 2 - c, i++) {
@@ -761,8 +762,8 @@ void RawImageSource::refinement(int PassCount)
 
 #endif
 
-                for (; col < width - 2; col += 2) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 2; col += 2) {
+                    int indx = row * W + col;
                     pix[1] = (float*)(*rgb[1]) + indx;
 
                     for (int i = 0; i < 2; c = 2 - c, i++) {
@@ -782,16 +783,16 @@ void RawImageSource::refinement(int PassCount)
             #pragma omp for
 #endif
 
-            for (int row = 2; row < height - 2; row++) {
-                int col = 2 + (FC(row, 2) & 1);
+            for (int row = winy + 2; row < rowEnd - 2; row++) {
+                int col = winx + 2 + (FC(row, winx + 2) & 1);
                 int c = 2 - FC(row, col);
 #ifdef __SSE2__
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 vfloat onev = F2V(1.f);
                 vfloat zd5v = F2V(0.5f);
 
-                for (; col < width - 8; col += 8) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 8; col += 8) {
+                    int indx = row * W + col;
                     pix[0] = (float*)(*rgb[0]) + indx;
                     pix[1] = (float*)(*rgb[1]) + indx;
                     pix[2] = (float*)(*rgb[2]) + indx;
@@ -806,8 +807,8 @@ void RawImageSource::refinement(int PassCount)
 
 #endif
 
-                for (; col < width - 2; col += 2) {
-                    int indx = row * width + col;
+                for (; col < colEnd - 2; col += 2) {
+                    int indx = row * W + col;
                     pix[0] = (float*)(*rgb[0]) + indx;
                     pix[1] = (float*)(*rgb[1]) + indx;
                     pix[2] = (float*)(*rgb[2]) + indx;
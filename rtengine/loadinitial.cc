@@ -16,7 +16,13 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <atomic>
+#include <string>
+
+#include <glibmm/miscutils.h>
+
 #include "rtengine.h"
+#include "myfile.h"
 #include "stdimagesource.h"
 #include "rawimagesource.h"
 
@@ -45,5 +51,19 @@ InitialImage* InitialImage::load (const Glib::ustring& fname, bool isRaw, int* e
 
     return isrc;
 }
+
+InitialImage* InitialImage::load (const void* data, std::size_t size, const Glib::ustring& fname, bool isRaw, int* errorCode, ProgressListener* pl)
+{
+    static std::atomic<unsigned int> counter(0);
+
+    // the loaders open the buffer by this name, keep the extension they dispatch on
+    const Glib::ustring memoryName = Glib::ustring("memory/") + std::to_string(counter++) + "/" + Glib::path_get_basename(fname);
+
+    register_memory_file(memoryName.c_str(), data, size);
+    InitialImage* const result = load(memoryName, isRaw, errorCode, pl);
+    unregister_memory_file(memoryName.c_str());
+
+    return result;
+}
 }
 
@@ -0,0 +1,163 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#include "alignedbuffer.h"
+#include "noncopyable.h"
+#include "opthelper.h"
+#include "rt_math.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Regular 3D lookup table with 4 float channels per node and tetrahedral interpolation
+ *
+ * Nodes are stored interleaved and 16 byte aligned, so that one node fits exactly in one SSE
+ * register and the interpolation works on all 4 channels at once.
+ * Coordinates are expressed in node units, i.e. in the [0 ; size-1] range for each axis.
+ */
+class LUT3D final :
+    public NonCopyable
+{
+public:
+    LUT3D() :
+        size(0)
+    {
+    }
+
+    explicit LUT3D(unsigned int size) :
+        size(0)
+    {
+        init(size);
+    }
+
+    bool init(unsigned int newSize)
+    {
+        if (newSize < 2 || !data.resize(static_cast<std::size_t>(newSize) * newSize * newSize * 4)) {
+            size = 0;
+            return false;
+        }
+
+        size = newSize;
+        return true;
+    }
+
+    explicit operator bool() const
+    {
+        return size > 0;
+    }
+
+    unsigned int getSize() const
+    {
+        return size;
+    }
+
+    void swap(LUT3D& other)
+    {
+        data.swap(other.data);
+        std::swap(size, other.size);
+    }
+
+    float* node(unsigned int r, unsigned int g, unsigned int b)
+    {
+        return data.data + ((static_cast<std::size_t>(r) * size + g) * size + b) * 4;
+    }
+
+    const float* node(unsigned int r, unsigned int g, unsigned int b) const
+    {
+        return data.data + ((static_cast<std::size_t>(r) * size + g) * size + b) * 4;
+    }
+
+    /**
+    * @brief Tetrahedral interpolation
+    * @param r,g,b coordinates in node units, clamped to [0 ; size-1]
+    * @param out receives the 4 interpolated channels
+    */
+    void getValues(float r, float g, float b, float out[4]) const
+    {
+        const float maxc = size - 1;
+        r = LIM(r, 0.f, maxc);
+        g = LIM(g, 0.f, maxc);
+        b = LIM(b, 0.f, maxc);
+
+        const unsigned int ir = rtengine::min<unsigned int>(r, size - 2);
+        const unsigned int ig = rtengine::min<unsigned int>(g, size - 2);
+        const unsigned int ib = rtengine::min<unsigned int>(b, size - 2);
+        const float fr = r - ir;
+        const float fg = g - ig;
+        const float fb = b - ib;
+
+        const std::size_t sr = static_cast<std::size_t>(size) * size * 4;
+        const std::size_t sg = static_cast<std::size_t>(size) * 4;
+        constexpr std::size_t sb = 4;
+        const float* const c000 = node(ir, ig, ib);
+
+        // select the tetrahedron containing the point, then walk along its edges
+        const float *c1, *c2;
+        float w0, w1, w2, w3;
+
+        if (fr > fg) {
+            if (fg > fb) {
+                c1 = c000 + sr;
+                c2 = c000 + sr + sg;
+                w0 = 1.f - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb;
+            } else if (fr > fb) {
+                c1 = c000 + sr;
+                c2 = c000 + sr + sb;
+                w0 = 1.f - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg;
+            } else {
+                c1 = c000 + sb;
+                c2 = c000 + sr + sb;
+                w0 = 1.f - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg;
+            }
+        } else {
+            if (fb > fg) {
+                c1 = c000 + sb;
+                c2 = c000 + sg + sb;
+                w0 = 1.f - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr;
+            } else if (fb > fr) {
+                c1 = c000 + sg;
+                c2 = c000 + sg + sb;
+                w0 = 1.f - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr;
+            } else {
+                c1 = c000 + sg;
+                c2 = c000 + sr + sg;
+                w0 = 1.f - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb;
+            }
+        }
+
+        const float* const c111 = c000 + sr + sg + sb;
+
+#ifdef __SSE2__
+        STVFU(out[0], F2V(w0) * LVF(c000[0]) + F2V(w1) * LVF(c1[0]) + F2V(w2) * LVF(c2[0]) + F2V(w3) * LVF(c111[0]));
+#else
+        for (int c = 0; c < 4; ++c) {
+            out[c] = w0 * c000[c] + w1 * c1[c] + w2 * c2[c] + w3 * c111[c];
+        }
+#endif
+    }
+
+private:
+    AlignedBuffer<float> data;
+    unsigned int size;
+};
+
+}
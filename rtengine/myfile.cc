@@ -18,7 +18,57 @@
  */
 #include "myfile.h"
 #include <cstdarg>
+#include <map>
+#include <mutex>
+#include <string>
 #include "rtengine.h"
+
+namespace
+{
+
+// IMFILE::fd of a registered buffer, which is neither unmapped nor freed by fclose
+constexpr int memory_file_fd = -2;
+
+struct MemoryFile {
+    const void* data;
+    size_t size;
+};
+
+std::map<std::string, MemoryFile> memoryFiles;
+std::mutex memoryFilesMutex;
+
+bool findMemoryFile (const char* fname, MemoryFile& memoryFile)
+{
+    std::lock_guard<std::mutex> lock(memoryFilesMutex);
+
+    if (memoryFiles.empty()) {
+        return false;
+    }
+
+    const auto it = memoryFiles.find(fname);
+
+    if (it == memoryFiles.end()) {
+        return false;
+    }
+
+    memoryFile = it->second;
+    return true;
+}
+
+rtengine::IMFILE* openMemoryFile (const MemoryFile& memoryFile)
+{
+    rtengine::IMFILE* mf = new rtengine::IMFILE;
+    memset(mf, 0, sizeof(*mf));
+    mf->fd = memory_file_fd;
+    mf->pos = 0;
+    mf->size = memoryFile.size;
+    mf->data = static_cast<char*>(const_cast<void*>(memoryFile.data));
+    mf->eof = false;
+    return mf;
+}
+
+}
+
 // get mmap() sorted out
 #ifdef MYFILE_MMAP
 
@@ -72,6 +122,12 @@ int munmap(void *start, size_t length)
 
 rtengine::IMFILE* rtengine::fopen (const char* fname)
 {
+    MemoryFile memoryFile;
+
+    if (findMemoryFile(fname, memoryFile)) {
+        return openMemoryFile(memoryFile);
+    }
+
     int fd;
 
 #ifdef WIN32
@@ -131,6 +187,11 @@ rtengine::IMFILE* rtengine::gfopen (const char* fname)
 
 rtengine::IMFILE* rtengine::fopen (const char* fname)
 {
+    MemoryFile memoryFile;
+
+    if (findMemoryFile(fname, memoryFile)) {
+        return openMemoryFile(memoryFile);
+    }
 
     FILE* f = g_fopen (fname, "rb");
 
@@ -154,6 +215,11 @@ rtengine::IMFILE* rtengine::fopen (const char* fname)
 
 rtengine::IMFILE* rtengine::gfopen (const char* fname)
 {
+    MemoryFile memoryFile;
+
+    if (findMemoryFile(fname, memoryFile)) {
+        return openMemoryFile(memoryFile);
+    }
 
     FILE* f = g_fopen (fname, "rb");
 
@@ -192,6 +258,11 @@ rtengine::IMFILE* rtengine::fopen (unsigned* buf, int size)
 
 void rtengine::fclose (IMFILE* f)
 {
+    if (f->fd == memory_file_fd) {
+        delete f;
+        return;
+    }
+
 #ifdef MYFILE_MMAP
 
     if ( f->fd == -1 ) {
@@ -207,6 +278,39 @@ void rtengine::fclose (IMFILE* f)
     delete f;
 }
 
+void rtengine::register_memory_file (const char* fname, const void* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(memoryFilesMutex);
+    memoryFiles[fname] = {data, size};
+}
+
+void rtengine::unregister_memory_file (const char* fname)
+{
+    std::lock_guard<std::mutex> lock(memoryFilesMutex);
+    memoryFiles.erase(fname);
+}
+
+bool rtengine::is_memory_file (const char* fname)
+{
+    MemoryFile memoryFile;
+    return findMemoryFile(fname, memoryFile);
+}
+
+FILE* rtengine::gfopen_stdio (const char* fname)
+{
+    MemoryFile memoryFile;
+
+    if (findMemoryFile(fname, memoryFile)) {
+#ifdef WIN32
+        return nullptr;
+#else
+        return fmemopen(const_cast<void*>(memoryFile.data), memoryFile.size, "rb");
+#endif
+    }
+
+    return g_fopen(fname, "rb");
+}
+
 int rtengine::fscanf (IMFILE* f, const char* s ...)
 {
     // fscanf not easily wrapped since we have no terminating \0 at end
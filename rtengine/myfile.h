@@ -54,6 +54,16 @@ IMFILE* fopen (const char* fname);
 IMFILE* gfopen (const char* fname);
 IMFILE* fopen (unsigned* buf, int size);
 void fclose (IMFILE* f);
+
+/*
+  Buffers registered under a file name are opened by fopen(), gfopen() and gfopen_stdio() instead of
+  the file, without being copied. The buffer has to stay valid until it is unregistered.
+ */
+void register_memory_file (const char* fname, const void* data, size_t size);
+void unregister_memory_file (const char* fname);
+bool is_memory_file (const char* fname);
+// opens the file (or its registered buffer, not supported on Windows) as a stdio stream for reading
+FILE* gfopen_stdio (const char* fname);
 inline long ftell (IMFILE* f)
 {
     return f->pos;
@@ -20,6 +20,7 @@
 //
 ////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cmath>
 #include <stack>
 
@@ -309,7 +310,7 @@ using namespace rtengine;
 void RawImageSource::pixelshift(int winx, int winy, int winw, int winh, const procparams::RAWParams &rawParamsIn, unsigned int frame, const std::string &make, const std::string &model, float rawWpCorrection)
 {
 BENCHFUN
-    if(numFrames != 4) { // fallback for non pixelshift files
+    if(numFrames != 4 || !rawDataFrames[0]) { // fallback for non pixelshift files and for frames which were not preprocessed
         amaze_demosaic_RT(winx, winy, winw, winh, rawData, red, green, blue, options.chunkSizeAMAZE, options.measure);
         return;
     }
@@ -336,7 +337,7 @@ BENCHFUN
         if(!showOnlyMask) {
             if(bayerParams.pixelShiftMedian || bayerParams.pixelShiftAverage) { // We need the demosaiced frames for motion correction
                 if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::LMMSE)) {
-                    lmmse_interpolate_omp(winw, winh, *(rawDataFrames[0]), red, green, blue, bayerParams.lmmse_iterations);
+                    lmmse_interpolate_omp(winx, winy, winw, winh, *(rawDataFrames[0]), red, green, blue, bayerParams.lmmse_iterations);
                 } else if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::AMAZEVNG4)) {
                     dual_demosaic_RT (true, rawParamsIn, winw, winh, *(rawDataFrames[0]), red, green, blue, bayerParams.dualDemosaicContrast, true);
                 } else if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::RCDVNG4)) {
@@ -350,7 +351,7 @@ BENCHFUN
 
                 for(int i = 0; i < 3; i++) {
                     if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::LMMSE)) {
-                        lmmse_interpolate_omp(winw, winh, *(rawDataFrames[i + 1]), redTmp[i], greenTmp[i], blueTmp[i], bayerParams.lmmse_iterations);
+                        lmmse_interpolate_omp(winx, winy, winw, winh, *(rawDataFrames[i + 1]), redTmp[i], greenTmp[i], blueTmp[i], bayerParams.lmmse_iterations);
                     } else if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::AMAZEVNG4)) {
                         dual_demosaic_RT (true, rawParamsIn, winw, winh, *(rawDataFrames[i + 1]), redTmp[i], greenTmp[i], blueTmp[i], bayerParams.dualDemosaicContrast, true);
                     } else if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::RCDVNG4)) {
@@ -399,7 +400,7 @@ BENCHFUN
                 }
             } else {
                 if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::LMMSE)) {
-                    lmmse_interpolate_omp(winw, winh, rawData, red, green, blue, bayerParams.lmmse_iterations);
+                    lmmse_interpolate_omp(winx, winy, winw, winh, rawData, red, green, blue, bayerParams.lmmse_iterations);
                 } else if (bayerParams.pixelShiftDemosaicMethod == bayerParams.getPSDemosaicMethodString(procparams::RAWParams::BayerSensor::PSDemosaicMethod::AMAZEVNG4)) {
                     procparams::RAWParams rawParamsTmp = rawParamsIn;
                     rawParamsTmp.bayersensor.method = procparams::RAWParams::BayerSensor::getMethodString(procparams::RAWParams::BayerSensor::Method::AMAZEVNG4);
@@ -743,17 +744,11 @@ BENCHFUN
 
 
     if(motionDetection) {
-        // fill channels psRed and psBlue
-        array2D<float> psRed(winw + 32, winh); // increase width to avoid cache conflicts
-        array2D<float> psBlue(winw + 32, winh);
+        // The red and blue values of the 4 frames are only needed around the processed rows, so each thread
+        // keeps them for a band of rows instead of keeping two planes of the size of the frames
+        constexpr int bandHeight = 32;
 
-#ifdef _OPENMP
-        #pragma omp parallel for schedule(dynamic,16)
-#endif
-
-        for(int i = winy + 1; i < winh - 1; ++i) {
-            float *nonGreenDest0 = psRed[i];
-            float *nonGreenDest1 = psBlue[i];
+        const auto fillNonGreen = [&](int i, float *nonGreenDest0, float *nonGreenDest1) {
             float ngbright[2][4] = {{redBrightness[0], redBrightness[1], redBrightness[2], redBrightness[3]},
                                     {blueBrightness[0], blueBrightness[1], blueBrightness[2], blueBrightness[3]}
                                    };
@@ -776,13 +771,21 @@ BENCHFUN
                 nonGreenDest1[j] = (*rawDataFrames[2 - offset])[i + 1][j - offset + 1] * ngbright[ng ^ 1][2 - offset];
                 offset ^= 1; // 0 => 1 or 1 => 0
             }
-        }
+        };
 
-        if(plistener) {
-            plistener->setProgress(0.3);
-        }
+        // fills the rows [bandStart, bandEnd) into the rows [0, bandEnd - bandStart) of psRed and psBlue
+        const auto fillBand = [&](int bandStart, int bandEnd, array2D<float> &psRed, array2D<float> &psBlue) {
+            for(int i = bandStart; i < bandEnd; ++i) {
+                if(i > winy && i < winh - 1) {
+                    fillNonGreen(i, psRed[i - bandStart], psBlue[i - bandStart]);
+                } else {
+                    std::fill_n(psRed[i - bandStart], winw, 0.f);
+                    std::fill_n(psBlue[i - bandStart], winw, 0.f);
+                }
+            }
+        };
 
-        // now that the temporary planes are filled for easy access we do the motion detection
+        // now we do the motion detection
         array2D<float> psMask(winw, winh);
 
         int offsX = 0, offsY = 0;
@@ -810,50 +813,70 @@ BENCHFUN
         }
 
 
+        const int yStart = winy + border - offsY;
+        const int yEnd = winh - (border + offsY);
+
 #ifdef _OPENMP
-        #pragma omp parallel for schedule(dynamic,16)
+        #pragma omp parallel
 #endif
+        {
+            // one row above and below the band for the cross check
+            array2D<float> psRed(winw + 32, bandHeight + 2, ARRAY2D_CLEAR_DATA); // increase width to avoid cache conflicts
+            array2D<float> psBlue(winw + 32, bandHeight + 2, ARRAY2D_CLEAR_DATA);
 
-        for(int i = winy + border - offsY; i < winh - (border + offsY); ++i) {
-            // offset to keep the code short. It changes its value between 0 and 1 for each iteration of the loop
-            unsigned int offset = fc(cfarray, i, winx + border - offsX) & 1;
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic)
+#endif
 
-            for(int j = winx + border - offsX; j < winw - (border + offsX); ++j, offset ^= 1) {
-                psMask[i][j] = noMotion;
+            for(int bandStart = yStart; bandStart < yEnd; bandStart += bandHeight) {
+                const int bandEnd = std::min(bandStart + bandHeight, yEnd);
 
-                if(checkGreen) {
-                    if(greenDiff((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset], (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset], stddevFactorGreen, eperIsoGreen, nRead, prnu) > 0.f) {
-                        psMask[i][j] = greenWeight;
-                        // do not set the motion pixel values. They have already been set by demosaicer
-                        continue;
-                    }
+                if(checkNonGreenCross) {
+                    fillBand(bandStart - 1, bandEnd + 1, psRed, psBlue);
                 }
 
-                if(checkNonGreenCross) {
-                    // check red cross
-                    float redTop    = psRed[i - 1][j];
-                    float redLeft   = psRed[i][j - 1];
-                    float redCentre = psRed[i][j];
-                    float redRight  = psRed[i][j + 1];
-                    float redBottom = psRed[i + 1][j];
-                    float redDiff   = nonGreenDiffCross(redRight, redLeft, redTop, redBottom, redCentre, clippedRed, stddevFactorRed, eperIsoRed, nRead, prnu);
-
-                    if(redDiff > 0.f) {
-                        psMask[i][j] = redBlueWeight;
-                        continue;
-                    }
+                for(int i = bandStart; i < bandEnd; ++i) {
+                    // offset to keep the code short. It changes its value between 0 and 1 for each iteration of the loop
+                    unsigned int offset = fc(cfarray, i, winx + border - offsX) & 1;
+
+                    for(int j = winx + border - offsX; j < winw - (border + offsX); ++j, offset ^= 1) {
+                        psMask[i][j] = noMotion;
 
-                    // check blue cross
-                    float blueTop    = psBlue[i - 1][j];
-                    float blueLeft   = psBlue[i][j - 1];
-                    float blueCentre = psBlue[i][j];
-                    float blueRight  = psBlue[i][j + 1];
-                    float blueBottom = psBlue[i + 1][j];
-                    float blueDiff   = nonGreenDiffCross(blueRight, blueLeft, blueTop, blueBottom, blueCentre, clippedBlue, stddevFactorBlue, eperIsoBlue, nRead, prnu);
-
-                    if(blueDiff > 0.f) {
-                        psMask[i][j] = redBlueWeight;
-                        continue;
+                        if(checkGreen) {
+                            if(greenDiff((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset], (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset], stddevFactorGreen, eperIsoGreen, nRead, prnu) > 0.f) {
+                                psMask[i][j] = greenWeight;
+                                // do not set the motion pixel values. They have already been set by demosaicer
+                                continue;
+                            }
+                        }
+
+                        if(checkNonGreenCross) {
+                            // check red cross
+                            float redTop    = psRed[i - bandStart][j];
+                            float redLeft   = psRed[i - bandStart + 1][j - 1];
+                            float redCentre = psRed[i - bandStart + 1][j];
+                            float redRight  = psRed[i - bandStart + 1][j + 1];
+                            float redBottom = psRed[i - bandStart + 2][j];
+                            float redDiff   = nonGreenDiffCross(redRight, redLeft, redTop, redBottom, redCentre, clippedRed, stddevFactorRed, eperIsoRed, nRead, prnu);
+
+                            if(redDiff > 0.f) {
+                                psMask[i][j] = redBlueWeight;
+                                continue;
+                            }
+
+                            // check blue cross
+                            float blueTop    = psBlue[i - bandStart][j];
+                            float blueLeft   = psBlue[i - bandStart + 1][j - 1];
+                            float blueCentre = psBlue[i - bandStart + 1][j];
+                            float blueRight  = psBlue[i - bandStart + 1][j + 1];
+                            float blueBottom = psBlue[i - bandStart + 2][j];
+                            float blueDiff   = nonGreenDiffCross(blueRight, blueLeft, blueTop, blueBottom, blueCentre, clippedBlue, stddevFactorBlue, eperIsoBlue, nRead, prnu);
+
+                            if(blueDiff > 0.f) {
+                                psMask[i][j] = redBlueWeight;
+                                continue;
+                            }
+                        }
                     }
                 }
             }
@@ -922,68 +945,84 @@ BENCHFUN
         }
 
 #ifdef _OPENMP
-        #pragma omp parallel for schedule(dynamic,16)
+        #pragma omp parallel
 #endif
+        {
+            array2D<float> psRed(winw + 32, bandHeight, ARRAY2D_CLEAR_DATA);
+            array2D<float> psBlue(winw + 32, bandHeight, ARRAY2D_CLEAR_DATA);
 
-        for(int i = winy + border - offsY; i < winh - (border + offsY); ++i) {
-#ifdef __SSE2__
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic)
+#endif
 
-            // pow() is expensive => pre calculate blend factor using SSE
-            if(smoothTransitions) { //
-                vfloat onev = F2V(1.f);
-                vfloat smoothv = F2V(smoothFactor);
-                int j = winx + border - offsX;
-
-                for(; j < winw - (border + offsX) - 3; j += 4) {
-                    vfloat blendv = vmaxf(LVFU(psMask[i][j]), onev) - onev;
-                    blendv = pow_F(blendv, smoothv);
-                    blendv = vself(vmaskf_eq(smoothv, ZEROV), onev, blendv);
-                    STVFU(psMask[i][j], blendv);
-                }
+            for(int bandStart = yStart; bandStart < yEnd; bandStart += bandHeight) {
+                const int bandEnd = std::min(bandStart + bandHeight, yEnd);
 
-                for(; j < winw - (border + offsX); ++j) {
-                    psMask[i][j] = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
+                if(!showOnlyMask) {
+                    fillBand(bandStart, bandEnd, psRed, psBlue);
                 }
-            }
+
+                for(int i = bandStart; i < bandEnd; ++i) {
+#ifdef __SSE2__
+
+                    // pow() is expensive => pre calculate blend factor using SSE
+                    if(smoothTransitions) { //
+                        vfloat onev = F2V(1.f);
+                        vfloat smoothv = F2V(smoothFactor);
+                        int j = winx + border - offsX;
+
+                        for(; j < winw - (border + offsX) - 3; j += 4) {
+                            vfloat blendv = vmaxf(LVFU(psMask[i][j]), onev) - onev;
+                            blendv = pow_F(blendv, smoothv);
+                            blendv = vself(vmaskf_eq(smoothv, ZEROV), onev, blendv);
+                            STVFU(psMask[i][j], blendv);
+                        }
+
+                        for(; j < winw - (border + offsX); ++j) {
+                            psMask[i][j] = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
+                        }
+                    }
 
 #endif
-            float *greenDest = green[i + offsY];
-            float *redDest = red[i + offsY];
-            float *blueDest = blue[i + offsY];
+                    float *greenDest = green[i + offsY];
+                    float *redDest = red[i + offsY];
+                    float *blueDest = blue[i + offsY];
 
-            // offset to keep the code short. It changes its value between 0 and 1 for each iteration of the loop
-            unsigned int offset = fc(cfarray, i, winx + border - offsX) & 1;
+                    // offset to keep the code short. It changes its value between 0 and 1 for each iteration of the loop
+                    unsigned int offset = fc(cfarray, i, winx + border - offsX) & 1;
 
-            for(int j = winx + border - offsX; j < winw - (border + offsX); ++j, offset ^= 1) {
-                if(showOnlyMask) {
-                    if(smoothTransitions) { // we want only motion mask => paint areas according to their motion (dark = no motion, bright = motion)
+                    for(int j = winx + border - offsX; j < winw - (border + offsX); ++j, offset ^= 1) {
+                        if(showOnlyMask) {
+                            if(smoothTransitions) { // we want only motion mask => paint areas according to their motion (dark = no motion, bright = motion)
 #ifdef __SSE2__
-                        // use pre calculated blend factor
-                        const float blend = psMask[i][j];
+                                // use pre calculated blend factor
+                                const float blend = psMask[i][j];
 #else
-                        const float blend = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
+                                const float blend = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
 #endif
-                        redDest[j + offsX] = greenDest[j + offsX] = blueDest[j + offsX] = blend * 32768.f;
-                    } else {
-                        redDest[j + offsX] = greenDest[j + offsX] = blueDest[j + offsX] = mask[i][j] == 255 ? 65535.f : 0.f;
-                    }
-                } else if(mask[i][j] == 255) {
-                    paintMotionMask(j + offsX, showMotion, greenDest, redDest, blueDest);
-                } else {
-                    if(smoothTransitions) {
+                                redDest[j + offsX] = greenDest[j + offsX] = blueDest[j + offsX] = blend * 32768.f;
+                            } else {
+                                redDest[j + offsX] = greenDest[j + offsX] = blueDest[j + offsX] = mask[i][j] == 255 ? 65535.f : 0.f;
+                            }
+                        } else if(mask[i][j] == 255) {
+                            paintMotionMask(j + offsX, showMotion, greenDest, redDest, blueDest);
+                        } else {
+                            if(smoothTransitions) {
 #ifdef __SSE2__
-                        // use pre calculated blend factor
-                        const float blend = psMask[i][j];
+                                // use pre calculated blend factor
+                                const float blend = psMask[i][j];
 #else
-                        const float blend = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
+                                const float blend = smoothFactor == 0.f ? 1.f : pow_F(std::max(psMask[i][j] - 1.f, 0.f), smoothFactor);
 #endif
-                        redDest[j + offsX] = intp(blend, showMotion ? 0.f : redDest[j + offsX], psRed[i][j] );
-                        greenDest[j + offsX] = intp(blend, showMotion ? 13500.f : greenDest[j + offsX], ((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset] + (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset]) * 0.5f);
-                        blueDest[j + offsX] = intp(blend, showMotion ? 0.f : blueDest[j + offsX], psBlue[i][j]);
-                    } else {
-                        redDest[j + offsX] = psRed[i][j];
-                        greenDest[j + offsX] = ((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset] + (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset]) * 0.5f;
-                        blueDest[j + offsX] = psBlue[i][j];
+                                redDest[j + offsX] = intp(blend, showMotion ? 0.f : redDest[j + offsX], psRed[i - bandStart][j] );
+                                greenDest[j + offsX] = intp(blend, showMotion ? 13500.f : greenDest[j + offsX], ((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset] + (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset]) * 0.5f);
+                                blueDest[j + offsX] = intp(blend, showMotion ? 0.f : blueDest[j + offsX], psBlue[i - bandStart][j]);
+                            } else {
+                                redDest[j + offsX] = psRed[i - bandStart][j];
+                                greenDest[j + offsX] = ((*rawDataFrames[1 - offset])[i - offset + 1][j] * greenBrightness[1 - offset] + (*rawDataFrames[3 - offset])[i + offset][j + 1] * greenBrightness[3 - offset]) * 0.5f;
+                                blueDest[j + offsX] = psBlue[i - bandStart][j];
+                            }
+                        }
                     }
                 }
             }
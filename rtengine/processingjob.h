@@ -18,6 +18,8 @@
  */
 #pragma once
 
+#include <vector>
+
 #include "procparams.h"
 #include "rtengine.h"
 
@@ -28,11 +30,21 @@ class ProcessingJobImpl final : public ProcessingJob
 {
 
 public:
+    // The part of the processing parameters that may differ between the outputs of a job
+    struct Output {
+        procparams::ResizeParams resize;
+        procparams::SharpeningParams prsharpening;
+        Glib::ustring outputProfile;
+        RenderingIntent outputIntent;
+        bool outputBPC;
+    };
+
     Glib::ustring fname;
     bool isRaw;
     InitialImage* initialImage;
     procparams::ProcParams pparams;
     bool fast;
+    std::vector<Output> outputs;
 
     ProcessingJobImpl (const Glib::ustring& fn, bool iR, const procparams::ProcParams& pp, bool ff)
         : fname(fn), isRaw(iR), initialImage(nullptr), pparams(pp), fast(ff) {}
@@ -51,6 +63,17 @@ public:
     }
 
     bool fastPipeline() const override { return fast; }
+
+    void addOutput(const procparams::ProcParams& outputParams) override
+    {
+        outputs.push_back({
+            outputParams.resize,
+            outputParams.prsharpening,
+            outputParams.icm.outputProfile,
+            outputParams.icm.outputIntent,
+            outputParams.icm.outputBPC
+        });
+    }
 };
 
 }
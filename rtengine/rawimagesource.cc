@@ -20,6 +20,8 @@
 #include <cstdlib>
 #include <iostream>
 
+#include <glibmm/miscutils.h>
+
 #include "camconst.h"
 #include "color.h"
 #include "curves.h"
@@ -32,6 +34,7 @@
 #include "improcfun.h"
 #include "jaggedarray.h"
 #include "median.h"
+#include "myfile.h"
 #include "mytime.h"
 #include "pdaflinesfilter.h"
 #include "procparams.h"
@@ -41,6 +44,7 @@
 #include "rt_math.h"
 #include "rtengine.h"
 #include "rtlensfun.h"
+#include "../rtgui/multilangmgr.h"
 #include "../rtgui/options.h"
 
 #define BENCHMARK
@@ -502,6 +506,48 @@ unsigned RawImageSource::FC(int row, int col) const
     return ri->FC(row, col);
 }
 
+// returns the frame, decodes it on first use
+RawImage* RawImageSource::getFrame(unsigned int frameNum)
+{
+    if (frameNum >= numFrames || frameFailed[frameNum]) {
+        return nullptr;
+    }
+
+    if (!riFrames[frameNum]) {
+        RawImage* const frame = new RawImage(fileName);
+
+        if (memoryBacked || frame->loadRaw(true, frameNum + frameOffset) || frame->get_width() != riFrames[0]->get_width() || frame->get_height() != riFrames[0]->get_height()) {
+            // the processing goes on without the frame (e.g. pixel shift falls back to AMaZE), tell it to the user
+            frameFailed[frameNum] = true;
+            fprintf(stderr, "Could not decode frame %u of %s\n", frameNum + 1, fileName.c_str());
+
+            if (plistener) {
+                plistener->error(Glib::ustring::compose(M("MAIN_MSG_CANNOTDECODEFRAME"), frameNum + 1, Glib::path_get_basename(fileName)));
+            }
+
+            delete frame;
+            return nullptr;
+        }
+
+        frame->compress_image(frameNum);
+        frame->set_prefilters();
+        riFrames[frameNum] = frame;
+    }
+
+    return riFrames[frameNum];
+}
+
+// decodes the first count frames in parallel
+void RawImageSource::loadFrames(unsigned int count)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (unsigned int i = 1; i < std::min(count, numFrames); ++i) {
+        getFrame(i);
+    }
+}
+
 eSensorType RawImageSource::getSensorType () const
 {
     return ri != nullptr ? ri->getSensorType() : ST_NONE;
@@ -1077,8 +1123,6 @@ int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
     }
     numFrames = firstFrameOnly ? (numFrames < 7 ? 1 : ri->getFrameCount()) : ri->getFrameCount();
 
-    errCode = 0;
-
     if (numFrames >= 7) {
         // special case to avoid crash when loading Hasselblad H6D-100cMS pixelshift files
         // limit to 6 frames and skip first frame, as first frame is not bayer
@@ -1087,72 +1131,32 @@ int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
         } else {
             numFrames = 6;
         }
-#ifdef _OPENMP
-        #pragma omp parallel
-#endif
-        {
-            int errCodeThr = 0;
-#ifdef _OPENMP
-            #pragma omp for nowait
-#endif
-            for (unsigned int i = 0; i < numFrames; ++i) {
-                if (i == 0) {
-                    riFrames[i] = ri;
-                    errCodeThr = riFrames[i]->loadRaw (true, i + 1, true, plistener, 0.8);
-                } else {
-                    riFrames[i] = new RawImage(fname);
-                    errCodeThr = riFrames[i]->loadRaw (true, i + 1);
-                }
-            }
-#ifdef _OPENMP
-            #pragma omp critical
-#endif
-            {
-                errCode = errCodeThr ? errCodeThr : errCode;
-            }
-        }
-    } else if (numFrames > 1) {
-#ifdef _OPENMP
-        #pragma omp parallel
-#endif
-        {
-            int errCodeThr = 0;
-#ifdef _OPENMP
-            #pragma omp for nowait
-#endif
-            for (unsigned int i = 0; i < numFrames; ++i) {
-                if (i == 0) {
-                    riFrames[i] = ri;
-                    errCodeThr = riFrames[i]->loadRaw (true, i, true, plistener, 0.8);
-                } else {
-                    riFrames[i] = new RawImage(fname);
-                    errCodeThr = riFrames[i]->loadRaw (true, i);
-                }
-            }
-#ifdef _OPENMP
-            #pragma omp critical
-#endif
-            {
-                errCode = errCodeThr ? errCodeThr : errCode;
-            }
-        }
-    } else {
-        riFrames[0] = ri;
-        errCode = riFrames[0]->loadRaw (true, 0, true, plistener, 0.8);
+        frameOffset = 1;
     }
 
-    if (!errCode) {
-        for (unsigned int i = 0; i < numFrames; ++i) {
-            riFrames[i]->compress_image(i);
+    if (numFrames > 1) { // this disables multi frame support for Fuji S5 until I found a solution to handle different dimensions
+        // only the headers are read here, the other frames are decoded when they are needed (see getFrame())
+        RawImage frame(fname);
+
+        if ((frameOffset && ri->loadRaw (false, frameOffset, false)) || frame.loadRaw (false, frameOffset + 1)
+                || ri->get_width() != frame.get_width() || ri->get_height() != frame.get_height()) {
+            numFrames = 1;
         }
-    } else {
+    }
+
+    riFrames[0] = ri;
+    errCode = ri->loadRaw (true, frameOffset, true, plistener, 0.8);
+
+    if (errCode) {
         return errCode;
     }
 
-    if (numFrames > 1) { // this disables multi frame support for Fuji S5 until I found a solution to handle different dimensions
-        if (riFrames[0]->get_width() != riFrames[1]->get_width() || riFrames[0]->get_height() != riFrames[1]->get_height()) {
-            numFrames = 1;
-        }
+    ri->compress_image(0);
+
+    if (numFrames > 1 && is_memory_file(fname.c_str())) {
+        // the buffer of an image loaded from memory is only registered during load, decode all the frames now
+        loadFrames(numFrames);
+        memoryBacked = true;
     }
 
     if (plistener) {
@@ -1247,9 +1251,7 @@ int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
                 initialGain = 1.0 / min(pre_mul[0], pre_mul[1], pre_mul[2]);
     }*/
 
-    for (unsigned int i = 0;i < numFrames; ++i) {
-        riFrames[i]->set_prefilters();
-    }
+    ri->set_prefilters();
 
 
     // Load complete Exif information
@@ -1352,7 +1354,21 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         printf("Flat Field Correction:%s\n", rif->get_filename().c_str());
     }
 
-    if (numFrames == 4) {
+    // the other frames are only needed for the pixel shift demosaic and for the average of two frames
+    bool pixelShift = false;
+
+    if (numFrames == 4 && raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::PIXELSHIFT)) {
+        loadFrames(4);
+        pixelShift = riFrames[1] && riFrames[2] && riFrames[3];
+    }
+
+    RawImage* const secondFrame = numFrames == 2 && currFrame == 2 ? getFrame(1) : nullptr;
+
+    for (unsigned int i = 0; i < 6; ++i) {
+        rawDataFrames[i] = nullptr;
+    }
+
+    if (pixelShift) {
         int bufferNumber = 0;
         for (unsigned int i=0; i<4; ++i) {
             if (i==currFrame) {
@@ -1367,12 +1383,12 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
                 copyOriginalPixels(raw, riFrames[i], rid, rif, *rawDataFrames[i]);
             }
         }
-    } else if (numFrames == 2 && currFrame == 2) { // average the frames
+    } else if (secondFrame) { // average the frames
         if (!rawDataBuffer[0]) {
             rawDataBuffer[0] = new array2D<float>;
         }
         rawDataFrames[1] = rawDataBuffer[0];
-        copyOriginalPixels(raw, riFrames[1], rid, rif, *rawDataFrames[1]);
+        copyOriginalPixels(raw, secondFrame, rid, rif, *rawDataFrames[1]);
         copyOriginalPixels(raw, ri, rid, rif, rawData);
 
         for (int i = 0; i < H; ++i) {
@@ -1381,6 +1397,12 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
             }
         }
     } else {
+        // the buffers of the other frames are not used by this run
+        for (size_t i = 0; i + 1 < numFrames; ++i) {
+            delete rawDataBuffer[i];
+            rawDataBuffer[i] = nullptr;
+        }
+
         copyOriginalPixels(raw, ri, rid, rif, rawData);
     }
     //FLATFIELD end
@@ -1422,7 +1444,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         }
     }
 
-    if (numFrames == 4) {
+    if (pixelShift) {
         for (int i=0; i<4; ++i) {
             scaleColors(0, 0, W, H, raw, *rawDataFrames[i]);
         }
@@ -1446,7 +1468,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         if (pmap) {
             LensCorrection &map = *pmap;
             if (ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS || ri->get_colors() == 1) {
-                if (numFrames == 4) {
+                if (pixelShift) {
                     for (int i = 0; i < 4; ++i) {
                         map.processVignette(W, H, *rawDataFrames[i]);
                     }
@@ -1495,7 +1517,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
             }
 
             auto &thresh = f.greenEqThreshold();        
-            if (numFrames == 4) {
+            if (pixelShift) {
                 for (int i = 0; i < 4; ++i) {
                     green_equilibrate(thresh, *rawDataFrames[i]);
                 }
@@ -1519,7 +1541,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
             printf("Performing global green equilibration...\n");
         }
         // global correction
-        if (numFrames == 4) {
+        if (pixelShift) {
             for (int i = 0; i < 4; ++i) {
                 green_equilibrate_global(*rawDataFrames[i]);
             }
@@ -1536,7 +1558,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
 
         GreenEqulibrateThreshold thresh(0.01 * raw.bayersensor.greenthresh);
 
-        if (numFrames == 4) {
+        if (pixelShift) {
             for (int i = 0; i < 4; ++i) {
                 green_equilibrate(thresh, *rawDataFrames[i]);
             }
@@ -1548,7 +1570,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
 
     if (totBP) {
         if (ri->getSensorType() == ST_BAYER) {
-            if (numFrames == 4) {
+            if (pixelShift) {
                 for (int i = 0; i < 4; ++i) {
                     interpolateBadPixelsBayer(*bitmapBads, *rawDataFrames[i]);
                 }
@@ -1584,7 +1606,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
             plistener->setProgressStr ("PROGRESSBAR_RAWCACORR");
             plistener->setProgress (0.0);
         }
-        if (numFrames == 4) {
+        if (pixelShift) {
             double fitParams[64];
             float *buffer = CA_correct_RT(raw.ca_autocorrect, raw.caautoiterations, raw.cared, raw.cablue, raw.ca_avoidcolourshift, *rawDataFrames[0], fitParams, false, true, nullptr, false, options.chunkSizeCA, options.measure);
             for (int i = 1; i < 3; ++i) {
@@ -1616,12 +1638,23 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
 }
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold, bool cache)
+void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold, bool cache, bool superpixel)
 {
     MyTime t1, t2;
     t1.set();
 
-    if (ri->getSensorType() == ST_BAYER) {
+    // the superpixel demosaic never replaces the NONE and MONO methods
+    superpixel = superpixel
+                 && ((ri->getSensorType() == ST_BAYER
+                      && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::NONE)
+                      && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO))
+                     || (ri->getSensorType() == ST_FUJI_XTRANS
+                      && raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::NONE)
+                      && raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::MONO)));
+
+    if (superpixel) {
+        superpixel_demosaic();
+    } else if (ri->getSensorType() == ST_BAYER) {
         if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::HPHD)) {
             hphd_demosaic ();
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::VNG4)) {
@@ -1645,19 +1678,19 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::PIXELSHIFT)) {
             pixelshift(0, 0, W, H, raw, currFrame, ri->get_maker(), ri->get_model(), raw.expos);
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::DCB)) {
-            dcb_demosaic(raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
+            dcb_demosaic(0, 0, W, H, raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::EAHD)) {
             eahd_demosaic ();
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::IGV)) {
             igv_interpolate(W, H);
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::LMMSE)) {
-            lmmse_interpolate_omp(W, H, rawData, red, green, blue, raw.bayersensor.lmmse_iterations);
+            lmmse_interpolate_omp(0, 0, W, H, rawData, red, green, blue, raw.bayersensor.lmmse_iterations);
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::FAST)) {
             fast_demosaic();
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO)) {
             nodemosaic(true);
         } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::RCD)) {
-            rcd_demosaic(options.chunkSizeRCD, options.measure);
+            rcd_demosaic(0, 0, W, H, options.chunkSizeRCD, options.measure);
         } else {
             nodemosaic(false);
         }
@@ -1665,9 +1698,9 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
         if (raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::FAST)) {
             fast_xtrans_interpolate(rawData, red, green, blue);
         } else if (raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::ONE_PASS)) {
-            xtrans_interpolate(1, false, options.chunkSizeXT, options.measure);
+            xtrans_interpolate(0, 0, W, H, 1, false, options.chunkSizeXT, options.measure);
         } else if (raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::THREE_PASS)) {
-            xtrans_interpolate(3, true, options.chunkSizeXT, options.measure);
+            xtrans_interpolate(0, 0, W, H, 3, true, options.chunkSizeXT, options.measure);
         } else if (raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::FOUR_PASS) || raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::TWO_PASS)) {
             if (!autoContrast) {
                 double threshold = raw.xtranssensor.dualDemosaicContrast;
@@ -1692,6 +1725,7 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 
 
     rgbSourceModified = false;
+    captureSharpeningCache.clear();
 
     if (cache) {
         if (!redCache) {
@@ -1737,7 +1771,9 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
         blueCache = nullptr;
     }
     if (settings->verbose) {
-        if (getSensorType() == ST_BAYER) {
+        if (superpixel) {
+            printf("Demosaicing raw data: superpixel - %d usec\n", t2.etime(t1));
+        } else if (getSensorType() == ST_BAYER) {
             printf("Demosaicing Bayer data: %s - %d usec\n", raw.bayersensor.method.c_str(), t2.etime(t1));
         } else if (getSensorType() == ST_FUJI_XTRANS) {
             printf("Demosaicing X-Trans data: %s - %d usec\n", raw.xtranssensor.method.c_str(), t2.etime(t1));
@@ -1745,6 +1781,78 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
     }
 }
 
+bool RawImageSource::demosaicRegion(const RAWParams &raw, const PreviewProps &pp, int tran)
+{
+    if (fuji || d1x || red.getWidth() != W || red.getHeight() != H) {
+        return false;
+    }
+
+    const bool isBayer = ri->getSensorType() == ST_BAYER;
+    const bool isXtrans = ri->getSensorType() == ST_FUJI_XTRANS;
+
+    if (isBayer) {
+        if (raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::AMAZE)
+                && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::RCD)
+                && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::LMMSE)
+                && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::DCB)) {
+            return false;
+        }
+    } else if (isXtrans) {
+        if (raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::ONE_PASS)
+                && raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::THREE_PASS)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    int sx, sy, width, height, fw;
+    transformRect(pp, tran, sx, sy, width, height, fw);
+
+    // The origin is kept on the CFA period. AMaZE and LMMSE process the window like a whole frame, so their
+    // output near its edges differs from a full demosaic; the margin keeps these differences out of the crops.
+    constexpr int margin = 32;
+    const int x1 = std::max(sx - margin, 0) / 6 * 6;
+    const int y1 = std::max(sy - margin, 0) / 6 * 6;
+    const int x2 = std::min(sx + width + margin, W);
+    const int y2 = std::min(sy + height + margin, H);
+
+    if (x2 <= x1 || y2 <= y1) {
+        return false;
+    }
+
+    MyTime t1, t2;
+    t1.set();
+
+    if (isBayer) {
+        if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::AMAZE)) {
+            amaze_demosaic_RT(x1, y1, x2 - x1, y2 - y1, rawData, red, green, blue, options.chunkSizeAMAZE, options.measure);
+        } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::RCD)) {
+            rcd_demosaic(x1, y1, x2 - x1, y2 - y1, options.chunkSizeRCD, options.measure);
+        } else if (raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::LMMSE)) {
+            lmmse_interpolate_omp(x1, y1, x2 - x1, y2 - y1, rawData, red, green, blue, raw.bayersensor.lmmse_iterations);
+        } else {
+            dcb_demosaic(x1, y1, x2 - x1, y2 - y1, raw.bayersensor.dcb_iterations, raw.bayersensor.dcb_enhance);
+        }
+    } else {
+        if (raw.xtranssensor.method == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::ONE_PASS)) {
+            xtrans_interpolate(x1, y1, x2 - x1, y2 - y1, 1, false, options.chunkSizeXT, options.measure);
+        } else {
+            xtrans_interpolate(x1, y1, x2 - x1, y2 - y1, 3, true, options.chunkSizeXT, options.measure);
+        }
+    }
+
+    t2.set();
+
+    rgbSourceModified = false;
+
+    if (settings->verbose) {
+        printf("Demosaicing region %d,%d %dx%d: %s - %d usec\n", x1, y1, x2 - x1, y2 - y1, isBayer ? raw.bayersensor.method.c_str() : raw.xtranssensor.method.c_str(), t2.etime(t1));
+    }
+
+    return true;
+}
+
 
 //void RawImageSource::retinexPrepareBuffers(ColorManagementParams cmp, RetinexParams retinexParams, multi_array2D<float, 3> &conversionBuffer, LUTu &lhist16RETI)
 void RawImageSource::retinexPrepareBuffers(const ColorManagementParams& cmp, const RetinexParams &retinexParams, multi_array2D<float, 4> &conversionBuffer, LUTu &lhist16RETI)
@@ -2407,6 +2515,18 @@ void RawImageSource::flush()
         rawDataBuffer[i] = nullptr;
     }
 
+    for (size_t i = 0; i < 6; ++i) {
+        rawDataFrames[i] = nullptr;
+    }
+
+    // release the decoded frames, but keep the current frame and the first one (and all of them if they can not be decoded again)
+    for (size_t i = 1; i < numFrames && !memoryBacked; ++i) {
+        if (riFrames[i] != ri) {
+            delete riFrames[i];
+            riFrames[i] = nullptr;
+        }
+    }
+
     if (rawData) {
         rawData(0, 0);
     }
@@ -2433,6 +2553,8 @@ void RawImageSource::flush()
     if (blueloc) {
         blueloc(0, 0);
     }
+
+    captureSharpeningCache.clear();
 }
 
 void RawImageSource::HLRecovery_Global(const ToneCurveParams &hrp)
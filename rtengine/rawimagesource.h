@@ -23,6 +23,7 @@
 #include <memory>
 
 #include "array2D.h"
+#include "capturesharpening.h"
 #include "colortemp.h"
 #include "iimage.h"
 #include "imagesource.h"
@@ -77,9 +78,12 @@ protected:
     bool rgbSourceModified;
 
     RawImage* ri;  // Copy of raw pixels, NOT corrected for initial gain, blackpoint etc.
-    RawImage* riFrames[6] = {nullptr};
+    RawImage* riFrames[6] = {nullptr}; // decoded on first use, see getFrame()
+    bool frameFailed[6] = {false}; // frames which could not be decoded, they are reported once
+    bool memoryBacked = false; // loaded from a buffer which is gone after load(), the frames can not be decoded later
     unsigned int currFrame = 0;
     unsigned int numFrames = 0;
+    unsigned int frameOffset = 0; // number of the dcraw shot of frame 0
     int flatFieldAutoClipValue = 0;
     array2D<float> rawData;  // holds preprocessed pixel values, rowData[i][j] corresponds to the ith row and jth column
     array2D<float> *rawDataFrames[6] = {nullptr};
@@ -99,6 +103,8 @@ protected:
     array2D<float>* redCache;
     // the interpolated blue plane:
     array2D<float>* blueCache;
+    // deconvolution state of the last capture sharpening run, only used with cached demosaic output
+    CaptureSharpeningCache captureSharpeningCache;
     bool rawDirty;
     float psRedBrightness[4];
     float psGreenBrightness[4];
@@ -114,6 +120,8 @@ protected:
     void ItcWB(bool extra, double &tempref, double &greenref, double &tempitc, double &greenitc, float &studgood, array2D<float> &redloc, array2D<float> &greenloc, array2D<float> &blueloc, int bfw, int bfh, double &avg_rm, double &avg_gm, double &avg_bm, const procparams::ColorManagementParams &cmp, const procparams::RAWParams &raw, const procparams::WBParams & wbpar);
 
     unsigned FC(int row, int col) const;
+    RawImage* getFrame(unsigned int frameNum);
+    void loadFrames(unsigned int count);
     inline void getRowStartEnd (int x, int &start, int &end);
     static void getProfilePreprocParams(cmsHPROFILE in, float& gammafac, float& lineFac, float& lineSum);
 
@@ -124,13 +132,14 @@ public:
     int load(const Glib::ustring &fname) override { return load(fname, false); }
     int load(const Glib::ustring &fname, bool firstFrameOnly);
     void        preprocess  (const procparams::RAWParams &raw, const procparams::LensProfParams &lensProf, const procparams::CoarseTransformParams& coarse, bool prepareDenoise = true) override;
-    void        demosaic    (const procparams::RAWParams &raw, bool autoContrast, double &contrastThreshold, bool cache = false) override;
+    void        demosaic    (const procparams::RAWParams &raw, bool autoContrast, double &contrastThreshold, bool cache = false, bool superpixel = false) override;
+    bool        demosaicRegion (const procparams::RAWParams &raw, const PreviewProps &pp, int tran) override;
     void        retinex       (const procparams::ColorManagementParams& cmp, const procparams::RetinexParams &deh, const procparams::ToneCurveParams& Tc, LUTf & cdcurve, LUTf & mapcurve, const RetinextransmissionCurve & dehatransmissionCurve, const RetinexgaintransmissionCurve & dehagaintransmissionCurve, multi_array2D<float, 4> &conversionBuffer, bool dehacontlutili, bool mapcontlutili, bool useHsl, float &minCD, float &maxCD, float &mini, float &maxi, float &Tmean, float &Tsigma, float &Tmin, float &Tmax, LUTu &histLRETI) override;
     void        retinexPrepareCurves       (const procparams::RetinexParams &retinexParams, LUTf &cdcurve, LUTf &mapcurve, RetinextransmissionCurve &retinextransmissionCurve, RetinexgaintransmissionCurve &retinexgaintransmissionCurve, bool &retinexcontlutili, bool &mapcontlutili, bool &useHsl, LUTu & lhist16RETI, LUTu & histLRETI) override;
     void        retinexPrepareBuffers      (const procparams::ColorManagementParams& cmp, const procparams::RetinexParams &retinexParams, multi_array2D<float, 4> &conversionBuffer, LUTu &lhist16RETI) override;
     void        flush      () override;
     void        HLRecovery_Global (const procparams::ToneCurveParams &hrp) override;
-    void        refinement(int PassCount);
+    void        refinement(int PassCount, int winx, int winy, int winw, int winh);
     void        setBorder(unsigned int rawBorder) override {border = rawBorder;}
     bool        isRGBSourceModified() const override
     {
@@ -207,7 +216,8 @@ public:
             ri = riFrames[0];
         } else  {
             currFrame = std::min(numFrames - 1, frameNum);
-            ri = riFrames[currFrame];
+            RawImage* const frame = getFrame(currFrame);
+            ri = frame ? frame : riFrames[0];
         }
     }
     int getFrameCount() override {return numFrames;}
@@ -267,17 +277,18 @@ protected:
     void green_equilibrate (const GreenEqulibrateThreshold &greenthresh, array2D<float> &rawData);//Emil's green equilibration
 
     void nodemosaic(bool bw);
+    void superpixel_demosaic();
     void eahd_demosaic();
     void hphd_demosaic();
     void vng4_demosaic(const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
     void igv_interpolate(int winw, int winh);
-    void lmmse_interpolate_omp(int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, int iterations);
+    void lmmse_interpolate_omp(int winx, int winy, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, int iterations);
     void amaze_demosaic_RT(int winx, int winy, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, size_t chunkSize = 1, bool measure = false);//Emil's code for AMaZE
     void dual_demosaic_RT(bool isBayer, const procparams::RAWParams &raw, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue, double &contrast, bool autoContrast = false);
     void fast_demosaic();//Emil's code for fast demosaicing
-    void dcb_demosaic(int iterations, bool dcb_enhance);
+    void dcb_demosaic(int winx, int winy, int winw, int winh, int iterations, bool dcb_enhance);
     void ahd_demosaic();
-    void rcd_demosaic(size_t chunkSize = 1, bool measure = false);
+    void rcd_demosaic(int winx, int winy, int winw, int winh, size_t chunkSize = 1, bool measure = false);
     void border_interpolate(int winw, int winh, int lborders, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
     void dcb_initTileLimits(int &colMin, int &rowMin, int &colMax, int &rowMax, int x0, int y0, int border);
     void fill_raw(float (*cache)[3], int x0, int y0, float** rawData);
@@ -295,7 +306,7 @@ protected:
     void dcb_color_full(float (*image)[3], int x0, int y0, float (*chroma)[2]);
     void cielab(const float (*rgb)[3], float* l, float* a, float *b, const int width, const int height, const int labWidth, const float xyz_cam[3][3]);
     void xtransborder_interpolate (int border, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
-    void xtrans_interpolate (const int passes, const bool useCieLab, size_t chunkSize = 1, bool measure = false);
+    void xtrans_interpolate (int winx, int winy, int winw, int winh, const int passes, const bool useCieLab, size_t chunkSize = 1, bool measure = false);
     void fast_xtrans_interpolate (const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
     void fast_xtrans_interpolate_blend (const float* const * blend, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
     void pixelshift(int winx, int winy, int winw, int winh, const procparams::RAWParams &rawParams, unsigned int frame, const std::string &make, const std::string &model, float rawWpCorrection);
@@ -50,7 +50,7 @@ namespace rtengine
 // coefficients in an exact, shorter and more performant formula.
 // In cooperation with Hanno Schwalm (hanno@schwalm-bremen.de) and Luis Sanz Rodriguez this has been tuned for performance.
 
-void RawImageSource::rcd_demosaic(size_t chunkSize, bool measure)
+void RawImageSource::rcd_demosaic(int winx, int winy, int winw, int winh, size_t chunkSize, bool measure)
 {
     // Test for RGB cfa
     for (int i = 0; i < 2; i++) {
@@ -118,6 +118,10 @@ void RawImageSource::rcd_demosaic(size_t chunkSize, bool measure)
             if (colStart + tileBorder == colEnd - tileBorder) {
                 continue;
             }
+            if (rowEnd <= winy || rowStart >= winy + winh || colEnd <= winx || colStart >= winx + winw) {
+                // tile does not intersect the requested window
+                continue;
+            }
 
             const int tileRows = std::min(rowEnd - rowStart, tileSize);
             const int tilecols = std::min(colEnd - colStart, tileSize);
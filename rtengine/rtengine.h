@@ -22,6 +22,7 @@
 #include <ctime>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <glibmm/ustring.h>
 
@@ -241,6 +242,17 @@ public:
       * @param pl is a pointer pointing to an object implementing a progress listener. It can be NULL, in this case progress is not reported.
       * @return an object representing the loaded and pre-processed image */
     static InitialImage* load (const Glib::ustring& fname, bool isRaw, int* errorCode, ProgressListener* pl = nullptr);
+    /** Loads an image from a buffer in memory holding the content of an image file.
+      * The buffer is not copied, it has to stay valid until this function returns. TIFF files can not be loaded
+      * this way, and on Windows only raw files can (without their metadata).
+      * @param data points to the content of the file
+      * @param size is the size of the content in bytes
+      * @param fname the name of the file, only its extension is used to determine the format
+      * @param isRaw shall be true if it is a raw file
+      * @param errorCode is a pointer to a variable that is set to nonzero if an error happened (output)
+      * @param pl is a pointer pointing to an object implementing a progress listener. It can be NULL, in this case progress is not reported.
+      * @return an object representing the loaded and pre-processed image */
+    static InitialImage* load (const void* data, std::size_t size, const Glib::ustring& fname, bool isRaw, int* errorCode, ProgressListener* pl = nullptr);
 };
 
 /** When the preview image is ready for display during staged processing (thus the changes have been updated),
@@ -710,6 +722,12 @@ public:
     static void destroy (ProcessingJob* job);
 
     virtual bool fastPipeline() const = 0;
+
+    /** Adds an output to the job. The image is developed only once, then resized, sharpened and converted to the output profile
+      * for each output, using the resize, post-resize sharpening and output profile settings of outputParams. Without any output
+      * added, the job produces a single image using its own processing parameters.
+      * @param outputParams holds the output specific settings */
+    virtual void addOutput(const procparams::ProcParams& outputParams) = 0;
 };
 
 /** This function performs all the image processing steps corresponding to the given ProcessingJob. It returns when it is ready, so it can be slow.
@@ -720,6 +738,11 @@ public:
    * @return the resulting image, with the output profile applied, exif and iptc data set. You have to save it or you can access the pixel data directly.  */
 IImagefloat* processImage (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false);
 
+/** Same as above, for jobs with several outputs (see ProcessingJob::addOutput).
+   * @param outputs receives the resulting images, in the order the outputs have been added. You have to free them.
+   * @return true on success */
+bool processImage (ProcessingJob* job, int& errorCode, std::vector<IImagefloat*>& outputs, ProgressListener* pl = nullptr, bool flush = false);
+
 /** This class is used to control the batch processing. The class implementing this interface will be called when the full processing of an
    * image is ready and the next job to process is needed. */
 class BatchProcessingListener : public ProgressListener
@@ -318,23 +318,30 @@ LFDatabase LFDatabase::instance_;
 
 bool LFDatabase::init(const Glib::ustring &dbdir)
 {
-    instance_.data_ = lfDatabase::Create();
+    instance_.dbdir_ = dbdir;
+    return true;
+}
+
+
+bool LFDatabase::load()
+{
+    data_ = lfDatabase::Create();
 
     if (settings->verbose) {
         std::cout << "Loading lensfun database from ";
-        if (dbdir.empty()) {
+        if (dbdir_.empty()) {
             std::cout << "the default directories";
         } else {
-            std::cout << "'" << dbdir << "'";
+            std::cout << "'" << dbdir_ << "'";
         }
         std::cout << "..." << std::flush;
     }
 
     bool ok = false;
-    if (dbdir.empty()) {
-        ok = (instance_.data_->Load() ==  LF_NO_ERROR);
+    if (dbdir_.empty()) {
+        ok = (data_->Load() ==  LF_NO_ERROR);
     } else {
-        ok = instance_.LoadDirectory(dbdir.c_str());
+        ok = LoadDirectory(dbdir_.c_str());
     }
 
     if (settings->verbose) {
@@ -399,6 +406,9 @@ LFDatabase::~LFDatabase()
 
 const LFDatabase *LFDatabase::getInstance()
 {
+    std::call_once(instance_.loaded_, []() {
+        instance_.load();
+    });
     return &instance_;
 }
 
@@ -21,6 +21,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -136,11 +137,15 @@ private:
                                             float focalLen, float aperture, float focusDist,
                                             int width, int height, bool swap_xy) const;
     LFDatabase();
+    bool load();
     bool LoadDirectory(const char *dirname);
 
     mutable MyMutex lfDBMutex;
     static LFDatabase instance_;
     lfDatabase *data_;
+    // the database is only loaded by the first getInstance()
+    Glib::ustring dbdir_;
+    std::once_flag loaded_;
     mutable std::set<std::string> notFound;
 };
 
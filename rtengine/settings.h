@@ -46,8 +46,10 @@ public:
     bool            autocielab;
     bool            rgbcurveslumamode_gamut;// controls gamut enforcement for RGB curves in lumamode
     bool            verbose;
+    bool            colorTablesSnapshot;    ///< Read the gamma tables of Color from a snapshot in the cache dir instead of computing them at each start
     Glib::ustring   darkFramesPath;         ///< The default directory for dark frames
     Glib::ustring   flatFieldsPath;         ///< The default directory for flat fields
+    bool            calibrationStackMedian; ///< Stack multiple dark frames or flat fields by median instead of mean
 
     Glib::ustring   adobe;                  // filename of AdobeRGB1998 profile (default to the bundled one)
     Glib::ustring   prophoto;               // filename of Prophoto     profile (default to the bundled one)
@@ -114,6 +116,8 @@ public:
     };
     ThumbnailInspectorMode thumbnail_inspector_mode;
 
+    int             bufferPoolSize;         ///< Maximum size in MB of the released working buffers kept for reuse (see BufferPool), 0 to disable
+
     /** Creates a new instance of Settings.
       * @return a pointer to the new Settings instance. */
     static Settings* create();
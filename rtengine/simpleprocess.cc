@@ -116,6 +116,12 @@ public:
         }
     }
 
+    // all the images produced by operator(), one per output of the job
+    const std::vector<Imagefloat*>& getReadyImages() const
+    {
+        return readyImages;
+    }
+
 private:
     Imagefloat *normal_pipeline()
     {
@@ -130,7 +136,7 @@ private:
 
     Imagefloat *fast_pipeline()
     {
-        if (!job->pparams.resize.enabled) {
+        if (!job->pparams.resize.enabled || !job->outputs.empty()) {
             return normal_pipeline();
         }
 
@@ -1717,13 +1723,79 @@ private:
             pl->setProgress(0.60);
         }
 
+        if (job->outputs.empty()) {
+            readyImages.push_back(finish_output(params, false));
+        } else {
+            // The image is developed once, only the final resize, sharpening and output profile differ between the outputs
+            for (const auto& output : job->outputs) {
+                procparams::ProcParams outputParams = params;
+                outputParams.resize = output.resize;
+                outputParams.prsharpening = output.prsharpening;
+                outputParams.icm.outputProfile = output.outputProfile;
+                outputParams.icm.outputIntent = output.outputIntent;
+                outputParams.icm.outputBPC = output.outputBPC;
+                readyImages.push_back(finish_output(outputParams, true));
+            }
+        }
+
+        delete labView;
+        labView = nullptr;
+
+//    t2.set();
+//    if( settings->verbose )
+//           printf("Total:- %d usec\n", t2.etime(t1));
+
+        if (!job->initialImage) {
+            initialImage->decreaseRef();
+        }
+
+        delete job;
+
+        if (pl) {
+            pl->setProgress(0.75);
+        }
+
+        /*  curve1.reset();curve2.reset();
+            curve.reset();
+            satcurve.reset();
+            lhskcurve.reset();
+
+            rCurve.reset();
+            gCurve.reset();
+            bCurve.reset();
+            hist16.reset();
+            hist16C.reset();
+        */
+        return readyImages.front();
+    }
+
+    // Crop, resize, post-resize sharpening and conversion to the output profile of labView.
+    // labView is left untouched if it is shared by several outputs, otherwise it is freed
+    // as soon as it has been cropped or resized, to keep the memory peak low.
+    Imagefloat *finish_output(const procparams::ProcParams& params, bool shared)
+    {
+        ImProcFunctions ipf(&params, true);
+        LabImage* view = labView;
+        std::unique_ptr<LabImage> ownView;
+
+        const auto setView =
+            [&](LabImage* newView)
+            {
+                if (!shared && view == labView) {
+                    delete labView;
+                    labView = nullptr;
+                }
+
+                ownView.reset(newView);
+                view = newView;
+            };
+
         int imw, imh;
         double tmpScale = ipf.resizeScale(&params, fw, fh, imw, imh);
         bool labResize = params.resize.enabled && params.resize.method != "Nearest" && (tmpScale != 1.0 || params.prsharpening.enabled);
-        LabImage *tmplab;
 
         // crop and convert to rgb16
-        int cx = 0, cy = 0, cw = labView->W, ch = labView->H;
+        int cx = 0, cy = 0, cw = view->W, ch = view->H;
 
         if (params.crop.enabled) {
             cx = params.crop.x;
@@ -1732,44 +1804,47 @@ private:
             ch = params.crop.h;
 
             if (labResize) { // crop lab data
-                tmplab = new LabImage(cw, ch);
+                LabImage* const tmplab = new LabImage(cw, ch);
 
                 for (int row = 0; row < ch; row++) {
                     for (int col = 0; col < cw; col++) {
-                        tmplab->L[row][col] = labView->L[row + cy][col + cx];
-                        tmplab->a[row][col] = labView->a[row + cy][col + cx];
-                        tmplab->b[row][col] = labView->b[row + cy][col + cx];
+                        tmplab->L[row][col] = view->L[row + cy][col + cx];
+                        tmplab->a[row][col] = view->a[row + cy][col + cx];
+                        tmplab->b[row][col] = view->b[row + cy][col + cx];
                     }
                 }
 
-                delete labView;
-                labView = tmplab;
+                setView(tmplab);
                 cx = 0;
                 cy = 0;
             }
         }
 
         if (labResize) { // resize lab data
-            if ((labView->W != imw || labView->H != imh) &&
-                    (params.resize.allowUpscaling || (labView->W >= imw && labView->H >= imh))) {
+            if ((view->W != imw || view->H != imh) &&
+                    (params.resize.allowUpscaling || (view->W >= imw && view->H >= imh))) {
                 // resize image
-                tmplab = new LabImage(imw, imh);
-                ipf.Lanczos(labView, tmplab, tmpScale);
-                delete labView;
-                labView = tmplab;
+                LabImage* const tmplab = new LabImage(imw, imh);
+                ipf.resample(view, tmplab, tmpScale);
+                setView(tmplab);
             }
 
-            cw = labView->W;
-            ch = labView->H;
+            cw = view->W;
+            ch = view->H;
 
             if (params.prsharpening.enabled) {
+                if (shared && view == labView) {
+                    ownView.reset(new LabImage(*view, true));
+                    view = ownView.get();
+                }
+
                 for (int i = 0; i < ch; i++) {
                     for (int j = 0; j < cw; j++) {
-                        labView->L[i][j] = labView->L[i][j] < 0.f ? 0.f : labView->L[i][j];
+                        view->L[i][j] = view->L[i][j] < 0.f ? 0.f : view->L[i][j];
                     }
                 }
 
-                ipf.sharpening(labView, params.prsharpening);
+                ipf.sharpening(view, params.prsharpening);
             }
         }
 
@@ -1781,14 +1856,13 @@ private:
         // if Default gamma mode: we use the profile selected in the "Output profile" combobox;
         // gamma come from the selected profile, otherwise it comes from "Free gamma" tool
 
-        Imagefloat* readyImg = ipf.lab2rgbOut(labView, cx, cy, cw, ch, params.icm);
+        Imagefloat* readyImg = ipf.lab2rgbOut(view, cx, cy, cw, ch, params.icm);
 
         if (settings->verbose) {
             printf("Output profile_: \"%s\"\n", params.icm.outputProfile.c_str());
         }
 
-        delete labView;
-        labView = nullptr;
+        ownView.reset();
 
         if (bwonly) { //force BW r=g=b
             if (settings->verbose) {
@@ -1858,31 +1932,6 @@ private:
             readyImg->setOutputProfile(nullptr, 0);
         }
 
-//    t2.set();
-//    if( settings->verbose )
-//           printf("Total:- %d usec\n", t2.etime(t1));
-
-        if (!job->initialImage) {
-            initialImage->decreaseRef();
-        }
-
-        delete job;
-
-        if (pl) {
-            pl->setProgress(0.75);
-        }
-
-        /*  curve1.reset();curve2.reset();
-            curve.reset();
-            satcurve.reset();
-            lhskcurve.reset();
-
-            rCurve.reset();
-            gCurve.reset();
-            bCurve.reset();
-            hist16.reset();
-            hist16C.reset();
-        */
         return readyImg;
     }
 
@@ -1922,7 +1971,7 @@ private:
         // resize image
         if (params.resize.allowUpscaling || (imw <= fw && imh <= fh)) {
             std::unique_ptr<LabImage> resized(new LabImage(imw, imh));
-            ipf.Lanczos(tmplab.get(), resized.get(), scale_factor);
+            ipf.resample(tmplab.get(), resized.get(), scale_factor);
             tmplab = std::move(resized);
         }
 
@@ -2091,6 +2140,8 @@ private:
     ToneCurve customToneCurvebw2;
 
     bool autili, butili;
+
+    std::vector<Imagefloat*> readyImages;
 };
 
 } // namespace
@@ -2102,6 +2153,18 @@ IImagefloat* processImage(ProcessingJob* pjob, int& errorCode, ProgressListener*
     return proc();
 }
 
+bool processImage(ProcessingJob* pjob, int& errorCode, std::vector<IImagefloat*>& outputs, ProgressListener* pl, bool flush)
+{
+    ImageProcessor proc(pjob, errorCode, pl, flush);
+
+    if (!proc()) {
+        return false;
+    }
+
+    outputs.assign(proc.getReadyImages().begin(), proc.getReadyImages().end());
+    return true;
+}
+
 void batchProcessingThread(ProcessingJob* job, BatchProcessingListener* bpl)
 {
 
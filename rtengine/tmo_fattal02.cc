@@ -62,7 +62,6 @@
 #include <vector>
 
 #include <assert.h>
-#include <fftw3.h>
 #include <math.h>
 
 #include "array2D.h"
@@ -85,8 +84,6 @@ namespace rtengine
  * RT code
  ******************************************************************************/
 
-extern MyMutex *fftwMutex;
-
 using namespace std;
 
 namespace
@@ -416,7 +413,7 @@ void calculateFiMatrix(Array2Df* FI, Array2Df* gradients[],
     delete[] fi;
 }
 
-void solve_pde_fft(Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread, int algo);
+void solve_pde_multigrid(Array2Df *F, Array2Df *U, bool multithread, int algo);
 
 void tmo_fattal02(size_t width,
                   size_t height,
@@ -599,24 +596,17 @@ void tmo_fattal02(size_t width,
     Array2Df* Gx = new Array2Df(width, height);
     Array2Df* Gy = &L; // use L as buffer for Gy
 
-    // the fft solver solves the Poisson pde but with slightly different
-    // boundary conditions, so we need to adjust the assembly of the right hand
-    // side accordingly (basically fft solver assumes U(-1) = U(1), whereas zero
-    // Neumann conditions assume U(-1)=U(0)), see also divergence calculation
+    // RT - the multigrid solver uses zero Neumann boundary conditions,
+    // U(-1) = U(0), i.e. no gradient across the border of the image
 #ifdef _OPENMP
     #pragma omp parallel for if(multithread)
 #endif
 
     for (size_t y = 0 ; y < height ; y++) {
-        // sets index+1 based on the boundary assumption H(N+1)=H(N-1)
-        unsigned int yp1 = (y + 1 >= height ? height - 2 : y + 1);
-
         for (size_t x = 0 ; x < width ; x++) {
-            // sets index+1 based on the boundary assumption H(N+1)=H(N-1)
-            unsigned int xp1 = (x + 1 >= width ?  width - 2  : x + 1);
             // forward differences in H, so need to use between-points approx of FI
-            (*Gx) (x, y) = ((*H) (xp1, y) - (*H) (x, y)) * 0.5f * ((*FI) (xp1, y) + (*FI) (x, y));
-            (*Gy) (x, y) = ((*H) (x, yp1) - (*H) (x, y)) * 0.5f * ((*FI) (x, yp1) + (*FI) (x, y));
+            (*Gx) (x, y) = x + 1 < width ? ((*H) (x + 1, y) - (*H) (x, y)) * 0.5f * ((*FI) (x + 1, y) + (*FI) (x, y)) : 0.f;
+            (*Gy) (x, y) = y + 1 < height ? ((*H) (x, y + 1) - (*H) (x, y)) * 0.5f * ((*FI) (x, y + 1) + (*FI) (x, y)) : 0.f;
         }
     }
 
@@ -638,26 +628,13 @@ void tmo_fattal02(size_t width,
             if (y > 0) {
                 (*FI)(x, y) -= (*Gy)(x, y - 1);
             }
-
-            if (x == 0) {
-                (*FI)(x, y) += (*Gx)(x, y);
-            }
-
-            if (y == 0) {
-                (*FI)(x, y) += (*Gy)(x, y);
-            }
-
         }
     }
 
-    //delete Gx; // RT - reused as temp buffer in solve_pde_fft, deleted later
+    delete Gx;
 
     // solve pde and exponentiate (ie recover compressed image)
-    {
-        MyMutex::MyLock lock(*fftwMutex);
-        solve_pde_fft(FI, &L, Gx, multithread, algo);
-    }
-    delete Gx;
+    solve_pde_multigrid(FI, &L, multithread, algo);
     delete FI;
 
 #ifdef _OPENMP
@@ -689,300 +666,371 @@ void tmo_fattal02(size_t width,
 }
 
 
-/**
- *
- * @file pde_fft.cpp
- * @brief Direct Poisson solver using the discrete cosine transform
+/*****************************************************************************
+ * RT - multigrid Poisson solver
  *
- * @author Tino Kluge (tino.kluge@hrz.tu-chemnitz.de)
+ * Solves Laplace U = F with Neumann boundary conditions, U(-1) = U(0), on the
+ * full image. This replaces the DCT based solver of Luminance HDR, which
+ * needed the image to be resampled to sizes suitable for FFTW, the
+ * transforms and plans to be serialised by fftwMutex, and two additional
+ * buffers of the size of the image. Here, the coarser levels take one third
+ * of the memory of U and F together, and all the passes are parallelised
+ * over the rows.
  *
- */
+ * The grids are cell centred: the coarse cell (x, y) covers the fine cells
+ * (2x, 2y) to (2x + 1, 2y + 1). For odd sizes, the last coarse column or row
+ * only covers one fine cell, so the coarse operators are finite volume
+ * discretisations taking the actual cell sizes into account (the 5 point
+ * stencil on the full image and wherever the cells are complete). Smoothing
+ * is red-black Gauss-Seidel, restriction sums the residual over the children
+ * of a cell and prolongation is bilinear.
+ *****************************************************************************/
+
+// coarsest level, solved by plain relaxation
+constexpr int multigrid_min_dim = 4;
+
+struct MultigridLevel {
+    Array2Df *U;
+    Array2Df *F;
+    // size of the cells in pixels of the full image
+    std::vector<float> cellWidth;
+    std::vector<float> cellHeight;
+    // inverse distance between the centres of cells x - 1 and x (resp. y - 1 and y)
+    std::vector<float> invDistX;
+    std::vector<float> invDistY;
+    // the full image, all coefficients are 1
+    bool uniform;
+};
 
-//////////////////////////////////////////////////////////////////////
-// Direct Poisson solver using the discrete cosine transform
-//////////////////////////////////////////////////////////////////////
-// by Tino Kluge (tino.kluge@hrz.tu-chemnitz.de)
-//
-// let U and F be matrices of order (n1,n2), ie n1=height, n2=width
-// and L_x of order (n2,n2) and L_y of order (n1,n1) and both
-// representing the 1d Laplace operator with Neumann boundary conditions,
-// ie L_x and L_y are tridiagonal matrices of the form
-//
-//  ( -2  2          )
-//  (  1 -2  1       )
-//  (     .  .  .    )
-//  (        1 -2  1 )
-//  (           2 -2 )
-//
-// then this solver computes U given F based on the equation
-//
-//  -------------------------
-//  L_y U + (L_x U^tr)^tr = F
-//  -------------------------
-//
-// Note, if the first and last row of L_x and L_y contained one's instead of
-// two's then this equation would be exactly the 2d Poisson equation with
-// Neumann boundary conditions. As a simple rule:
-// - Neumann: assume U(-1)=U(0) --> U(i-1) - 2 U(i) + U(i+1) becomes
-//        i=0: U(0) - 2 U(0) + U(1) = -U(0) + U(1)
-// - our system: assume U(-1)=U(1) --> this becomes
-//        i=0: U(1) - 2(0) + U(1) = -2 U(0) + 2 U(1)
-//
-// The multi grid solver solve_pde_multigrid() solves the 2d Poisson pde
-// with the right Neumann boundary conditions, U(-1)=U(0), see function
-// atimes(). This means the assembly of the right hand side F is different
-// for both solvers.
-
-
-// returns T = EVy A EVx^tr
-// note, modifies input data
-void transform_ev2normal(Array2Df *A, Array2Df *T, bool multithread)
+void initMultigridLevel(MultigridLevel &level)
 {
-    int width = A->getCols();
-    int height = A->getRows();
-    assert((int)T->getCols() == width && (int)T->getRows() == height);
+    const int width = level.U->getCols();
+    const int height = level.U->getRows();
 
-    // the discrete cosine transform is not exactly the transform needed
-    // need to scale input values to get the right transformation
-#ifdef _OPENMP
-    #pragma omp parallel for if(multithread)
-#endif
+    level.invDistX.assign(width + 1, 0.f);
+    level.invDistY.assign(height + 1, 0.f);
 
-    for (int y = 1 ; y < height - 1 ; y++)
-        for (int x = 1 ; x < width - 1 ; x++) {
-            (*A)(x, y) *= 0.25f;
-        }
+    for (int x = 1; x < width; ++x) {
+        level.invDistX[x] = 2.f / (level.cellWidth[x - 1] + level.cellWidth[x]);
+    }
 
-    for (int x = 1 ; x < width - 1 ; x++) {
-        (*A)(x, 0) *= 0.5f;
-        (*A)(x, height - 1) *= 0.5f;
+    for (int y = 1; y < height; ++y) {
+        level.invDistY[y] = 2.f / (level.cellHeight[y - 1] + level.cellHeight[y]);
     }
+}
 
-    for (int y = 1 ; y < height - 1 ; y++) {
-        (*A) (0, y) *= 0.5f;
-        (*A)(width - 1, y) *= 0.5f;
+// returns the weighted sum of the neighbours of (x, y), diag receives the sum of the weights
+inline float neighbours(const MultigridLevel &level, int x, int y, float &diag)
+{
+    const Array2Df &U = *level.U;
+    const int width = U.getCols();
+    const int height = U.getRows();
+    float sum = 0.f;
+    diag = 0.f;
+
+    if (x > 0) {
+        const float a = level.cellHeight[y] * level.invDistX[x];
+        sum += a * U(x - 1, y);
+        diag += a;
     }
 
-    // note, fftw provides its own memory allocation routines which
-    // ensure that memory is properly 16/32 byte aligned so it can
-    // use SSE/AVX operations (2/4 double ops in parallel), if our
-    // data is not properly aligned fftw won't use SSE/AVX
-    // (I believe new() aligns memory to 16 byte so avoid overhead here)
-    //
-    // double* in = (double*) fftwf_malloc(sizeof(double) * width*height);
-    // fftwf_free(in);
+    if (x < width - 1) {
+        const float a = level.cellHeight[y] * level.invDistX[x + 1];
+        sum += a * U(x + 1, y);
+        diag += a;
+    }
+
+    if (y > 0) {
+        const float a = level.cellWidth[x] * level.invDistY[y];
+        sum += a * U(x, y - 1);
+        diag += a;
+    }
+
+    if (y < height - 1) {
+        const float a = level.cellWidth[x] * level.invDistY[y + 1];
+        sum += a * U(x, y + 1);
+        diag += a;
+    }
+
+    return sum;
+}
+
+inline void relax(MultigridLevel &level, int x, int y)
+{
+    float diag;
+    const float sum = neighbours(level, x, y, diag);
 
-    // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                          FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    if (diag > 0.f) {
+        (*level.U)(x, y) = (sum - (*level.F)(x, y)) / diag;
+    }
 }
 
+inline float residual(const MultigridLevel &level, int x, int y)
+{
+    float diag;
+    const float sum = neighbours(level, x, y, diag);
+    return (*level.F)(x, y) - (sum - diag * (*level.U)(x, y));
+}
 
-// returns T = EVy^-1 * A * (EVx^-1)^tr
-void transform_normal2ev(Array2Df *A, Array2Df *T, bool multithread)
+// red-black Gauss-Seidel sweeps
+void smooth(MultigridLevel &level, int iterations, bool multithread)
 {
-    int width = A->getCols();
-    int height = A->getRows();
-    assert((int)T->getCols() == width && (int)T->getRows() == height);
-
-    // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                          FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
-
-    // need to scale the output matrix to get the right transform
-    float factor = (1.0f / ((height - 1) * (width - 1)));
+    Array2Df &U = *level.U;
+    const Array2Df &F = *level.F;
+    const int width = U.getCols();
+    const int height = U.getRows();
+
+    for (int i = 0; i < iterations; ++i) {
+        for (int colour = 0; colour < 2; ++colour) {
 #ifdef _OPENMP
-    #pragma omp parallel for if(multithread)
+            #pragma omp parallel for if(multithread && height > 64)
 #endif
 
-    for (int y = 0 ; y < height ; y++)
-        for (int x = 0 ; x < width ; x++) {
-            (*T)(x, y) *= factor;
-        }
+            for (int y = 0; y < height; ++y) {
+                int x = (y + colour) & 1;
+
+                if (!level.uniform || y == 0 || y == height - 1 || width < 3) {
+                    for (; x < width; x += 2) {
+                        relax(level, x, y);
+                    }
 
-    for (int x = 0 ; x < width ; x++) {
-        (*T)(x, 0) *= 0.5f;
-        (*T)(x, height - 1) *= 0.5f;
+                    continue;
+                }
+
+                if (x == 0) {
+                    relax(level, 0, y);
+                    x += 2;
+                }
+
+                float *const u = U[y];
+                const float *const um = U[y - 1];
+                const float *const up = U[y + 1];
+                const float *const f = F[y];
+
+                for (; x < width - 1; x += 2) {
+                    u[x] = 0.25f * (u[x - 1] + u[x + 1] + um[x] + up[x] - f[x]);
+                }
+
+                if (x == width - 1) {
+                    relax(level, x, y);
+                }
+            }
+        }
     }
+}
 
-    for (int y = 0 ; y < height ; y++) {
-        (*T)(0, y) *= 0.5f;
-        (*T)(width - 1, y) *= 0.5f;
+// right hand side of the coarse level: sum of the residuals of the children of each cell
+void restrictResidual(const MultigridLevel &fine, MultigridLevel &coarse, bool multithread)
+{
+    const int width = fine.U->getCols();
+    const int height = fine.U->getRows();
+    Array2Df &Fc = *coarse.F;
+    const int cwidth = Fc.getCols();
+    const int cheight = Fc.getRows();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread && cheight > 32)
+#endif
+
+    for (int cy = 0; cy < cheight; ++cy) {
+        const int y1 = std::min(2 * cy + 1, height - 1);
+
+        for (int cx = 0; cx < cwidth; ++cx) {
+            const int x1 = std::min(2 * cx + 1, width - 1);
+            float sum = 0.f;
+
+            for (int y = 2 * cy; y <= y1; ++y) {
+                for (int x = 2 * cx; x <= x1; ++x) {
+                    sum += residual(fine, x, y);
+                }
+            }
+
+            Fc(cx, cy) = sum;
+        }
     }
 }
 
-// returns the eigenvalues of the 1d laplace operator
-std::vector<double> get_lambda(int n)
+// U += bilinear interpolation of the solution of the coarse level
+void prolongateAdd(const MultigridLevel &coarse, MultigridLevel &fine, bool multithread)
 {
-    assert(n > 1);
-    std::vector<double> v(n);
+    const Array2Df &Uc = *coarse.U;
+    Array2Df &U = *fine.U;
+    const int width = U.getCols();
+    const int height = U.getRows();
+    const int cwidth = Uc.getCols();
+    const int cheight = Uc.getRows();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread && height > 64)
+#endif
+
+    for (int y = 0; y < height; ++y) {
+        const int cy = y / 2;
+        const int ny = LIM(cy + ((y & 1) ? 1 : -1), 0, cheight - 1);
 
-    for (int i = 0; i < n; i++) {
-        v[i] = -4.0 * SQR(sin((double)i / (2 * (n - 1)) * RT_PI));
+        for (int x = 0; x < width; ++x) {
+            const int cx = x / 2;
+            const int nx = LIM(cx + ((x & 1) ? 1 : -1), 0, cwidth - 1);
+            U(x, y) += 0.5625f * Uc(cx, cy) + 0.1875f * (Uc(nx, cy) + Uc(cx, ny)) + 0.0625f * Uc(nx, ny);
+        }
     }
+}
+
+void clear(Array2Df &A, bool multithread)
+{
+    const int width = A.getCols();
+    const int height = A.getRows();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread && height > 64)
+#endif
 
-    return v;
+    for (int y = 0; y < height; ++y) {
+        std::fill(A[y], A[y] + width, 0.f);
+    }
 }
 
-// // makes boundary conditions compatible so that a solution exists
-// void make_compatible_boundary(Array2Df *F)
-// {
-//   int width = F->getCols();
-//   int height = F->getRows();
-
-//   double sum=0.0;
-//   for(int y=1 ; y<height-1 ; y++ )
-//     for(int x=1 ; x<width-1 ; x++ )
-//       sum+=(*F)(x,y);
-
-//   for(int x=1 ; x<width-1 ; x++ )
-//     sum+=0.5*((*F)(x,0)+(*F)(x,height-1));
-
-//   for(int y=1 ; y<height-1 ; y++ )
-//     sum+=0.5*((*F)(0,y)+(*F)(width-1,y));
-
-//   sum+=0.25*((*F)(0,0)+(*F)(0,height-1)+(*F)(width-1,0)+(*F)(width-1,height-1));
-
-//   //DEBUG_STR << "compatible_boundary: int F = " << sum ;
-//   //DEBUG_STR << " (should be 0 to be solvable)" << std::endl;
-
-//   double add=-sum/(height+width-3);
-//   //DEBUG_STR << "compatible_boundary: adjusting boundary by " << add << std::endl;
-//   for(int x=0 ; x<width ; x++ )
-//   {
-//     (*F)(x,0)+=add;
-//     (*F)(x,height-1)+=add;
-//   }
-//   for(int y=1 ; y<height-1 ; y++ )
-//   {
-//     (*F)(0,y)+=add;
-//     (*F)(width-1,y)+=add;
-//   }
-// }
-
-
-
-// solves Laplace U = F with Neumann boundary conditions
-// if adjust_bound is true then boundary values in F are modified so that
-// the equation has a solution, if adjust_bound is set to false then F is
-// not modified and the equation might not have a solution but an
-// approximate solution with a minimum error is then calculated
-// double precision version
-void solve_pde_fft(Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread, int algo)/*, pfs::Progress &ph,
-                                              bool adjust_bound)*/
+void solve_coarsest(MultigridLevel &level)
 {
-    // ph.setValue(20);
-    //DEBUG_STR << "solve_pde_fft: solving Laplace U = F ..." << std::endl;
-    int width = F->getCols();
-    int height = F->getRows();
-    assert((int)U->getCols() == width && (int)U->getRows() == height);
-    assert(buf->getCols() == width && buf->getRows() == height);
+    Array2Df &F = *level.F;
+    const int width = F.getCols();
+    const int height = F.getRows();
+    const int size = width * height;
 
-    // activate parallel execution of fft routines
-#ifdef RT_FFTW3F_OMP
+    // make the problem compatible, rounding errors accumulate on the way down
+    double mean = 0.0;
 
-    if (multithread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
+    for (int i = 0; i < size; ++i) {
+        mean += F(i);
     }
 
-// #else
-//   fftwf_plan_with_nthreads( 2 );
-#endif
+    mean /= size;
 
-    // in general there might not be a solution to the Poisson pde
-    // with Neumann boundary conditions unless the boundary satisfies
-    // an integral condition, this function modifies the boundary so that
-    // the condition is exactly satisfied
-    // if(adjust_bound)
-    // {
-    //   //DEBUG_STR << "solve_pde_fft: checking boundary conditions" << std::endl;
-    //   make_compatible_boundary(F);
-    // }
+    for (int i = 0; i < size; ++i) {
+        F(i) -= mean;
+    }
+
+    const int dim = std::max(width, height);
+    smooth(level, 4 * dim * dim + 16, false);
+}
+
+void vcycle(std::vector<MultigridLevel> &levels, size_t k, bool multithread)
+{
+    constexpr int pre_smooth = 2;
+    constexpr int post_smooth = 2;
 
-    // transforms F into eigenvector space: Ftr =
-    //DEBUG_STR << "solve_pde_fft: transform F to ev space (fft)" << std::endl;
-    Array2Df* F_tr = buf;
-    transform_normal2ev(F, F_tr, multithread);
-    // TODO: F no longer needed so could release memory, but as it is an
-    // input parameter we won't do that
+    if (k == levels.size() - 1) {
+        solve_coarsest(levels[k]);
+        return;
+    }
 
+    smooth(levels[k], pre_smooth, multithread);
+    restrictResidual(levels[k], levels[k + 1], multithread);
+    clear(*levels[k + 1].U, multithread);
+    vcycle(levels, k + 1, multithread);
+    prolongateAdd(levels[k + 1], levels[k], multithread);
+    smooth(levels[k], post_smooth, multithread);
+}
 
-    // in the eigenvector space the solution is very simple
-    std::vector<double> l1 = get_lambda(height);
-    std::vector<double> l2 = get_lambda(width);
+// solves Laplace U = F with Neumann boundary conditions, using full multigrid
+void solve_pde_multigrid(Array2Df *F, Array2Df *U, bool multithread, int algo)
+{
+    constexpr int cycles = 2;
+
+    const int width = F->getCols();
+    const int height = F->getRows();
+    assert(U->getCols() == width && U->getRows() == height);
+
+    std::vector<MultigridLevel> levels(1);
+    levels[0].U = U;
+    levels[0].F = F;
+    levels[0].cellWidth.assign(width, 1.f);
+    levels[0].cellHeight.assign(height, 1.f);
+    levels[0].uniform = true;
+
+    while (std::max(levels.back().U->getCols(), levels.back().U->getRows()) > multigrid_min_dim) {
+        const MultigridLevel &fine = levels.back();
+        const int fw = fine.U->getCols();
+        const int fh = fine.U->getRows();
+        MultigridLevel coarse;
+        coarse.U = new Array2Df((fw + 1) / 2, (fh + 1) / 2);
+        coarse.F = new Array2Df((fw + 1) / 2, (fh + 1) / 2);
+        coarse.uniform = false;
+
+        for (int x = 0; x < fw; x += 2) {
+            coarse.cellWidth.push_back(fine.cellWidth[x] + (x + 1 < fw ? fine.cellWidth[x + 1] : 0.f));
+        }
 
-#ifdef _OPENMP
-    #pragma omp parallel for if(multithread)
-#endif
+        for (int y = 0; y < fh; y += 2) {
+            coarse.cellHeight.push_back(fine.cellHeight[y] + (y + 1 < fh ? fine.cellHeight[y + 1] : 0.f));
+        }
 
-    for (int y = 0 ; y < height ; y++) {
-        for (int x = 0 ; x < width ; x++) {
-            (*F_tr) (x, y) = static_cast<double>((*F_tr) (x, y)) / (l1[y] + l2[x]);
+        levels.push_back(std::move(coarse));
+    }
+
+    for (auto &level : levels) {
+        initMultigridLevel(level);
+        clear(*level.U, multithread);
+    }
+
+    // right hand sides of all levels, then from coarse to fine: interpolate
+    // the solution of the coarser level and refine it with a few V-cycles
+    for (size_t k = 1; k < levels.size(); ++k) {
+        restrictResidual(levels[k - 1], levels[k], multithread);
+    }
+
+    solve_coarsest(levels.back());
+
+    for (size_t k = levels.size() - 1; k-- > 0;) {
+        prolongateAdd(levels[k + 1], levels[k], multithread);
+
+        for (int i = 0; i < cycles; ++i) {
+            vcycle(levels, k, multithread);
         }
     }
 
-    (*F_tr)(0, 0) = 0.f;  // any value ok, only adds a const to the solution
+    for (size_t k = 1; k < levels.size(); ++k) {
+        delete levels[k].U;
+        delete levels[k].F;
+    }
 
-    // transforms F_tr back to the normal space
-    transform_ev2normal(F_tr, U, multithread);
+    // the solution is defined up to a constant. As we are mainly working in
+    // the logspace of (0,1) data we prefer to have a solution which has no
+    // positive values (not really needed but good for numerics as we later
+    // take exp(U)), whereas algo 1 expects a solution with zero mean
+    const int size = width * height;
+    float offset = 0.f;
 
-    // the solution U as calculated will satisfy something like int U = 0
-    // since for any constant c, U-c is also a solution and we are mainly
-    // working in the logspace of (0,1) data we prefer to have
-    // a solution which has no positive values: U_new(x,y)=U(x,y)-max
-    // (not really needed but good for numerics as we later take exp(U))
-    //DEBUG_STR << "solve_pde_fft: removing constant from solution" << std::endl;
     if (algo == 0) {
-        float maxVal = 0.f;
+        offset = (*U)(0);
 #ifdef _OPENMP
-        #pragma omp parallel for reduction(max:maxVal) if(multithread)
+        #pragma omp parallel for reduction(max:offset) if(multithread)
 #endif
 
-        for (int i = 0; i < width * height; i++) {
-            maxVal = std::max(maxVal, (*U)(i));
+        for (int i = 0; i < size; i++) {
+            offset = std::max(offset, (*U)(i));
         }
-
+    } else {
+        double sum = 0.0;
 #ifdef _OPENMP
-        #pragma omp parallel for if(multithread)
+        #pragma omp parallel for reduction(+:sum) if(multithread)
 #endif
 
-        for (int i = 0; i < width * height; i++) {
-            (*U)(i) -= maxVal;
+        for (int i = 0; i < size; i++) {
+            sum += (*U)(i);
         }
-    }
-}
-
-
-// ---------------------------------------------------------------------
-// the functions below are only for test purposes to check the accuracy
-// of the pde solvers
 
+        offset = sum / size;
+    }
 
-// // returns the norm of (Laplace U - F) of all interior points
-// // useful to compare solvers
-// float residual_pde(Array2Df* U, Array2Df* F)
-// {
-//   int width = U->getCols();
-//   int height = U->getRows();
-//   assert((int)F->getCols()==width && (int)F->getRows()==height);
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread)
+#endif
 
-//   double res=0.0;
-//   for(int y=1;y<height-1;y++)
-//     for(int x=1;x<width-1;x++)
-//     {
-//       double laplace=-4.0*(*U)(x,y)+(*U)(x-1,y)+(*U)(x+1,y)
-//                      +(*U)(x,y-1)+(*U)(x,y+1);
-//       res += SQR( laplace-(*F)(x,y) );
-//     }
-//   return static_cast<float>( sqrt(res) );
-// }
+    for (int i = 0; i < size; i++) {
+        (*U)(i) -= offset;
+    }
+}
 
 
 /*****************************************************************************
@@ -1006,61 +1054,6 @@ inline float luminance(float r, float g, float b, TMatrix ws)
 }
 
 
-inline int round_up_pow2(int dim)
-{
-    // from https://graphics.stanford.edu/~seander/bithacks.html
-    assert(dim > 0);
-    unsigned int v = dim;
-    v--;
-    v |= v >> 1;
-    v |= v >> 2;
-    v |= v >> 4;
-    v |= v >> 8;
-    v |= v >> 16;
-    v++;
-    return v;
-}
-
-inline int find_fast_dim(int dim)
-{
-    // as per the FFTW docs:
-    //
-    //   FFTW is generally best at handling sizes of the form
-    //     2^a 3^b 5^c 7^d 11^e 13^f,
-    //   where e+f is either 0 or 1.
-    //
-    // Here, we try to round up to the nearest dim that can be expressed in
-    // the above form. This is not exhaustive, but should be ok for pictures
-    // up to 100MPix at least
-
-    int d1 = round_up_pow2(dim);
-    std::vector<int> d = {
-        d1 / 128 * 65,
-        d1 / 64 * 33,
-        d1 / 512 * 273,
-        d1 / 16 * 9,
-        d1 / 8 * 5,
-        d1 / 16 * 11,
-        d1 / 128 * 91,
-        d1 / 4 * 3,
-        d1 / 64 * 49,
-        d1 / 16 * 13,
-        d1 / 8 * 7,
-        d1
-    };
-
-    for (size_t i = 0; i < d.size(); ++i) {
-        if (d[i] >= dim) {
-            return d[i];
-        }
-    }
-
-    assert(false);
-    return dim;
-}
-
-
-
 } // namespace
 
 
@@ -1131,10 +1124,8 @@ void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingPa
     }
 
     // median filter on the deep shadows, to avoid boosting noise
-    // because w2 >= w and h2 >= h, we can use the L buffer as temporary buffer for Median_Denoise()
-    int w2 = find_fast_dim(w) + 1;
-    int h2 = find_fast_dim(h) + 1;
-    Array2Df L(w2, h2);
+    // we can use the L buffer as temporary buffer for Median_Denoise()
+    Array2Df L(w, h);
     {
 #ifdef _OPENMP
         int num_threads = multiThread ? omp_get_max_threads() : 1;
@@ -1164,12 +1155,8 @@ void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingPa
                   << ", detail_level = " << detail_level << std::endl;
     }
 
-    rescale_nearest(Yr, L, multiThread);
-
-    tmo_fattal02(w2, h2, L, L, alpha, beta, noise, detail_level, multiThread, 0);
-
-    const float hr = float(h2) / float(h);
-    const float wr = float(w2) / float(w);
+    // RT - the solver works on the full image, no need to resample to sizes FFTW likes
+    tmo_fattal02(w, h, Yr, L, alpha, beta, noise, detail_level, multiThread, 0);
 
     float offset = 0.f;
     float scale = 65535.f;
@@ -1230,13 +1217,9 @@ void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingPa
 #endif
 
     for (int y = 0; y < h; y++) {
-        int yy = y * hr + 1;
-
         for (int x = 0; x < w; x++) {
-            int xx = x * wr + 1;
-
             float Y = std::max(Yr(x, y), epsilon);
-            float l = std::max(L(xx, yy), epsilon) * (scale / Y);
+            float l = std::max(L(x, y), epsilon) * (scale / Y);
 
             if (Lalone == 0) {
                 float &r = rgb->r(y, x);
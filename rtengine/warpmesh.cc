@@ -0,0 +1,230 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "warpmesh.h"
+
+#include "rt_math.h"
+#include "settings.h"
+
+namespace
+{
+
+// number of meshes kept, enough for the preview and a few detail windows
+constexpr unsigned long mesh_cache_size = 8;
+
+inline void catmullRomWeights(float t, float w[4])
+{
+    const float t2 = t * t;
+    const float t3 = t2 * t;
+    w[0] = 0.5f * (-t3 + 2.f * t2 - t);
+    w[1] = 0.5f * (3.f * t3 - 5.f * t2 + 2.f);
+    w[2] = 0.5f * (-3.f * t3 + 4.f * t2 + t);
+    w[3] = 0.5f * (t3 - t2);
+}
+
+}
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+WarpMesh::WarpMesh(int width, int height, int planes, const Mapping& mapping, double tolerance) :
+    width(width),
+    height(height),
+    planes(planes),
+    // node i is at (i - 1) * spacing, so that each pixel has two nodes on either side
+    nodesW((width - 1) / spacing + 4),
+    nodesH((height - 1) / spacing + 4),
+    nodes(static_cast<std::size_t>(nodesW) * nodesH * planes),
+    valid(width > 0 && height > 0 && planes > 0)
+{
+    if (!valid) {
+        return;
+    }
+
+    int undefined = 0;
+
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(+:undefined) schedule(dynamic, 4)
+#endif
+
+    for (int j = 0; j < nodesH; ++j) {
+        std::vector<double> values(planes);
+
+        for (int i = 0; i < nodesW; ++i) {
+            if (!mapping((i - 1) * spacing, (j - 1) * spacing, values.data())) {
+                ++undefined;
+                continue;
+            }
+
+            for (int p = 0; p < planes; ++p) {
+                if (!std::isfinite(values[p])) {
+                    ++undefined;
+                }
+
+                nodes[(static_cast<std::size_t>(j) * planes + p) * nodesW + i] = values[p];
+            }
+        }
+    }
+
+    if (undefined) {
+        valid = false;
+        return;
+    }
+
+    // check the interpolation against the exact mapping at the cell centres
+    double maxError = 0.0;
+
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(max:maxError) schedule(dynamic, 4)
+#endif
+
+    for (int cy = 0; cy <= (height - 1) / spacing; ++cy) {
+        const int y = std::min(cy * spacing + spacing / 2, height - 1);
+        std::vector<float> rowBuffer(getRowBufferSize());
+        std::vector<float> rowValues(static_cast<std::size_t>(width) * planes);
+        std::vector<float*> out(planes);
+
+        for (int p = 0; p < planes; ++p) {
+            out[p] = rowValues.data() + static_cast<std::size_t>(p) * width;
+        }
+
+        getRow(y, 0, width, rowBuffer.data(), out.data());
+
+        std::vector<double> values(planes);
+
+        for (int x = std::min(spacing / 2, width - 1); x < width; x += spacing) {
+            if (!mapping(x, y, values.data())) {
+                maxError = RT_INFINITY;
+                continue;
+            }
+
+            for (int p = 0; p < planes; ++p) {
+                const double error = std::fabs(values[p] - out[p][x]);
+                maxError = std::isfinite(error) ? std::max(maxError, error) : RT_INFINITY;
+            }
+        }
+    }
+
+    valid = maxError <= tolerance;
+
+    if (settings->verbose) {
+        printf("WarpMesh %dx%d, %d planes: max. interpolation error %g px%s\n", width, height, planes, maxError, valid ? "" : ", using exact mapping");
+    }
+}
+
+bool WarpMesh::isValid() const
+{
+    return valid;
+}
+
+int WarpMesh::getWidth() const
+{
+    return width;
+}
+
+int WarpMesh::getHeight() const
+{
+    return height;
+}
+
+int WarpMesh::getPlanes() const
+{
+    return planes;
+}
+
+std::size_t WarpMesh::getRowBufferSize() const
+{
+    return static_cast<std::size_t>(nodesW) * planes;
+}
+
+void WarpMesh::getRow(int y, int x0, int count, float* rowBuffer, float* const* out) const
+{
+    if (count <= 0) {
+        return;
+    }
+
+    const int ky = y / spacing;
+    float wy[4];
+    catmullRomWeights(static_cast<float>(y - ky * spacing) / spacing, wy);
+
+    // vertical pass, only over the node columns used by this part of the row
+    const int i0 = x0 / spacing;
+    const int i1 = (x0 + count - 1) / spacing + 3;
+
+    for (int p = 0; p < planes; ++p) {
+        float* const rb = rowBuffer + static_cast<std::size_t>(p) * nodesW;
+        const float* const r0 = nodes.data() + (static_cast<std::size_t>(ky) * planes + p) * nodesW;
+        const float* const r1 = r0 + static_cast<std::size_t>(planes) * nodesW;
+        const float* const r2 = r1 + static_cast<std::size_t>(planes) * nodesW;
+        const float* const r3 = r2 + static_cast<std::size_t>(planes) * nodesW;
+
+        for (int i = i0; i <= i1; ++i) {
+            rb[i] = wy[0] * r0[i] + wy[1] * r1[i] + wy[2] * r2[i] + wy[3] * r3[i];
+        }
+    }
+
+    // horizontal pass, the weights only depend on the position inside the cell
+    float wx[spacing][4];
+
+    for (int t = 0; t < spacing; ++t) {
+        catmullRomWeights(static_cast<float>(t) / spacing, wx[t]);
+    }
+
+    for (int p = 0; p < planes; ++p) {
+        const float* const rb = rowBuffer + static_cast<std::size_t>(p) * nodesW;
+        float* const dst = out[p];
+
+        for (int x = x0; x < x0 + count; ++x) {
+            const int k = x / spacing;
+            const float* const w = wx[x - k * spacing];
+            dst[x - x0] = w[0] * rb[k] + w[1] * rb[k + 1] + w[2] * rb[k + 2] + w[3] * rb[k + 3];
+        }
+    }
+}
+
+WarpMeshCache& WarpMeshCache::getInstance()
+{
+    static WarpMeshCache instance;
+    return instance;
+}
+
+std::shared_ptr<const WarpMesh> WarpMeshCache::getMesh(const std::string& key, int width, int height, int planes, const WarpMesh::Mapping& mapping)
+{
+    // well below the precision of the cubic resampling
+    constexpr double tolerance = 0.01;
+
+    std::shared_ptr<const WarpMesh> result;
+
+    if (!cache.get(key, result) || !result || result->getWidth() != width || result->getHeight() != height || result->getPlanes() != planes) {
+        // invalid meshes are cached too, so that the check is not repeated on each update
+        result = std::make_shared<const WarpMesh>(width, height, planes, mapping, tolerance);
+        cache.set(key, result);
+    }
+
+    return result;
+}
+
+WarpMeshCache::WarpMeshCache() :
+    cache(mesh_cache_size)
+{
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Coarse sampling of a smooth per pixel mapping
+ *
+ * The geometry corrections (lens profile, distortion, rotation, perspective) map each
+ * output pixel to a source position. That mapping is smooth, so instead of evaluating it
+ * for every pixel it is sampled every WarpMesh::spacing pixels and interpolated with
+ * Catmull-Rom splines. The values of all planes are expected in pixel units. If the
+ * interpolation error at the cell centres exceeds the tolerance (or the mapping is not
+ * defined everywhere), the mesh is flagged invalid and the exact mapping has to be used.
+ */
+class WarpMesh final :
+    public NonCopyable
+{
+public:
+    static constexpr int spacing = 16;
+
+    // fills values[0 .. planes - 1] for the point (x, y), returns false where the mapping is undefined
+    using Mapping = std::function<bool(double x, double y, double* values)>;
+
+    WarpMesh(int width, int height, int planes, const Mapping& mapping, double tolerance);
+
+    bool isValid() const;
+    int getWidth() const;
+    int getHeight() const;
+    int getPlanes() const;
+
+    // size (in floats) of the scratch buffer needed by getRow
+    std::size_t getRowBufferSize() const;
+
+    /**
+    * @brief Interpolate the planes for a part of a row
+    * @param y row, 0 <= y < height
+    * @param x0,count columns x0 .. x0 + count - 1, inside [0 ; width)
+    * @param rowBuffer scratch buffer of getRowBufferSize() floats
+    * @param out receives the values, out[plane][0 .. count - 1]
+    */
+    void getRow(int y, int x0, int count, float* rowBuffer, float* const* out) const;
+
+private:
+    int width;
+    int height;
+    int planes;
+    int nodesW;
+    int nodesH;
+    std::vector<float> nodes; // [node row][plane][node column]
+    bool valid;
+};
+
+/**
+ * @brief Cache of the warp meshes, keyed by everything the mapping depends on
+ *
+ * Keeps the meshes of the preview and of the detail windows, so that only changes to
+ * the lens or geometry parameters (or to the scale) rebuild them.
+ */
+class WarpMeshCache final :
+    public NonCopyable
+{
+public:
+    static WarpMeshCache& getInstance();
+
+    // returns the cached mesh for key or builds it, check isValid() before using it
+    std::shared_ptr<const WarpMesh> getMesh(const std::string& key, int width, int height, int planes, const WarpMesh::Mapping& mapping);
+
+private:
+    WarpMeshCache();
+
+    mutable Cache<std::string, std::shared_ptr<const WarpMesh>> cache;
+};
+
+}
@@ -178,7 +178,7 @@ void RawImageSource::xtransborder_interpolate (int border, array2D<float> &red,
 */
 // override CLIP function to test unclipped output
 #define CLIP(x) (x)
-void RawImageSource::xtrans_interpolate (const int passes, const bool useCieLab, size_t chunkSize, bool measure)
+void RawImageSource::xtrans_interpolate (int winx, int winy, int winw, int winh, const int passes, const bool useCieLab, size_t chunkSize, bool measure)
 {
 
     std::unique_ptr<StopWatch> stop;
@@ -314,6 +314,11 @@ void RawImageSource::xtrans_interpolate (const int passes, const bool useCieLab,
                 int mrow = MIN (top + ts, height - 3);
                 int mcol = MIN (left + ts, width - 3);
 
+                if (mrow <= winy || top >= winy + winh || mcol <= winx || left >= winx + winw) {
+                    // tile does not intersect the requested window
+                    continue;
+                }
+
                 /* Set greenmin and greenmax to the minimum and maximum allowed values: */
                 for (int row = top; row < mrow; row++) {
                     // find first non-green pixel
@@ -30,7 +30,7 @@ using namespace rtengine::procparams;
 
 
 BayerProcess::BayerProcess () :
-    FoldableToolPanel(this, "bayerprocess", M("TP_RAW_LABEL"), options.prevdemo != PD_Sidecar),
+    FoldableToolPanel(this, "bayerprocess", M("TP_RAW_LABEL"), options.prevdemo == PD_Fast),
     oldMethod(-1)
 {
 
@@ -598,6 +598,8 @@ void BayerProcess::methodChanged ()
     if (listener && method->get_active_row_number() >= 0) {
         listener->panelChanged (
             currentMethod == procparams::RAWParams::BayerSensor::Method::MONO || RAWParams::BayerSensor::Method(oldMethod) == procparams::RAWParams::BayerSensor::Method::MONO
+            // the frames of pixel shift files are only preprocessed for the pixel shift demosaic
+            || currentMethod == procparams::RAWParams::BayerSensor::Method::PIXELSHIFT || RAWParams::BayerSensor::Method(oldMethod) == procparams::RAWParams::BayerSensor::Method::PIXELSHIFT
             ? EvDemosaicMethodPreProc
             : EvDemosaicMethod, method->get_active_text());
     }
@@ -1227,6 +1227,7 @@ void EditorPanel::setProgressState(bool inProcessing)
 
 void EditorPanel::error(const Glib::ustring& descr)
 {
+    error(M("GENERAL_WARNING"), descr);
 }
 
 void EditorPanel::error(const Glib::ustring& title, const Glib::ustring& descr)
@@ -682,7 +682,7 @@ void ImageArea::initialImageArrived ()
     if (mainCropWindow) {
         int w, h;
         mainCropWindow->cropHandler.getFullImageSize(w, h);
-        if(options.prevdemo != PD_Sidecar || !options.rememberZoomAndPan || w != fullImageWidth || h != fullImageHeight) {
+        if(options.prevdemo == PD_Fast || !options.rememberZoomAndPan || w != fullImageWidth || h != fullImageHeight) {
             if (options.cropAutoFit || options.bgcolor != 0) {
                 mainCropWindow->zoomFitCrop();
             } else {
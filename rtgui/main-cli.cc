@@ -26,11 +26,18 @@
 #include "config.h"
 #include <gtkmm.h>
 #include <giomm.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <tiffio.h>
 #include <cstring>
 #include <cstdlib>
 #include <locale.h>
+#include "../rtengine/cJSON.h"
 #include "../rtengine/procparams.h"
 #include "../rtengine/profilestore.h"
 #include "../rtengine/rtengine.h"
@@ -46,7 +53,9 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glibmm/threads.h>
+#include <unistd.h>
 #else
+#include <io.h>
 #include <windows.h>
 #include <shlobj.h>
 #include <glibmm/thread.h>
@@ -88,6 +97,536 @@ Glib::ustring fname_to_utf8 (const char* fname)
 
 bool fast_export = false;
 
+// One output of a multi-output export (-m switch)
+struct OutputSpec {
+    Glib::ustring suffix;
+    std::string type;
+    int compression;
+    int bits;
+    bool isFloat;
+    int longEdge;
+    Glib::ustring iccProfile;
+};
+
+// Parses "<suffix>,<token>[,<token>...]", returns false on syntax error
+bool parseOutputSpec (const Glib::ustring& spec, OutputSpec& out)
+{
+    std::vector<Glib::ustring> tokens;
+    Glib::ustring::size_type start = 0;
+
+    while (true) {
+        const Glib::ustring::size_type end = spec.find (',', start);
+        tokens.push_back (spec.substr (start, end == Glib::ustring::npos ? Glib::ustring::npos : end - start));
+
+        if (end == Glib::ustring::npos) {
+            break;
+        }
+
+        start = end + 1;
+    }
+
+    out.suffix = tokens[0];
+    out.type = "jpg";
+    out.compression = 92;
+    out.bits = -1;
+    out.isFloat = false;
+    out.longEdge = 0;
+
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        const Glib::ustring& token = tokens[i];
+
+        if (token.empty()) {
+            return false;
+        } else if (token.substr (0, 4) == "icc=") {
+            out.iccProfile = token.substr (4);
+        } else if (token.at (0) == 'j') {
+            out.type = "jpg";
+            out.compression = token.size() > 1 ? atoi (token.substr (1).c_str()) : 92;
+
+            if (out.compression < 1 || out.compression > 100) {
+                return false;
+            }
+        } else if (token == "t" || token == "tz") {
+            out.type = "tif";
+            out.compression = token == "tz" ? 1 : 0;
+        } else if (token == "n") {
+            out.type = "png";
+            out.compression = -1;
+        } else if (token == "b8") {
+            out.bits = 8;
+        } else if (token == "b16" || token == "b16f") {
+            out.bits = 16;
+            out.isFloat = token == "b16f";
+        } else if (token == "b32") {
+            out.bits = 32;
+            out.isFloat = true;
+        } else if (token.find_first_not_of ("0123456789") == Glib::ustring::npos) {
+            out.longEdge = atoi (token.c_str());
+
+            if (out.longEdge <= 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if (out.bits == -1) {
+        out.bits = out.type == "tif" ? 16 : 8;
+    }
+
+    return true;
+}
+
+// Merges the default processing profile for raw or non-raw images, as set in Preferences
+bool applyDefaultProfile (bool isRaw, rtengine::InitialImage* ii, rtengine::procparams::ProcParams& params)
+{
+    Glib::ustring& defProf = isRaw ? options.defProfRaw : options.defProfImg;
+
+    if (isRaw ? options.is_defProfRawMissing() : options.is_defProfImgMissing()) {
+        return false;
+    }
+
+    rtengine::procparams::PartialProfile* profile;
+
+    if (defProf == DEFPROFILE_DYNAMIC) {
+        profile = ProfileStore::getInstance()->loadDynamicProfile (ii->getMetaData());
+    } else {
+        const Glib::ustring profPath = options.findProfilePath (defProf);
+        profile = new rtengine::procparams::PartialProfile (true, isRaw);
+
+        if (profPath.empty() || profile->load (profPath == DEFPROFILE_INTERNAL ? DEFPROFILE_INTERNAL : Glib::build_filename (profPath, Glib::path_get_basename (defProf) + paramFileExtension))) {
+            profile->deleteInstance();
+            delete profile;
+            return false;
+        }
+    }
+
+    profile->applyTo (&params);
+    profile->deleteInstance();
+    delete profile;
+    return true;
+}
+
+bool getJobFlag (const cJSON* job, const char* name, bool defaultValue)
+{
+    const cJSON* const item = cJSON_GetObjectItem (job, name);
+    return cJSON_IsBool (item) ? cJSON_IsTrue (item) : defaultValue;
+}
+
+/* Worker mode (-w switch)
+ * Jobs are read from stdin, one JSON object per line, e.g.
+ *   {"id": 1, "input": "a.nef", "profiles": ["b.pp3"], "outputs": [{"file": "a.jpg", "format": "j90,2048"}]}
+ * "format" uses the <spec> syntax of the -m switch, it defaults to the extension of the file. A single
+ * "output" (and "format") can be given instead of "outputs". The optional "default", "sidecar", "fast"
+ * and "overwrite" flags default to -d, -s, -f and -Y. The -p profiles are merged before the job's ones.
+ * Progress and results are written to stdout, one JSON object per line, tagged with the job's id.
+ * From the "ready" event on, stdout only carries these lines: whatever else the CLI and the engine print
+ * (e.g. in verbose mode) is redirected to stderr, clients have to skip the lines before "ready".
+ * The engine stays initialized between jobs, so its stores and caches are shared by all of them. */
+class CliWorker final
+{
+public:
+    CliWorker (unsigned int concurrency, bool useDefault, bool sideProcParams, bool overwriteFiles, int subsampling, const std::vector<rtengine::procparams::PartialProfile*>& baseParams) :
+        concurrency (concurrency),
+        useDefault (useDefault),
+        sideProcParams (sideProcParams),
+        overwriteFiles (overwriteFiles),
+        subsampling (subsampling),
+        baseParams (baseParams),
+        finished (false),
+        protocol (stdout),
+        errors (0)
+    {
+    }
+
+    // processes the jobs until end of input or a {"quit": true} line, returns the number of failed jobs
+    unsigned int run ()
+    {
+        std::vector<std::thread> workers;
+
+        // keep the real stdout for the protocol, the other prints go to stderr
+        std::cout.flush();
+        std::fflush (stdout);
+        const int protocolFd = dup (fileno (stdout));
+        FILE* const protocolFile = protocolFd == -1 ? nullptr : fdopen (protocolFd, "w");
+
+        if (protocolFile && dup2 (fileno (stderr), fileno (stdout)) != -1) {
+            protocol = protocolFile;
+        } else if (protocolFile) {
+            std::fclose (protocolFile);
+        } else if (protocolFd != -1) {
+            close (protocolFd);
+        }
+
+        for (unsigned int i = 0; i < concurrency; ++i) {
+            workers.emplace_back ([this]() {
+                work();
+            });
+        }
+
+        cJSON* const ready = createEvent (nullptr, "ready");
+        cJSON_AddStringToObject (ready, "version", RTVERSION);
+        emit (ready);
+
+        std::string line;
+
+        while (std::getline (std::cin, line)) {
+            if (line.find_first_not_of (" \t\r") == std::string::npos) {
+                continue;
+            }
+
+            cJSON* const job = cJSON_Parse (line.c_str());
+
+            if (!cJSON_IsObject (job)) {
+                cJSON_Delete (job);
+                reportError (nullptr, "Invalid job: " + line);
+                continue;
+            }
+
+            if (getJobFlag (job, "quit", false)) {
+                cJSON_Delete (job);
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock (queueMutex);
+                queue.push_back (job);
+            }
+
+            queueChanged.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (queueMutex);
+            finished = true;
+        }
+
+        queueChanged.notify_all();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (protocol != stdout) {
+            std::cout.flush();
+            std::fflush (stdout);
+            dup2 (fileno (protocol), fileno (stdout));
+            std::fclose (protocol);
+            protocol = stdout;
+        }
+
+        return errors;
+    }
+
+    void reportProgress (const cJSON* id, double progress)
+    {
+        cJSON* const event = createEvent (id, "progress");
+        cJSON_AddNumberToObject (event, "progress", progress);
+        emit (event);
+    }
+
+private:
+    class Progress final :
+        public rtengine::ProgressListener
+    {
+    public:
+        Progress (CliWorker& worker, const cJSON* id) :
+            worker (worker),
+            id (id)
+        {
+        }
+
+        void setProgress (double p) override
+        {
+            worker.reportProgress (id, p);
+        }
+
+        void setProgressStr (const Glib::ustring& str) override {}
+        void setProgressState (bool inProcessing) override {}
+        void error (const Glib::ustring& descr) override {}
+
+    private:
+        CliWorker& worker;
+        const cJSON* const id;
+    };
+
+    void work ()
+    {
+        while (true) {
+            cJSON* job;
+
+            {
+                std::unique_lock<std::mutex> lock (queueMutex);
+                queueChanged.wait (lock, [this]() {
+                    return finished || !queue.empty();
+                });
+
+                if (queue.empty()) {
+                    return;
+                }
+
+                job = queue.front();
+                queue.pop_front();
+            }
+
+            const cJSON* const id = cJSON_GetObjectItem (job, "id");
+            emit (createEvent (id, "started"));
+
+            cJSON* const outputs = cJSON_CreateArray();
+            Glib::ustring error;
+
+            if (processJob (job, outputs, error)) {
+                cJSON* const event = createEvent (id, "done");
+                cJSON_AddItemToObject (event, "outputs", outputs);
+                emit (event);
+            } else {
+                cJSON_Delete (outputs);
+                reportError (id, error);
+            }
+
+            cJSON_Delete (job);
+        }
+    }
+
+    bool processJob (const cJSON* json, cJSON* outputs, Glib::ustring& error)
+    {
+        const cJSON* const input = cJSON_GetObjectItem (json, "input");
+
+        if (!cJSON_IsString (input)) {
+            error = "The job has no input file.";
+            return false;
+        }
+
+        const Glib::ustring inputFile (input->valuestring);
+        std::vector<Glib::ustring> outputFiles;
+        std::vector<OutputSpec> outputSpecs;
+
+        const auto addOutput = [&outputFiles, &outputSpecs] (const cJSON* file, const cJSON* format) {
+            if (!cJSON_IsString (file) || (format && !cJSON_IsString (format))) {
+                return false;
+            }
+
+            const Glib::ustring fileName (file->valuestring);
+            const Glib::ustring ext = getExtension (fileName).lowercase();
+            OutputSpec outputSpec;
+
+            if (!parseOutputSpec ("," + (format ? Glib::ustring (format->valuestring) : ext == "tif" || ext == "tiff" ? "t" : ext == "png" ? "n" : "j"), outputSpec)) {
+                return false;
+            }
+
+            outputFiles.push_back (fileName);
+            outputSpecs.push_back (outputSpec);
+            return true;
+        };
+
+        const cJSON* const outputList = cJSON_GetObjectItem (json, "outputs");
+
+        if (outputList) {
+            const cJSON* output;
+
+            if (!cJSON_IsArray (outputList)) {
+                error = "Invalid output specification.";
+                return false;
+            }
+
+            cJSON_ArrayForEach (output, outputList) {
+                if (!addOutput (cJSON_GetObjectItem (output, "file"), cJSON_GetObjectItem (output, "format"))) {
+                    error = "Invalid output specification.";
+                    return false;
+                }
+            }
+        } else if (!addOutput (cJSON_GetObjectItem (json, "output"), cJSON_GetObjectItem (json, "format"))) {
+            error = "Invalid output specification.";
+            return false;
+        }
+
+        if (outputFiles.empty()) {
+            error = "The job has no output file.";
+            return false;
+        }
+
+        const bool overwrite = getJobFlag (json, "overwrite", overwriteFiles);
+
+        for (const auto& file : outputFiles) {
+            if (file == inputFile) {
+                error = "Cannot overwrite: " + inputFile;
+                return false;
+            }
+
+            if (!overwrite && Glib::file_test (file, Glib::FILE_TEST_EXISTS)) {
+                error = file + " already exists.";
+                return false;
+            }
+        }
+
+        // an output must not overwrite another one of the job
+        for (auto file = outputFiles.begin() + 1; file < outputFiles.end(); ++file) {
+            if (std::find (outputFiles.begin(), file, *file) != file) {
+                error = "Several outputs resolve to the same file: " + *file;
+                return false;
+            }
+        }
+
+        const Glib::ustring ext = getExtension (inputFile).lowercase();
+        const bool isRaw = !(ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png");
+        int errorCode;
+
+        rtengine::InitialImage* const ii = rtengine::InitialImage::load (inputFile, isRaw, &errorCode, nullptr);
+
+        if (!ii) {
+            error = "Error loading file: " + inputFile;
+            return false;
+        }
+
+        rtengine::procparams::ProcParams params;
+
+        if (getJobFlag (json, "default", useDefault) && !applyDefaultProfile (isRaw, ii, params)) {
+            ii->decreaseRef();
+            error = Glib::ustring ("Default ") + (isRaw ? "raw" : "non-raw") + " processing profile not found.";
+            return false;
+        }
+
+        for (const auto profile : baseParams) {
+            profile->applyTo (&params);
+        }
+
+        const cJSON* profileName;
+
+        cJSON_ArrayForEach (profileName, cJSON_GetObjectItem (json, "profiles")) {
+            rtengine::procparams::PartialProfile profile (true);
+
+            if (!cJSON_IsString (profileName) || profile.load (profileName->valuestring)) {
+                profile.deleteInstance();
+                ii->decreaseRef();
+                error = "Processing profile not found: " + Glib::ustring (cJSON_IsString (profileName) ? profileName->valuestring : "");
+                return false;
+            }
+
+            profile.applyTo (&params);
+            profile.deleteInstance();
+        }
+
+        if (getJobFlag (json, "sidecar", sideProcParams)) {
+            const Glib::ustring sideProcessingParams = inputFile + paramFileExtension;
+
+            if (Glib::file_test (sideProcessingParams, Glib::FILE_TEST_EXISTS)) {
+                params.load (sideProcessingParams);
+            }
+        }
+
+        rtengine::ProcessingJob* const job = rtengine::ProcessingJob::create (ii, params, getJobFlag (json, "fast", fast_export));
+
+        if (!job) {
+            ii->decreaseRef();
+            error = "Error creating processing for: " + inputFile;
+            return false;
+        }
+
+        for (const auto& outputSpec : outputSpecs) {
+            rtengine::procparams::ProcParams outputParams = params;
+
+            if (outputSpec.longEdge > 0) {
+                outputParams.resize.enabled = true;
+                outputParams.resize.dataspec = 4;
+                outputParams.resize.longedge = outputSpec.longEdge;
+                outputParams.resize.allowUpscaling = false;
+            }
+
+            if (!outputSpec.iccProfile.empty()) {
+                outputParams.icm.outputProfile = outputSpec.iccProfile;
+            }
+
+            job->addOutput (outputParams);
+        }
+
+        Progress progress (*this, cJSON_GetObjectItem (json, "id"));
+        std::vector<rtengine::IImagefloat*> resultImages;
+
+        if (!rtengine::processImage (job, errorCode, resultImages, &progress)) {
+            rtengine::ProcessingJob::destroy (job);
+            error = "Error processing: " + inputFile;
+            return false;
+        }
+
+        for (size_t i = 0; i < resultImages.size(); ++i) {
+            const OutputSpec& outputSpec = outputSpecs[i];
+            int saveError;
+
+            if (outputSpec.type == "jpg") {
+                saveError = resultImages[i]->saveAsJPEG (outputFiles[i], outputSpec.compression, subsampling);
+            } else if (outputSpec.type == "tif") {
+                saveError = resultImages[i]->saveAsTIFF (outputFiles[i], outputSpec.bits, outputSpec.isFloat, outputSpec.compression == 0);
+            } else {
+                saveError = resultImages[i]->saveAsPNG (outputFiles[i], outputSpec.bits);
+            }
+
+            if (saveError) {
+                error = "Error saving to: " + outputFiles[i];
+            } else {
+                cJSON_AddItemToArray (outputs, cJSON_CreateString (outputFiles[i].c_str()));
+            }
+
+            delete resultImages[i];
+        }
+
+        ii->decreaseRef();
+        return error.empty();
+    }
+
+    cJSON* createEvent (const cJSON* id, const char* name) const
+    {
+        cJSON* const event = cJSON_CreateObject();
+
+        if (id) {
+            cJSON_AddItemToObject (event, "id", cJSON_Duplicate (id, true));
+        }
+
+        cJSON_AddStringToObject (event, "event", name);
+        return event;
+    }
+
+    void reportError (const cJSON* id, const Glib::ustring& message)
+    {
+        ++errors;
+        cJSON* const event = createEvent (id, "error");
+        cJSON_AddStringToObject (event, "message", message.c_str());
+        emit (event);
+    }
+
+    // writes the event as one line and deletes it
+    void emit (cJSON* event)
+    {
+        char* const text = cJSON_PrintUnformatted (event);
+
+        {
+            std::lock_guard<std::mutex> lock (outputMutex);
+            std::fputs (text, protocol);
+            std::fputc ('\n', protocol);
+            std::fflush (protocol);
+        }
+
+        cJSON_free (text);
+        cJSON_Delete (event);
+    }
+
+    const unsigned int concurrency;
+    const bool useDefault;
+    const bool sideProcParams;
+    const bool overwriteFiles;
+    const int subsampling;
+    const std::vector<rtengine::procparams::PartialProfile*>& baseParams;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<cJSON*> queue;
+    bool finished;
+
+    std::mutex outputMutex;
+    FILE* protocol; // stdout, or a duplicate of it while run() redirects stdout to stderr
+    std::atomic<unsigned int> errors;
+};
+
 }
 
 /* Process line command options
@@ -271,6 +810,8 @@ int processLineParams ( int argc, char **argv )
     int bits = -1;
     bool isFloat = false;
     std::string outputType;
+    std::vector<OutputSpec> outputSpecs;
+    unsigned int workerThreads = 0;
     unsigned errors = 0;
 
     for ( int iArg = 1; iArg < argc; iArg++) {
@@ -432,6 +973,47 @@ int processLineParams ( int argc, char **argv )
                     fast_export = true;
                     break;
 
+                case 'm': // additional output, the image is developed only once for all of them
+                    if (iArg + 1 < argc) {
+                        iArg++;
+                        Glib::ustring spec (fname_to_utf8 (argv[iArg]));
+#if ECLIPSE_ARGS
+                        spec = spec.substr (1, spec.length() - 2);
+#endif
+                        OutputSpec outputSpec;
+
+                        if (!parseOutputSpec (spec, outputSpec)) {
+                            std::cerr << "Error: invalid output specification \"" << spec << "\" next to the -m switch." << std::endl;
+                            deleteProcParams (processingParams);
+                            return -3;
+                        }
+
+                        outputSpecs.push_back (outputSpec);
+                    } else {
+                        std::cerr << "Error: the -m switch requires an output specification." << std::endl;
+                        deleteProcParams (processingParams);
+                        return -3;
+                    }
+
+                    break;
+
+                case 'w': // worker mode, jobs are read from stdin
+                    if (currParam.size() < 3) {
+                        workerThreads = 1;
+                    } else {
+                        const int threads = atoi (currParam.substr (2).c_str());
+
+                        if (threads < 1 || threads > 64) {
+                            std::cerr << "Error: the value accompanying the -w switch has to be in the [1-64] range!" << std::endl;
+                            deleteProcParams (processingParams);
+                            return -3;
+                        }
+
+                        workerThreads = threads;
+                    }
+
+                    break;
+
                 case 'c': // MUST be last option
                     while (iArg + 1 < argc) {
                         iArg++;
@@ -538,7 +1120,7 @@ int processLineParams ( int argc, char **argv )
                     std::cout << "  " << Glib::path_get_basename (argv[0]) << " <other options> -c <dir>|<files>   Convert files in batch with your own settings." << std::endl;
                     std::cout << std::endl;
                     std::cout << "Options:" << std::endl;
-                    std::cout << "  " << Glib::path_get_basename (argv[0]) << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one.pp3> [-p <two.pp3> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> ] [-Y] [-f] -c <input>" << std::endl;
+                    std::cout << "  " << Glib::path_get_basename (argv[0]) << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one.pp3> [-p <two.pp3> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> ] [-m <suffix>,<spec>[,<spec>...] ...] [-Y] [-f] -c <input>|-w[1-64]" << std::endl;
                     std::cout << std::endl;
                     std::cout << "  -c <files>       Specify one or more input files or folders." << std::endl;
                     std::cout << "                   When specifying folders, Rawtherapee will look for image file types which comply" << std::endl;
@@ -580,6 +1162,22 @@ int processLineParams ( int argc, char **argv )
                     std::cout << "                   Compression is hard-coded to PNG_FILTER_PAETH, Z_RLE." << std::endl;
                     std::cout << "  -Y               Overwrite output if present." << std::endl;
                     std::cout << "  -f               Use the custom fast-export processing pipeline." << std::endl;
+                    std::cout << "  -m <suffix>,<spec>[,<spec>...]" << std::endl;
+                    std::cout << "                   Add an output: the image is developed once and then resized and saved for each" << std::endl;
+                    std::cout << "                   -m switch, to the output file name followed by <suffix>. When -m is used, only" << std::endl;
+                    std::cout << "                   these outputs are saved. <spec> is one of:" << std::endl;
+                    std::cout << "                   j[1-100], t[z], n, b<8|16|16f|32>  Format, as for the switches above." << std::endl;
+                    std::cout << "                   <pixels>       Resize to this long edge, never upscaling." << std::endl;
+                    std::cout << "                   icc=<profile>  Use this output profile." << std::endl;
+                    std::cout << "                   e.g. -m _web,j85,2048 -m _print,t,b16,icc=RTv4_Large" << std::endl;
+                    std::cout << "  -w[1-64]         Worker mode: instead of -c, read jobs from stdin, one JSON object per line, and" << std::endl;
+                    std::cout << "                   process up to this many of them at once (default: 1). Each job has an \"input\"" << std::endl;
+                    std::cout << "                   file, \"outputs\" as [{\"file\": <file>, \"format\": <spec>}, ...] with <spec>" << std::endl;
+                    std::cout << "                   as for -m, optional \"profiles\" [<file.pp3>, ...] merged after the -p ones," << std::endl;
+                    std::cout << "                   an optional \"id\" and optional \"default\", \"sidecar\", \"fast\" and \"overwrite\"" << std::endl;
+                    std::cout << "                   flags (see -d, -s, -f, -Y). Progress and results are written to stdout as" << std::endl;
+                    std::cout << "                   JSON lines tagged with the id. End of input or {\"quit\": true} stops the worker." << std::endl;
+                    std::cout << "                   e.g. {\"id\": 1, \"input\": \"a.nef\", \"outputs\": [{\"file\": \"a.jpg\", \"format\": \"j90,2048\"}]}" << std::endl;
                     std::cout << std::endl;
                     std::cout << "Your " << pparamsExt << " files can be incomplete, RawTherapee will build the final values as follows:" << std::endl;
                     std::cout << "  1- A new processing profile is created using neutral values," << std::endl;
@@ -638,6 +1236,13 @@ int processLineParams ( int argc, char **argv )
         }
     }
 
+    if (workerThreads > 0) {
+        CliWorker worker (workerThreads, useDefault, sideProcParams, overwriteFiles, subsampling, processingParams);
+        errors = worker.run();
+        deleteProcParams (processingParams);
+        return errors > 0 ? -2 : 0;
+    }
+
     if ( !argv1.empty() ) {
         return 1;
     }
@@ -692,31 +1297,62 @@ int processLineParams ( int argc, char **argv )
             outputType = "jpg";
         }
 
+        Glib::ustring outputBase;
+
         if ( outputPath.empty() ) {
             Glib::ustring s = inputFile;
             Glib::ustring::size_type ext = s.find_last_of ('.');
-            outputFile = s.substr (0, ext) + "." + outputType;
+            outputBase = s.substr (0, ext);
         } else if ( outputDirectory ) {
             Glib::ustring s = Glib::path_get_basename ( inputFile );
             Glib::ustring::size_type ext = s.find_last_of ('.');
-            outputFile = Glib::build_filename (outputPath, s.substr (0, ext) + "." + outputType);
+            outputBase = Glib::build_filename (outputPath, s.substr (0, ext));
+        } else if (!leaveUntouched) {
+            Glib::ustring s = outputPath;
+            Glib::ustring::size_type ext = s.find_last_of ('.');
+            outputBase = s.substr (0, ext);
+        }
+
+        // one file per -m switch, or the single output file
+        std::vector<Glib::ustring> outputFiles;
+
+        if (leaveUntouched) {
+            outputFiles.assign (std::max<size_t> (outputSpecs.size(), 1), outputPath);
+        } else if (outputSpecs.empty()) {
+            outputFiles.push_back (outputBase + "." + outputType);
         } else {
-            if (leaveUntouched) {
-                outputFile = outputPath;
-            } else {
-                Glib::ustring s = outputPath;
-                Glib::ustring::size_type ext = s.find_last_of ('.');
-                outputFile = s.substr (0, ext) + "." + outputType;
+            for (const auto& outputSpec : outputSpecs) {
+                outputFiles.push_back (outputBase + outputSpec.suffix + "." + outputSpec.type);
             }
         }
 
-        if ( inputFile == outputFile) {
-            std::cerr << "Cannot overwrite: " << inputFile << std::endl;
-            continue;
+        outputFile = outputFiles[0];
+        bool skip = false;
+
+        for (const auto& file : outputFiles) {
+            if ( inputFile == file) {
+                std::cerr << "Cannot overwrite: " << inputFile << std::endl;
+                skip = true;
+                break;
+            }
+
+            if ( !overwriteFiles && Glib::file_test ( file, Glib::FILE_TEST_EXISTS ) ) {
+                std::cerr << file  << " already exists: use -Y option to overwrite. This image has been skipped." << std::endl;
+                skip = true;
+                break;
+            }
         }
 
-        if ( !overwriteFiles && Glib::file_test ( outputFile, Glib::FILE_TEST_EXISTS ) ) {
-            std::cerr << outputFile  << " already exists: use -Y option to overwrite. This image has been skipped." << std::endl;
+        // the outputs are written concurrently, they must not share a file
+        for (size_t j = 1; j < outputFiles.size() && !skip; ++j) {
+            if (std::find (outputFiles.begin(), outputFiles.begin() + j, outputFiles[j]) != outputFiles.begin() + j) {
+                std::cerr << "Error: several -m outputs resolve to the same file: " << outputFiles[j] << ". This image has been skipped." << std::endl;
+                errors++;
+                skip = true;
+            }
+        }
+
+        if (skip) {
             continue;
         }
 
@@ -800,6 +1436,77 @@ int processLineParams ( int argc, char **argv )
             continue;
         }
 
+        if (!outputSpecs.empty()) {
+            // the params used for each output, also written to its sidecar file
+            std::vector<rtengine::procparams::ProcParams> outputParamsList;
+
+            for (const auto& outputSpec : outputSpecs) {
+                rtengine::procparams::ProcParams outputParams = currentParams;
+
+                if (outputSpec.longEdge > 0) {
+                    outputParams.resize.enabled = true;
+                    outputParams.resize.dataspec = 4;
+                    outputParams.resize.longedge = outputSpec.longEdge;
+                    outputParams.resize.allowUpscaling = false;
+                }
+
+                if (!outputSpec.iccProfile.empty()) {
+                    outputParams.icm.outputProfile = outputSpec.iccProfile;
+                }
+
+                job->addOutput (outputParams);
+                outputParamsList.push_back (outputParams);
+            }
+
+            // Process image, once for all the outputs
+            std::vector<rtengine::IImagefloat*> resultImages;
+
+            if ( !rtengine::processImage (job, errorCode, resultImages, nullptr) ) {
+                errors++;
+                std::cerr << "Error processing: " << inputFile << std::endl;
+                rtengine::ProcessingJob::destroy ( job );
+                continue;
+            }
+
+            // encode the outputs concurrently, the engine is done with them
+            std::vector<int> saveErrors (resultImages.size(), 0);
+            std::vector<std::thread> savers;
+
+            for (size_t j = 0; j < resultImages.size(); ++j) {
+                savers.emplace_back ([&, j]() {
+                    const OutputSpec& outputSpec = outputSpecs[j];
+                    rtengine::IImagefloat* const resultImage = resultImages[j];
+
+                    if ( outputSpec.type == "jpg" ) {
+                        saveErrors[j] = resultImage->saveAsJPEG ( outputFiles[j], outputSpec.compression, subsampling );
+                    } else if ( outputSpec.type == "tif" ) {
+                        saveErrors[j] = resultImage->saveAsTIFF ( outputFiles[j], outputSpec.bits, outputSpec.isFloat, outputSpec.compression == 0 );
+                    } else {
+                        saveErrors[j] = resultImage->saveAsPNG ( outputFiles[j], outputSpec.bits );
+                    }
+                });
+            }
+
+            for (auto& saver : savers) {
+                saver.join();
+            }
+
+            for (size_t j = 0; j < resultImages.size(); ++j) {
+                if (saveErrors[j]) {
+                    errors++;
+                    std::cerr << "Error saving to: " << outputFiles[j] << std::endl;
+                } else if ( copyParamsFile ) {
+                    Glib::ustring outputProcessingParams = outputFiles[j] + paramFileExtension;
+                    outputParamsList[j].save ( outputProcessingParams );
+                }
+
+                delete resultImages[j];
+            }
+
+            ii->decreaseRef();
+            continue;
+        }
+
         // Process image
         rtengine::IImagefloat* resultImage = rtengine::processImage (job, errorCode, nullptr);
 
@@ -478,6 +478,7 @@ void Options::setDefaults()
     chunkSizeRCD = 2;
     chunkSizeRGB = 2;
     chunkSizeXT = 2;
+    rgbProcFusedLutSize = 0;
     FileBrowserToolbarSingleRow = false;
     hideTPVScrollbar = false;
     whiteBalanceSpotSize = 8;
@@ -566,6 +567,7 @@ void Options::setDefaults()
 
     rtSettings.darkFramesPath = "";
     rtSettings.flatFieldsPath = "";
+    rtSettings.calibrationStackMedian = false;
 #ifdef WIN32
     const gchar* sysRoot = g_getenv("SystemRoot");  // Returns e.g. "c:\Windows"
 
@@ -604,6 +606,7 @@ void Options::setDefaults()
     rtSettings.ACESp0 = "RTv2_ACES-AP0";
     rtSettings.ACESp1 = "RTv2_ACES-AP1";
     rtSettings.verbose = false;
+    rtSettings.colorTablesSnapshot = false;
     rtSettings.gamutICC = true;
     rtSettings.gamutLch = true;
     rtSettings.amchroma = 40;//between 20 and 140   low values increase effect..and also artifacts, high values reduces
@@ -690,6 +693,7 @@ void Options::setDefaults()
     cropAutoFit = false;
 
     rtSettings.thumbnail_inspector_mode = rtengine::Settings::ThumbnailInspectorMode::JPEG;
+    rtSettings.bufferPoolSize = 512;
 }
 
 Options* Options::copyFrom(Options* other)
@@ -791,10 +795,18 @@ void Options::readFromFile(Glib::ustring fname)
                     rtSettings.flatFieldsPath = keyFile.get_string("General", "FlatFieldsPath");
                 }
 
+                if (keyFile.has_key("General", "CalibrationStackMedian")) {
+                    rtSettings.calibrationStackMedian = keyFile.get_boolean("General", "CalibrationStackMedian");
+                }
+
                 if (keyFile.has_key("General", "Verbose")) {
                     rtSettings.verbose = keyFile.get_boolean("General", "Verbose");
                 }
 
+                if (keyFile.has_key("General", "ColorTablesSnapshot")) {
+                    rtSettings.colorTablesSnapshot = keyFile.get_boolean("General", "ColorTablesSnapshot");
+                }
+
                 if (keyFile.has_key("General", "Detectshape")) {
                     rtSettings.detectshape = keyFile.get_boolean("General", "Detectshape");
                 }
@@ -1212,9 +1224,18 @@ void Options::readFromFile(Glib::ustring fname)
                     chunkSizeXT = std::min(16, std::max(1, keyFile.get_integer("Performance", "ChunkSizeXT")));
                 }
 
+                if (keyFile.has_key("Performance", "RgbProcFusedLutSize")) {
+                    rgbProcFusedLutSize = keyFile.get_integer("Performance", "RgbProcFusedLutSize");
+                    rgbProcFusedLutSize = rgbProcFusedLutSize <= 0 ? 0 : std::min(129, std::max(9, rgbProcFusedLutSize));
+                }
+
                 if (keyFile.has_key("Performance", "ThumbnailInspectorMode")) {
                     rtSettings.thumbnail_inspector_mode = static_cast<rtengine::Settings::ThumbnailInspectorMode>(keyFile.get_integer("Performance", "ThumbnailInspectorMode"));
                 }
+
+                if (keyFile.has_key("Performance", "BufferPoolSize")) {
+                    rtSettings.bufferPoolSize = std::max(0, keyFile.get_integer("Performance", "BufferPoolSize"));
+                }
             }
 
             if (keyFile.has_group("GUI")) {
@@ -2150,7 +2171,9 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_string("General", "Version", RTVERSION);
         keyFile.set_string("General", "DarkFramesPath", rtSettings.darkFramesPath);
         keyFile.set_string("General", "FlatFieldsPath", rtSettings.flatFieldsPath);
+        keyFile.set_boolean("General", "CalibrationStackMedian", rtSettings.calibrationStackMedian);
         keyFile.set_boolean("General", "Verbose", rtSettings.verbose);
+        keyFile.set_boolean("General", "ColorTablesSnapshot", rtSettings.colorTablesSnapshot);
         keyFile.set_integer("General", "Cropsleep", rtSettings.cropsleep);
         keyFile.set_double("General", "Reduchigh", rtSettings.reduchigh);
         keyFile.set_double("General", "Reduclow", rtSettings.reduclow);
@@ -2230,7 +2253,9 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_integer("Performance", "ChunkSizeRGB", chunkSizeRGB);
         keyFile.set_integer("Performance", "ChunkSizeXT", chunkSizeXT);
         keyFile.set_integer("Performance", "ChunkSizeCA", chunkSizeCA);
+        keyFile.set_integer("Performance", "RgbProcFusedLutSize", rgbProcFusedLutSize);
         keyFile.set_integer("Performance", "ThumbnailInspectorMode", int(rtSettings.thumbnail_inspector_mode));
+        keyFile.set_integer("Performance", "BufferPoolSize", rtSettings.bufferPoolSize);
 
 
         keyFile.set_string("Output", "Format", saveFormat.format);
@@ -109,7 +109,7 @@ struct SaveFormat {
 enum ThFileType {FT_Invalid = -1, FT_None = 0, FT_Raw = 1, FT_Jpeg = 2, FT_Tiff = 3, FT_Png = 4, FT_Custom = 5, FT_Tiff16 = 6, FT_Png16 = 7, FT_Custom16 = 8};
 enum PPLoadLocation {PLL_Cache = 0, PLL_Input = 1};
 enum CPBKeyType {CPBKT_TID = 0, CPBKT_NAME = 1, CPBKT_TID_NAME = 2};
-enum prevdemo_t {PD_Sidecar = 1, PD_Fast = 0};
+enum prevdemo_t {PD_Sidecar = 1, PD_Fast = 0, PD_Superpixel = 2};
 
 namespace Glib
 {
@@ -365,6 +365,7 @@ public:
     size_t chunkSizeRCD;
     size_t chunkSizeRGB;
     size_t chunkSizeXT;
+    int rgbProcFusedLutSize; // size of the 3D LUT used to fuse the RGB operations of the preview ; 0 = disabled
     bool menuGroupRank;
     bool menuGroupLabel;
     bool menuGroupFileOperations;
@@ -628,6 +628,11 @@ Gtk::Widget* Preferences::getImageProcessingPanel ()
     dirgrid->attach_next_to(*clutsDir, *clutsDirLabel, Gtk::POS_RIGHT, 1, 1);
     dirgrid->attach_next_to(*clutsRestartNeeded, *clutsDir, Gtk::POS_RIGHT, 1, 1);
 
+    // stacking of the dark frame and flat field templates
+    calibrationStackMedian = Gtk::manage(new Gtk::CheckButton(M("PREFERENCES_CALIBRATIONSTACKMEDIAN")));
+    setExpandAlignProperties(calibrationStackMedian, false, false, Gtk::ALIGN_START, Gtk::ALIGN_CENTER);
+    dirgrid->attach_next_to(*calibrationStackMedian, *clutsDir, Gtk::POS_BOTTOM, 2, 1);
+
     cdf->add(*dirgrid);
     vbImageProcessing->pack_start (*cdf, Gtk::PACK_SHRINK, 4 );
 
@@ -670,6 +675,7 @@ Gtk::Widget* Preferences::getPerformancePanel()
     cprevdemo = Gtk::manage(new Gtk::ComboBoxText());
     cprevdemo->append(M("PREFERENCES_PREVDEMO_FAST"));
     cprevdemo->append(M("PREFERENCES_PREVDEMO_SIDECAR"));
+    cprevdemo->append(M("PREFERENCES_PREVDEMO_SUPERPIXEL"));
     cprevdemo->set_active(1);
     hbprevdemo->pack_start(*lprevdemo, Gtk::PACK_SHRINK);
     hbprevdemo->pack_start(*cprevdemo);
@@ -1889,6 +1895,7 @@ void Preferences::storePreferences()
 
     moptions.rtSettings.darkFramesPath = darkFrameDir->get_filename();
     moptions.rtSettings.flatFieldsPath = flatFieldDir->get_filename();
+    moptions.rtSettings.calibrationStackMedian = calibrationStackMedian->get_active();
 
     moptions.clutsDir = clutsDir->get_filename();
 
@@ -2161,6 +2168,8 @@ void Preferences::fillPreferences()
     flatFieldDir->set_current_folder(moptions.rtSettings.flatFieldsPath);
     flatFieldChanged();
 
+    calibrationStackMedian->set_active(moptions.rtSettings.calibrationStackMedian);
+
     clutsDir->set_current_folder(moptions.clutsDir);
 
     addc.block(true);
@@ -114,6 +114,7 @@ class Preferences final :
     MyFileChooserButton* clutsDir;
     Gtk::Label *dfLabel;
     Gtk::Label *ffLabel;
+    Gtk::CheckButton* calibrationStackMedian;
 
     Gtk::CheckButton* showDateTime;
     Gtk::CheckButton* showBasicExif;
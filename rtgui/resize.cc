@@ -58,6 +58,8 @@ Resize::Resize () : FoldableToolPanel(this, "resize", M("TP_RESIZE_LABEL"), fals
     method = Gtk::manage (new MyComboBoxText ());
     method->append (M("TP_RESIZE_LANCZOS"));
     method->append (M("TP_RESIZE_NEAREST"));
+    method->append (M("TP_RESIZE_LANCZOS2"));
+    method->append (M("TP_RESIZE_MITCHELL"));
     method->set_active (0);
     method->set_hexpand();
     method->set_halign(Gtk::ALIGN_FILL);
@@ -220,6 +222,10 @@ void Resize::read (const ProcParams* pp, const ParamsEdited* pedited)
         method->set_active (0);
     } else if (pp->resize.method == "Nearest") {
         method->set_active (1);
+    } else if (pp->resize.method == "Lanczos2") {
+        method->set_active (2);
+    } else if (pp->resize.method == "Mitchell") {
+        method->set_active (3);
     } else {
         method->set_active (0);
     }
@@ -241,7 +247,7 @@ void Resize::read (const ProcParams* pp, const ParamsEdited* pedited)
         }
 
         if (!pedited->resize.method) {
-            method->set_active (3);
+            method->set_active (4);
         }
 
         if (!pedited->resize.dataspec) {
@@ -284,6 +290,10 @@ void Resize::write (ProcParams* pp, ParamsEdited* pedited)
         pp->resize.method = "Lanczos";
     } else if (method->get_active_row_number() == 1) {
         pp->resize.method = "Nearest";
+    } else if (method->get_active_row_number() == 2) {
+        pp->resize.method = "Lanczos2";
+    } else if (method->get_active_row_number() == 3) {
+        pp->resize.method = "Mitchell";
     }
 
     pp->resize.dataspec = dataSpec;
@@ -300,7 +310,7 @@ void Resize::write (ProcParams* pp, ParamsEdited* pedited)
         pedited->resize.enabled   = !get_inconsistent();
         pedited->resize.dataspec  = dataSpec != 6;
         pedited->resize.appliesTo = appliesTo->get_active_row_number() != 2;
-        pedited->resize.method    = method->get_active_row_number() != 3;
+        pedited->resize.method    = method->get_active_row_number() != 4;
 
         if (pedited->resize.dataspec) {
             pedited->resize.scale     = scale->getEditedState ();
@@ -394,8 +404,8 @@ void Resize::methodChanged ()
         listener->panelChanged (EvResizeMethod, method->get_active_text());
     }
 
-    // Post-resize Sharpening assumes the image is in Lab space, and currently Lanczos is the only method which uses that space, and Lanczos is on row 0.
-    if (method->get_active_row_number() == 0) {
+    // Post-resize Sharpening assumes the image is in Lab space, which is used by all methods except Nearest (row 1).
+    if (method->get_active_row_number() != 1) {
         packBox->set_sensitive(true);
     } else {
         packBox->set_sensitive(false);